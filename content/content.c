@@ -44,6 +44,7 @@
 #include "utils/http.h"
 #include "utils/log.h"
 #include "utils/messages.h"
+#include "utils/schedule.h"
 #include "utils/utils.h"
 
 #define URL_FMT_SPC "%.140s"
@@ -58,6 +59,7 @@ const char * const content_status_name[] = {
 static nserror content_llcache_callback(llcache_handle *llcache,
 		const llcache_event *event, void *pw);
 static void content_convert(struct content *c);
+static void content_flush_messages(void *p);
 
 
 /**
@@ -118,6 +120,7 @@ nserror content__init(struct content *c, const content_handler *handler,
 	c->total_size = 0;
 	c->http_code = 0;
 	c->error_count = 0;
+	memset(&c->pending, 0, sizeof(c->pending));
 
 	content_set_status(c, messages_get("Loading"));
 
@@ -162,6 +165,17 @@ nserror content_llcache_callback(llcache_handle *llcache,
 				error = NSERROR_NOMEM;
 			}
 		}
+
+		/* Periodically reflow contents which have been made
+		 * available for display before all data arrived */
+		if (error == NSERROR_OK &&
+				c->status == CONTENT_STATUS_READY &&
+				c->locked == false &&
+				nsoption_bool(incremental_reflow) &&
+				wallclock() > c->reformat_time) {
+			content__reformat(c, false,
+					c->available_width, c->height);
+		}
 		break;
 	case LLCACHE_EVENT_DONE:
 	{
@@ -266,9 +280,10 @@ void content_convert(struct content *c)
 {
 	assert(c);
 	assert(c->status == CONTENT_STATUS_LOADING ||
+			c->status == CONTENT_STATUS_READY ||
 			c->status == CONTENT_STATUS_ERROR);
 
-	if (c->status != CONTENT_STATUS_LOADING)
+	if (c->status == CONTENT_STATUS_ERROR)
 		return;
 
 	if (c->locked == true)
@@ -277,7 +292,19 @@ void content_convert(struct content *c)
 	LOG(("content "URL_FMT_SPC" (%p)",
 			nsurl_access(llcache_handle_get_url(c->llcache)), c));
 
-	if (c->handler->data_complete != NULL) {
+	if (c->status == CONTENT_STATUS_READY) {
+		/* Content was made available for display while its data
+		 * was still arriving (see content_set_ready_incremental()).
+		 * It remains displayable, so is not locked while the
+		 * handler completes it. */
+		if (c->handler->data_complete != NULL) {
+			if (c->handler->data_complete(c) == false) {
+				content_set_error(c);
+			}
+		} else {
+			content_set_done(c);
+		}
+	} else if (c->handler->data_complete != NULL) {
 		c->locked = true;
 		if (c->handler->data_complete(c) == false) {
 			content_set_error(c);
@@ -307,6 +334,29 @@ void content_set_ready(struct content *c)
 	content_broadcast(c, CONTENT_MSG_READY, msg_data);
 }
 
+/**
+ * Put a content which is still receiving data in status CONTENT_STATUS_READY.
+ *
+ * Handlers which can display partial data call this from their process_data
+ * callback once enough has arrived. The content's reformat callback will then
+ * be called periodically, no more often than reformat_time allows, while the
+ * remaining data arrives. The handler's data_complete callback is still called
+ * once all data has arrived; it must not call content_set_ready() if the
+ * content is already READY, but must still call content_set_done().
+ *
+ * Only text/plain uses this at present; see
+ * Docs/ideas/incremental-html.txt for HTML.
+ */
+
+void content_set_ready_incremental(struct content *c)
+{
+	assert(c->status == CONTENT_STATUS_LOADING);
+	assert(c->locked == false);
+
+	c->locked = true;
+	content_set_ready(c);
+}
+
 /**
  * Put a content in status CONTENT_STATUS_DONE.
  */
@@ -383,6 +433,10 @@ void content_destroy(struct content *c)
 			nsurl_access(llcache_handle_get_url(c->llcache))));
 	assert(c->locked == false);
 
+	/* Users are going away, so undelivered messages are irrelevant */
+	if (c->pending.scheduled)
+		schedule_remove(content_flush_messages, c);
+
 	if (c->handler->destroy != NULL)
 		c->handler->destroy(c);
 
@@ -682,10 +736,10 @@ bool content_is_shareable(struct content *c)
 }
 
 /**
- * Send a message to all users.
+ * Deliver a message to all users immediately.
  */
 
-void content_broadcast(struct content *c, content_msg msg,
+static void content_send(struct content *c, content_msg msg,
 		union content_msg_data data)
 {
 	struct content_user *user, *next;
@@ -698,6 +752,131 @@ void content_broadcast(struct content *c, content_msg msg,
 	}
 }
 
+/**
+ * Deliver any coalesced messages held for a content.
+ *
+ * \param c  content to flush messages for
+ */
+
+static void content_send_pending(struct content *c)
+{
+	union content_msg_data data;
+
+	if (c->pending.redraw) {
+		c->pending.redraw = false;
+
+		data.redraw.x = c->pending.area.x0;
+		data.redraw.y = c->pending.area.y0;
+		data.redraw.width = c->pending.area.x1 - c->pending.area.x0;
+		data.redraw.height = c->pending.area.y1 - c->pending.area.y0;
+
+		data.redraw.full_redraw = true;
+
+		data.redraw.object = c;
+		data.redraw.object_x = 0;
+		data.redraw.object_y = 0;
+		data.redraw.object_width = c->width;
+		data.redraw.object_height = c->height;
+
+		content_send(c, CONTENT_MSG_REDRAW, data);
+	}
+
+	if (c->pending.status) {
+		c->pending.status = false;
+
+		if (c->pending.status_explicit)
+			data.explicit_status_text = c->pending.status_text;
+		else
+			data.explicit_status_text = NULL;
+
+		content_send(c, CONTENT_MSG_STATUS, data);
+	}
+}
+
+/**
+ * Scheduled callback to deliver coalesced messages.
+ *
+ * \param p  content to flush messages for
+ */
+
+void content_flush_messages(void *p)
+{
+	struct content *c = p;
+
+	c->pending.scheduled = false;
+
+	content_send_pending(c);
+}
+
+/**
+ * Send a message to all users.
+ *
+ * Full redraw requests and status updates are coalesced: redraw areas
+ * are merged and superseded status updates dropped. The result is
+ * delivered once per scheduler run, or before any other message is sent,
+ * so that users see messages in the order they were broadcast.
+ */
+
+void content_broadcast(struct content *c, content_msg msg,
+		union content_msg_data data)
+{
+	assert(c);
+
+	switch (msg) {
+	case CONTENT_MSG_REDRAW:
+		if (data.redraw.full_redraw == false)
+			break;
+
+		if (c->pending.redraw) {
+			struct rect *area = &c->pending.area;
+
+			if (data.redraw.x < area->x0)
+				area->x0 = data.redraw.x;
+			if (data.redraw.y < area->y0)
+				area->y0 = data.redraw.y;
+			if (data.redraw.x + data.redraw.width > area->x1)
+				area->x1 = data.redraw.x + data.redraw.width;
+			if (data.redraw.y + data.redraw.height > area->y1)
+				area->y1 = data.redraw.y + data.redraw.height;
+		} else {
+			c->pending.redraw = true;
+			c->pending.area.x0 = data.redraw.x;
+			c->pending.area.y0 = data.redraw.y;
+			c->pending.area.x1 = data.redraw.x + data.redraw.width;
+			c->pending.area.y1 = data.redraw.y + data.redraw.height;
+		}
+		goto coalesced;
+
+	case CONTENT_MSG_STATUS:
+		c->pending.status = true;
+		if (data.explicit_status_text != NULL) {
+			c->pending.status_explicit = true;
+			snprintf(c->pending.status_text,
+					sizeof(c->pending.status_text),
+					"%s", data.explicit_status_text);
+		} else {
+			c->pending.status_explicit = false;
+		}
+		goto coalesced;
+
+	default:
+		break;
+	}
+
+	/* Preserve ordering with respect to any coalesced messages */
+	content_send_pending(c);
+
+	content_send(c, msg, data);
+
+	return;
+
+coalesced:
+	if (c->pending.scheduled == false) {
+		c->pending.scheduled = true;
+		schedule(0, content_flush_messages, c);
+	}
+}
+
 /* exported interface documented in content_protected.h */
 void content_broadcast_errorcode(struct content *c, nserror errorcode)
 {
@@ -706,6 +885,8 @@ void content_broadcast_errorcode(struct content *c, nserror errorcode)
 
 	assert(c);
 
+	content_send_pending(c);
+
 	data.errorcode = errorcode;
 
 	for (user = c->user_list->next; user != 0; user = next) {
@@ -841,6 +1022,50 @@ void content_debug_dump(struct hlcache_handle *h, FILE *f)
 }
 
 
+/**
+ * Accumulate the memory used by a content.
+ *
+ * \param h      Content handle
+ * \param usage  Memory usage record to add this content's usage to
+ *
+ * The values in \a usage are added to rather than replaced so that the
+ * usage of several contents may be totalled in a single record.
+ */
+void content_get_memory_usage(struct hlcache_handle *h,
+		struct content_memory_usage *usage)
+{
+	content__get_memory_usage(hlcache_handle_get_content(h), usage);
+}
+
+void content__get_memory_usage(const struct content *c,
+		struct content_memory_usage *usage)
+{
+	size_t source_size = 0;
+
+	assert(usage != NULL);
+
+	if (c == NULL)
+		return;
+
+	if (c->llcache != NULL)
+		(void) llcache_handle_get_source_data(c->llcache, &source_size);
+	usage->source += source_size;
+
+	usage->other += sizeof(struct content);
+	if (c->title != NULL)
+		usage->other += strlen(c->title) + 1;
+	if (c->fallback_charset != NULL)
+		usage->other += strlen(c->fallback_charset) + 1;
+
+	if (c->handler->get_memory_usage != NULL) {
+		c->handler->get_memory_usage(c, usage);
+	} else if (c->handler->type() == CONTENT_IMAGE) {
+		/* Assume the handler keeps a 32bpp bitmap of the image */
+		usage->bitmap += (size_t) c->width * c->height * 4;
+	}
+}
+
+
 void content_add_error(struct content *c, const char *token,
 		unsigned int line)
 {
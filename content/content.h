@@ -206,6 +206,20 @@ struct content_redraw_data {
 	bool repeat_y; /**< whether content is tiled in y direction */
 };
 
+/** Memory used by a content, broken down by category.
+ *
+ * All values are in bytes. Where a handler cannot measure a category
+ * exactly it reports an estimate.
+ */
+struct content_memory_usage {
+	size_t source;	/**< Source data held by the low-level cache */
+	size_t dom;	/**< Document tree */
+	size_t box;	/**< Box tree and layout data */
+	size_t style;	/**< Computed styles */
+	size_t bitmap;	/**< Decoded bitmaps */
+	size_t other;	/**< Everything else owned by the content */
+};
+
 /* The following are for hlcache */
 void content_destroy(struct content *c);
 
@@ -257,6 +271,8 @@ bool content_drop_file_at_point(struct hlcache_handle *h,
 void content_debug_dump(struct hlcache_handle *h, FILE *f);
 struct content_rfc5988_link *content_find_rfc5988_link(struct hlcache_handle *c,
 		lwc_string *rel);
+void content_get_memory_usage(struct hlcache_handle *h,
+		struct content_memory_usage *usage);
 
 /* Member accessors */
 content_type content_get_type(struct hlcache_handle *c);
@@ -74,6 +74,8 @@ struct content_handler {
 	bool (*drop_file_at_point)(struct content *c, int x, int y,
 			char *file);
 	void (*debug_dump)(struct content *c, FILE *f);
+	void (*get_memory_usage)(const struct content *c,
+			struct content_memory_usage *usage);
 	nserror (*clone)(const struct content *old, struct content **newc);
 	bool (*matches_quirks)(const struct content *c, bool quirks);
 	content_type (*type)(void);
@@ -138,6 +140,16 @@ struct content {
 	unsigned long total_size;	/**< Total data size, 0 if unknown. */
 	long http_code;			/**< HTTP status code, 0 if not HTTP. */
 
+	/** Messages coalesced by content_broadcast() awaiting delivery. */
+	struct {
+		bool scheduled;		/**< Flush has been scheduled */
+		bool redraw;		/**< A redraw of area is pending */
+		struct rect area;	/**< Union of pending redraw areas */
+		bool status;		/**< A status update is pending */
+		bool status_explicit;	/**< Status update has explicit text */
+		char status_text[120];	/**< Explicit status text */
+	} pending;
+
 	/** Array of first n rendering errors or warnings. */
 	struct {
 		const char *token;
@@ -156,6 +168,7 @@ nserror content__init(struct content *c, const content_handler *handler,
 nserror content__clone(const struct content *c, struct content *nc);
 
 void content_set_ready(struct content *c);
+void content_set_ready_incremental(struct content *c);
 void content_set_done(struct content *c);
 void content_set_error(struct content *c);
 
@@ -196,4 +209,7 @@ bool content__get_opaque(struct content *c);
 
 bool content__is_locked(struct content *c);
 
+void content__get_memory_usage(const struct content *c,
+		struct content_memory_usage *usage);
+
 #endif
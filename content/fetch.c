@@ -49,6 +49,7 @@
 #include "utils/log.h"
 #include "utils/messages.h"
 #include "utils/nsurl.h"
+#include "utils/pool.h"
 #include "utils/utils.h"
 #include "utils/ring.h"
 
@@ -94,6 +95,7 @@ struct fetch {
 
 static struct fetch *fetch_ring = 0;	/**< Ring of active fetches. */
 static struct fetch *queue_ring = 0;	/**< Ring of queued fetches */
+static struct pool *fetch_pool;		/**< Pool of fetch structures */
 
 #define fetch_ref_fetcher(F) F->refcount++
 static void fetch_unref_fetcher(scheme_fetcher *fetcher);
@@ -119,6 +121,12 @@ void fetch_init(void)
 	fetch_about_register();
 	fetch_active = false;
 
+	fetch_pool = pool_create("fetches", sizeof(struct fetch));
+	if (fetch_pool == NULL) {
+		die("Failed to initialise the fetch module "
+				"(couldn't create fetch pool).");
+	}
+
 	if (lwc_intern_string("http", SLEN("http"), &fetch_http_lwc) !=
 			lwc_error_ok) {
 		die("Failed to initialise the fetch module "
@@ -153,6 +161,9 @@ void fetch_quit(void)
 
 	lwc_string_unref(fetch_http_lwc);
 	lwc_string_unref(fetch_https_lwc);
+
+	pool_destroy(fetch_pool);
+	fetch_pool = NULL;
 }
 
 
@@ -243,7 +254,7 @@ struct fetch * fetch_start(nsurl *url, nsurl *referer,
 	lwc_string *scheme;
 	bool match;
 
-	fetch = malloc(sizeof (*fetch));
+	fetch = pool_alloc(fetch_pool);
 	if (fetch == NULL)
 		return NULL;
 
@@ -335,6 +346,8 @@ struct fetch * fetch_start(nsurl *url, nsurl *referer,
 	/* these aren't needed past here */
 	lwc_string_unref(scheme);
 
+	TRACE_BEGIN(NSLOG_TRACE_FETCH, fetch);
+
 	/* Dump us in the queue and ask the queue to run. */
 	RING_INSERT(queue_ring, fetch);
 	fetch_dispatch_jobs();
@@ -351,7 +364,7 @@ failed:
 	if (fetch->referer != NULL)
 		nsurl_unref(fetch->referer);
 
-	free(fetch);
+	pool_free(fetch_pool, fetch);
 
 	return NULL;
 }
@@ -493,6 +506,7 @@ void fetch_free(struct fetch *f)
 #ifdef DEBUG_FETCH_VERBOSE
 	LOG(("Freeing fetch %p, fetcher %p", f, f->fetcher_handle));
 #endif
+	TRACE_END(NSLOG_TRACE_FETCH, f);
 	f->ops->free_fetch(f->fetcher_handle);
 	fetch_unref_fetcher(f->ops);
 	nsurl_unref(f->url);
@@ -500,7 +514,7 @@ void fetch_free(struct fetch *f)
 		nsurl_unref(f->referer);
 	if (f->host != NULL)
 		lwc_string_unref(f->host);
-        free(f);
+	pool_free(fetch_pool, f);
 }
 
 
@@ -46,6 +46,7 @@
 #include "content/fetch.h"
 #include "content/fetchers/about.h"
 #include "content/urldb.h"
+#include "desktop/browser.h"
 #include "desktop/netsurf.h"
 #include "desktop/options.h"
 #include "utils/log.h"
@@ -298,6 +299,140 @@ fetch_about_imagecache_handler_aborted:
 	return false;
 }
 
+/**
+ * Format one row of the about:memory usage table.
+ *
+ * \param buffer The buffer to write the row to.
+ * \param size   The size of the buffer.
+ * \param name   The row heading.
+ * \param usage  The memory usage to show.
+ * \return The number of bytes which would be written as for snprintf.
+ */
+static int fetch_about_memory_row(char *buffer, size_t size,
+		const char *name, const struct content_memory_usage *usage)
+{
+	return snprintf(buffer, size,
+			"<tr><th>%s</th>"
+			"<td>%"SSIZET_FMT"</td><td>%"SSIZET_FMT"</td>"
+			"<td>%"SSIZET_FMT"</td><td>%"SSIZET_FMT"</td>"
+			"<td>%"SSIZET_FMT"</td><td>%"SSIZET_FMT"</td>"
+			"<td>%"SSIZET_FMT"</td></tr>\n",
+			name,
+			usage->source, usage->dom, usage->box,
+			usage->style, usage->bitmap, usage->other,
+			usage->source + usage->dom + usage->box +
+			usage->style + usage->bitmap + usage->other);
+}
+
+/** Handler to generate about:memory page.
+ *
+ * Shows the memory used by the contents of each browser window.
+ */
+static bool fetch_about_memory_handler(struct fetch_about_context *ctx)
+{
+	fetch_msg msg;
+	char buffer[1024]; /* output buffer */
+	char name[32];
+	int code = 200;
+	int slen;
+	int res = 0;
+	unsigned int window_count = 0;
+	struct browser_window *bw = NULL;
+	struct content_memory_usage total;
+
+	memset(&total, 0, sizeof(total));
+
+	/* content is going to return ok */
+	fetch_set_http_code(ctx->fetchh, code);
+
+	/* content type */
+	if (fetch_about_send_header(ctx, "Content-Type: text/html"))
+		goto fetch_about_memory_handler_aborted;
+
+	msg.type = FETCH_DATA;
+	msg.data.header_or_data.buf = (const uint8_t *) buffer;
+
+	slen = snprintf(buffer, sizeof buffer, 
+			"<html>\n<head>\n"
+			"<title>NetSurf Browser Memory Usage</title>\n"
+			"<link rel=\"stylesheet\" type=\"text/css\" "
+			"href=\"resource:internal.css\">\n"
+			"</head>\n"
+			"<body id =\"memory\">\n"
+			"<p class=\"banner\">"
+			"<a href=\"http://www.netsurf-browser.org/\">"
+			"<img src=\"resource:netsurf.png\" alt=\"NetSurf\"></a>"
+			"</p>\n"
+			"<h1>NetSurf Browser Memory Usage</h1>\n"
+			"<p>Sizes are in bytes. Objects shared between "
+			"windows are counted against each of them.</p>\n"
+			"<table class=\"config\">\n"
+			"<tr><th>Window</th><th>Source</th><th>DOM</th>"
+			"<th>Boxes</th><th>Styles</th><th>Bitmaps</th>"
+			"<th>Other</th><th>Total</th></tr>\n");
+
+	while ((bw = browser_window_get_next_root(bw)) != NULL) {
+		struct content_memory_usage usage;
+
+		memset(&usage, 0, sizeof(usage));
+		browser_window_get_memory_usage(bw, &usage);
+
+		total.source += usage.source;
+		total.dom += usage.dom;
+		total.box += usage.box;
+		total.style += usage.style;
+		total.bitmap += usage.bitmap;
+		total.other += usage.other;
+
+		snprintf(name, sizeof name, "%u", ++window_count);
+
+		res = fetch_about_memory_row(buffer + slen,
+				sizeof buffer - slen, name, &usage);
+		if (res >= (int) (sizeof buffer - slen)) {
+			/* last entry would not fit in buffer, submit buffer */
+			msg.data.header_or_data.len = slen;
+			if (fetch_about_send_callback(&msg, ctx))
+				goto fetch_about_memory_handler_aborted;
+			slen = 0;
+
+			res = fetch_about_memory_row(buffer, sizeof buffer,
+					name, &usage);
+		}
+		slen += res;
+	}
+
+	msg.data.header_or_data.len = slen;
+	if (fetch_about_send_callback(&msg, ctx))
+		goto fetch_about_memory_handler_aborted;
+
+	slen = fetch_about_memory_row(buffer, sizeof buffer, "Total", &total);
+
+	slen += snprintf(buffer + slen, sizeof buffer - slen, 
+			"</table>\n");
+
+	/* image cache summary */
+	res = image_cache_snsummaryf(buffer + slen, sizeof buffer - slen,
+			"<p>Image cache holds %c in %d bitmaps "
+			"(configured limit %a)</p>\n");
+	if (res > 0 && res < (int) (sizeof buffer - slen))
+		slen += res;
+
+	slen += snprintf(buffer + slen, sizeof buffer - slen, 
+			 "</body>\n</html>\n");
+
+	msg.data.header_or_data.len = slen;
+	if (fetch_about_send_callback(&msg, ctx))
+		goto fetch_about_memory_handler_aborted;
+
+	msg.type = FETCH_FINISHED;
+	fetch_about_send_callback(&msg, ctx);
+
+	return true;
+
+fetch_about_memory_handler_aborted:
+	return false;
+}
+
 /** Handler to generate about:config page */
 static bool fetch_about_config_handler(struct fetch_about_context *ctx)
 {
@@ -600,6 +735,9 @@ struct about_handlers about_handler_list[] = {
 	/* details about the image cache */
 	{ "imagecache", SLEN("imagecache"), NULL,
 			fetch_about_imagecache_handler, true },
+	/* memory used by the contents of each browser window */
+	{ "memory", SLEN("memory"), NULL,
+			fetch_about_memory_handler, false },
 	/* The default blank page */
 	{ "blank", SLEN("blank"), NULL,
 			fetch_about_blank_handler, true } 
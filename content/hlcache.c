@@ -30,6 +30,7 @@
 #include "utils/http.h"
 #include "utils/log.h"
 #include "utils/messages.h"
+#include "utils/pool.h"
 #include "utils/ring.h"
 #include "utils/schedule.h"
 #include "utils/url.h"
@@ -85,6 +86,15 @@ struct hlcache_s {
 	/** Ring of retrieval contexts */
 	hlcache_retrieval_ctx *retrieval_ctx_ring;
 
+	/** Pool of retrieval contexts */
+	struct pool *ctx_pool;
+
+	/** Pool of handles */
+	struct pool *handle_pool;
+
+	/** Pool of cache entries */
+	struct pool *entry_pool;
+
 	/* statsistics */
 	unsigned int hit_count;
 	unsigned int miss_count;
@@ -121,10 +131,24 @@ hlcache_initialise(const struct hlcache_parameters *hlcache_parameters)
 		return NSERROR_NOMEM;
 	}
 
-	ret = llcache_initialise(hlcache_parameters->cb,
-				 hlcache_parameters->cb_ctx,
-				 hlcache_parameters->limit);
+	hlcache->ctx_pool = pool_create("hlcache retrieval contexts",
+			sizeof(hlcache_retrieval_ctx));
+	hlcache->handle_pool = pool_create("hlcache handles",
+			sizeof(hlcache_handle));
+	hlcache->entry_pool = pool_create("hlcache entries",
+			sizeof(hlcache_entry));
+	if (hlcache->ctx_pool == NULL || hlcache->handle_pool == NULL ||
+			hlcache->entry_pool == NULL) {
+		ret = NSERROR_NOMEM;
+	} else {
+		ret = llcache_initialise(hlcache_parameters->cb,
+					 hlcache_parameters->cb_ctx,
+					 hlcache_parameters->limit);
+	}
 	if (ret != NSERROR_OK) {
+		pool_destroy(hlcache->ctx_pool);
+		pool_destroy(hlcache->handle_pool);
+		pool_destroy(hlcache->entry_pool);
 		free(hlcache);
 		hlcache = NULL;
 		return ret;
@@ -194,13 +218,12 @@ void hlcache_finalise(void)
 			if (ctx->llcache != NULL)
 				llcache_handle_release(ctx->llcache);
 
-			if (ctx->handle != NULL)
-				free(ctx->handle);
+			pool_free(hlcache->handle_pool, ctx->handle);
 
 			if (ctx->child.charset != NULL)
 				free((char *) ctx->child.charset);
 
-			free(ctx);
+			pool_free(hlcache->ctx_pool, ctx);
 
 			ctx = next;
 		} while (ctx != hlcache->retrieval_ctx_ring);
@@ -210,6 +233,10 @@ void hlcache_finalise(void)
 
 	LOG(("hit/miss %d/%d", hlcache->hit_count, hlcache->miss_count));
 
+	pool_destroy(hlcache->ctx_pool);
+	pool_destroy(hlcache->handle_pool);
+	pool_destroy(hlcache->entry_pool);
+
 	free(hlcache);
 	hlcache = NULL;
 
@@ -238,13 +265,13 @@ nserror hlcache_handle_retrieve(nsurl *url, uint32_t flags,
 
 	assert(cb != NULL);
 
-	ctx = calloc(1, sizeof(hlcache_retrieval_ctx));
+	ctx = pool_alloc(hlcache->ctx_pool);
 	if (ctx == NULL)
 		return NSERROR_NOMEM;
 
-	ctx->handle = calloc(1, sizeof(hlcache_handle));
+	ctx->handle = pool_alloc(hlcache->handle_pool);
 	if (ctx->handle == NULL) {
-		free(ctx);
+		pool_free(hlcache->ctx_pool, ctx);
 		return NSERROR_NOMEM;
 	}
 
@@ -252,8 +279,8 @@ nserror hlcache_handle_retrieve(nsurl *url, uint32_t flags,
 		if (child->charset != NULL) {
 			ctx->child.charset = strdup(child->charset);
 			if (ctx->child.charset == NULL) {
-				free(ctx->handle);
-				free(ctx);
+				pool_free(hlcache->handle_pool, ctx->handle);
+				pool_free(hlcache->ctx_pool, ctx);
 				return NSERROR_NOMEM;
 			}
 		}
@@ -271,8 +298,8 @@ nserror hlcache_handle_retrieve(nsurl *url, uint32_t flags,
 			&ctx->llcache);
 	if (error != NSERROR_OK) {
 		free((char *) ctx->child.charset);
-		free(ctx->handle);
-		free(ctx);
+		pool_free(hlcache->handle_pool, ctx->handle);
+		pool_free(hlcache->ctx_pool, ctx);
 		return error;
 	}
 
@@ -303,7 +330,7 @@ nserror hlcache_handle_release(hlcache_handle *handle)
 				RING_REMOVE(hlcache->retrieval_ctx_ring, ictx);
 				/* Throw us away */
 				free((char *) ictx->child.charset);
-				free(ictx);
+				pool_free(hlcache->ctx_pool, ictx);
 				/* And stop */
 				RING_ITERATE_STOP(hlcache->retrieval_ctx_ring,
 						ictx);
@@ -314,7 +341,7 @@ nserror hlcache_handle_release(hlcache_handle *handle)
 	handle->cb = NULL;
 	handle->pw = NULL;
 
-	free(handle);
+	pool_free(hlcache->handle_pool, handle);
 
 	return NSERROR_OK;
 }
@@ -355,7 +382,7 @@ nserror hlcache_handle_abort(hlcache_handle *handle)
 				RING_REMOVE(hlcache->retrieval_ctx_ring, ictx);
 				/* Throw us away */
 				free((char *) ictx->child.charset);
-				free(ictx);
+				pool_free(hlcache->ctx_pool, ictx);
 				/* And stop */
 				RING_ITERATE_STOP(hlcache->retrieval_ctx_ring,
 						ictx);
@@ -374,7 +401,7 @@ nserror hlcache_handle_abort(hlcache_handle *handle)
 		if (clone == NULL)
 			return NSERROR_NOMEM;
 
-		entry = calloc(sizeof(struct hlcache_entry), 1);
+		entry = pool_alloc(hlcache->entry_pool);
 
 		if (entry == NULL) {
 			content_destroy(clone);
@@ -384,7 +411,7 @@ nserror hlcache_handle_abort(hlcache_handle *handle)
 		if (content_add_user(clone,
 				hlcache_content_callback, handle) == false) {
 			content_destroy(clone);
-			free(entry);
+			pool_free(hlcache->entry_pool, entry);
 			return NSERROR_NOMEM;
 		}
 
@@ -491,7 +518,7 @@ void hlcache_clean(void *ignored)
 		content_destroy(entry->content);
 
 		/* Destroy entry */
-		free(entry);
+		pool_free(hlcache->entry_pool, entry);
 	}
 
 	/* Attempt to clean the llcache */
@@ -671,7 +698,7 @@ nserror hlcache_migrate_ctx(hlcache_retrieval_ctx *ctx,
 	/* No longer require retrieval context */
 	RING_REMOVE(hlcache->retrieval_ctx_ring, ctx);
 	free((char *) ctx->child.charset);
-	free(ctx);
+	pool_free(hlcache->ctx_pool, ctx);
 
 	return error;
 }
@@ -749,7 +776,7 @@ nserror hlcache_find_content(hlcache_retrieval_ctx *ctx,
 
 	if (entry == NULL) {
 		/* No existing entry, so need to create one */
-		entry = malloc(sizeof(hlcache_entry));
+		entry = pool_alloc(hlcache->entry_pool);
 		if (entry == NULL)
 			return NSERROR_NOMEM;
 
@@ -758,7 +785,7 @@ nserror hlcache_find_content(hlcache_retrieval_ctx *ctx,
 				ctx->child.charset, ctx->child.quirks,
 				effective_type);
 		if (entry->content == NULL) {
-			free(entry);
+			pool_free(hlcache->entry_pool, entry);
 			return NSERROR_NOMEM;
 		}
 
@@ -32,6 +32,7 @@
 #include "utils/log.h"
 #include "utils/messages.h"
 #include "utils/nsurl.h"
+#include "utils/pool.h"
 #include "utils/utils.h"
 
 /** Define to enable tracing of llcache operations. */
@@ -157,6 +158,15 @@ struct llcache_s {
 	llcache_object *uncached_objects;
 
 	uint32_t limit;
+
+	/** Pool of objects */
+	struct pool *object_pool;
+
+	/** Pool of object users */
+	struct pool *user_pool;
+
+	/** Pool of handles */
+	struct pool *handle_pool;
 };
 
 /** low level cache state */
@@ -189,13 +199,13 @@ static nserror llcache_object_user_new(llcache_handle_callback cb, void *pw,
 	llcache_handle *h;
 	llcache_object_user *u;
 
-	h = calloc(1, sizeof(llcache_handle));
+	h = pool_alloc(llcache->handle_pool);
 	if (h == NULL)
 		return NSERROR_NOMEM;
 
-	u = calloc(1, sizeof(llcache_object_user));
+	u = pool_alloc(llcache->user_pool);
 	if (u == NULL) {
-		free(h);
+		pool_free(llcache->handle_pool, h);
 		return NSERROR_NOMEM;
 	}
 
@@ -230,10 +240,8 @@ static nserror llcache_object_user_destroy(llcache_object_user *user)
 	assert(user->next == NULL);
 	assert(user->prev == NULL);
 	
-	if (user->handle != NULL)
-		free(user->handle);
-
-	free(user);
+	pool_free(llcache->handle_pool, user->handle);
+	pool_free(llcache->user_pool, user);
 
 	return NSERROR_OK;
 }
@@ -318,7 +326,7 @@ static nserror llcache_send_event_to_users(llcache_object *object,
  */
 static nserror llcache_object_new(nsurl *url, llcache_object **result)
 {
-	llcache_object *obj = calloc(1, sizeof(llcache_object));
+	llcache_object *obj = pool_alloc(llcache->object_pool);
 	if (obj == NULL)
 		return NSERROR_NOMEM;
 
@@ -820,7 +828,7 @@ static nserror llcache_object_destroy(llcache_object *object)
 	}
 	free(object->headers);
 
-	free(object);
+	pool_free(llcache->object_pool, object);
 
 	return NSERROR_OK;
 }
@@ -1018,6 +1026,15 @@ static nserror llcache_object_retrieve_from_cache(nsurl *url, uint32_t flags,
 		LOG(("Found fresh %p", obj));
 #endif
 
+		/* A retrieval which may query the user takes over any
+		 * speculative fetch in progress, so that authentication and
+		 * certificate problems are put to the user */
+		if (obj->fetch.state != LLCACHE_FETCH_COMPLETE &&
+				(flags & LLCACHE_RETRIEVE_SPECULATIVE) == 0) {
+			obj->fetch.flags &= ~LLCACHE_RETRIEVE_SPECULATIVE;
+			obj->fetch.flags |= flags & LLCACHE_RETRIEVE_VERIFIABLE;
+		}
+
 		/* The client needs to catch up with the object's state.
 		 * This will occur the next time that llcache_poll is called.
 		 */
@@ -1489,7 +1506,8 @@ static nserror llcache_fetch_auth(llcache_object *object, const char *realm)
 		/* No authentication details, or tried what we had, so ask */
 		object->fetch.tried_with_auth = false;
 
-		if (llcache->query_cb != NULL) {
+		if (llcache->query_cb != NULL && (object->fetch.flags &
+				LLCACHE_RETRIEVE_SPECULATIVE) == 0) {
 			llcache_query query;
 
 			/* Emit query for authentication details */
@@ -1543,7 +1561,8 @@ static nserror llcache_fetch_cert_error(llcache_object *object,
 	/* Invalidate cache-control data */
 	llcache_invalidate_cache_control_data(object);
 
-	if (llcache->query_cb != NULL) {
+	if (llcache->query_cb != NULL && (object->fetch.flags &
+			LLCACHE_RETRIEVE_SPECULATIVE) == 0) {
 		llcache_query query;
 
 		/* Emit query for TLS */
@@ -2271,22 +2290,51 @@ llcache_initialise(llcache_query_callback cb, void *pw, uint32_t llcache_limit)
 	llcache->query_cb_pw = pw;
 	llcache->limit = llcache_limit;
 
+	llcache->object_pool = pool_create("llcache objects",
+			sizeof(llcache_object));
+	llcache->user_pool = pool_create("llcache users",
+			sizeof(llcache_object_user));
+	llcache->handle_pool = pool_create("llcache handles",
+			sizeof(llcache_handle));
+	if (llcache->object_pool == NULL || llcache->user_pool == NULL ||
+			llcache->handle_pool == NULL)
+		goto failed;
+
 	/* Create static scheme strings */
 	if (lwc_intern_string("file", SLEN("file"),
 			&llcache_file_lwc) != lwc_error_ok)
-		return NSERROR_NOMEM;
+		goto failed;
 
 	if (lwc_intern_string("about", SLEN("about"),
 			&llcache_about_lwc) != lwc_error_ok)
-		return NSERROR_NOMEM;
+		goto failed;
 
 	if (lwc_intern_string("resource", SLEN("resource"),
 			&llcache_resource_lwc) != lwc_error_ok)
-		return NSERROR_NOMEM;
+		goto failed;
 
 	LOG(("llcache initialised with a limit of %d bytes", llcache_limit));
 
 	return NSERROR_OK;
+
+failed:
+	if (llcache_about_lwc != NULL) {
+		lwc_string_unref(llcache_about_lwc);
+		llcache_about_lwc = NULL;
+	}
+
+	if (llcache_file_lwc != NULL) {
+		lwc_string_unref(llcache_file_lwc);
+		llcache_file_lwc = NULL;
+	}
+
+	pool_destroy(llcache->object_pool);
+	pool_destroy(llcache->user_pool);
+	pool_destroy(llcache->handle_pool);
+	free(llcache);
+	llcache = NULL;
+
+	return NSERROR_NOMEM;
 }
 
 /* See llcache.h for documentation */
@@ -2303,10 +2351,8 @@ void llcache_finalise(void)
 		for (user = object->users; user != NULL; user = next_user) {
 			next_user = user->next;
 
-			if (user->handle != NULL)
-				free(user->handle);
-
-			free(user);
+			pool_free(llcache->handle_pool, user->handle);
+			pool_free(llcache->user_pool, user);
 		}
 
 		/* Fetch system has already been destroyed */
@@ -2324,10 +2370,8 @@ void llcache_finalise(void)
 		for (user = object->users; user != NULL; user = next_user) {
 			next_user = user->next;
 
-			if (user->handle != NULL)
-			       free(user->handle);
-
-			free(user);
+			pool_free(llcache->handle_pool, user->handle);
+			pool_free(llcache->user_pool, user);
 		}
 
 		/* Fetch system has already been destroyed */
@@ -2340,6 +2384,13 @@ void llcache_finalise(void)
 	lwc_string_unref(llcache_file_lwc);
 	lwc_string_unref(llcache_about_lwc);
 	lwc_string_unref(llcache_resource_lwc);
+	llcache_file_lwc = NULL;
+	llcache_about_lwc = NULL;
+	llcache_resource_lwc = NULL;
+
+	pool_destroy(llcache->object_pool);
+	pool_destroy(llcache->user_pool);
+	pool_destroy(llcache->handle_pool);
 
 	free(llcache);
 	llcache = NULL;
@@ -2475,7 +2526,7 @@ nserror llcache_handle_abort(llcache_handle *handle)
 		if (user->iterator_target) {
 			/* User is current iterator target, clone it */
 			llcache_object_user *newuser = 
-					calloc(1, sizeof(llcache_object_user));
+					pool_alloc(llcache->user_pool);
 			if (newuser == NULL) {
 				llcache_object_destroy(newobject);
 				return NSERROR_NOMEM;
@@ -93,7 +93,9 @@ enum llcache_retrieve_flag {
 	/**< No error pages */
 	LLCACHE_RETRIEVE_NO_ERROR_PAGES = (1 << 2),
 	/**< Stream data (implies that object is not cacheable) */
-	LLCACHE_RETRIEVE_STREAM_DATA    = (1 << 3)
+	LLCACHE_RETRIEVE_STREAM_DATA    = (1 << 3),
+	/**< Speculative fetch; fail rather than query the user */
+	LLCACHE_RETRIEVE_SPECULATIVE    = (1 << 4)
 };
 
 /** Low-level cache query types */
@@ -81,6 +81,38 @@
  * simpler implementation. Entries in this tree comprise pointers to the
  * leaf nodes of the host tree described above.
  *
+ * The search trees are only used where hosts must be visited in order (for
+ * prefix matching). Exact lookups of a host, which happen for every fetch
+ * and cookie access, use a hash table of the same entries keyed on the full
+ * host name (see urldb_host_hash_find).
+ *
+ * URL completion does not use either of these. Instead, a radix tree of
+ * every URL in the database, keyed on its host and path in lower case, is
+ * built the first time a completion is requested and kept up to date as
+ * URLs are added and visited. Each node of this tree records the highest
+ * visit count below it, so the most visited completions of a prefix can be
+ * found without considering every URL which matches it. URLs which are
+ * still only present in the URL file are indexed from their file records,
+ * and their host is only materialised if one of them is reported.
+ *
+ * The database is saved as a binary file comprising a header, an array of
+ * URL records, an array of host records and a table of NUL terminated
+ * strings which the records refer to by offset. All values are stored in
+ * host byte order; a file written on a host of differing endianness fails
+ * the magic word check and is ignored. On loading, the file is mapped into
+ * memory and the host tree and search trees are built immediately, but a
+ * host's URLs are only added to its path tree when the host is first looked
+ * at (see urldb_materialise_host). Changes to URL data made after loading
+ * are appended to a journal alongside the file, which is replayed on the
+ * next load and emptied whenever the database is saved.
+ *
+ * Persistent cookies are saved as a binary file of cookie records, with
+ * a journal in the same record format to which every change is appended
+ * as it happens. The journal belongs to the file it is merged into: it
+ * is merged when cookies are saved to that file, or from a scheduled
+ * callback once it grows beyond COOKIE_JOURNAL_MAX_RECORDS. Saving to a
+ * different file discards it and starts a journal for the new file.
+ *
  * REALLY IMPORTANT NOTE: urldb expects all URLs to be normalised. Use of 
  * non-normalised URLs with urldb will result in undefined behaviour and 
  * potential crashes.
@@ -89,6 +121,7 @@
 #include <assert.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -97,6 +130,12 @@
 
 #include <curl/curl.h>
 
+#include "utils/config.h"
+
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
 #include "image/bitmap.h"
 #include "content/content.h"
 #include "content/urldb.h"
@@ -105,6 +144,8 @@
 #include "utils/log.h"
 #include "utils/corestrings.h"
 #include "utils/filename.h"
+#include "utils/hashtable.h"
+#include "utils/schedule.h"
 #include "utils/url.h"
 #include "utils/utils.h"
 
@@ -127,6 +168,9 @@ struct cookie_internal_data {
 
 	struct cookie_internal_data *prev;	/**< Previous in list */
 	struct cookie_internal_data *next;	/**< Next in list */
+
+	struct path_data *owner;	/**< Path node whose list this is in */
+	int expiry_index;	/**< Index in expiry heap, or -1 if absent */
 };
 
 /* A protection space is defined as a tuple canonical_root_url and realm.
@@ -185,6 +229,46 @@ struct path_data {
 	struct path_data *parent;	/**< Parent path segment */
 	struct path_data *children;	/**< Child path segments */
 	struct path_data *last;		/**< Last child */
+
+	struct completion_node *completion;	/**< Completion index node
+				 * for this URL, or NULL if not indexed */
+	struct path_data *completion_next;	/**< Next URL sharing the
+				 * same completion index node */
+};
+
+/** URL file record in the completion index, whose host has not been
+ * materialised */
+struct completion_pending {
+	const struct url_file_url *url;	/**< URL file record */
+	const struct host_part *host;	/**< Host of URL */
+	struct completion_node *node;	/**< Index node, or NULL once the
+				 * URL has been added to its host */
+	struct path_data *path;	/**< URL, once added to its host */
+	struct completion_pending *next;	/**< Next record sharing the
+				 * same completion index node */
+};
+
+/** Node of the URL completion index */
+struct completion_node {
+	char *label;		/**< Key fragment leading to this node */
+	size_t len;		/**< Length of label */
+	unsigned int visits;	/**< Highest visit count in subtree */
+	struct path_data *entries;	/**< URLs whose key ends here */
+	struct completion_pending *pending;	/**< URL file records whose
+				 * key ends here */
+
+	struct completion_node *parent;	/**< Parent node */
+	struct completion_node *children;	/**< First child */
+	struct completion_node *next;	/**< Next sibling */
+};
+
+/** Entry in the queue of a ranked completion search */
+struct completion_item {
+	unsigned int visits;	/**< Visit count to rank by */
+	const struct completion_node *node;	/**< Subtree, or NULL */
+	const struct path_data *entry;	/**< URL, or NULL */
+	const struct completion_pending *pending;	/**< URL file record,
+				 * if node and entry are NULL */
 };
 
 struct host_part {
@@ -198,6 +282,10 @@ struct host_part {
 
 	char *part;		/**< Part of host string */
 
+	const struct url_file_url *pending;	/**< URL file records not yet
+				 * added to paths, or NULL */
+	unsigned int pending_count;	/**< Number of records in pending */
+
 	struct prot_space_data *prot_space;	/**< Linked list of all known
 				 * proctection spaces known for his host and
 				 * all its schems and ports. */
@@ -217,6 +305,62 @@ struct search_node {
 	struct search_node *right;	/**< Right subtree */
 };
 
+/** Binary URL file header */
+struct url_file_header {
+	uint32_t magic;		/**< URL_FILE_MAGIC */
+	uint32_t version;	/**< URL_FILE_BINARY_VERSION */
+	uint32_t url_count;	/**< Number of URL records */
+	uint32_t host_count;	/**< Number of host records */
+	uint32_t strings_size;	/**< Size of string table, in bytes */
+	uint32_t reserved;	/**< Zero; aligns the URL records */
+};
+
+/** Binary URL file host record */
+struct url_file_host {
+	uint32_t host;		/**< Host name */
+	uint32_t first_url;	/**< Index of host's first URL record */
+	uint32_t url_count;	/**< Number of URL records for host */
+};
+
+/** Binary URL file URL record */
+struct url_file_url {
+	int64_t last_visit;	/**< Last visit time */
+	uint32_t scheme;	/**< URL scheme */
+	uint32_t port;		/**< Port number, or 0 for default */
+	uint32_t path;		/**< Path and query */
+	uint32_t title;		/**< Resource title, or URL_FILE_NO_STRING */
+	uint32_t visits;	/**< Visit count */
+	uint32_t type;		/**< Type of resource */
+};
+
+/** URL journal record, followed by the URL and title strings */
+struct url_journal_record {
+	int64_t last_visit;	/**< Last visit time */
+	uint32_t url_len;	/**< Length of URL */
+	uint32_t title_len;	/**< Length of title, or 0 for none */
+	uint32_t visits;	/**< Visit count */
+	uint32_t type;		/**< Type of resource */
+};
+
+/** Binary URL file being written */
+struct url_file_writer {
+	FILE *fp;		/**< File to write URL records to */
+	uint32_t url_count;	/**< Number of URL records written */
+
+	struct url_file_host *hosts;	/**< Host records */
+	uint32_t host_count;	/**< Number of host records */
+	uint32_t host_alloc;	/**< Allocated size of hosts */
+
+	char *strings;		/**< String table */
+	uint32_t strings_size;	/**< Used size of strings */
+	uint32_t strings_alloc;	/**< Allocated size of strings */
+
+	lwc_string *scheme[4];	/**< Recently written schemes */
+	uint32_t scheme_offset[4];	/**< String offsets of schemes */
+
+	bool error;		/**< A write has failed */
+};
+
 /* Destruction */
 static void urldb_destroy_host_tree(struct host_part *root);
 static void urldb_destroy_path_tree(struct path_data *root);
@@ -225,25 +369,45 @@ static void urldb_destroy_cookie(struct cookie_internal_data *c);
 static void urldb_destroy_prot_space(struct prot_space_data *space);
 static void urldb_destroy_search_tree(struct search_node *root);
 
+/* Loading */
+static bool urldb_load_binary(const char *filename);
+static void urldb_load_text(const char *filename);
+static void urldb_release_url_file(void);
+static void urldb_materialise_host(const struct host_part *host);
+static void urldb_materialise_hosts(struct host_part *parent);
+static bool urldb_file_url_create(const char *host,
+		const struct url_file_url *u, nsurl **url);
+static bool urldb_add_file_url(struct host_part *h, const char *host,
+		const struct url_file_url *u);
+static void urldb_host_name(const struct host_part *h, char *buf,
+		size_t size);
+
+/* Journal */
+static void urldb_journal_open(const char *filename);
+static void urldb_journal_close(void);
+static void urldb_journal_url(const struct path_data *p);
+
 /* Saving */
-static void urldb_save_search_tree(struct search_node *root, FILE *fp);
-static void urldb_count_urls(const struct path_data *root, time_t expiry,
-		unsigned int *count);
+static void urldb_save_search_tree(struct search_node *root,
+		struct url_file_writer *w);
+static uint32_t urldb_write_string(struct url_file_writer *w,
+		const char *str, size_t len);
+static uint32_t urldb_write_scheme(struct url_file_writer *w,
+		lwc_string *scheme);
+static void urldb_write_url(struct url_file_writer *w,
+		const struct url_file_url *u);
 static void urldb_write_paths(const struct path_data *parent,
-		const char *host, FILE *fp, char **path, int *path_alloc,
+		struct url_file_writer *w, char **path, int *path_alloc,
 		int *path_used, time_t expiry);
 
 /* Iteration */
-static bool urldb_iterate_partial_host(struct search_node *root,
-		const char *prefix, bool (*callback)(nsurl *url,
-		const struct url_data *data));
-static bool urldb_iterate_partial_path(const struct path_data *parent,
-		const char *prefix, bool (*callback)(nsurl *url,
-		const struct url_data *data));
 static bool urldb_iterate_entries_host(struct search_node *parent,
 		bool (*url_callback)(nsurl *url,
 		const struct url_data *data),
 		bool (*cookie_callback)(const struct cookie_data *data));
+static bool urldb_iterate_entries_transient_host(struct search_node *parent,
+		bool (*callback)(nsurl *url,
+		const struct url_data *data));
 static bool urldb_iterate_entries_path(const struct path_data *parent,
 		bool (*url_callback)(nsurl *url,
 		const struct url_data *data),
@@ -266,6 +430,37 @@ static struct path_data *urldb_match_path(const struct path_data *parent,
 static struct search_node **urldb_get_search_tree_direct(const char *host);
 static struct search_node *urldb_get_search_tree(const char *host);
 
+/* Host hash */
+static uint32_t urldb_host_hash(uint32_t hash, const char *s);
+static unsigned int urldb_host_key_hash(const void *key, size_t length);
+static bool urldb_host_key_compare(const void *a, const void *b,
+		size_t length);
+static bool urldb_host_hash_match(const struct host_part *h,
+		const char *host);
+static struct host_part *urldb_host_hash_find(const char *host);
+static bool urldb_host_hash_insert(struct host_part *h);
+
+/* Completion index */
+static bool urldb_completion_build(void);
+static bool urldb_completion_build_tree(struct search_node *root);
+static bool urldb_completion_add(const struct host_part *h,
+		struct path_data *p);
+static bool urldb_completion_add_pending(const struct host_part *h);
+static void urldb_completion_resolve(const struct url_file_url *u,
+		struct path_data *p);
+static struct completion_node *urldb_completion_insert(const char *key);
+static void urldb_completion_refresh(struct completion_node *n);
+static const struct completion_node *urldb_completion_find(
+		const char *key);
+static bool urldb_completion_push(struct completion_item **heap,
+		int *used, int *alloc, const struct completion_node *node,
+		const struct path_data *entry,
+		const struct completion_pending *pending);
+static void urldb_completion_pop(struct completion_item *heap, int *used,
+		struct completion_item *item);
+static void urldb_completion_destroy(struct completion_node *root);
+static size_t urldb_completion_key(char *buf, const char *str, size_t len);
+
 /* Dump */
 static void urldb_dump_hosts(struct host_part *parent);
 static void urldb_dump_paths(struct path_data *parent);
@@ -277,16 +472,10 @@ static struct search_node *urldb_search_insert(struct search_node *root,
 static struct search_node *urldb_search_insert_internal(
 		struct search_node *root, struct search_node *n);
 /* for urldb_search_remove, see r5531 which removed it */
-static const struct host_part *urldb_search_find(struct search_node *root,
-		const char *host);
 static struct search_node *urldb_search_skew(struct search_node *root);
 static struct search_node *urldb_search_split(struct search_node *root);
 static int urldb_search_match_host(const struct host_part *a,
 		const struct host_part *b);
-static int urldb_search_match_string(const struct host_part *a,
-		const char *b);
-static int urldb_search_match_prefix(const struct host_part *a,
-		const char *b);
 
 /* Cookies */
 static struct cookie_internal_data *urldb_parse_cookie(nsurl *url,
@@ -296,6 +485,14 @@ static bool urldb_parse_avpair(struct cookie_internal_data *c, char *n,
 static bool urldb_insert_cookie(struct cookie_internal_data *c, 
 		lwc_string *scheme, nsurl *url);
 static void urldb_free_cookie(struct cookie_internal_data *c);
+static void urldb_unlink_cookie(struct cookie_internal_data *c);
+static void urldb_expiry_insert(struct cookie_internal_data *c);
+static void urldb_expiry_remove(struct cookie_internal_data *c);
+static void urldb_expiry_sift(int i);
+static void urldb_expire_cookies(time_t now);
+static struct cookie_cache_entry *urldb_cookie_cache_entry(
+		const struct path_data *p, bool include_http_only);
+static void urldb_cookie_cache_flush(void);
 static bool urldb_concat_cookie(struct cookie_internal_data *c, int version,
 		int *used, int *alloc, char **buf);
 static void urldb_delete_cookie_hosts(const char *domain, const char *path, 
@@ -305,6 +502,20 @@ static void urldb_delete_cookie_paths(const char *domain, const char *path,
 static void urldb_save_cookie_hosts(FILE *fp, struct host_part *parent);
 static void urldb_save_cookie_paths(FILE *fp, struct path_data *parent);
 
+/* Cookie persistence */
+static void urldb_load_cookies_text(FILE *fp);
+static int urldb_load_cookie_records(FILE *fp);
+static bool urldb_insert_loaded_cookie(struct cookie_internal_data *c,
+		const char *url);
+static bool urldb_write_cookie_record(FILE *fp, uint32_t op,
+		const struct cookie_internal_data *c);
+static bool urldb_cookie_journal_set_file(const char *filename);
+static void urldb_cookie_journal_open(const char *filename);
+static void urldb_cookie_journal_close(void);
+static void urldb_cookie_journal_compact(void *p);
+static void urldb_cookie_journal_write(uint32_t op,
+		const struct cookie_internal_data *c);
+
 /** Root database handle */
 static struct host_part db_root;
 
@@ -321,18 +532,317 @@ static struct search_node *search_trees[NUM_SEARCH_TREES] = {
 	&empty, &empty, &empty, &empty
 };
 
+/** Number of hosts the host hash table is initially sized for */
+#define HOST_HASH_INITIAL_SIZE 256
+
+/** Key of the host hash table */
+struct host_key {
+	const char *name;		/**< Full host name, when looking up */
+	const struct host_part *part;	/**< Host tree node, when stored */
+};
+
+/** Hash table of the hosts in the search trees, mapping to host_parts */
+static struct hash_table *host_hash;
+
+/** Maximum number of URLs reported by urldb_iterate_partial */
+#define COMPLETION_MAX_RESULTS 64
+
+/** Root of the URL completion index */
+static struct completion_node completion_root;
+/** The completion index has been built */
+static bool completion_built;
+/** Completion index entries of the URL file's records, by record index,
+ * or NULL if the index was built without the URL file */
+static struct completion_pending *completion_pending;
+
+/** Number of entries in the Cookie header cache */
+#define COOKIE_CACHE_SIZE 64
+
+/** Cached result of urldb_get_cookie */
+struct cookie_cache_entry {
+	const struct path_data *path;	/**< URL node, or NULL if unused */
+	bool include_http_only;		/**< HttpOnly cookies were included */
+	unsigned int generation;	/**< Value of cookie_generation when
+					 * the entry was filled */
+	char *header;			/**< Cookie header, or NULL if none */
+	struct cookie_internal_data **cookies;	/**< Cookies in header */
+	int count;			/**< Number of cookies */
+};
+
+/** Cookie header cache, indexed by a hash of URL node */
+static struct cookie_cache_entry cookie_cache[COOKIE_CACHE_SIZE];
+/** Incremented whenever the set of cookies changes, staling the cache */
+static unsigned int cookie_generation;
+
+/** Heap of cookies which expire, ordered on expiry time */
+static struct {
+	struct cookie_internal_data **heap;	/**< Heap array */
+	int used;		/**< Number of cookies in heap */
+	int alloc;		/**< Allocated size of heap */
+} cookie_expiry;
+
 #define MIN_COOKIE_FILE_VERSION 100
 #define COOKIE_FILE_VERSION 102
 static int loaded_cookie_file_version;
+
+/** Magic word of binary cookie files ("NSCK" on little-endian hosts) */
+#define COOKIE_FILE_MAGIC 0x4b43534e
+/** Magic word of cookie journal files ("NSCJ" on little-endian hosts) */
+#define COOKIE_JOURNAL_MAGIC 0x4a43534e
+
+/** Record operations in cookie files and journals */
+#define COOKIE_RECORD_SET 0
+#define COOKIE_RECORD_DELETE 1
+
+/** Cookie record flags */
+#define COOKIE_RECORD_DOMAIN_FROM_SET (1 << 0)
+#define COOKIE_RECORD_PATH_FROM_SET (1 << 1)
+#define COOKIE_RECORD_SECURE (1 << 2)
+#define COOKIE_RECORD_HTTP_ONLY (1 << 3)
+#define COOKIE_RECORD_NO_DESTROY (1 << 4)
+#define COOKIE_RECORD_VALUE_QUOTED (1 << 5)
+
+/** Indices of the strings of a cookie record */
+#define COOKIE_STRING_NAME 0
+#define COOKIE_STRING_VALUE 1
+#define COOKIE_STRING_COMMENT 2
+#define COOKIE_STRING_DOMAIN 3
+#define COOKIE_STRING_PATH 4
+#define COOKIE_STRING_SCHEME 5
+#define COOKIE_STRING_URL 6
+#define COOKIE_RECORD_STRINGS 7
+
+/** Longest string accepted in a cookie record */
+#define COOKIE_RECORD_MAX_STRING (64 * 1024)
+
+/** Number of journal records after which the cookie file is rewritten */
+#define COOKIE_JOURNAL_MAX_RECORDS 4096
+
+/**
+ * Binary cookie file and journal record
+ *
+ * Both comprise a magic word followed by a sequence of these records,
+ * each followed by its strings, in host byte order. The strings are
+ * written with their terminators, in the order of the COOKIE_STRING_*
+ * indices. Later records override earlier ones.
+ */
+struct cookie_file_record {
+	int64_t expires;	/**< Expiry time */
+	int64_t last_used;	/**< Last used time */
+	uint32_t op;		/**< COOKIE_RECORD_SET or COOKIE_RECORD_DELETE */
+	uint32_t version;	/**< Specification compliance */
+	uint32_t flags;		/**< COOKIE_RECORD_* flags */
+	uint32_t len[COOKIE_RECORD_STRINGS];	/**< Lengths of strings */
+};
+
+/** Cookie file which the journal belongs to, or NULL */
+static char *cookie_file_name;
+/** Journal of changes to persistent cookies since the file was saved */
+static FILE *cookie_journal;
+/** Name of cookie journal file */
+static char *cookie_journal_name;
+/** Number of records in cookie journal */
+static int cookie_journal_records;
+/** Whether merging the cookie journal into the file has been scheduled */
+static bool cookie_journal_compact_scheduled;
 #define MIN_URL_FILE_VERSION 106
 #define URL_FILE_VERSION 106
 
+/** Magic word of binary URL files ("NSUD" on little-endian hosts) */
+#define URL_FILE_MAGIC 0x4455534e
+/** Version of binary URL file and URL journal formats */
+#define URL_FILE_BINARY_VERSION 2
+/** String table offset of absent strings */
+#define URL_FILE_NO_STRING 0xffffffff
+/** Magic word of URL journal files ("NSUJ" on little-endian hosts) */
+#define URL_JOURNAL_MAGIC 0x4a55534e
+
+/** Separator between URL file name and suffixes of related files */
+#ifdef riscos
+#define URL_FILE_SUFFIX_SEP "/"
+#else
+#define URL_FILE_SUFFIX_SEP "."
+#endif
+
+/** Binary URL file which host path data is loaded from */
+static struct {
+	void *data;		/**< File contents */
+	size_t size;		/**< Size of data */
+	bool mapped;		/**< data is mapped, rather than allocated */
+	const struct url_file_url *urls;	/**< URL records */
+	uint32_t url_count;	/**< Number of URL records */
+	const char *strings;	/**< String table */
+	uint32_t strings_size;	/**< Size of string table */
+} url_file;
+
+/** Journal of URL data changes since the URL file was saved */
+static FILE *url_journal;
+/** Name of journal file */
+static char *url_journal_name;
+
 /**
  * Import an URL database from file, replacing any existing database
  *
  * \param filename Name of file containing data
  */
 void urldb_load(const char *filename)
+{
+	assert(filename);
+
+	LOG(("Loading URL file"));
+
+	/* URLs which are only present in a previously loaded file must be
+	 * added to the database before that file is released */
+	urldb_materialise_hosts(&db_root);
+	urldb_release_url_file();
+
+	/* The index is rebuilt when next needed, from the new data */
+	urldb_completion_destroy(&completion_root);
+
+	if (urldb_load_binary(filename) == false)
+		urldb_load_text(filename);
+
+	urldb_journal_open(filename);
+}
+
+/**
+ * Import a binary URL file
+ *
+ * Host entries are created for each host in the file, but the paths on
+ * each host are left in the file until they are needed.
+ *
+ * \param filename Name of file containing data
+ * \return false if the file is not a binary URL file, true otherwise
+ */
+bool urldb_load_binary(const char *filename)
+{
+	const struct url_file_header *header;
+	const struct url_file_host *hosts;
+	const struct url_file_url *urls;
+	uint64_t expected;
+	uint32_t magic;
+	uint32_t i;
+	long size;
+	FILE *fp;
+
+	fp = fopen(filename, "rb");
+	if (!fp) {
+		LOG(("Failed to open file '%s' for reading", filename));
+		return true;
+	}
+
+	if (fread(&magic, sizeof magic, 1, fp) != 1 ||
+			magic != URL_FILE_MAGIC) {
+		fclose(fp);
+		return false;
+	}
+
+	if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0 ||
+			(size_t) size < sizeof(*header)) {
+		LOG(("Truncated URL file"));
+		fclose(fp);
+		return true;
+	}
+
+	url_file.size = size;
+
+#ifdef HAVE_MMAP
+	url_file.data = mmap(NULL, url_file.size, PROT_READ, MAP_PRIVATE,
+			fileno(fp), 0);
+	if (url_file.data == MAP_FAILED)
+		url_file.data = NULL;
+	else
+		url_file.mapped = true;
+#endif
+
+	if (url_file.data == NULL) {
+		url_file.data = malloc(url_file.size);
+		if (url_file.data == NULL || fseek(fp, 0, SEEK_SET) != 0 ||
+				fread(url_file.data, url_file.size, 1,
+						fp) != 1) {
+			LOG(("Failed reading URL file"));
+			fclose(fp);
+			urldb_release_url_file();
+			return true;
+		}
+	}
+
+	fclose(fp);
+
+	header = url_file.data;
+
+	if (header->version != URL_FILE_BINARY_VERSION) {
+		LOG(("Unknown URL file version."));
+		urldb_release_url_file();
+		return true;
+	}
+
+	expected = sizeof(*header) +
+			(uint64_t) header->url_count * sizeof(*urls) +
+			(uint64_t) header->host_count * sizeof(*hosts) +
+			header->strings_size;
+	if (expected != url_file.size || header->strings_size == 0) {
+		LOG(("Corrupt URL file"));
+		urldb_release_url_file();
+		return true;
+	}
+
+	urls = (const struct url_file_url *) (header + 1);
+	hosts = (const struct url_file_host *) (urls + header->url_count);
+	url_file.urls = urls;
+	url_file.url_count = header->url_count;
+	url_file.strings = (const char *) (hosts + header->host_count);
+	url_file.strings_size = header->strings_size;
+
+	/* Every string offset below strings_size must be terminated */
+	if (url_file.strings[url_file.strings_size - 1] != '\0') {
+		LOG(("Corrupt URL file"));
+		urldb_release_url_file();
+		return true;
+	}
+
+	for (i = 0; i < header->host_count; i++) {
+		const char *host;
+		struct host_part *h;
+
+		if (hosts[i].host >= url_file.strings_size ||
+				(uint64_t) hosts[i].first_url +
+				hosts[i].url_count > header->url_count) {
+			LOG(("Corrupt host record %u", i));
+			continue;
+		}
+
+		host = url_file.strings + hosts[i].host;
+
+		/* skip data that has ended up with a host of '' */
+		if (*host == '\0' || hosts[i].url_count == 0)
+			continue;
+
+		h = urldb_add_host(host);
+		if (!h) {
+			LOG(("Failed adding host: '%s'", host));
+			die("Memory exhausted whilst loading URL file");
+		}
+
+		/* Merge any duplicate host entry's paths now */
+		urldb_materialise_host(h);
+
+		h->pending = urls + hosts[i].first_url;
+		h->pending_count = hosts[i].url_count;
+	}
+
+	LOG(("Successfully loaded URL file (%u hosts, %u URLs)",
+			header->host_count, header->url_count));
+
+	return true;
+}
+
+/**
+ * Import a URL file in the old line-based text format
+ *
+ * \param filename Name of file containing data
+ */
+void urldb_load_text(const char *filename)
 {
 #define MAXIMUM_URL_LENGTH 4096
 	char s[MAXIMUM_URL_LENGTH];
@@ -344,10 +854,6 @@ void urldb_load(const char *filename)
 	int length;
 	FILE *fp;
 
-	assert(filename);
-
-	LOG(("Loading URL file"));
-
 	fp = fopen(filename, "r");
 	if (!fp) {
 		LOG(("Failed to open file '%s' for reading", filename));
@@ -446,11 +952,6 @@ void urldb_load(const char *filename)
 					(port ? ports : ""),
 					s);
 
-			/* TODO: store URLs in pre-parsed state, and make
-			 *       a nsurl_load to generate the nsurl more
-			 *       swiftly.
-			 *       Need a nsurl_save too.
-			 */
 			if (nsurl_create(url, &nsurl) != NSERROR_OK) {
 				LOG(("Failed inserting '%s'", url));
 				die("Memory exhausted whilst loading "
@@ -517,208 +1018,678 @@ void urldb_load(const char *filename)
 }
 
 /**
- * Export the current database to file
+ * Release the loaded binary URL file
  *
- * \param filename Name of file to export to
+ * No host may have records pending from the file when it is released.
  */
-void urldb_save(const char *filename)
+void urldb_release_url_file(void)
 {
-	FILE *fp;
-	int i;
-
-	assert(filename);
-
-	fp = fopen(filename, "w");
-	if (!fp) {
-		LOG(("Failed to open file '%s' for writing", filename));
-		return;
-	}
-
-	/* file format version number */
-	fprintf(fp, "%d\n", URL_FILE_VERSION);
-
-	for (i = 0; i != NUM_SEARCH_TREES; i++) {
-		urldb_save_search_tree(search_trees[i], fp);
+	if (url_file.data != NULL) {
+#ifdef HAVE_MMAP
+		if (url_file.mapped)
+			munmap(url_file.data, url_file.size);
+		else
+#endif
+			free(url_file.data);
 	}
 
-	fclose(fp);
+	memset(&url_file, 0, sizeof(url_file));
 }
 
 /**
- * Save a search (sub)tree
+ * Add a host's URLs which are still only present in the URL file to the
+ * host's path tree
  *
- * \param root Root of (sub)tree to save
- * \param fp File to write to
+ * \param host Host to process
  */
-void urldb_save_search_tree(struct search_node *parent, FILE *fp)
+void urldb_materialise_host(const struct host_part *host)
 {
-	char host[256];
-	const struct host_part *h;
-	unsigned int path_count = 0;
-	char *path, *p, *end;
-	int path_alloc = 64, path_used = 1;
-	time_t expiry;
-
-	expiry = time(NULL) - ((60 * 60 * 24) * nsoption_int(expire_url));
+	/* Pending data is not part of the host's logical state */
+	struct host_part *h = (struct host_part *) host;
+	const struct url_file_url *u, *end;
+	char host_str[256];
 
-	if (parent == &empty)
+	if (h->pending == NULL)
 		return;
 
-	urldb_save_search_tree(parent->left, fp);
+	u = h->pending;
+	end = u + h->pending_count;
 
-	path = malloc(path_alloc);
-	if (!path)
-		return;
+	/* Adding the paths brings us back here, so clear this first */
+	h->pending = NULL;
+	h->pending_count = 0;
 
-	path[0] = '\0';
+	urldb_host_name(h, host_str, sizeof host_str);
 
-	for (h = parent->data, p = host, end = host + sizeof host;
-			h && h != &db_root && p < end; h = h->parent) {
-		int written = snprintf(p, end - p, "%s%s", h->part,
-				(h->parent && h->parent->parent) ? "." : "");
-		if (written < 0) {
-			free(path);
-			return;
-		}
-		p += written;
+	for (; u != end; u++) {
+		if (!urldb_add_file_url(h, host_str, u))
+			LOG(("Failed adding URL on '%s'", host_str));
 	}
+}
 
-	urldb_count_urls(&parent->data->paths, expiry, &path_count);
-
-	if (path_count > 0) {
-		fprintf(fp, "%s\n%i\n", host, path_count);
-
-		urldb_write_paths(&parent->data->paths, host, fp,
-				&path, &path_alloc, &path_used, expiry);
-	}
+/**
+ * Add all URLs still only present in the URL file to the database
+ *
+ * \param parent Root of host (sub)tree to process
+ */
+void urldb_materialise_hosts(struct host_part *parent)
+{
+	struct host_part *h;
 
-	free(path);
+	urldb_materialise_host(parent);
 
-	urldb_save_search_tree(parent->right, fp);
+	for (h = parent->children; h; h = h->next)
+		urldb_materialise_hosts(h);
 }
 
 /**
- * Count number of URLs associated with a host
+ * Create the URL of a URL file record
  *
- * \param root Root of path data tree
- * \param expiry Expiry time for URLs
- * \param count Pointer to count
+ * \param host Name of host of URL
+ * \param u URL record
+ * \param url Updated to contain the URL
+ * \return true on success, false on memory exhaustion or a corrupt record
  */
-void urldb_count_urls(const struct path_data *root, time_t expiry,
-		unsigned int *count)
+bool urldb_file_url_create(const char *host, const struct url_file_url *u,
+		nsurl **url)
 {
-	const struct path_data *p = root;
+	char buf[64 + 3 + 256 + 6 + 4096 + 1];
+	char ports[11];
+	const char *scheme;
+	bool is_file;
+	int written;
+
+	if (u->scheme >= url_file.strings_size ||
+			u->path >= url_file.strings_size ||
+			(u->title != URL_FILE_NO_STRING &&
+			u->title >= url_file.strings_size))
+		return false;
 
-	do {
-		if (p->children != NULL) {
-			/* Drill down into children */
-			p = p->children;
-		} else {
-			/* No more children, increment count if required */
-			if (p->persistent || ((p->urld.last_visit > expiry) &&
-					(p->urld.visits > 0)))
-				(*count)++;
+	scheme = url_file.strings + u->scheme;
 
-			/* Now, find next node to process. */
-			while (p != root) {
-				if (p->next != NULL) {
-					/* Have a sibling, process that */
-					p = p->next;
-					break;
-				}
+	/* file URLs have no host */
+	is_file = (strcasecmp(host, "localhost") == 0 &&
+			strcasecmp(scheme, "file") == 0);
 
-				/* Ascend tree */
-				p = p->parent;
-			}
-		}
-	} while (p != root);
+	snprintf(ports, sizeof ports, "%u", u->port);
+
+	written = snprintf(buf, sizeof buf, "%s://%s%s%s%s", scheme,
+			(is_file ? "" : host),
+			(u->port ? ":" : ""),
+			(u->port ? ports : ""),
+			url_file.strings + u->path);
+	if (written < 0 || (size_t) written >= sizeof buf)
+		return false;
+
+	return nsurl_create(buf, url) == NSERROR_OK;
 }
 
 /**
- * Write paths associated with a host
+ * Add an URL from the URL file to a host's path tree
  *
- * \param parent Root of (sub)tree to write
- * \param host Current host name
- * \param fp File to write to
- * \param path Current path string
- * \param path_alloc Allocated size of path
- * \param path_used Used size of path
- * \param expiry Expiry time of URLs
+ * \param h Host to add to
+ * \param host Name of host
+ * \param u URL record to add
+ * \return true on success, false otherwise
  */
-void urldb_write_paths(const struct path_data *parent, const char *host,
-		FILE *fp, char **path, int *path_alloc, int *path_used,
-		time_t expiry)
+bool urldb_add_file_url(struct host_part *h, const char *host,
+		const struct url_file_url *u)
 {
-	const struct path_data *p = parent;
-	int i;
-
-	do {
-		int seglen = p->segment != NULL ? strlen(p->segment) : 0;
-		int len = *path_used + seglen + 1;
-
-		if (*path_alloc < len) {
-			char *temp = realloc(*path,
-					(len > 64) ? len : *path_alloc + 64);
-			if (!temp)
-				return;
-			*path = temp;
-			*path_alloc = (len > 64) ? len : *path_alloc + 64;
-		}
+	nsurl *nsurl;
+	lwc_string *scheme_lwc, *fragment_lwc;
+	struct path_data *p;
+	char *path_query;
+	size_t len;
 
-		if (p->segment != NULL)
-			memcpy(*path + *path_used - 1, p->segment, seglen);
+	if (!urldb_file_url_create(host, u, &nsurl))
+		return false;
 
-		if (p->children != NULL) {
-			(*path)[*path_used + seglen - 1] = '/';
-			(*path)[*path_used + seglen] = '\0';
-		} else {
-			(*path)[*path_used + seglen - 1] = '\0';
-			len -= 1;
-		}
+	/* Copy and merge path/query strings */
+	if (nsurl_get(nsurl, NSURL_PATH | NSURL_QUERY,
+			&path_query, &len) != NSERROR_OK) {
+		nsurl_unref(nsurl);
+		return false;
+	}
 
-		*path_used = len;
+	scheme_lwc = nsurl_get_component(nsurl, NSURL_SCHEME);
+	fragment_lwc = nsurl_get_component(nsurl, NSURL_FRAGMENT);
 
-		if (p->children != NULL) {
-			/* Drill down into children */
-			p = p->children;
-		} else {
-			/* leaf node */
-			if (p->persistent ||((p->urld.last_visit > expiry) &&
-					(p->urld.visits > 0))) {
-				fprintf(fp, "%s\n", lwc_string_data(p->scheme));
+	p = urldb_add_path(scheme_lwc, u->port, h, path_query,
+			fragment_lwc, nsurl);
 
-				if (p->port)
-					fprintf(fp,"%d\n", p->port);
-				else
-					fprintf(fp, "\n");
+	nsurl_unref(nsurl);
+	lwc_string_unref(scheme_lwc);
+	if (fragment_lwc != NULL)
+		lwc_string_unref(fragment_lwc);
 
-				fprintf(fp, "%s\n", *path);
+	if (!p)
+		return false;
 
-				/** \todo handle fragments? */
+	p->urld.visits = u->visits;
+	p->urld.last_visit = (time_t) u->last_visit;
+	p->urld.type = (content_type) u->type;
 
-				fprintf(fp, "%i\n%i\n%i\n", p->urld.visits,
-						(int)p->urld.last_visit,
-						(int)p->urld.type);
+	if (u->title != URL_FILE_NO_STRING && p->urld.title == NULL)
+		p->urld.title = strdup(url_file.strings + u->title);
 
-				fprintf(fp, "\n");
+	urldb_completion_resolve(u, p);
 
-				if (p->urld.title) {
-					uint8_t *s = (uint8_t *) p->urld.title;
+	return true;
+}
 
-					for (i = 0; s[i] != '\0'; i++)
-						if (s[i] < 32)
-							s[i] = ' ';
-					for (--i; ((i > 0) && (s[i] == ' ')); 
-							i--)
-						s[i] = '\0';
-					fprintf(fp, "%s\n", p->urld.title);
-				} else
-					fprintf(fp, "\n");
-			}
+/**
+ * Build the full name of a host
+ *
+ * \param h Host tree node
+ * \param buf Buffer to fill
+ * \param size Size of buffer
+ */
+void urldb_host_name(const struct host_part *h, char *buf, size_t size)
+{
+	char *p = buf, *end = buf + size;
+
+	buf[0] = '\0';
+
+	for (; h && h != &db_root && p < end; h = h->parent) {
+		int written = snprintf(p, end - p, "%s%s", h->part,
+				(h->parent && h->parent->parent) ? "." : "");
+		if (written < 0)
+			return;
+		p += written;
+	}
+}
+
+/**
+ * Replay and open the journal for an URL file
+ *
+ * \param filename Name of URL file
+ */
+void urldb_journal_open(const char *filename)
+{
+	struct url_journal_record r;
+	char *buf = NULL;
+	size_t buf_alloc = 0;
+	uint32_t magic[2]; /* magic word and format version */
+	FILE *fp;
+
+	urldb_journal_close();
+
+	url_journal_name = malloc(strlen(filename) +
+			SLEN(URL_FILE_SUFFIX_SEP "journal") + 1);
+	if (url_journal_name == NULL)
+		return;
+
+	sprintf(url_journal_name, "%s" URL_FILE_SUFFIX_SEP "journal",
+			filename);
+
+	fp = fopen(url_journal_name, "rb");
+	if (fp != NULL) {
+		if (fread(magic, sizeof magic, 1, fp) != 1 ||
+				magic[0] != URL_JOURNAL_MAGIC ||
+				magic[1] != URL_FILE_BINARY_VERSION) {
+			LOG(("Ignoring invalid URL journal"));
+			fclose(fp);
+			fp = NULL;
+		}
+	}
+
+	/* A truncated final record is the result of a crash; ignore it */
+	while (fp != NULL && fread(&r, sizeof r, 1, fp) == 1) {
+		struct path_data *p;
+		nsurl *url;
+		size_t len;
+
+		/* URL and title are each followed by a terminator */
+		len = (size_t) r.url_len + 1;
+		if (r.title_len > 0)
+			len += (size_t) r.title_len + 1;
+
+		if (len > buf_alloc) {
+			char *temp = realloc(buf, len);
+			if (temp == NULL)
+				break;
+			buf = temp;
+			buf_alloc = len;
+		}
+
+		if (fread(buf, len, 1, fp) != 1)
+			break;
+
+		buf[r.url_len] = '\0';
+		buf[len - 1] = '\0';
+
+		if (nsurl_create(buf, &url) != NSERROR_OK)
+			continue;
+
+		p = urldb_add_url(url) ? urldb_find_url(url) : NULL;
+		nsurl_unref(url);
+		if (p == NULL)
+			continue;
+
+		p->urld.visits = r.visits;
+		p->urld.last_visit = (time_t) r.last_visit;
+		p->urld.type = (content_type) r.type;
+
+		if (r.title_len > 0) {
+			char *title = strdup(buf + r.url_len + 1);
+			if (title != NULL) {
+				free(p->urld.title);
+				p->urld.title = title;
+			}
+		}
+	}
+
+	free(buf);
+
+	if (fp != NULL) {
+		fclose(fp);
+		url_journal = fopen(url_journal_name, "ab");
+	} else {
+		url_journal = fopen(url_journal_name, "wb");
+		if (url_journal != NULL) {
+			magic[0] = URL_JOURNAL_MAGIC;
+			magic[1] = URL_FILE_BINARY_VERSION;
+			fwrite(magic, sizeof magic, 1, url_journal);
+		}
+	}
+
+	if (url_journal == NULL)
+		LOG(("Failed to open URL journal '%s'", url_journal_name));
+}
+
+/**
+ * Close the URL journal
+ */
+void urldb_journal_close(void)
+{
+	if (url_journal != NULL) {
+		fclose(url_journal);
+		url_journal = NULL;
+	}
+
+	free(url_journal_name);
+	url_journal_name = NULL;
+}
+
+/**
+ * Append an URL's current data to the journal
+ *
+ * \param p Path data of URL
+ */
+void urldb_journal_url(const struct path_data *p)
+{
+	struct url_journal_record r;
+
+	if (url_journal == NULL || p->url == NULL)
+		return;
+
+	r.url_len = nsurl_length(p->url);
+	r.title_len = p->urld.title != NULL ? strlen(p->urld.title) : 0;
+	r.visits = p->urld.visits;
+	r.last_visit = (int64_t) p->urld.last_visit;
+	r.type = (uint32_t) p->urld.type;
+
+	/* Strings are written with their terminators */
+	if (fwrite(&r, sizeof r, 1, url_journal) != 1 ||
+			fwrite(nsurl_access(p->url), r.url_len + 1, 1,
+					url_journal) != 1 ||
+			(r.title_len > 0 && fwrite(p->urld.title,
+					r.title_len + 1, 1, url_journal) != 1)) {
+		LOG(("Failed writing URL journal"));
+	}
+
+	fflush(url_journal);
+}
+
+/**
+ * Export the current database to file
+ *
+ * The file is written alongside the existing one and moved into place,
+ * as paths may still be being loaded lazily from the existing file.
+ *
+ * \param filename Name of file to export to
+ */
+void urldb_save(const char *filename)
+{
+	struct url_file_writer w;
+	struct url_file_header header;
+	char *temp;
+	int i;
+
+	assert(filename);
+
+	temp = malloc(strlen(filename) + SLEN(URL_FILE_SUFFIX_SEP "new") + 1);
+	if (!temp)
+		return;
+
+	sprintf(temp, "%s" URL_FILE_SUFFIX_SEP "new", filename);
+
+	memset(&w, 0, sizeof(w));
+
+	w.fp = fopen(temp, "wb");
+	if (!w.fp) {
+		LOG(("Failed to open file '%s' for writing", temp));
+		free(temp);
+		return;
+	}
+
+	/* Header is filled in once the contents are known */
+	memset(&header, 0, sizeof(header));
+	if (fwrite(&header, sizeof(header), 1, w.fp) != 1)
+		w.error = true;
+
+	for (i = 0; i != NUM_SEARCH_TREES; i++) {
+		urldb_save_search_tree(search_trees[i], &w);
+	}
+
+	header.magic = URL_FILE_MAGIC;
+	header.version = URL_FILE_BINARY_VERSION;
+	header.url_count = w.url_count;
+	header.host_count = w.host_count;
+	header.strings_size = w.strings_size;
+
+	if (w.host_count > 0 && fwrite(w.hosts, sizeof(*w.hosts),
+			w.host_count, w.fp) != w.host_count)
+		w.error = true;
+
+	if (w.strings_size > 0 && fwrite(w.strings, w.strings_size,
+			1, w.fp) != 1)
+		w.error = true;
+
+	if (fseek(w.fp, 0, SEEK_SET) != 0 ||
+			fwrite(&header, sizeof(header), 1, w.fp) != 1)
+		w.error = true;
+
+	if (fclose(w.fp) != 0)
+		w.error = true;
+
+	free(w.hosts);
+	free(w.strings);
+
+	if (w.error) {
+		LOG(("Failed writing URL file '%s'", temp));
+		remove(temp);
+		free(temp);
+		return;
+	}
+
+	if (rename(temp, filename) != 0) {
+		/* Some platforms won't replace an existing file */
+		remove(filename);
+		if (rename(temp, filename) != 0) {
+			LOG(("Failed to replace '%s'", filename));
+			remove(temp);
+			free(temp);
+			return;
+		}
+	}
+
+	free(temp);
+
+	/* Everything in the journal is now in the file */
+	if (url_journal != NULL) {
+		uint32_t magic[2] = { URL_JOURNAL_MAGIC,
+				URL_FILE_BINARY_VERSION };
+
+		fclose(url_journal);
+		url_journal = fopen(url_journal_name, "wb");
+		if (url_journal != NULL)
+			fwrite(magic, sizeof magic, 1, url_journal);
+	}
+}
+
+/**
+ * Save a search (sub)tree
+ *
+ * \param root Root of (sub)tree to save
+ * \param w File being written
+ */
+void urldb_save_search_tree(struct search_node *parent,
+		struct url_file_writer *w)
+{
+	char host[256];
+	const struct host_part *h;
+	struct url_file_host record;
+	char *path;
+	int path_alloc = 64, path_used = 1;
+	time_t expiry;
+
+	expiry = time(NULL) - ((60 * 60 * 24) * nsoption_int(expire_url));
+
+	if (parent == &empty)
+		return;
+
+	urldb_save_search_tree(parent->left, w);
+
+	h = parent->data;
+
+	urldb_host_name(h, host, sizeof host);
+
+	record.first_url = w->url_count;
+
+	if (h->pending != NULL) {
+		/* Paths never looked at; copy them from the loaded file */
+		const struct url_file_url *u = h->pending;
+		const struct url_file_url *end = u + h->pending_count;
+
+		for (; u != end; u++) {
+			struct url_file_url copy = *u;
+
+			if (((time_t) u->last_visit <= expiry ||
+					u->visits == 0) ||
+					u->scheme >= url_file.strings_size ||
+					u->path >= url_file.strings_size)
+				continue;
+
+			copy.scheme = urldb_write_string(w,
+					url_file.strings + u->scheme,
+					strlen(url_file.strings + u->scheme));
+			copy.path = urldb_write_string(w,
+					url_file.strings + u->path,
+					strlen(url_file.strings + u->path));
+			if (u->title != URL_FILE_NO_STRING &&
+					u->title < url_file.strings_size)
+				copy.title = urldb_write_string(w,
+						url_file.strings + u->title,
+						strlen(url_file.strings +
+						u->title));
+			else
+				copy.title = URL_FILE_NO_STRING;
+
+			urldb_write_url(w, &copy);
+		}
+	} else {
+		path = malloc(path_alloc);
+		if (path != NULL) {
+			path[0] = '\0';
+
+			urldb_write_paths(&h->paths, w, &path, &path_alloc,
+					&path_used, expiry);
+
+			free(path);
+		}
+	}
+
+	record.url_count = w->url_count - record.first_url;
+
+	if (record.url_count > 0) {
+		record.host = urldb_write_string(w, host, strlen(host));
+
+		if (w->host_count == w->host_alloc) {
+			uint32_t alloc = w->host_alloc + 256;
+			struct url_file_host *temp = realloc(w->hosts,
+					alloc * sizeof(*temp));
+			if (!temp) {
+				w->error = true;
+				return;
+			}
+			w->hosts = temp;
+			w->host_alloc = alloc;
+		}
+
+		w->hosts[w->host_count++] = record;
+	}
+
+	urldb_save_search_tree(parent->right, w);
+}
+
+/**
+ * Add a string to the string table of a URL file being written
+ *
+ * \param w File being written
+ * \param str String to add
+ * \param len Length of str
+ * \return Offset of string in string table
+ */
+uint32_t urldb_write_string(struct url_file_writer *w, const char *str,
+		size_t len)
+{
+	uint32_t offset = w->strings_size;
+
+	if (len + 1 > UINT32_MAX - w->strings_size) {
+		w->error = true;
+		return URL_FILE_NO_STRING;
+	}
+
+	if (w->strings_size + len + 1 > w->strings_alloc) {
+		uint32_t alloc = w->strings_alloc + len + 1 + 64 * 1024;
+		char *temp = realloc(w->strings, alloc);
+		if (!temp) {
+			w->error = true;
+			return URL_FILE_NO_STRING;
+		}
+		w->strings = temp;
+		w->strings_alloc = alloc;
+	}
+
+	memcpy(w->strings + w->strings_size, str, len);
+	w->strings[w->strings_size + len] = '\0';
+	w->strings_size += len + 1;
+
+	return offset;
+}
+
+/**
+ * Add a scheme to the string table of a URL file being written
+ *
+ * Schemes are drawn from a very small set, so recently written ones are
+ * shared rather than being written again.
+ *
+ * \param w File being written
+ * \param scheme Scheme to add
+ * \return Offset of scheme in string table
+ */
+uint32_t urldb_write_scheme(struct url_file_writer *w, lwc_string *scheme)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(w->scheme) / sizeof(w->scheme[0]); i++) {
+		if (w->scheme[i] == scheme)
+			return w->scheme_offset[i];
+	}
+
+	/* Replace the oldest entry */
+	memmove(&w->scheme[1], &w->scheme[0],
+			sizeof(w->scheme) - sizeof(w->scheme[0]));
+	memmove(&w->scheme_offset[1], &w->scheme_offset[0],
+			sizeof(w->scheme_offset) - sizeof(w->scheme_offset[0]));
+
+	w->scheme[0] = scheme;
+	w->scheme_offset[0] = urldb_write_string(w, lwc_string_data(scheme),
+			lwc_string_length(scheme));
+
+	return w->scheme_offset[0];
+}
+
+/**
+ * Write an URL record to a URL file
+ *
+ * \param w File being written
+ * \param u Record to write
+ */
+void urldb_write_url(struct url_file_writer *w, const struct url_file_url *u)
+{
+	if (fwrite(u, sizeof(*u), 1, w->fp) != 1)
+		w->error = true;
+
+	w->url_count++;
+}
+
+/**
+ * Write paths associated with a host
+ *
+ * \param parent Root of (sub)tree to write
+ * \param w File being written
+ * \param path Current path string
+ * \param path_alloc Allocated size of path
+ * \param path_used Used size of path
+ * \param expiry Expiry time of URLs
+ */
+void urldb_write_paths(const struct path_data *parent,
+		struct url_file_writer *w, char **path, int *path_alloc,
+		int *path_used, time_t expiry)
+{
+	const struct path_data *p = parent;
+
+	do {
+		int seglen = p->segment != NULL ? strlen(p->segment) : 0;
+		int len = *path_used + seglen + 1;
+
+		if (*path_alloc < len) {
+			char *temp = realloc(*path,
+					(len > 64) ? len : *path_alloc + 64);
+			if (!temp)
+				return;
+			*path = temp;
+			*path_alloc = (len > 64) ? len : *path_alloc + 64;
+		}
+
+		if (p->segment != NULL)
+			memcpy(*path + *path_used - 1, p->segment, seglen);
+
+		if (p->children != NULL) {
+			(*path)[*path_used + seglen - 1] = '/';
+			(*path)[*path_used + seglen] = '\0';
+		} else {
+			(*path)[*path_used + seglen - 1] = '\0';
+			len -= 1;
+		}
+
+		*path_used = len;
+
+		if (p->children != NULL) {
+			/* Drill down into children */
+			p = p->children;
+		} else {
+			/* leaf node */
+			if (p->persistent ||((p->urld.last_visit > expiry) &&
+					(p->urld.visits > 0))) {
+				struct url_file_url u;
+
+				u.scheme = urldb_write_scheme(w, p->scheme);
+				u.port = p->port;
+				u.path = urldb_write_string(w, *path,
+						*path_used - 1);
+
+				/** \todo handle fragments? */
+
+				if (p->urld.title != NULL)
+					u.title = urldb_write_string(w,
+							p->urld.title,
+							strlen(p->urld.title));
+				else
+					u.title = URL_FILE_NO_STRING;
+
+				u.visits = p->urld.visits;
+				u.last_visit = (int64_t) p->urld.last_visit;
+				u.type = (uint32_t) p->urld.type;
+
+				urldb_write_url(w, &u);
+			}
 
 			/* Now, find next node to process. */
 			while (p != parent) {
-				int seglen = p->segment != NULL 
+				int seglen = p->segment != NULL
 						? strlen(p->segment) : 0;
 
 				/* Remove our segment from the path */
@@ -854,6 +1825,8 @@ void urldb_set_url_title(nsurl *url, const char *title)
 
 	free(p->urld.title);
 	p->urld.title = temp;
+
+	urldb_journal_url(p);
 }
 
 /**
@@ -873,6 +1846,8 @@ void urldb_set_url_content_type(nsurl *url, content_type type)
 		return;
 
 	p->urld.type = type;
+
+	urldb_journal_url(p);
 }
 
 /**
@@ -892,6 +1867,9 @@ void urldb_update_url_visit_data(nsurl *url)
 
 	p->urld.last_visit = time(NULL);
 	p->urld.visits++;
+
+	urldb_completion_refresh(p->completion);
+	urldb_journal_url(p);
 }
 
 /**
@@ -911,6 +1889,9 @@ void urldb_reset_url_visit_data(nsurl *url)
 
 	p->urld.last_visit = (time_t)0;
 	p->urld.visits = 0;
+
+	urldb_completion_refresh(p->completion);
+	urldb_journal_url(p);
 }
 
 
@@ -1178,6 +2159,8 @@ struct bitmap *urldb_get_thumbnail(nsurl *url)
 /**
  * Iterate over entries in the database which match the given prefix
  *
+ * At most COMPLETION_MAX_RESULTS entries are reported, most visited first.
+ *
  * \param prefix Prefix to match
  * \param callback Callback function
  */
@@ -1185,207 +2168,138 @@ void urldb_iterate_partial(const char *prefix,
 		bool (*callback)(nsurl *url,
 		const struct url_data *data))
 {
-	char host[256];
-	char buf[260]; /* max domain + "www." */
-	const char *slash, *scheme_sep;
-	struct search_node *tree;
-	const struct host_part *h;
+	char *key;
+	const char *scheme_sep;
+	const struct completion_node *n, *www = NULL, *a;
+	struct completion_item *heap = NULL, item;
+	int used = 0, alloc = 0, reported = 0;
+	size_t len;
 
 	assert(prefix && callback);
 
+	if (!urldb_completion_build())
+		return;
+
 	/* strip scheme */
 	scheme_sep = strstr(prefix, "://");
 	if (scheme_sep)
 		prefix = scheme_sep + 3;
 
-	slash = strchr(prefix, '/');
-	tree = urldb_get_search_tree(prefix);
+	len = strlen(prefix);
 
-	if (slash) {
-		/* if there's a slash in the input, then we can
-		 * assume that we're looking for a path */
-		snprintf(host, sizeof host, "%.*s",
-				(int) (slash - prefix), prefix);
+	/* Room for "www." and the prefix */
+	key = malloc(len + 5);
+	if (key == NULL)
+		return;
 
-		h = urldb_search_find(tree, host);
-		if (!h) {
-			int len = slash - prefix;
-
-			if (len <= 3 || strncasecmp(host, "www.", 4) != 0) {
-				snprintf(buf, sizeof buf, "www.%s", host);
-				h = urldb_search_find(
-					search_trees[ST_DN + 'w' - 'a'],
-					buf);
-				if (!h)
-					return;
-			} else
-				return;
-		}
-
-		if (h->paths.children) {
-			/* Have paths, iterate them */
-			urldb_iterate_partial_path(&h->paths, slash + 1,
-					callback);
-		}
+	urldb_completion_key(key, prefix, len);
+	n = urldb_completion_find(key);
 
-	} else {
-		int len = strlen(prefix);
-
-		/* looking for hosts */
-		if (!urldb_iterate_partial_host(tree, prefix, callback))
-			return;
+	if (len <= 3 || strncasecmp(prefix, "www.", 4) != 0) {
+		/* now look for www.prefix, unless it is within the
+		 * subtree matching prefix */
+		memcpy(key, "www.", 4);
+		urldb_completion_key(key + 4, prefix, len);
+		www = urldb_completion_find(key);
 
-		if (len <= 3 || strncasecmp(prefix, "www.", 4) != 0) {
-			/* now look for www.prefix */
-			snprintf(buf, sizeof buf, "www.%s", prefix);
-			if(!urldb_iterate_partial_host(
-					search_trees[ST_DN + 'w' - 'a'],
-					buf, callback))
-				return;
+		for (a = www; a && n; a = a->parent) {
+			if (a == n) {
+				www = NULL;
+				break;
+			}
 		}
 	}
-}
 
-/**
- * Partial host iterator (internal)
- *
- * \param root Root of (sub)tree to traverse
- * \param prefix Prefix to match
- * \param callback Callback function
- * \return true to continue, false otherwise
- */
-bool urldb_iterate_partial_host(struct search_node *root, const char *prefix,
-		bool (*callback)(nsurl *url, const struct url_data *data))
-{
-	int c;
+	free(key);
 
-	assert(root && prefix && callback);
+	if ((n && !urldb_completion_push(&heap, &used, &alloc, n,
+			NULL, NULL)) ||
+			(www && !urldb_completion_push(&heap, &used, &alloc,
+					www, NULL, NULL))) {
+		free(heap);
+		return;
+	}
 
-	if (root == &empty)
-		return true;
+	/* Report URLs in order of visit count. The subtree of a node is
+	 * only queued once its highest visit count is the best remaining. */
+	while (used > 0 && reported < COMPLETION_MAX_RESULTS) {
+		const struct completion_node *c;
+		const struct completion_pending *f;
+		const struct path_data *p;
+
+		urldb_completion_pop(heap, &used, &item);
+
+		if (item.pending != NULL) {
+			/* Add the record's host's URLs to the database,
+			 * which fills in the record's path data */
+			urldb_materialise_host(item.pending->host);
+			item.entry = item.pending->path;
+			if (item.entry == NULL)
+				continue;
+		}
 
-	c = urldb_search_match_prefix(root->data, prefix);
-
-	if (c > 0)
-		/* No match => look in left subtree */
-		return urldb_iterate_partial_host(root->left, prefix,
-				callback);
-	else if (c < 0)
-		/* No match => look in right subtree */
-		return urldb_iterate_partial_host(root->right, prefix,
-				callback);
-	else {
-		/* Match => iterate over l/r subtrees & process this node */
-		if (!urldb_iterate_partial_host(root->left, prefix,
-				callback))
-			return false;
+		if (item.entry != NULL) {
+			reported++;
+			if (!callback(item.entry->url,
+					(const struct url_data *)
+					&item.entry->urld))
+				break;
+			continue;
+		}
 
-		if (root->data->paths.children) {
-			/* and extract all paths attached to this host */
-			if (!urldb_iterate_entries_path(&root->data->paths,
-					callback, NULL)) {
-				return false;
-			}
+		for (p = item.node->entries; p; p = p->completion_next) {
+			if (!urldb_completion_push(&heap, &used, &alloc,
+					NULL, p, NULL))
+				break;
 		}
 
-		if (!urldb_iterate_partial_host(root->right, prefix,
-				callback))
-			return false;
+		for (f = item.node->pending; f; f = f->next) {
+			if (!urldb_completion_push(&heap, &used, &alloc,
+					NULL, NULL, f))
+				break;
+		}
+
+		for (c = item.node->children; c; c = c->next) {
+			if (!urldb_completion_push(&heap, &used, &alloc,
+					c, NULL, NULL))
+				break;
+		}
 	}
 
-	return true;
+	free(heap);
 }
 
 /**
- * Partial path iterator (internal)
+ * Iterate over all entries in database
  *
- * \param parent Root of (sub)tree to traverse
- * \param prefix Prefix to match
- * \param callback Callback function
- * \return true to continue, false otherwise
+ * \param callback Function to callback for each entry
  */
-bool urldb_iterate_partial_path(const struct path_data *parent,
-		const char *prefix, bool (*callback)(nsurl *url,
+void urldb_iterate_entries(bool (*callback)(nsurl *url,
 		const struct url_data *data))
 {
-	const struct path_data *p = parent->children;
-	const char *slash, *end = prefix + strlen(prefix);
-
-	/* 
-	 * Given: http://www.example.org/a/b/c/d//e
-	 * and assuming a path tree:
-	 *     .
-	 *    / \
-	 *   a1 b1
-	 *  / \
-	 * a2 b2
-	 *    /|\
-	 *   a b c
-	 *   3 3 |
-	 *       d
-	 *       |
-	 *       e
-	 *      / \
-	 *      f g
-	 *
-	 * Prefix will be:	p will be:
-	 *
-	 * a/b/c/d//e		a1
-	 *   b/c/d//e		a2
-	 *   b/c/d//e		b3
-	 *     c/d//e		a3
-	 *     c/d//e		b3
-	 *     c/d//e		c
-	 *       d//e		d
-	 *         /e		e		(skip /)
-	 *          e		e
-	 *
-	 * I.E. we perform a breadth-first search of the tree.
-	 */
-
-	do {
-		slash = strchr(prefix, '/');
-		if (!slash)
-			slash = end;
-
-		if (slash == prefix && *prefix == '/') {
-			/* Ignore "//" */
-			prefix++;
-			continue;
-		}
-	
-		if (strncasecmp(p->segment, prefix, slash - prefix) == 0) {
-			/* prefix matches so far */
-			if (slash == end) {
-				/* we've run out of prefix, so all
-				 * paths below this one match */
-				if (!urldb_iterate_entries_path(p, callback, 
-						NULL))
-					return false;
-
-				/* Progress to next sibling */
-				p = p->next;
-			} else {
-				/* Skip over this segment */
-				prefix = slash + 1;
+	int i;
 
-				p = p->children;
-			}
-		} else {
-			/* Doesn't match this segment, try next sibling */
-			p = p->next;
-		}
-	} while (p != NULL);
+	assert(callback);
 
-	return true;
+	for (i = 0; i < NUM_SEARCH_TREES; i++) {
+		if (!urldb_iterate_entries_host(search_trees[i],
+				callback, NULL))
+			break;
+	}
 }
 
 /**
- * Iterate over all entries in database
+ * Iterate over all entries in database, without loading URLs from the URL
+ * file
+ *
+ * URLs which are still only present in the URL file are reported from their
+ * file records. Unlike urldb_iterate_entries, the URL and data passed to the
+ * callback are only valid until it returns; it must take a reference to the
+ * URL to keep it.
  *
  * \param callback Function to callback for each entry
  */
-void urldb_iterate_entries(bool (*callback)(nsurl *url,
+void urldb_iterate_entries_transient(bool (*callback)(nsurl *url,
 		const struct url_data *data))
 {
 	int i;
@@ -1393,8 +2307,8 @@ void urldb_iterate_entries(bool (*callback)(nsurl *url,
 	assert(callback);
 
 	for (i = 0; i < NUM_SEARCH_TREES; i++) {
-		if (!urldb_iterate_entries_host(search_trees[i],
-				callback, NULL))
+		if (!urldb_iterate_entries_transient_host(search_trees[i],
+				callback))
 			break;
 	}
 }
@@ -1437,6 +2351,8 @@ bool urldb_iterate_entries_host(struct search_node *parent,
 			url_callback, cookie_callback))
 		return false;
 
+	urldb_materialise_host(parent->data);
+
 	if ((parent->data->paths.children) || ((cookie_callback) &&
 			(parent->data->paths.cookies))) {
 		/* We have paths (or domain cookies), so iterate them */
@@ -1453,6 +2369,61 @@ bool urldb_iterate_entries_host(struct search_node *parent,
 	return true;
 }
 
+/**
+ * Host data iterator which leaves URLs in the URL file (internal)
+ *
+ * \param parent Root of subtree to iterate over
+ * \param callback Callback function
+ * \return true to continue, false otherwise
+ */
+bool urldb_iterate_entries_transient_host(struct search_node *parent,
+		bool (*callback)(nsurl *url,
+				const struct url_data *data))
+{
+	const struct host_part *h;
+
+	if (parent == &empty)
+		return true;
+
+	if (!urldb_iterate_entries_transient_host(parent->left, callback))
+		return false;
+
+	h = parent->data;
+
+	if (h->pending != NULL) {
+		const struct url_file_url *u = h->pending;
+		const struct url_file_url *end = u + h->pending_count;
+		char host[256];
+
+		urldb_host_name(h, host, sizeof host);
+
+		for (; u != end; u++) {
+			struct url_data data;
+			nsurl *url;
+			bool cont;
+
+			if (!urldb_file_url_create(host, u, &url))
+				continue;
+
+			data.title = u->title != URL_FILE_NO_STRING ?
+					url_file.strings + u->title : NULL;
+			data.visits = u->visits;
+			data.last_visit = (time_t) u->last_visit;
+			data.type = (content_type) u->type;
+
+			cont = callback(url, &data);
+			nsurl_unref(url);
+			if (!cont)
+				return false;
+		}
+	} else if (h->paths.children != NULL) {
+		if (!urldb_iterate_entries_path(&h->paths, callback, NULL))
+			return false;
+	}
+
+	return urldb_iterate_entries_transient_host(parent->right, callback);
+}
+
 /**
  * Path data iterator (internal)
  *
@@ -1504,13 +2475,512 @@ bool urldb_iterate_entries_path(const struct path_data *parent,
 					break;
 				}
 
-				/* Ascend tree */
-				p = p->parent;
-			}
-		}
-	} while (p != parent);
+				/* Ascend tree */
+				p = p->parent;
+			}
+		}
+	} while (p != parent);
+
+	return true;
+}
+
+/**
+ * Build the URL completion index, if it does not already exist
+ *
+ * \return true on success, false on memory exhaustion
+ */
+bool urldb_completion_build(void)
+{
+	int i;
+
+	if (completion_built)
+		return true;
+
+	/* URLs still in the URL file are indexed from their records */
+	if (url_file.url_count > 0) {
+		completion_pending = calloc(url_file.url_count,
+				sizeof(*completion_pending));
+		if (completion_pending == NULL)
+			return false;
+	}
+
+	for (i = 0; i < NUM_SEARCH_TREES; i++) {
+		if (!urldb_completion_build_tree(search_trees[i])) {
+			urldb_completion_destroy(&completion_root);
+			return false;
+		}
+	}
+
+	completion_built = true;
+
+	return true;
+}
+
+/**
+ * Add the URLs of all hosts in a search tree to the completion index
+ *
+ * \param root Root of (sub)tree to add
+ * \return true on success, false on memory exhaustion
+ */
+bool urldb_completion_build_tree(struct search_node *root)
+{
+	struct path_data *p;
+
+	if (root == &empty)
+		return true;
+
+	if (!urldb_completion_build_tree(root->left))
+		return false;
+
+	if (!urldb_completion_add_pending(root->data))
+		return false;
+
+	/* Walk the host's path tree, depth first */
+	p = root->data->paths.children;
+	while (p != NULL) {
+		if (p->url && !urldb_completion_add(root->data, p))
+			return false;
+
+		if (p->children) {
+			p = p->children;
+			continue;
+		}
+
+		while (p->next == NULL && p->parent != &root->data->paths)
+			p = p->parent;
+		p = p->next;
+	}
+
+	return urldb_completion_build_tree(root->right);
+}
+
+/**
+ * Add an URL to the completion index
+ *
+ * \param h Host of URL
+ * \param p Path data of URL
+ * \return true on success, false on memory exhaustion
+ */
+bool urldb_completion_add(const struct host_part *h, struct path_data *p)
+{
+	char host[256];
+	char *plq, *key;
+	size_t host_len, len;
+	struct completion_node *n;
+
+	assert(p->url && p->completion == NULL);
+
+	if (nsurl_get(p->url, NSURL_PATH | NSURL_QUERY, &plq, &len) !=
+			NSERROR_OK)
+		return false;
+
+	urldb_host_name(h, host, sizeof host);
+	host_len = strlen(host);
+
+	key = malloc(host_len + len + 1);
+	if (key == NULL) {
+		free(plq);
+		return false;
+	}
+
+	len = urldb_completion_key(key, host, host_len);
+	urldb_completion_key(key + len, plq, strlen(plq));
+	free(plq);
+
+	n = urldb_completion_insert(key);
+
+	free(key);
+
+	if (n == NULL)
+		return false;
+
+	p->completion = n;
+	p->completion_next = n->entries;
+	n->entries = p;
+
+	urldb_completion_refresh(n);
+
+	return true;
+}
+
+/**
+ * Add the URLs of a host which are still only present in the URL file to
+ * the completion index
+ *
+ * \param h Host to add the URL file records of
+ * \return true on success, false on memory exhaustion
+ */
+bool urldb_completion_add_pending(const struct host_part *h)
+{
+	const struct url_file_url *u, *end;
+	char host[256];
+	char *key = NULL;
+	size_t host_len, alloc = 0;
+
+	if (h->pending == NULL || completion_pending == NULL)
+		return true;
+
+	urldb_host_name(h, host, sizeof host);
+	host_len = urldb_completion_key(host, host, strlen(host));
+
+	end = h->pending + h->pending_count;
+	for (u = h->pending; u != end; u++) {
+		struct completion_pending *f;
+		struct completion_node *n;
+		const char *path;
+		size_t len;
+
+		if (u->path >= url_file.strings_size)
+			continue;
+
+		path = url_file.strings + u->path;
+		len = strlen(path);
+
+		if (host_len + len + 1 > alloc) {
+			char *temp = realloc(key, host_len + len + 1);
+			if (temp == NULL) {
+				free(key);
+				return false;
+			}
+			key = temp;
+			alloc = host_len + len + 1;
+		}
+
+		memcpy(key, host, host_len);
+		urldb_completion_key(key + host_len, path, len);
+
+		n = urldb_completion_insert(key);
+		if (n == NULL) {
+			free(key);
+			return false;
+		}
+
+		f = &completion_pending[u - url_file.urls];
+		f->url = u;
+		f->host = h;
+		f->node = n;
+		f->next = n->pending;
+		n->pending = f;
+
+		urldb_completion_refresh(n);
+	}
+
+	free(key);
+
+	return true;
+}
+
+/**
+ * Move an URL from the URL file into the completion index, once it has been
+ * added to its host
+ *
+ * \param u URL file record of URL
+ * \param p Path data of URL
+ */
+void urldb_completion_resolve(const struct url_file_url *u,
+		struct path_data *p)
+{
+	struct completion_pending *f, **link;
+	struct completion_node *n;
+
+	if (completion_pending == NULL)
+		return;
+
+	f = &completion_pending[u - url_file.urls];
+	n = f->node;
+	if (n == NULL)
+		return;
+
+	for (link = &n->pending; *link != f; link = &(*link)->next)
+		assert(*link != NULL);
+	*link = f->next;
+
+	f->node = NULL;
+	f->next = NULL;
+	f->path = p;
+
+	/* The path was indexed as it was added, before its data was set */
+	urldb_completion_refresh(p->completion);
+	urldb_completion_refresh(n);
+}
+
+/**
+ * Normalise a string for use as a completion index key
+ *
+ * The string is lower cased and runs of '/' are collapsed, so that keys
+ * match regardless of case and of empty path segments.
+ *
+ * \param buf Buffer to fill, at least len + 1 bytes long
+ * \param str String to normalise
+ * \param len Length of str
+ * \return Length of key placed in buf
+ */
+size_t urldb_completion_key(char *buf, const char *str, size_t len)
+{
+	const char *end = str + len;
+	char *d = buf;
+
+	for (; str < end; str++) {
+		if (*str == '/' && d > buf && d[-1] == '/')
+			continue;
+		*d++ = tolower((unsigned char) *str);
+	}
+	*d = '\0';
+
+	return d - buf;
+}
+
+/**
+ * Find or create the completion index node for a key
+ *
+ * \param key Normalised key of URL
+ * \return Node, or NULL on memory exhaustion
+ */
+struct completion_node *urldb_completion_insert(const char *key)
+{
+	struct completion_node *n = &completion_root, *c, **link;
+	size_t len = strlen(key), common;
+
+	while (len > 0) {
+		for (link = &n->children; (c = *link) != NULL;
+				link = &c->next) {
+			if (c->label[0] == key[0])
+				break;
+		}
+
+		if (c == NULL) {
+			/* No child shares a prefix with key: add a leaf */
+			c = calloc(1, sizeof(*c) + len + 1);
+			if (c == NULL)
+				return NULL;
+
+			c->label = (char *) (c + 1);
+			c->len = len;
+			memcpy(c->label, key, len + 1);
+			c->parent = n;
+			*link = c;
+
+			n = c;
+			break;
+		}
+
+		for (common = 1; common < c->len && common < len &&
+				c->label[common] == key[common]; common++)
+			;
+
+		if (common < c->len) {
+			/* Key diverges within label: split child */
+			struct completion_node *mid;
+
+			mid = calloc(1, sizeof(*mid) + common + 1);
+			if (mid == NULL)
+				return NULL;
+
+			mid->label = (char *) (mid + 1);
+			mid->len = common;
+			memcpy(mid->label, c->label, common);
+			mid->visits = c->visits;
+			mid->parent = n;
+			mid->children = c;
+			mid->next = c->next;
+			*link = mid;
+
+			memmove(c->label, c->label + common,
+					c->len - common + 1);
+			c->len -= common;
+			c->parent = mid;
+			c->next = NULL;
+
+			c = mid;
+		}
+
+		n = c;
+		key += common;
+		len -= common;
+	}
+
+	return n;
+}
+
+/**
+ * Recalculate the highest visit counts of a completion index node and its
+ * ancestors, after the visit count of one of its URLs has changed
+ *
+ * \param n Node to start from, or NULL
+ */
+void urldb_completion_refresh(struct completion_node *n)
+{
+	for (; n != NULL; n = n->parent) {
+		const struct completion_node *c;
+		const struct completion_pending *f;
+		const struct path_data *p;
+		unsigned int visits = 0;
+
+		for (p = n->entries; p; p = p->completion_next)
+			if (p->urld.visits > visits)
+				visits = p->urld.visits;
+
+		for (f = n->pending; f; f = f->next)
+			if (f->url->visits > visits)
+				visits = f->url->visits;
+
+		for (c = n->children; c; c = c->next)
+			if (c->visits > visits)
+				visits = c->visits;
+
+		if (visits == n->visits)
+			break;
+
+		n->visits = visits;
+	}
+}
+
+/**
+ * Find the completion index subtree containing all keys with a prefix
+ *
+ * \param key Normalised prefix
+ * \return Root of subtree, or NULL if no key has the prefix
+ */
+const struct completion_node *urldb_completion_find(const char *key)
+{
+	const struct completion_node *n = &completion_root, *c;
+	size_t len = strlen(key);
+
+	while (len > 0) {
+		for (c = n->children; c; c = c->next)
+			if (c->label[0] == key[0])
+				break;
+
+		if (c == NULL)
+			return NULL;
+
+		if (len <= c->len)
+			return strncmp(c->label, key, len) == 0 ? c : NULL;
+
+		if (strncmp(c->label, key, c->len) != 0)
+			return NULL;
+
+		n = c;
+		key += c->len;
+		len -= c->len;
+	}
+
+	return n;
+}
+
+/**
+ * Add a subtree or URL to the queue of a ranked completion search
+ *
+ * The queue is a binary max-heap ordered on visit count.
+ *
+ * \param heap Pointer to heap, updated if it is reallocated
+ * \param used Pointer to number of items in heap, updated
+ * \param alloc Pointer to number of items allocated, updated
+ * \param node Subtree to add, or NULL
+ * \param entry URL to add, or NULL
+ * \param pending URL file record to add, if node and entry are NULL
+ * \return true on success, false on memory exhaustion
+ */
+bool urldb_completion_push(struct completion_item **heap, int *used,
+		int *alloc, const struct completion_node *node,
+		const struct path_data *entry,
+		const struct completion_pending *pending)
+{
+	struct completion_item *h = *heap, item;
+	int i;
+
+	if (*used == *alloc) {
+		int n = *alloc ? *alloc * 2 : 32;
+
+		h = realloc(*heap, n * sizeof(*h));
+		if (h == NULL)
+			return false;
+
+		*heap = h;
+		*alloc = n;
+	}
+
+	if (node != NULL)
+		item.visits = node->visits;
+	else if (entry != NULL)
+		item.visits = entry->urld.visits;
+	else
+		item.visits = pending->url->visits;
+	item.node = node;
+	item.entry = entry;
+	item.pending = pending;
+
+	/* Sift up */
+	for (i = (*used)++; i > 0 && h[(i - 1) / 2].visits < item.visits;
+			i = (i - 1) / 2)
+		h[i] = h[(i - 1) / 2];
+	h[i] = item;
+
+	return true;
+}
+
+/**
+ * Remove the highest ranked item from the queue of a completion search
+ *
+ * \param heap Heap to remove from, which must not be empty
+ * \param used Pointer to number of items in heap, updated
+ * \param item Updated to contain removed item
+ */
+void urldb_completion_pop(struct completion_item *heap, int *used,
+		struct completion_item *item)
+{
+	struct completion_item last;
+	int i, child;
+
+	assert(*used > 0);
+
+	*item = heap[0];
+	last = heap[--(*used)];
+
+	/* Sift down */
+	for (i = 0; (child = 2 * i + 1) < *used; i = child) {
+		if (child + 1 < *used &&
+				heap[child + 1].visits > heap[child].visits)
+			child++;
+
+		if (heap[child].visits <= last.visits)
+			break;
+
+		heap[i] = heap[child];
+	}
+	heap[i] = last;
+}
+
+/**
+ * Destroy the completion index, or a subtree of it
+ *
+ * \param root Root of (sub)tree to destroy. The root itself is only freed
+ *             if it is not the root of the index.
+ */
+void urldb_completion_destroy(struct completion_node *root)
+{
+	struct completion_node *c, *next;
+	struct path_data *p, *p_next;
+
+	for (p = root->entries; p; p = p_next) {
+		p_next = p->completion_next;
+		p->completion = NULL;
+		p->completion_next = NULL;
+	}
 
-	return true;
+	for (c = root->children; c; c = next) {
+		next = c->next;
+		urldb_completion_destroy(c);
+	}
+
+	if (root == &completion_root) {
+		memset(&completion_root, 0, sizeof(completion_root));
+		completion_built = false;
+		free(completion_pending);
+		completion_pending = NULL;
+	} else {
+		free(root);
+	}
 }
 
 /**
@@ -1550,7 +3020,8 @@ struct host_part *urldb_add_host_node(const char *part,
  * Add a host to the database, creating any intermediate entries
  *
  * \param host Hostname to add
- * \return Pointer to leaf node, or NULL on memory exhaustion
+ * \return Pointer to leaf node, or NULL on memory exhaustion or if \a host is
+ *         longer than a domain name may be
  */
 struct host_part *urldb_add_host(const char *host)
 {
@@ -1562,6 +3033,15 @@ struct host_part *urldb_add_host(const char *host)
 
 	assert(host);
 
+	/* The host hash is keyed on the whole name, so it must fit in buf */
+	if (strlen(host) >= sizeof buf)
+		return NULL;
+
+	/* Fast path for hosts we already know about */
+	e = urldb_host_hash_find(host);
+	if (e)
+		return e;
+
 	if (url_host_is_ip_address(host)) {
 		/* Host is an IP, so simply add as TLD */
 
@@ -1572,9 +3052,11 @@ struct host_part *urldb_add_host(const char *host)
 				return e;
 
 		d = urldb_add_host_node(host, d);
+		if (!d)
+			return NULL;
 
 		s = urldb_search_insert(search_trees[ST_IP], d);
-		if (!s) {
+		if (!s || !urldb_host_hash_insert(d)) {
 			/* failed */
 			d = NULL;
 		} else {
@@ -1585,8 +3067,7 @@ struct host_part *urldb_add_host(const char *host)
 	}
 
 	/* Copy host string, so we can corrupt it */
-	strncpy(buf, host, sizeof buf);
-	buf[sizeof buf - 1] = '\0';
+	strcpy(buf, host);
 
 	/* Process FQDN segments backwards */
 	do {
@@ -1615,6 +3096,9 @@ struct host_part *urldb_add_host(const char *host)
 					d = NULL;
 				} else {
 					*r = s;
+
+					if (!urldb_host_hash_insert(d))
+						d = NULL;
 				}
 			}
 			break;
@@ -1725,6 +3209,8 @@ struct path_data *urldb_add_path(lwc_string *scheme, unsigned int port,
 
 	assert(scheme && host && url);
 
+	urldb_materialise_host(host);
+
 	d = (struct path_data *) &host->paths;
 
 	/* skip leading '/' */
@@ -1782,6 +3268,9 @@ struct path_data *urldb_add_path(lwc_string *scheme, unsigned int port,
 		} else {
 			d->url = nsurl_ref(url);
 		}
+
+		if (completion_built)
+			urldb_completion_add(host, d);
 	}
 
 	return d;
@@ -1848,7 +3337,6 @@ struct path_data *urldb_find_url(nsurl *url)
 {
 	const struct host_part *h;
 	struct path_data *p;
-	struct search_node *tree;
 	char *plq;
 	const char *host_str;
 	lwc_string *scheme, *host, *port;
@@ -1876,8 +3364,7 @@ struct path_data *urldb_find_url(nsurl *url)
 		return NULL;
 	}
 
-	tree = urldb_get_search_tree(host_str);
-	h = urldb_search_find(tree, host_str);
+	h = urldb_host_hash_find(host_str);
 	if (!h) {
 		lwc_string_unref(scheme);
 		return NULL;
@@ -1899,6 +3386,8 @@ struct path_data *urldb_find_url(nsurl *url)
 		port_int = 0;
 	}
 
+	urldb_materialise_host(h);
+
 	p = urldb_match_path(&h->paths, plq, scheme, port_int);
 
 	free(plq);
@@ -2006,6 +3495,8 @@ void urldb_dump_hosts(struct host_part *parent)
 {
 	struct host_part *h;
 
+	urldb_materialise_host(parent);
+
 	if (parent->part) {
 		LOG(("%s", parent->part));
 
@@ -2152,195 +3643,173 @@ struct search_node *urldb_search_insert_internal(struct search_node *root,
 }
 
 /**
- * Find a node in a search tree
+ * Continue the hash of a host name
  *
- * \param root Tree to look in
- * \param host Host to find
- * \return Pointer to host tree node, or NULL if not found
+ * Host names are compared case insensitively, so the hash is, too.
+ *
+ * \param hash Hash of the preceding part of the name
+ * \param s Next part of the host name
+ * \return Hash value
  */
-const struct host_part *urldb_search_find(struct search_node *root,
-		const char *host)
+uint32_t urldb_host_hash(uint32_t hash, const char *s)
 {
-	int c;
-
-	assert(root && host);
-
-	if (root == &empty) {
-		return NULL;
+	/* FNV-1a */
+	for (; *s != '\0'; s++) {
+		hash ^= (uint8_t) tolower((unsigned char) *s);
+		hash *= 0x01000193;
 	}
 
-	c = urldb_search_match_string(root->data, host);
-
-	if (c > 0)
-		return urldb_search_find(root->left, host);
-	else if (c < 0)
-		return urldb_search_find(root->right, host);
-	else
-		return root->data;
+	return hash;
 }
 
 /**
- * Compare a pair of host_parts
+ * Hash a key of the host hash table
  *
- * \param a
- * \param b
- * \return 0 if match, non-zero, otherwise
+ * \param key struct host_key to hash
+ * \param length Size of key
+ * \return Hash of the full host name, however the key gives it
  */
-int urldb_search_match_host(const struct host_part *a,
-		const struct host_part *b)
+unsigned int urldb_host_key_hash(const void *key, size_t length)
 {
-	int ret;
+	const struct host_key *k = key;
+	const struct host_part *h;
+	uint32_t hash = 0x811c9dc5;
 
-	assert(a && b);
+	if (k->name != NULL)
+		return urldb_host_hash(hash, k->name);
 
-	/* traverse up tree to root, comparing parts as we go. */
-	for (; a && a != &db_root && b && b != &db_root;
-			a = a->parent, b = b->parent)
-		if ((ret = strcasecmp(a->part, b->part)) != 0)
-			/* They differ => return the difference here */
-			return ret;
+	/* The full name is the parts from the leaf upwards, dot separated */
+	for (h = k->part; h && h != &db_root; h = h->parent) {
+		if (h != k->part)
+			hash = urldb_host_hash(hash, ".");
+		hash = urldb_host_hash(hash, h->part);
+	}
 
-	/* If we get here then either:
-	 *    a) The path lengths differ
-	 * or b) The hosts are identical
-	 */
-	if (a && a != &db_root && (!b || b == &db_root))
-		/* len(a) > len(b) */
-		return 1;
-	else if ((!a || a == &db_root) && b && b != &db_root)
-		/* len(a) < len(b) */
-		return -1;
+	return hash;
+}
 
-	/* identical */
-	return 0;
+/**
+ * Compare keys of the host hash table
+ *
+ * \param a Key to find
+ * \param b Key in the table, which always has a host tree node
+ * \param length Size of the keys
+ * \return true if the keys are for the same host
+ */
+bool urldb_host_key_compare(const void *a, const void *b, size_t length)
+{
+	const struct host_key *find = a;
+	const struct host_key *stored = b;
+
+	if (find->name != NULL)
+		return urldb_host_hash_match(stored->part, find->name);
+
+	return urldb_search_match_host(find->part, stored->part) == 0;
 }
 
 /**
- * Compare host_part with a string
+ * Determine whether a host tree node has a given full host name
  *
- * \param a
- * \param b
- * \return 0 if match, non-zero, otherwise
+ * \param h Host tree node
+ * \param host Full host name
+ * \return true if the names match, false otherwise
  */
-int urldb_search_match_string(const struct host_part *a,
-		const char *b)
+bool urldb_host_hash_match(const struct host_part *h, const char *host)
 {
-	const char *end, *dot;
-	int plen, ret;
+	size_t len;
+
+	/* Compare parts from the leaf upwards; IP addresses are stored
+	 * whole, directly below the root */
+	for (; h && h != &db_root; h = h->parent) {
+		len = strlen(h->part);
+
+		if (strncasecmp(h->part, host, len) != 0)
+			return false;
+		host += len;
 
-	assert(a && a != &db_root && b);
+		if (h->parent == &db_root)
+			return *host == '\0';
 
-	if (url_host_is_ip_address(b)) {
-		/* IP address */
-		return strcasecmp(a->part, b);
+		if (*host != '.')
+			return false;
+		host++;
 	}
 
-	end = b + strlen(b) + 1;
+	return false;
+}
 
-	while (b < end && a && a != &db_root) {
-		dot = strchr(b, '.');
-		if (!dot) {
-			/* last segment */
-			dot = end - 1;
-		}
+/**
+ * Find a host in the host hash table
+ *
+ * \param host Full host name to find
+ * \return Pointer to host tree node, or NULL if not found
+ */
+struct host_part *urldb_host_hash_find(const char *host)
+{
+	struct host_key key = { host, NULL };
 
-		/* Compare strings (length limited) */
-		if ((ret = strncasecmp(a->part, b, dot - b)) != 0)
-			/* didn't match => return difference */
-			return ret;
+	assert(host);
 
-		/* The strings matched, now check that the lengths do, too */
-		plen = strlen(a->part);
+	return hash_get_typed(host_hash, &key);
+}
 
-		if (plen > dot - b)
-			/* len(a) > len(b) */
-			return 1;
-		else if (plen < dot - b)
-			/* len(a) < len(b) */
-			return -1;
+/**
+ * Add a host to the host hash table, if it's not already there
+ *
+ * \param h Host tree node
+ * \return true on success, false on memory exhaustion
+ */
+bool urldb_host_hash_insert(struct host_part *h)
+{
+	/* Keys refer to the host tree, which outlives the table */
+	struct host_key key = { NULL, h };
 
-		b = dot + 1;
-		a = a->parent;
-	}
+	assert(h);
 
-	/* If we get here then either:
-	 *    a) The path lengths differ
-	 * or b) The hosts are identical
-	 */
-	if (a && a != &db_root && b >= end)
-		/* len(a) > len(b) */
-		return 1;
-	else if ((!a || a == &db_root) && b < end)
-		/* len(a) < len(b) */
-		return -1;
+	if (host_hash == NULL) {
+		host_hash = hash_create_typed(HOST_HASH_INITIAL_SIZE,
+				sizeof(key), urldb_host_key_hash,
+				urldb_host_key_compare);
+		if (host_hash == NULL)
+			return false;
+	}
 
-	/* Identical */
-	return 0;
+	return hash_add_typed(host_hash, &key, h);
 }
 
 /**
- * Compare host_part with prefix
+ * Compare a pair of host_parts
  *
  * \param a
  * \param b
  * \return 0 if match, non-zero, otherwise
  */
-int urldb_search_match_prefix(const struct host_part *a,
-		const char *b)
+int urldb_search_match_host(const struct host_part *a,
+		const struct host_part *b)
 {
-	const char *end, *dot;
-	int plen, ret;
-
-	assert(a && a != &db_root && b);
-
-	if (url_host_is_ip_address(b)) {
-		/* IP address */
-		return strncasecmp(a->part, b, strlen(b));
-	}
-
-	end = b + strlen(b) + 1;
+	int ret;
 
-	while (b < end && a && a != &db_root) {
-		dot = strchr(b, '.');
-		if (!dot) {
-			/* last segment */
-			dot = end - 1;
-		}
+	assert(a && b);
 
-		/* Compare strings (length limited) */
-		if ((ret = strncasecmp(a->part, b, dot - b)) != 0)
-			/* didn't match => return difference */
+	/* traverse up tree to root, comparing parts as we go. */
+	for (; a && a != &db_root && b && b != &db_root;
+			a = a->parent, b = b->parent)
+		if ((ret = strcasecmp(a->part, b->part)) != 0)
+			/* They differ => return the difference here */
 			return ret;
 
-		/* The strings matched */
-		if (dot < end - 1) {
-			/* Consider segment lengths only in the case
-			 * where the prefix contains segments */
-			plen = strlen(a->part);
-			if (plen > dot - b)
-				/* len(a) > len(b) */
-				return 1;
-			else if (plen < dot - b)
-				/* len(a) < len(b) */
-				return -1;
-		}
-
-		b = dot + 1;
-		a = a->parent;
-	}
-
 	/* If we get here then either:
 	 *    a) The path lengths differ
 	 * or b) The hosts are identical
 	 */
-	if (a && a != &db_root && b >= end)
-		/* len(a) > len(b) => prefix matches */
-		return 0;
-	else if ((!a || a == &db_root) && b < end)
-		/* len(a) < len(b) => prefix does not match */
+	if (a && a != &db_root && (!b || b == &db_root))
+		/* len(a) > len(b) */
+		return 1;
+	else if ((!a || a == &db_root) && b && b != &db_root)
+		/* len(a) < len(b) */
 		return -1;
 
-	/* Identical */
+	/* identical */
 	return 0;
 }
 
@@ -2399,10 +3868,11 @@ struct search_node *urldb_search_split(struct search_node *root)
  */
 char *urldb_get_cookie(nsurl *url, bool include_http_only)
 {
-	const struct path_data *p, *q;
+	const struct path_data *p, *q, *node;
 	const struct host_part *h;
 	lwc_string *path_lwc;
 	struct cookie_internal_data *c;
+	struct cookie_cache_entry *entry;
 	int count = 0, version = COOKIE_RFC2965;
 	struct cookie_internal_data **matched_cookies;
 	int matched_cookies_size = 20;
@@ -2426,6 +3896,36 @@ char *urldb_get_cookie(nsurl *url, bool include_http_only)
 		return NULL;
 
 	scheme = p->scheme;
+	node = p;
+
+	now = time(NULL);
+
+	urldb_expire_cookies(now);
+
+	/* Use the cached header, if nothing has changed since it was made */
+	entry = urldb_cookie_cache_entry(node, include_http_only);
+	if (entry->path == node &&
+			entry->include_http_only == include_http_only &&
+			entry->generation == cookie_generation) {
+		for (i = 0; i < entry->count; i++) {
+			c = entry->cookies[i];
+
+			/* Cookies missing from the expiry heap may still
+			 * have expired */
+			if (c->expires != -1 && c->expires < now)
+				break;
+
+			if (c->last_used != now) {
+				c->last_used = now;
+				cookies_schedule_update(
+						(struct cookie_data *) c);
+			}
+		}
+
+		if (i == entry->count)
+			return entry->header != NULL ?
+					strdup(entry->header) : NULL;
+	}
 
 	matched_cookies = malloc(matched_cookies_size * 
 			sizeof(struct cookie_internal_data *));
@@ -2468,8 +3968,6 @@ char *urldb_get_cookie(nsurl *url, bool include_http_only)
 	path = lwc_string_data(path_lwc);
 	lwc_string_unref(path_lwc);
 
-	now = time(NULL);
-
 	if (*(p->segment) != '\0') {
 		/* Match exact path, unless directory, when prefix matching
 		 * will handle this case for us. */
@@ -2623,8 +4121,8 @@ char *urldb_get_cookie(nsurl *url, bool include_http_only)
 	if (count == 0) {
 		/* No cookies found */
 		free(ret);
-		free(matched_cookies);
-		return NULL;
+		ret = NULL;
+		goto done;
 	}
 
 	/* and build output string */
@@ -2660,7 +4158,23 @@ char *urldb_get_cookie(nsurl *url, bool include_http_only)
 		ret = temp;
 	}
 
-	free(matched_cookies);
+done:
+	/* Remember the result until the cookies change */
+	free(entry->header);
+	free(entry->cookies);
+
+	entry->path = node;
+	entry->include_http_only = include_http_only;
+	entry->generation = cookie_generation;
+	entry->header = NULL;
+	entry->cookies = matched_cookies;
+	entry->count = count;
+
+	if (ret != NULL) {
+		entry->header = strdup(ret);
+		if (entry->header == NULL)
+			entry->path = NULL;
+	}
 
 	return ret;
 
@@ -3313,9 +4827,7 @@ bool urldb_insert_cookie(struct cookie_internal_data *c, lwc_string *scheme,
 	assert(c);
 
 	if (c->domain[0] == '.') {
-		h = urldb_search_find(
-			urldb_get_search_tree(&(c->domain[1])),
-			c->domain + 1);
+		h = urldb_host_hash_find(c->domain + 1);
 		if (!h) {
 			h = urldb_add_host(c->domain + 1);
 			if (!h) {
@@ -3330,9 +4842,7 @@ bool urldb_insert_cookie(struct cookie_internal_data *c, lwc_string *scheme,
 		assert(url != NULL);
 		assert(scheme != NULL);
 
-		h = urldb_search_find(
-				urldb_get_search_tree(c->domain),
-				c->domain);
+		h = urldb_host_hash_find(c->domain);
 
 		if (!h) {
 			h = urldb_add_host(c->domain);
@@ -3351,6 +4861,9 @@ bool urldb_insert_cookie(struct cookie_internal_data *c, lwc_string *scheme,
 		}
 	}
 
+	/* Cached Cookie headers may now be wrong */
+	cookie_generation++;
+
 	/* add cookie */
 	for (d = p->cookies; d; d = d->next) {
 		if (!strcmp(d->domain, c->domain) &&
@@ -3359,52 +4872,232 @@ bool urldb_insert_cookie(struct cookie_internal_data *c, lwc_string *scheme,
 			break;
 	}
 
-	if (d) {
-		if (c->expires != -1 && c->expires < now) {
-			/* remove cookie */
-			if (d->next)
-				d->next->prev = d->prev;
-			else
-				p->cookies_end = d->prev;
-			if (d->prev)
-				d->prev->next = d->next;
-			else
-				p->cookies = d->next;
-			
-			cookies_remove((struct cookie_data *)d);
-			urldb_free_cookie(d);
-			urldb_free_cookie(c);
-		} else {
-			/* replace d with c */
-			c->prev = d->prev;
-			c->next = d->next;
-			if (c->next)
-				c->next->prev = c;
-			else
-				p->cookies_end = c;
-			if (c->prev)
-				c->prev->next = c;
-			else
-				p->cookies = c;
-			
-			cookies_remove((struct cookie_data *)d);
-			urldb_free_cookie(d);
-			
-			cookies_schedule_update((struct cookie_data *)c);
-		}
-	} else {
-		c->prev = p->cookies_end;
-		c->next = NULL;
-		if (p->cookies_end)
-			p->cookies_end->next = c;
-		else
-			p->cookies = c;
-		p->cookies_end = c;
+	if (d) {
+		if (c->expires != -1 && c->expires < now) {
+			/* remove cookie */
+			urldb_unlink_cookie(d);
+			urldb_cookie_journal_write(COOKIE_RECORD_DELETE, d);
+
+			cookies_remove((struct cookie_data *)d);
+			urldb_free_cookie(d);
+			urldb_free_cookie(c);
+		} else {
+			/* replace d with c */
+			c->prev = d->prev;
+			c->next = d->next;
+			if (c->next)
+				c->next->prev = c;
+			else
+				p->cookies_end = c;
+			if (c->prev)
+				c->prev->next = c;
+			else
+				p->cookies = c;
+			c->owner = p;
+			urldb_expiry_insert(c);
+
+			/* A session cookie replacing a persistent one must
+			 * not be outlived by it */
+			urldb_cookie_journal_write(c->expires == -1 ?
+					COOKIE_RECORD_DELETE :
+					COOKIE_RECORD_SET, c);
+
+			urldb_expiry_remove(d);
+			cookies_remove((struct cookie_data *)d);
+			urldb_free_cookie(d);
+			
+			cookies_schedule_update((struct cookie_data *)c);
+		}
+	} else {
+		c->prev = p->cookies_end;
+		c->next = NULL;
+		if (p->cookies_end)
+			p->cookies_end->next = c;
+		else
+			p->cookies = c;
+		p->cookies_end = c;
+		c->owner = p;
+		urldb_expiry_insert(c);
+
+		if (c->expires != -1 && c->expires >= now)
+			urldb_cookie_journal_write(COOKIE_RECORD_SET, c);
+
+		cookies_schedule_update((struct cookie_data *)c);
+	}
+
+	return true;
+}
+
+/**
+ * Remove a cookie from the database, without freeing it
+ *
+ * \param c Cookie to remove
+ */
+void urldb_unlink_cookie(struct cookie_internal_data *c)
+{
+	struct path_data *p = c->owner;
+
+	assert(p);
+
+	if (c->prev)
+		c->prev->next = c->next;
+	else
+		p->cookies = c->next;
+
+	if (c->next)
+		c->next->prev = c->prev;
+	else
+		p->cookies_end = c->prev;
+
+	urldb_expiry_remove(c);
+}
+
+/**
+ * Add a cookie to the expiry heap, if it is not a session cookie
+ *
+ * If the heap cannot be extended the cookie is left out of it, and will
+ * only be ignored, rather than removed, once it expires.
+ *
+ * \param c Cookie to add
+ */
+void urldb_expiry_insert(struct cookie_internal_data *c)
+{
+	c->expiry_index = -1;
+
+	if (c->expires == -1)
+		return;
+
+	if (cookie_expiry.used == cookie_expiry.alloc) {
+		int alloc = cookie_expiry.alloc ? cookie_expiry.alloc * 2 : 64;
+		struct cookie_internal_data **heap;
+
+		heap = realloc(cookie_expiry.heap, alloc * sizeof(*heap));
+		if (heap == NULL)
+			return;
+
+		cookie_expiry.heap = heap;
+		cookie_expiry.alloc = alloc;
+	}
+
+	c->expiry_index = cookie_expiry.used++;
+	cookie_expiry.heap[c->expiry_index] = c;
+
+	urldb_expiry_sift(c->expiry_index);
+}
+
+/**
+ * Remove a cookie from the expiry heap
+ *
+ * \param c Cookie to remove
+ */
+void urldb_expiry_remove(struct cookie_internal_data *c)
+{
+	struct cookie_internal_data *last;
+	int i = c->expiry_index;
+
+	if (i < 0)
+		return;
+
+	c->expiry_index = -1;
+
+	last = cookie_expiry.heap[--cookie_expiry.used];
+	if (last != c) {
+		cookie_expiry.heap[i] = last;
+		last->expiry_index = i;
+
+		urldb_expiry_sift(i);
+	}
+}
+
+/**
+ * Restore the ordering of the expiry heap around a changed entry
+ *
+ * \param i Index of entry
+ */
+void urldb_expiry_sift(int i)
+{
+	struct cookie_internal_data **heap = cookie_expiry.heap;
+	struct cookie_internal_data *c = heap[i];
+	int child;
+
+	/* Sift up */
+	while (i > 0 && heap[(i - 1) / 2]->expires > c->expires) {
+		heap[i] = heap[(i - 1) / 2];
+		heap[i]->expiry_index = i;
+		i = (i - 1) / 2;
+	}
+
+	/* Sift down */
+	while ((child = 2 * i + 1) < cookie_expiry.used) {
+		if (child + 1 < cookie_expiry.used &&
+				heap[child + 1]->expires < heap[child]->expires)
+			child++;
+
+		if (heap[child]->expires >= c->expires)
+			break;
+
+		heap[i] = heap[child];
+		heap[i]->expiry_index = i;
+		i = child;
+	}
+
+	heap[i] = c;
+	c->expiry_index = i;
+}
+
+/**
+ * Remove all cookies which have expired from the database
+ *
+ * \param now Current time
+ */
+void urldb_expire_cookies(time_t now)
+{
+	struct cookie_internal_data *c;
+
+	while (cookie_expiry.used > 0 &&
+			cookie_expiry.heap[0]->expires < now) {
+		c = cookie_expiry.heap[0];
+
+		urldb_unlink_cookie(c);
+		cookie_generation++;
+
+		cookies_remove((struct cookie_data *) c);
+		urldb_free_cookie(c);
+	}
+}
+
+/**
+ * Find the Cookie header cache entry for an URL
+ *
+ * \param p Path data of URL
+ * \param include_http_only Whether HttpOnly cookies are included
+ * \return Cache entry, which may hold the header for another URL
+ */
+struct cookie_cache_entry *urldb_cookie_cache_entry(
+		const struct path_data *p, bool include_http_only)
+{
+	uintptr_t hash = (uintptr_t) p;
 
-		cookies_schedule_update((struct cookie_data *)c);
+	hash ^= hash >> 7;
+	hash ^= hash >> 13;
+
+	return &cookie_cache[((hash << 1) | include_http_only) %
+			COOKIE_CACHE_SIZE];
+}
+
+/**
+ * Empty the Cookie header cache
+ */
+void urldb_cookie_cache_flush(void)
+{
+	int i;
+
+	for (i = 0; i < COOKIE_CACHE_SIZE; i++) {
+		free(cookie_cache[i].header);
+		free(cookie_cache[i].cookies);
 	}
 
-	return true;
+	memset(cookie_cache, 0, sizeof(cookie_cache));
 }
 
 /**
@@ -3586,18 +5279,46 @@ bool urldb_concat_cookie(struct cookie_internal_data *c, int version,
 /**
  * Load a cookie file into the database
  *
+ * The file's journal of changes is replayed on top of it, and is then
+ * opened so that subsequent changes are appended to it.
+ *
  * \param filename File to load
  */
 void urldb_load_cookies(const char *filename)
 {
+	uint32_t magic;
 	FILE *fp;
-	char s[16*1024];
 
 	assert(filename);
 
-	fp = fopen(filename, "r");
-	if (!fp)
-		return;
+	urldb_cookie_journal_close();
+
+	fp = fopen(filename, "rb");
+	if (fp != NULL) {
+		if (fread(&magic, sizeof magic, 1, fp) == 1 &&
+				magic == COOKIE_FILE_MAGIC) {
+			urldb_load_cookie_records(fp);
+		} else {
+			rewind(fp);
+			urldb_load_cookies_text(fp);
+		}
+
+		fclose(fp);
+	}
+
+	urldb_cookie_journal_open(filename);
+}
+
+/**
+ * Load cookies from a text cookie file, as written by old versions
+ *
+ * \param fp File to load from
+ */
+void urldb_load_cookies_text(FILE *fp)
+{
+	char s[16*1024];
+
+	assert(fp);
 
 #define FIND_T {							\
 		for (; *p && *p != '\t'; p++)				\
@@ -3715,41 +5436,347 @@ void urldb_load_cookies(const char *filename)
 			break;
 		}
 
-		if (c->domain[0] != '.') {
-			lwc_string *scheme_lwc = NULL;
-			nsurl *url_nsurl = NULL;
+		assert(c->domain[0] == '.' || scheme[0] != 'u');
+
+		/* And insert it into database */
+		if (!urldb_insert_loaded_cookie(c, url)) {
+			/* Cookie freed for us */
+			break;
+		}
+	}
 
-			assert(scheme[0] != 'u');
+#undef SKIP_T
+#undef FIND_T
+}
 
-			if (nsurl_create(url, &url_nsurl) != NSERROR_OK) {
-				urldb_free_cookie(c);
+/**
+ * Insert a cookie read from file into the database
+ *
+ * \param c The cookie to insert
+ * \param url URL associated with cookie, if not a domain cookie
+ * \return true on success, false on failure (c will be freed)
+ */
+bool urldb_insert_loaded_cookie(struct cookie_internal_data *c,
+		const char *url)
+{
+	lwc_string *scheme_lwc;
+	nsurl *url_nsurl;
+	bool ret;
+
+	if (c->domain[0] == '.')
+		return urldb_insert_cookie(c, NULL, NULL);
+
+	if (nsurl_create(url, &url_nsurl) != NSERROR_OK) {
+		urldb_free_cookie(c);
+		return false;
+	}
+	scheme_lwc = nsurl_get_component(url_nsurl, NSURL_SCHEME);
+
+	ret = urldb_insert_cookie(c, scheme_lwc, url_nsurl);
+
+	nsurl_unref(url_nsurl);
+	lwc_string_unref(scheme_lwc);
+
+	return ret;
+}
+
+/**
+ * Apply the records of a binary cookie file or journal to the database
+ *
+ * \param fp File to read from, positioned after the magic word
+ * \return Number of records applied
+ */
+int urldb_load_cookie_records(FILE *fp)
+{
+	struct cookie_file_record r;
+	const char *str[COOKIE_RECORD_STRINGS];
+	char *buf = NULL;
+	size_t buf_alloc = 0;
+	time_t now = time(NULL);
+	int count = 0;
+
+	/* A truncated final record is the result of a crash; ignore it */
+	while (fread(&r, sizeof r, 1, fp) == 1) {
+		struct cookie_internal_data *c;
+		size_t len = 0;
+		int i;
+
+		/* Strings are each followed by a terminator */
+		for (i = 0; i < COOKIE_RECORD_STRINGS; i++) {
+			if (r.len[i] > COOKIE_RECORD_MAX_STRING)
 				break;
-			}
-			scheme_lwc = nsurl_get_component(url_nsurl,
-					NSURL_SCHEME);
-
-			/* And insert it into database */
-			if (!urldb_insert_cookie(c, scheme_lwc, url_nsurl)) {
-				/* Cookie freed for us */
-				nsurl_unref(url_nsurl);
-				lwc_string_unref(scheme_lwc);
+			len += (size_t) r.len[i] + 1;
+		}
+		if (i != COOKIE_RECORD_STRINGS) {
+			LOG(("Invalid cookie record"));
+			break;
+		}
+
+		if (len > buf_alloc) {
+			char *temp = realloc(buf, len);
+			if (temp == NULL)
 				break;
-			}
-			nsurl_unref(url_nsurl);
-			lwc_string_unref(scheme_lwc);
+			buf = temp;
+			buf_alloc = len;
+		}
+
+		if (fread(buf, len, 1, fp) != 1)
+			break;
+
+		for (i = 0, len = 0; i < COOKIE_RECORD_STRINGS; i++) {
+			str[i] = buf + len;
+			len += (size_t) r.len[i] + 1;
+			buf[len - 1] = '\0';
+		}
+
+		count++;
+
+		/* A cookie which has expired since it was written must also
+		 * remove any earlier record of it, such as one in the main
+		 * file that the journal's record was to replace */
+		if (r.op == COOKIE_RECORD_DELETE || r.expires < (int64_t) now) {
+			urldb_delete_cookie(str[COOKIE_STRING_DOMAIN],
+					str[COOKIE_STRING_PATH],
+					str[COOKIE_STRING_NAME]);
+			continue;
+		}
+
+		c = malloc(sizeof(struct cookie_internal_data));
+		if (!c)
+			break;
+
+		c->name = strdup(str[COOKIE_STRING_NAME]);
+		c->value = strdup(str[COOKIE_STRING_VALUE]);
+		c->value_was_quoted = r.flags & COOKIE_RECORD_VALUE_QUOTED;
+		c->comment = strdup(str[COOKIE_STRING_COMMENT]);
+		c->domain_from_set = r.flags & COOKIE_RECORD_DOMAIN_FROM_SET;
+		c->domain = strdup(str[COOKIE_STRING_DOMAIN]);
+		c->path_from_set = r.flags & COOKIE_RECORD_PATH_FROM_SET;
+		c->path = strdup(str[COOKIE_STRING_PATH]);
+		c->expires = (time_t) r.expires;
+		c->last_used = (time_t) r.last_used;
+		c->secure = r.flags & COOKIE_RECORD_SECURE;
+		c->http_only = r.flags & COOKIE_RECORD_HTTP_ONLY;
+		c->version = r.version;
+		c->no_destroy = r.flags & COOKIE_RECORD_NO_DESTROY;
+
+		if (!(c->name && c->value && c->comment &&
+				c->domain && c->path)) {
+			urldb_free_cookie(c);
+			break;
+		}
+
+		if (!urldb_insert_loaded_cookie(c, str[COOKIE_STRING_URL]))
+			/* Cookie freed for us */
+			break;
+	}
+
+	free(buf);
+
+	return count;
+}
+
+/**
+ * Write a cookie record to a binary cookie file or journal
+ *
+ * \param fp File to write to
+ * \param op COOKIE_RECORD_SET to write the cookie, or COOKIE_RECORD_DELETE
+ *           to write its removal
+ * \param c Cookie to write
+ * \return true on success, false on error
+ */
+bool urldb_write_cookie_record(FILE *fp, uint32_t op,
+		const struct cookie_internal_data *c)
+{
+	struct cookie_file_record r;
+	const char *str[COOKIE_RECORD_STRINGS];
+	const struct path_data *p = c->owner;
+	int i;
+
+	memset(&r, 0, sizeof(r));
+
+	r.op = op;
+
+	str[COOKIE_STRING_NAME] = c->name;
+	str[COOKIE_STRING_DOMAIN] = c->domain;
+	str[COOKIE_STRING_PATH] = c->path;
+
+	if (op == COOKIE_RECORD_DELETE) {
+		str[COOKIE_STRING_VALUE] = "";
+		str[COOKIE_STRING_COMMENT] = "";
+		str[COOKIE_STRING_SCHEME] = "";
+		str[COOKIE_STRING_URL] = "";
+	} else {
+		r.expires = (int64_t) c->expires;
+		r.last_used = (int64_t) c->last_used;
+		r.version = c->version;
+		r.flags = (c->value_was_quoted ?
+					COOKIE_RECORD_VALUE_QUOTED : 0) |
+				(c->domain_from_set ?
+					COOKIE_RECORD_DOMAIN_FROM_SET : 0) |
+				(c->path_from_set ?
+					COOKIE_RECORD_PATH_FROM_SET : 0) |
+				(c->secure ? COOKIE_RECORD_SECURE : 0) |
+				(c->http_only ? COOKIE_RECORD_HTTP_ONLY : 0) |
+				(c->no_destroy ? COOKIE_RECORD_NO_DESTROY : 0);
+
+		str[COOKIE_STRING_VALUE] = c->value;
+		str[COOKIE_STRING_COMMENT] = c->comment ? c->comment : "";
+		str[COOKIE_STRING_SCHEME] = (p && p->scheme) ?
+				lwc_string_data(p->scheme) : "unused";
+		str[COOKIE_STRING_URL] = (p && p->url) ?
+				nsurl_access(p->url) : "unused";
+	}
+
+	for (i = 0; i < COOKIE_RECORD_STRINGS; i++) {
+		size_t len = strlen(str[i]);
+
+		/* Such a cookie could not be read back */
+		if (len > COOKIE_RECORD_MAX_STRING)
+			return false;
+
+		r.len[i] = len;
+	}
+
+	if (fwrite(&r, sizeof r, 1, fp) != 1)
+		return false;
+
+	for (i = 0; i < COOKIE_RECORD_STRINGS; i++) {
+		if (fwrite(str[i], r.len[i] + 1, 1, fp) != 1)
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * Set the cookie file which the journal belongs to
+ *
+ * Any existing journal is closed first.
+ *
+ * \param filename Name of cookie file
+ * \return true on success, false on memory exhaustion
+ */
+bool urldb_cookie_journal_set_file(const char *filename)
+{
+	urldb_cookie_journal_close();
+
+	cookie_file_name = strdup(filename);
+	cookie_journal_name = malloc(strlen(filename) +
+			SLEN(URL_FILE_SUFFIX_SEP "journal") + 1);
+	if (cookie_file_name == NULL || cookie_journal_name == NULL) {
+		urldb_cookie_journal_close();
+		return false;
+	}
+
+	sprintf(cookie_journal_name, "%s" URL_FILE_SUFFIX_SEP "journal",
+			filename);
+
+	return true;
+}
 
+/**
+ * Replay and open the journal for a cookie file
+ *
+ * \param filename Name of cookie file
+ */
+void urldb_cookie_journal_open(const char *filename)
+{
+	uint32_t magic;
+	FILE *fp;
+
+	if (!urldb_cookie_journal_set_file(filename))
+		return;
+
+	fp = fopen(cookie_journal_name, "rb");
+	if (fp != NULL) {
+		if (fread(&magic, sizeof magic, 1, fp) == 1 &&
+				magic == COOKIE_JOURNAL_MAGIC) {
+			cookie_journal_records = urldb_load_cookie_records(fp);
 		} else {
-			if (!urldb_insert_cookie(c, NULL, NULL)) {
-				/* Cookie freed for us */
-				break;
-			}
+			LOG(("Ignoring invalid cookie journal"));
+			fclose(fp);
+			fp = NULL;
 		}
 	}
 
-#undef SKIP_T
-#undef FIND_T
+	if (fp != NULL) {
+		fclose(fp);
+		cookie_journal = fopen(cookie_journal_name, "ab");
+	} else {
+		cookie_journal = fopen(cookie_journal_name, "wb");
+		if (cookie_journal != NULL) {
+			magic = COOKIE_JOURNAL_MAGIC;
+			fwrite(&magic, sizeof magic, 1, cookie_journal);
+		}
+	}
 
-	fclose(fp);
+	if (cookie_journal == NULL)
+		LOG(("Failed to open cookie journal '%s'",
+				cookie_journal_name));
+}
+
+/**
+ * Close the cookie journal
+ */
+void urldb_cookie_journal_close(void)
+{
+	if (cookie_journal_compact_scheduled) {
+		schedule_remove(urldb_cookie_journal_compact, NULL);
+		cookie_journal_compact_scheduled = false;
+	}
+
+	if (cookie_journal != NULL) {
+		fclose(cookie_journal);
+		cookie_journal = NULL;
+	}
+
+	free(cookie_journal_name);
+	cookie_journal_name = NULL;
+	free(cookie_file_name);
+	cookie_file_name = NULL;
+	cookie_journal_records = 0;
+}
+
+/**
+ * Merge the cookie journal into the file it belongs to
+ *
+ * \param p Unused
+ */
+void urldb_cookie_journal_compact(void *p)
+{
+	cookie_journal_compact_scheduled = false;
+
+	if (cookie_file_name != NULL)
+		urldb_save_cookies(cookie_file_name);
+}
+
+/**
+ * Append a change to a persistent cookie to the journal
+ *
+ * Once the journal has grown large enough, merging it into the cookie
+ * file is scheduled, rather than rewriting the file while a cookie is
+ * being changed.
+ *
+ * \param op COOKIE_RECORD_SET or COOKIE_RECORD_DELETE
+ * \param c Cookie which has changed
+ */
+void urldb_cookie_journal_write(uint32_t op,
+		const struct cookie_internal_data *c)
+{
+	if (cookie_journal == NULL)
+		return;
+
+	if (!urldb_write_cookie_record(cookie_journal, op, c))
+		LOG(("Failed writing cookie journal"));
+
+	fflush(cookie_journal);
+
+	if (++cookie_journal_records >= COOKIE_JOURNAL_MAX_RECORDS &&
+			cookie_journal_compact_scheduled == false) {
+		cookie_journal_compact_scheduled = true;
+		schedule(0, urldb_cookie_journal_compact, NULL);
+	}
 }
 
 /**
@@ -3790,15 +5817,10 @@ void urldb_delete_cookie_paths(const char *domain, const char *path,
 			if (strcmp(c->domain, domain) == 0 && 
 					strcmp(c->path, path) == 0 &&
 					strcmp(c->name, name) == 0) {
-				if (c->prev)
-					c->prev->next = c->next;
-				else
-					p->cookies = c->next;
-
-				if (c->next)
-					c->next->prev = c->prev;
-				else
-					p->cookies_end = c->prev;
+				urldb_unlink_cookie(c);
+				cookie_generation++;
+				urldb_cookie_journal_write(
+						COOKIE_RECORD_DELETE, c);
 
 				cookies_remove((struct cookie_data *)c);
 				urldb_free_cookie(c);
@@ -3825,38 +5847,93 @@ void urldb_delete_cookie_paths(const char *domain, const char *path,
 /**
  * Save persistent cookies to file
  *
+ * The file is written alongside the existing one and moved into place.
+ * The journal is emptied, and if it belonged to a different file it is
+ * removed and a journal for this file is started in its place, so that
+ * it is only ever replayed on top of the file it was written against.
+ *
  * \param filename Path to save to
  */
 void urldb_save_cookies(const char *filename)
 {
+	uint32_t magic = COOKIE_FILE_MAGIC;
+	char *temp;
+	bool error;
 	FILE *fp;
-	int cookie_file_version = max(loaded_cookie_file_version, 
-			COOKIE_FILE_VERSION);
 
 	assert(filename);
 
-	fp = fopen(filename, "w");
-	if (!fp)
+	temp = malloc(strlen(filename) + SLEN(URL_FILE_SUFFIX_SEP "new") + 1);
+	if (!temp)
+		return;
+
+	sprintf(temp, "%s" URL_FILE_SUFFIX_SEP "new", filename);
+
+	fp = fopen(temp, "wb");
+	if (!fp) {
+		LOG(("Failed to open file '%s' for writing", temp));
+		free(temp);
 		return;
+	}
 
-	fprintf(fp, "# >%s\n", filename);
-	fprintf(fp, "# NetSurf cookies file.\n"
-		    "#\n"
-		    "# Lines starting with a '#' are comments, "
-						"blank lines are ignored.\n"
-		    "#\n"
-		    "# All lines prior to \"Version:\t%d\" are discarded.\n"
-		    "#\n"
-		    "# Version\tDomain\tDomain from Set-Cookie\tPath\t"
-			"Path from Set-Cookie\tSecure\tHTTP-Only\tExpires\tLast used\t"
-			"No destroy\tName\tValue\tValue was quoted\tScheme\t"
-			"URL\tComment\n",
-			cookie_file_version);
-	fprintf(fp, "Version:\t%d\n", cookie_file_version);
+	error = fwrite(&magic, sizeof magic, 1, fp) != 1;
 
 	urldb_save_cookie_hosts(fp, &db_root);
 
-	fclose(fp);
+	if (ferror(fp))
+		error = true;
+
+	if (fclose(fp) != 0)
+		error = true;
+
+	if (error) {
+		LOG(("Failed writing cookie file '%s'", temp));
+		remove(temp);
+		free(temp);
+		return;
+	}
+
+	if (rename(temp, filename) != 0) {
+		/* Some platforms won't replace an existing file */
+		remove(filename);
+		if (rename(temp, filename) != 0) {
+			LOG(("Failed to replace '%s'", filename));
+			remove(temp);
+			free(temp);
+			return;
+		}
+	}
+
+	free(temp);
+
+	if (cookie_file_name == NULL)
+		return;
+
+	if (strcmp(filename, cookie_file_name) != 0) {
+		/* The old journal was written against the other file */
+		remove(cookie_journal_name);
+		if (!urldb_cookie_journal_set_file(filename))
+			return;
+	}
+
+	/* Everything in the journal is now in the file */
+	if (cookie_journal != NULL)
+		fclose(cookie_journal);
+	cookie_journal_records = 0;
+	if (cookie_journal_compact_scheduled) {
+		schedule_remove(urldb_cookie_journal_compact, NULL);
+		cookie_journal_compact_scheduled = false;
+	}
+
+	cookie_journal = fopen(cookie_journal_name, "wb");
+	magic = COOKIE_JOURNAL_MAGIC;
+	if (cookie_journal != NULL) {
+		fwrite(&magic, sizeof magic, 1, cookie_journal);
+		fflush(cookie_journal);
+	} else {
+		LOG(("Failed to open cookie journal '%s'",
+				cookie_journal_name));
+	}
 }
 
 /**
@@ -3898,21 +5975,8 @@ void urldb_save_cookie_paths(FILE *fp, struct path_data *parent)
 					/* Skip expired & session cookies */
 					continue;
 
-				fprintf(fp, 
-					"%d\t%s\t%d\t%s\t%d\t%d\t%d\t%d\t%d\t%d\t"
-					"%s\t%s\t%d\t%s\t%s\t%s\n",
-					c->version, c->domain,
-					c->domain_from_set, c->path,
-					c->path_from_set, c->secure,
-					c->http_only,
-					(int)c->expires, (int)c->last_used,
-					c->no_destroy, c->name, c->value,
-					c->value_was_quoted,
-					p->scheme ? lwc_string_data(p->scheme) :
-							"unused",
-					p->url ? nsurl_access(p->url) :
-							"unused",
-					c->comment ? c->comment : "");
+				urldb_write_cookie_record(fp,
+						COOKIE_RECORD_SET, c);
 			}
 		}
 
@@ -3944,13 +6008,31 @@ void urldb_destroy(void)
 	for (i = 0; i < NUM_SEARCH_TREES; i++) {
 		if (search_trees[i] != &empty)
 			urldb_destroy_search_tree(search_trees[i]);
+		search_trees[i] = &empty;
 	}
 
+	/* Host hash entries are owned by the host tree */
+	hash_destroy(host_hash);
+	host_hash = NULL;
+
+	urldb_completion_destroy(&completion_root);
+
+	/* Cookies are owned by the path trees */
+	urldb_cookie_cache_flush();
+	free(cookie_expiry.heap);
+	memset(&cookie_expiry, 0, sizeof(cookie_expiry));
+
 	/* And database */
 	for (a = db_root.children; a; a = b) {
 		b = a->next;
 		urldb_destroy_host_tree(a);
 	}
+	db_root.children = NULL;
+
+	/* Hosts referring to the URL file are gone, so it can go too */
+	urldb_release_url_file();
+	urldb_journal_close();
+	urldb_cookie_journal_close();
 }
 
 /**
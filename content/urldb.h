@@ -109,6 +109,8 @@ void urldb_iterate_partial(const char *prefix,
 /* Iteration */
 void urldb_iterate_entries(bool (*callback)(nsurl *url,
 		const struct url_data *data));
+void urldb_iterate_entries_transient(bool (*callback)(nsurl *url,
+		const struct url_data *data));
 void urldb_iterate_cookies(bool (*callback)(const struct cookie_data *cookie));
 
 /* Debug */
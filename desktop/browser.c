@@ -61,9 +61,11 @@
 #include "render/textplain.h"
 #include "render/html.h"
 #include "render/box.h"
+#include "utils/corestrings.h"
 #include "utils/log.h"
 #include "utils/messages.h"
 #include "utils/nsurl.h"
+#include "utils/ring.h"
 #include "utils/schedule.h"
 #include "utils/url.h"
 #include "utils/utils.h"
@@ -75,6 +77,9 @@ bool browser_reformat_pending;
 /** maximum frame depth */
 #define FRAME_DEPTH 8
 
+/** Ring of all root browser windows */
+static struct browser_window *browser_window_ring = NULL;
+
 static nserror browser_window_callback(hlcache_handle *c,
 		const hlcache_event *event, void *pw);
 static void browser_window_refresh(void *p);
@@ -85,6 +90,8 @@ static void browser_window_start_throbber(struct browser_window *bw);
 static void browser_window_stop_throbber(struct browser_window *bw);
 static void browser_window_destroy_children(struct browser_window *bw);
 static void browser_window_destroy_internal(struct browser_window *bw);
+static void browser_window_cancel_prefetch(struct browser_window *bw,
+		nsurl *keep);
 static void browser_window_set_scale_internal(struct browser_window *bw,
 		float scale);
 static void browser_window_find_target_internal(struct browser_window *bw,
@@ -266,8 +273,10 @@ bool browser_window_redraw(struct browser_window *bw, int x, int y,
 	}
  
 	/* Render the content */
+	TRACE_BEGIN(NSLOG_TRACE_REDRAW, bw);
 	plot_ok &= content_redraw(bw->current_content, &data,
 			&content_clip, &new_ctx);
+	TRACE_END(NSLOG_TRACE_REDRAW, bw);
 
 	/* Back to full clip rect */
 	new_ctx.plot->clip(clip);
@@ -686,6 +695,50 @@ void browser_window_debug_dump(struct browser_window *bw, FILE *f)
 }
 
 
+/* exported interface, documented in browser.h */
+struct browser_window *browser_window_get_next_root(struct browser_window *bw)
+{
+	if (bw == NULL)
+		return browser_window_ring;
+
+	assert(bw->parent == NULL);
+
+	if (bw->r_next == browser_window_ring)
+		return NULL;
+
+	return bw->r_next;
+}
+
+
+/* exported interface, documented in browser.h */
+void browser_window_get_memory_usage(struct browser_window *bw,
+		struct content_memory_usage *usage)
+{
+	int i;
+
+	if (bw->current_content != NULL)
+		content_get_memory_usage(bw->current_content, usage);
+
+	if (bw->loading_content != NULL)
+		content_get_memory_usage(bw->loading_content, usage);
+
+	if (bw->current_favicon != NULL)
+		content_get_memory_usage(bw->current_favicon, usage);
+
+	if (bw->children != NULL) {
+		for (i = 0; i < (bw->rows * bw->cols); i++)
+			browser_window_get_memory_usage(&bw->children[i],
+					usage);
+	}
+
+	if (bw->iframes != NULL) {
+		for (i = 0; i < bw->iframe_count; i++)
+			browser_window_get_memory_usage(&bw->iframes[i],
+					usage);
+	}
+}
+
+
 /* exported interface, documented in desktop/browser.h */
 
 nserror
@@ -708,6 +761,8 @@ browser_window_create(enum browser_window_nav_flags flags,
 		return NSERROR_NOMEM;
 	}
 
+	RING_INSERT(browser_window_ring, bw);
+
 	/* new javascript context for window */
 	bw->jsctx = js_newcontext();
 
@@ -945,6 +1000,10 @@ nserror browser_window_navigate(struct browser_window *bw,
 		}
 	}
 
+	/* Leave any speculative fetch of the target running, so the
+	 * new retrieval can pick it up from the cache */
+	browser_window_cancel_prefetch(bw, url);
+
 	browser_window_stop(bw);
 	browser_window_remove_caret(bw, false);
 	browser_window_destroy_children(bw);
@@ -1163,6 +1222,159 @@ static void browser_window_update_favicon(hlcache_handle *c,
 	nsurl_unref(nsurl);
 }
 
+/**
+ * Callback for speculative fetches made on behalf of a browser window.
+ *
+ * The data fetched is left in the low-level cache, so once the fetch has
+ * finished, successfully or not, the window simply forgets about it.
+ */
+static nserror browser_window_prefetch_callback(llcache_handle *handle,
+		const llcache_event *event, void *pw)
+{
+	struct browser_window *bw = pw;
+	int i;
+
+	if (event->type != LLCACHE_EVENT_DONE &&
+			event->type != LLCACHE_EVENT_ERROR)
+		return NSERROR_OK;
+
+	for (i = 0; i < bw->prefetch_count; i++) {
+		if (bw->prefetch[i].handle == handle)
+			break;
+	}
+	assert(i < bw->prefetch_count);
+
+	LOG(("prefetch of '%s' %s", nsurl_access(bw->prefetch[i].url),
+			event->type == LLCACHE_EVENT_DONE ? "done" : "failed"));
+
+	llcache_handle_release(handle);
+	nsurl_unref(bw->prefetch[i].url);
+
+	bw->prefetch[i] = bw->prefetch[--bw->prefetch_count];
+
+	return NSERROR_OK;
+}
+
+
+/**
+ * Note a page which the loading content hints will be needed next.
+ *
+ * The fetch is not started until the hinting content has finished loading,
+ * so that it does not compete with the content's own objects.
+ *
+ * \param bw	browser window
+ * \param c	content the hint came from
+ * \param link	rfc5988 link with a rel of prefetch
+ */
+static void browser_window_queue_prefetch(struct browser_window *bw,
+		hlcache_handle *c, struct content_rfc5988_link *link)
+{
+	lwc_string *scheme;
+	bool match = false;
+	int i;
+
+	if (nsoption_bool(enable_prefetch) == false)
+		return;
+
+	if (bw->prefetch_count == BROWSER_WINDOW_MAX_PREFETCH)
+		return;
+
+	/* Only prefetch over http(s), where the result can be cached */
+	scheme = nsurl_get_component(link->href, NSURL_SCHEME);
+	if (scheme == NULL)
+		return;
+
+	if ((lwc_string_isequal(scheme, corestring_lwc_http, 
+			&match) != lwc_error_ok || match == false) &&
+	    (lwc_string_isequal(scheme, corestring_lwc_https, 
+			&match) != lwc_error_ok || match == false)) {
+		lwc_string_unref(scheme);
+		return;
+	}
+	lwc_string_unref(scheme);
+
+	if (nsurl_compare(link->href, hlcache_handle_get_url(c),
+			NSURL_COMPLETE))
+		return;
+
+	for (i = 0; i < bw->prefetch_count; i++) {
+		if (nsurl_compare(link->href, bw->prefetch[i].url,
+				NSURL_COMPLETE))
+			return;
+	}
+
+	bw->prefetch[bw->prefetch_count].url = nsurl_ref(link->href);
+	bw->prefetch[bw->prefetch_count].handle = NULL;
+	bw->prefetch_count++;
+}
+
+
+/**
+ * Start the speculative fetches queued for a browser window.
+ *
+ * \param bw	browser window
+ * \param c	content which requested the fetches
+ */
+static void browser_window_start_prefetch(struct browser_window *bw,
+		hlcache_handle *c)
+{
+	nsurl *referer = NULL;
+	nserror error;
+	int i = 0;
+
+	if (nsoption_bool(send_referer))
+		referer = hlcache_handle_get_url(c);
+
+	while (i < bw->prefetch_count) {
+		if (bw->prefetch[i].handle != NULL) {
+			i++;
+			continue;
+		}
+
+		LOG(("prefetching '%s'", nsurl_access(bw->prefetch[i].url)));
+
+		error = llcache_handle_retrieve(bw->prefetch[i].url,
+				LLCACHE_RETRIEVE_SPECULATIVE, referer, NULL,
+				browser_window_prefetch_callback, bw,
+				&bw->prefetch[i].handle);
+		if (error != NSERROR_OK) {
+			/* Forget about it */
+			nsurl_unref(bw->prefetch[i].url);
+			bw->prefetch[i] = bw->prefetch[--bw->prefetch_count];
+			continue;
+		}
+
+		i++;
+	}
+}
+
+
+/**
+ * Cancel a browser window's speculative fetches.
+ *
+ * \param bw	browser window
+ * \param keep	URL being navigated to, whose fetch is left to complete
+ *		into the cache, or NULL to abort all fetches
+ */
+static void browser_window_cancel_prefetch(struct browser_window *bw,
+		nsurl *keep)
+{
+	int i;
+
+	for (i = 0; i < bw->prefetch_count; i++) {
+		if (bw->prefetch[i].handle != NULL) {
+			if (keep == NULL || nsurl_compare(keep,
+					bw->prefetch[i].url,
+					NSURL_COMPLETE) == false)
+				llcache_handle_abort(bw->prefetch[i].handle);
+			llcache_handle_release(bw->prefetch[i].handle);
+		}
+		nsurl_unref(bw->prefetch[i].url);
+	}
+
+	bw->prefetch_count = 0;
+}
+
 /** window callback errorcode handling */
 static void 
 browser_window_callback_errorcode(hlcache_handle *c,
@@ -1311,6 +1523,7 @@ nserror browser_window_callback(hlcache_handle *c,
 		browser_window_set_status(bw, content_get_status_message(c));
 		browser_window_stop_throbber(bw);
 		browser_window_update_favicon(c, bw, NULL);
+		browser_window_start_prefetch(bw, c);
 
 		history_update(bw->history, c);
 		hotlist_visited(c);
@@ -1432,6 +1645,13 @@ nserror browser_window_callback(hlcache_handle *c,
 			/* it's a favicon perhaps start a fetch for it */
 			browser_window_update_favicon(c, bw,
 					event->data.rfc5988_link);
+		} else if (lwc_string_caseless_isequal(
+				event->data.rfc5988_link->rel,
+				corestring_lwc_prefetch, 
+				&icon_match) == lwc_error_ok && icon_match) {
+			/* the page expects to be followed by this one */
+			browser_window_queue_prefetch(bw, c,
+					event->data.rfc5988_link);
 		}
 	}
 		break;
@@ -1899,6 +2119,8 @@ void browser_window_stop(struct browser_window *bw)
 
 	schedule_remove(browser_window_refresh, bw);
 
+	browser_window_cancel_prefetch(bw, NULL);
+
 	if (bw->children) {
 		children = bw->rows * bw->cols;
 		for (index = 0; index < children; index++)
@@ -2065,6 +2287,8 @@ void browser_window_destroy(struct browser_window *bw)
 	/* can't destoy child windows on their own */
 	assert(!bw->parent);
 
+	RING_REMOVE(browser_window_ring, bw);
+
 	/* destroy */
 	browser_window_destroy_internal(bw);
 	free(bw);
@@ -2176,8 +2400,10 @@ void browser_window_destroy_internal(struct browser_window *bw)
 		bw->current_favicon = NULL;
 	}
 
+	browser_window_cancel_prefetch(bw, NULL);
+
 	if (bw->box != NULL) {
-		bw->box->iframe = NULL;
+		bw->box->extra->iframe = NULL;
 		bw->box = NULL;
 	}
 
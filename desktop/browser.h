@@ -344,6 +344,25 @@ char * browser_window_get_selection(struct browser_window *bw);
  */
 void browser_window_debug_dump(struct browser_window *bw, FILE *f);
 
+/**
+ * Iterate over the root browser windows
+ *
+ * \param  bw    The previous root browser window, or NULL to get the first
+ * \return the next root browser window, or NULL if there are no more
+ */
+struct browser_window *browser_window_get_next_root(struct browser_window *bw);
+
+/**
+ * Accumulate the memory used by the contents of a browser window
+ *
+ * Includes the contents of any frames and iframes within the window.
+ *
+ * \param  bw     The browser window
+ * \param  usage  Memory usage record to add the window's usage to
+ */
+void browser_window_get_memory_usage(struct browser_window *bw,
+		struct content_memory_usage *usage);
+
 
 /* In platform specific hotlist.c. */
 void hotlist_visited(struct hlcache_handle *c);
@@ -28,15 +28,21 @@
 
 #include "desktop/browser.h"
 
+/** Maximum number of speculative fetches per browser window */
+#define BROWSER_WINDOW_MAX_PREFETCH 4
 
 struct box;
 struct hlcache_handle;
+struct llcache_handle;
 struct gui_window;
 struct history;
 struct selection;
 
 /** Browser window data. */
 struct browser_window {
+	/** Ring of root browser windows; NULL for child windows. */
+	struct browser_window *r_next, *r_prev;
+
 	/** Page currently displayed, or 0. Must have status READY or DONE. */
 	struct hlcache_handle *current_content;
 	/** Page being loaded, or 0. */
@@ -49,6 +55,14 @@ struct browser_window {
 	/** favicon fetch already failed - prevents infinite error looping */
 	bool failed_favicon;
 
+	/** Speculative fetches of pages hinted by the loading content */
+	struct {
+		nsurl *url; /**< URL to fetch */
+		struct llcache_handle *handle; /**< Fetch, or NULL if queued */
+	} prefetch[BROWSER_WINDOW_MAX_PREFETCH];
+	/** Number of used entries in prefetch */
+	int prefetch_count;
+
 	/** Window history structure. */
 	struct history *history;
 
@@ -52,21 +52,142 @@ enum tree_element_cookie {
 	TREE_ELEMENT_VALUE = 0x09,
 };
 
+/** Number of buckets in the domain and pending change hash tables */
+#define COOKIES_HASH_SIZE 1021
+
+/** Delay before pending changes are applied to the tree, in cs */
+#define COOKIES_UPDATE_DELAY 10
+
+/** Domain folder in the cookie tree */
+struct cookies_domain {
+	const char *domain;		/**< Domain, the title of node */
+	struct node *node;		/**< Folder node for the domain */
+	unsigned int hash;		/**< Hash of domain */
+	struct cookies_domain *next;	/**< Next domain in hash chain */
+};
+
+/** Change to a cookie waiting to be applied to the tree */
+struct cookies_change {
+	const char *domain;		/**< Domain of the cookie */
+	const char *path;		/**< Path of the cookie */
+	const char *name;		/**< Name of the cookie */
+	/** Cookie to show, or NULL to remove the cookie's node */
+	const struct cookie_data *data;
+	unsigned int hash;		/**< Hash of domain, path and name */
+	struct cookies_change *next;	/**< Next change in batch order */
+	struct cookies_change *hash_next; /**< Next change in hash chain */
+};
+
 static struct tree *cookies_tree;
 static struct node *cookies_tree_root;
 static bool user_delete;
 static hlcache_handle *folder_icon;
 static hlcache_handle *cookie_icon;
 
+/** Domain folders, hashed by domain */
+static struct cookies_domain *cookies_domains[COOKIES_HASH_SIZE];
+
+/** Pending changes, hashed by domain, path and name */
+static struct cookies_change *cookies_changes[COOKIES_HASH_SIZE];
+static struct cookies_change *cookies_changes_first;
+static struct cookies_change *cookies_changes_last;
+
+
+/**
+ * Hash a string, continuing from a previous hash
+ *
+ * \param hash	  Hash of preceding data, or 0
+ * \param string  String to hash
+ * \return Updated hash
+ */
+static unsigned int cookies_hash(unsigned int hash, const char *string)
+{
+	for (; *string != '\0'; string++)
+		hash = hash * 31 + (unsigned char) *string;
+
+	return hash;
+}
+
+
+/**
+ * Find the folder for a domain in the cookie tree
+ *
+ * \param domain  Domain to find
+ * \return Domain folder, or NULL if not found
+ */
+static struct cookies_domain *cookies_find_domain(const char *domain)
+{
+	struct cookies_domain *d;
+	unsigned int hash = cookies_hash(0, domain);
+
+	for (d = cookies_domains[hash % COOKIES_HASH_SIZE]; d; d = d->next) {
+		if (d->hash == hash && strcmp(d->domain, domain) == 0)
+			return d;
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Forget a domain folder, as it is being deleted
+ *
+ * \param d  Domain folder to forget
+ */
+static void cookies_remove_domain(struct cookies_domain *d)
+{
+	struct cookies_domain **link;
+
+	for (link = &cookies_domains[d->hash % COOKIES_HASH_SIZE];
+			*link != NULL; link = &(*link)->next) {
+		if (*link == d) {
+			*link = d->next;
+			break;
+		}
+	}
+
+	free(d);
+}
+
+
+/**
+ * Determine whether a cookie's entry in the cookie tree is for a path
+ *
+ * \param node The cookie's node
+ * \param path The path to check for
+ * \return true if the cookie has the path, false otherwise
+ */
+static bool cookies_node_has_path(struct node *node, const char *path)
+{
+	struct node_element *element;
+	const char *path_t;
+	size_t len = strlen(path);
+
+	element = tree_node_find_element(node, TREE_ELEMENT_PATH, NULL);
+	if (element == NULL)
+		return false;
+
+	/* the path is followed by nothing, or by the TreeHeaders text */
+	path_t = tree_node_element_get_text(element) +
+			strlen(messages_get("TreePath")) - 4;
+
+	return strncmp(path_t, path, len) == 0 &&
+			(path_t[len] == '\0' || path_t[len] == ' ');
+}
 
 /**
  * Find an entry in the cookie tree
  *
+ * Cookies are identified by domain, path and name, so a domain folder may
+ * hold several cookies of the same name.
+ *
  * \param node the node to check the children of
  * \param title The title to find
+ * \param path The path of the cookie to find
  * \return Pointer to node, or NULL if not found
  */
-static struct node *cookies_find(struct node *node, const char *title)
+static struct node *cookies_find(struct node *node, const char *title,
+		const char *path)
 {
 	struct node *search;
 	struct node_element *element;
@@ -77,7 +198,8 @@ static struct node *cookies_find(struct node *node, const char *title)
 	     search = tree_node_get_next(search)) {
 		element = tree_node_find_element(search, TREE_ELEMENT_TITLE,
 						 NULL);
-		if (strcmp(title, tree_node_element_get_text(element)) == 0)
+		if (strcmp(title, tree_node_element_get_text(element)) == 0 &&
+				cookies_node_has_path(search, path))
 			return search;
 	}
 	return NULL;
@@ -103,8 +225,11 @@ static node_callback_resp cookies_node_callback(void *user_data, struct node_msg
 		return NODE_CALLBACK_NOT_HANDLED;
 
 	/* check if it's a domain folder */
-	if (is_folder)
+	if (is_folder) {
+		if (msg_data->flag == TREE_ELEMENT_TITLE && user_data != NULL)
+			cookies_remove_domain(user_data);
 		return NODE_CALLBACK_NOT_HANDLED;
+	}
 
 	switch (msg_data->flag) {
 	case TREE_ELEMENT_TITLE:
@@ -322,51 +447,188 @@ static struct node *cookies_create_cookie_node(struct node *parent,
 
 
 /**
- * Called when scheduled event gets fired. Actually performs the update.
+ * Find or create the folder for a domain in the cookie tree
+ *
+ * \param domain  Domain to find
+ * \return Folder node, or NULL on memory exhaustion
  */
-static void cookies_schedule_callback(const void *scheduled_data)
+static struct node *cookies_get_domain_node(const char *domain)
 {
-	const struct cookie_data *data = scheduled_data;
-	struct node *node = NULL;
-	struct node *cookie_node = NULL;
+	struct cookies_domain *d;
+	struct node *node;
 	char *domain_cp;
 
-	assert(data != NULL);
+	d = cookies_find_domain(domain);
+	if (d != NULL)
+		return d->node;
 
-	node = cookies_find(cookies_tree_root, data->domain);
+	d = malloc(sizeof(struct cookies_domain));
+	domain_cp = strdup(domain);
+	if (d == NULL || domain_cp == NULL) {
+		LOG(("malloc failed"));
+		warn_user("NoMemory", 0);
+		free(domain_cp);
+		free(d);
+		return NULL;
+	}
 
+	/* ownership of domain_cp passed to tree, if node creation
+	 * does not fail */
+	node = tree_create_folder_node(cookies_tree, cookies_tree_root,
+				       domain_cp, false, false, false);
 	if (node == NULL) {
-		domain_cp = strdup(data->domain);
-		if (domain_cp == NULL) {
-			LOG(("malloc failed"));
-			warn_user("NoMemory", 0);
+		free(domain_cp);
+		free(d);
+		return NULL;
+	}
+
+	d->domain = domain_cp;
+	d->node = node;
+	d->hash = cookies_hash(0, domain);
+	d->next = cookies_domains[d->hash % COOKIES_HASH_SIZE];
+	cookies_domains[d->hash % COOKIES_HASH_SIZE] = d;
+
+	tree_set_node_user_callback(node, cookies_node_callback, d);
+	tree_set_node_icon(cookies_tree, node, folder_icon);
+
+	return node;
+}
+
+
+/**
+ * Apply a pending change to the cookie tree
+ *
+ * \param change  The change to apply
+ */
+static void cookies_apply_change(struct cookies_change *change)
+{
+	struct cookies_domain *d;
+	struct node *node;
+	struct node *cookie_node;
+
+	if (change->data == NULL) {
+		d = cookies_find_domain(change->domain);
+		if (d == NULL)
 			return;
-		}
-		/* ownership of domain_cp passed to tree, if node creation
-		 * does not fail */
-		node = tree_create_folder_node(cookies_tree,
-					       cookies_tree_root, domain_cp,
-					       false, false, false);
-		if (node != NULL) {
-			tree_set_node_user_callback(node, cookies_node_callback,
-						    NULL);
-			tree_set_node_icon(cookies_tree, node, folder_icon);
-
-		} else {
-			free(domain_cp);
-		}
+
+		cookie_node = cookies_find(d->node, change->name,
+				change->path);
+		if (cookie_node != NULL)
+			tree_delete_node(cookies_tree, cookie_node, false);
+		return;
 	}
 
+	node = cookies_get_domain_node(change->data->domain);
 	if (node == NULL)
 		return;
 
-	cookie_node = cookies_find(node, data->name);
+	cookie_node = cookies_find(node, change->data->name,
+			change->data->path);
 	if (cookie_node == NULL)
-		cookies_create_cookie_node(node, data);
+		cookies_create_cookie_node(node, change->data);
 	else
-		cookies_update_cookie_node(cookie_node, data);
+		cookies_update_cookie_node(cookie_node, change->data);
+}
+
+
+/**
+ * Called when scheduled event gets fired. Applies all pending changes to
+ * the tree at once.
+ *
+ * \param p  Unused
+ */
+static void cookies_schedule_callback(void *p)
+{
+	struct cookies_change *change, *next;
+	bool needs_redraw;
 
-	return;
+	change = cookies_changes_first;
+	if (change == NULL)
+		return;
+
+	cookies_changes_first = cookies_changes_last = NULL;
+	memset(cookies_changes, 0, sizeof(cookies_changes));
+
+	needs_redraw = tree_get_redraw(cookies_tree);
+	if (needs_redraw)
+		tree_set_redraw(cookies_tree, false);
+
+	for (; change != NULL; change = next) {
+		next = change->next;
+		cookies_apply_change(change);
+		free(change);
+	}
+
+	if (needs_redraw)
+		tree_set_redraw(cookies_tree, true);
+}
+
+
+/**
+ * Queue a change to a cookie, replacing any change already pending for it
+ *
+ * \param domain  Domain of cookie
+ * \param path	  Path of cookie
+ * \param name	  Name of cookie
+ * \return The pending change for the cookie, or NULL on memory exhaustion
+ */
+static struct cookies_change *cookies_queue_change(const char *domain,
+		const char *path, const char *name)
+{
+	struct cookies_change *change;
+	unsigned int hash;
+	size_t domain_len, path_len, name_len;
+	char *strings;
+
+	hash = cookies_hash(cookies_hash(cookies_hash(0, domain), path), name);
+
+	for (change = cookies_changes[hash % COOKIES_HASH_SIZE];
+			change != NULL; change = change->hash_next) {
+		if (change->hash == hash &&
+				strcmp(change->domain, domain) == 0 &&
+				strcmp(change->path, path) == 0 &&
+				strcmp(change->name, name) == 0)
+			return change;
+	}
+
+	domain_len = strlen(domain) + 1;
+	path_len = strlen(path) + 1;
+	name_len = strlen(name) + 1;
+
+	change = malloc(sizeof(struct cookies_change) + domain_len +
+			path_len + name_len);
+	if (change == NULL) {
+		LOG(("malloc failed"));
+		warn_user("NoMemory", 0);
+		return NULL;
+	}
+
+	/* Copy the strings, as the cookie may be freed before the change
+	 * is applied */
+	strings = (char *) (change + 1);
+	memcpy(strings, domain, domain_len);
+	memcpy(strings + domain_len, path, path_len);
+	memcpy(strings + domain_len + path_len, name, name_len);
+
+	change->domain = strings;
+	change->path = strings + domain_len;
+	change->name = strings + domain_len + path_len;
+	change->data = NULL;
+	change->hash = hash;
+	change->next = NULL;
+	change->hash_next = cookies_changes[hash % COOKIES_HASH_SIZE];
+	cookies_changes[hash % COOKIES_HASH_SIZE] = change;
+
+	if (cookies_changes_last != NULL)
+		cookies_changes_last->next = change;
+	else
+		cookies_changes_first = change;
+	cookies_changes_last = change;
+
+	if (cookies_changes_first == change)
+		schedule(COOKIES_UPDATE_DELAY, cookies_schedule_callback, NULL);
+
+	return change;
 }
 
 /**
@@ -392,6 +654,8 @@ bool cookies_initialise(struct tree *tree, const char* folder_icon_name, const c
 
 	user_delete = false;
 	urldb_iterate_cookies(cookies_schedule_update);
+	schedule_remove(cookies_schedule_callback, NULL);
+	cookies_schedule_callback(NULL);
 	tree_set_node_expanded(cookies_tree, cookies_tree_root,
 			       false, true, true);
 
@@ -413,11 +677,17 @@ unsigned int cookies_get_tree_flags(void)
 /* exported interface documented in cookies.h */
 bool cookies_schedule_update(const struct cookie_data *data)
 {
+	struct cookies_change *change;
+
 	assert(data != NULL);
 	assert(user_delete == false);
 
-	if (cookies_tree_root != NULL)
-		cookies_schedule_callback(data);
+	if (cookies_tree_root == NULL)
+		return true;
+
+	change = cookies_queue_change(data->domain, data->path, data->name);
+	if (change != NULL)
+		change->data = data;
 
 	return true;
 }
@@ -426,10 +696,17 @@ bool cookies_schedule_update(const struct cookie_data *data)
 /* exported interface documented in cookies.h */
 void cookies_remove(const struct cookie_data *data)
 {
+	struct cookies_change *change;
+
 	assert(data != NULL);
 
-	if (cookies_tree_root != NULL)
-		cookies_schedule_callback(data);
+	if (cookies_tree_root == NULL)
+		return;
+
+	/* A cookie replacing this one may already be pending */
+	change = cookies_queue_change(data->domain, data->path, data->name);
+	if (change != NULL && change->data == data)
+		change->data = NULL;
 }
 
 
@@ -438,6 +715,16 @@ void cookies_remove(const struct cookie_data *data)
  */
 void cookies_cleanup(void)
 {
+	struct cookies_change *change, *next;
+
+	schedule_remove(cookies_schedule_callback, NULL);
+	for (change = cookies_changes_first; change != NULL; change = next) {
+		next = change->next;
+		free(change);
+	}
+	cookies_changes_first = cookies_changes_last = NULL;
+	memset(cookies_changes, 0, sizeof(cookies_changes));
+
 	hlcache_handle_release(folder_icon);
 	hlcache_handle_release(cookie_icon);
 }
@@ -229,7 +229,7 @@ void browser_window_create_iframes(struct browser_window *bw,
 		/* linking */
 		window->box = cur->box;
 		window->parent = bw;
-		window->box->iframe = window;
+		window->box->extra->iframe = window;
 
 		/* iframe dimensions */
 		box_bounds(window->box, &rect);
@@ -35,11 +35,39 @@
 #define MAXIMUM_BASE_NODES 16
 #define GLOBAL_HISTORY_RECENT_URLS 16
 #define URL_CHUNK_LENGTH 512
+#define GLOBAL_HISTORY_HASH_INITIAL_SIZE 1024
+
+/**
+ * An URL in the global history.
+ *
+ * Tree nodes for the URLs in a grouping node are only created when the
+ * grouping node is first expanded (or deleted); until then its entries
+ * are kept in a list.
+ */
+struct history_global_entry {
+	nsurl *url;			/**< URL of entry */
+	int base;			/**< Index of grouping node */
+	struct node *node;		/**< Tree node, or NULL if deferred */
+	struct history_global_entry *prev;	/**< Previous deferred entry */
+	struct history_global_entry *next;	/**< Next deferred entry */
+	struct history_global_entry *hash_next;	/**< Next in hash chain */
+};
 
 static struct node *global_history_base_node[MAXIMUM_BASE_NODES];
 static int global_history_base_node_time[MAXIMUM_BASE_NODES];
 static int global_history_base_node_count = 0;
 
+/** Whether the tree nodes of each grouping node's entries exist */
+static bool global_history_base_node_populated[MAXIMUM_BASE_NODES];
+/** Entries of each grouping node awaiting creation of their tree nodes */
+static struct history_global_entry *global_history_deferred[MAXIMUM_BASE_NODES];
+static struct history_global_entry *global_history_deferred_last[MAXIMUM_BASE_NODES];
+
+/** Hash table of all entries, keyed on URL */
+static struct history_global_entry **global_history_hash;
+static unsigned int global_history_hash_size;
+static unsigned int global_history_hash_count;
+
 static bool global_history_initialised;
 
 static struct tree *global_history_tree;
@@ -62,25 +90,212 @@ static const char *const weekday_msg_name [] =
  * Find an entry in the global history
  *
  * \param url The URL to find
- * \return Pointer to node, or NULL if not found
+ * \return Pointer to entry, or NULL if not found
  */
-static struct node *history_global_find(const char *url)
+static struct history_global_entry *history_global_find(nsurl *url)
 {
-	int i;
-	struct node *node;
-	const char *text;
+	struct history_global_entry *entry;
 
-	for (i = 0; i < global_history_base_node_count; i++) {
-		if (!tree_node_is_deleted(global_history_base_node[i])) {
-			node = tree_node_get_child(global_history_base_node[i]);
-			for (; node != NULL; node = tree_node_get_next(node)) {
-				text = tree_url_node_get_url(node);
-				if ((text != NULL) && !strcmp(url, text))
-					return node;
+	if (global_history_hash_size == 0)
+		return NULL;
+
+	entry = global_history_hash[nsurl_hash(url) &
+				    (global_history_hash_size - 1)];
+	for (; entry != NULL; entry = entry->hash_next) {
+		if (strcmp(nsurl_access(entry->url), nsurl_access(url)) == 0)
+			return entry;
+	}
+	return NULL;
+}
+
+/**
+ * Create a global history entry and add it to the hash table
+ *
+ * \param url The URL of the entry
+ * \return Pointer to entry, or NULL on memory exhaustion
+ */
+static struct history_global_entry *history_global_create_entry(nsurl *url)
+{
+	struct history_global_entry *entry, *next;
+	unsigned int i, bucket;
+
+	if (global_history_hash_count >= global_history_hash_size) {
+		/* Grow the table, keeping chains short */
+		unsigned int size = global_history_hash_size ?
+				global_history_hash_size * 2 :
+				GLOBAL_HISTORY_HASH_INITIAL_SIZE;
+		struct history_global_entry **hash;
+
+		hash = calloc(size, sizeof(*hash));
+		if (hash == NULL) {
+			LOG(("malloc failed"));
+			if (global_history_hash_size == 0)
+				return NULL;
+		} else {
+			for (i = 0; i < global_history_hash_size; i++) {
+				for (entry = global_history_hash[i]; entry;
+				     entry = next) {
+					next = entry->hash_next;
+					bucket = nsurl_hash(entry->url)
+							& (size - 1);
+					entry->hash_next = hash[bucket];
+					hash[bucket] = entry;
+				}
 			}
+			free(global_history_hash);
+			global_history_hash = hash;
+			global_history_hash_size = size;
 		}
 	}
-	return NULL;
+
+	entry = calloc(1, sizeof(*entry));
+	if (entry == NULL) {
+		LOG(("malloc failed"));
+		return NULL;
+	}
+
+	entry->url = nsurl_ref(url);
+
+	bucket = nsurl_hash(url) & (global_history_hash_size - 1);
+	entry->hash_next = global_history_hash[bucket];
+	global_history_hash[bucket] = entry;
+	global_history_hash_count++;
+
+	return entry;
+}
+
+/**
+ * Append an entry to the deferred entries of its grouping node
+ *
+ * \param entry The entry
+ */
+static void history_global_defer(struct history_global_entry *entry)
+{
+	entry->next = NULL;
+	entry->prev = global_history_deferred_last[entry->base];
+	if (entry->prev != NULL)
+		entry->prev->next = entry;
+	else
+		global_history_deferred[entry->base] = entry;
+	global_history_deferred_last[entry->base] = entry;
+
+	tree_set_node_deferred(global_history_base_node[entry->base], true);
+}
+
+/**
+ * Remove an entry from the deferred entries of its grouping node
+ *
+ * \param entry The entry
+ */
+static void history_global_undefer(struct history_global_entry *entry)
+{
+	if (entry->prev != NULL)
+		entry->prev->next = entry->next;
+	else
+		global_history_deferred[entry->base] = entry->next;
+	if (entry->next != NULL)
+		entry->next->prev = entry->prev;
+	else
+		global_history_deferred_last[entry->base] = entry->prev;
+	entry->prev = entry->next = NULL;
+
+	if (global_history_deferred[entry->base] == NULL)
+		tree_set_node_deferred(global_history_base_node[entry->base],
+				false);
+}
+
+/**
+ * Remove an entry from the global history and free it
+ *
+ * \param entry The entry, whose tree node must not exist or be being deleted
+ */
+static void history_global_destroy_entry(struct history_global_entry *entry)
+{
+	struct history_global_entry **link;
+
+	if (entry->prev != NULL ||
+	    global_history_deferred[entry->base] == entry)
+		history_global_undefer(entry);
+
+	link = &global_history_hash[nsurl_hash(entry->url) &
+				    (global_history_hash_size - 1)];
+	while (*link != entry)
+		link = &(*link)->hash_next;
+	*link = entry->hash_next;
+	global_history_hash_count--;
+
+	nsurl_unref(entry->url);
+	free(entry);
+}
+
+/**
+ * Callback for the nodes of global history entries.
+ */
+static node_callback_resp
+history_global_entry_callback(void *user_data,
+			      struct node_msg_data *msg_data)
+{
+	struct history_global_entry *entry = user_data;
+
+	/* Entries are freed by history_global_cleanup before the tree */
+	if (msg_data->msg == NODE_DELETE_ELEMENT_TXT &&
+	    msg_data->flag == TREE_ELEMENT_TITLE &&
+	    global_history_tree != NULL)
+		history_global_destroy_entry(entry);
+
+	return tree_url_node_callback(NULL, msg_data);
+}
+
+/**
+ * Create the tree node of an entry, at the bottom of its grouping node
+ *
+ * \param entry The entry, which is freed on failure
+ * \param data URL data associated with entry
+ */
+static void history_global_create_node(struct history_global_entry *entry,
+				       const struct url_data *data)
+{
+	entry->node = tree_create_URL_node_readonly(global_history_tree,
+			global_history_base_node[entry->base], entry->url,
+			data, history_global_entry_callback, entry);
+	if (entry->node == NULL)
+		history_global_destroy_entry(entry);
+}
+
+/**
+ * Create the tree nodes of the deferred entries of a grouping node
+ *
+ * \param base Index of grouping node
+ */
+static void history_global_populate(int base)
+{
+	struct history_global_entry *entry;
+	const struct url_data *data;
+	bool redraw_needed;
+
+	if (global_history_base_node_populated[base])
+		return;
+	global_history_base_node_populated[base] = true;
+
+	if (global_history_deferred[base] == NULL)
+		return;
+
+	redraw_needed = tree_get_redraw(global_history_tree);
+	if (redraw_needed)
+		tree_set_redraw(global_history_tree, false);
+
+	while ((entry = global_history_deferred[base]) != NULL) {
+		history_global_undefer(entry);
+
+		data = urldb_get_url_data(entry->url);
+		if (data == NULL)
+			history_global_destroy_entry(entry);
+		else
+			history_global_create_node(entry, data);
+	}
+
+	if (redraw_needed)
+		tree_set_redraw(global_history_tree, true);
 }
 
 /**
@@ -88,14 +303,14 @@ static struct node *history_global_find(const char *url)
  *
  * \param url The URL to add
  * \param data URL data associated with URL
- * \return true (for urldb_iterate_entries)
+ * \return true (for urldb_iterate_entries_transient)
  */
 static bool global_history_add_internal(nsurl *url, const struct url_data *data)
 {
 	int i, j;
 	struct node *parent = NULL;
 	struct node *link;
-	struct node *node;
+	struct history_global_entry *entry = NULL;
 	bool before = false;
 	int visit_date;
 
@@ -137,22 +352,35 @@ static bool global_history_add_internal(nsurl *url, const struct url_data *data)
 	}
 
 	/* find any previous occurance */
-	if (global_history_initialised == false) {
-		node = history_global_find(nsurl_access(url));
-		if (node != NULL) {
-			tree_update_URL_node(global_history_tree,
-					     node, url, data);
-			tree_delink_node(global_history_tree, node);
-			tree_link_node(global_history_tree, parent, node,
-				       false);
+	if (global_history_initialised == false)
+		entry = history_global_find(url);
+
+	if (entry != NULL && entry->node != NULL) {
+		tree_update_URL_node(global_history_tree,
+				     entry->node, url, data);
+		tree_delink_node(global_history_tree, entry->node);
+		tree_link_node(global_history_tree, parent, entry->node,
+			       false);
+		entry->base = i;
+		return true;
+	}
+
+	if (entry != NULL) {
+		history_global_undefer(entry);
+	} else {
+		entry = history_global_create_entry(url);
+		if (entry == NULL)
 			return true;
-		}
 	}
 
-	/* Add the node at the bottom */
-	node = tree_create_URL_node_readonly(global_history_tree,
-					   parent, url, data,
-					   tree_url_node_callback, NULL);
+	entry->base = i;
+
+	if (global_history_base_node_populated[i]) {
+		/* Add the node at the bottom */
+		history_global_create_node(entry, data);
+	} else {
+		history_global_defer(entry);
+	}
 
 	return true;
 }
@@ -161,6 +389,11 @@ static node_callback_resp
 history_global_node_callback(void *user_data,
 			     struct node_msg_data *msg_data)
 {
+	if (msg_data->msg == NODE_POPULATE) {
+		history_global_populate((struct node **) user_data -
+					global_history_base_node);
+		return NODE_CALLBACK_HANDLED;
+	}
 	if (msg_data->msg == NODE_DELETE_ELEMENT_IMG)
 		return NODE_CALLBACK_HANDLED;
 	return NODE_CALLBACK_NOT_HANDLED;
@@ -202,7 +435,8 @@ static bool history_global_initialise_node(const char *title,
 	}
 	if (folder_icon != NULL)
 		tree_set_node_icon(global_history_tree, node, folder_icon);
-	tree_set_node_user_callback(node, history_global_node_callback, NULL);
+	tree_set_node_user_callback(node, history_global_node_callback,
+			&global_history_base_node[global_history_base_node_count]);
 
 	global_history_base_node[global_history_base_node_count] = node;
 	global_history_base_node_time[global_history_base_node_count] = base;
@@ -290,7 +524,7 @@ bool history_global_initialise(struct tree *tree, const char* folder_icon_name)
 	LOG(("Building history tree"));
 
 	global_history_initialised = true;
-	urldb_iterate_entries(global_history_add_internal);
+	urldb_iterate_entries_transient(global_history_add_internal);
 	global_history_initialised = false;
 	tree_set_node_expanded(global_history_tree, global_history_tree_root,
 			       false, true, true);
@@ -315,6 +549,29 @@ unsigned int history_global_get_tree_flags(void)
  */
 void history_global_cleanup(void)
 {
+	struct history_global_entry *entry, *next;
+	unsigned int i;
+
+	for (i = 0; i < global_history_hash_size; i++) {
+		for (entry = global_history_hash[i]; entry; entry = next) {
+			next = entry->hash_next;
+			nsurl_unref(entry->url);
+			free(entry);
+		}
+	}
+	free(global_history_hash);
+	global_history_hash = NULL;
+	global_history_hash_size = 0;
+	global_history_hash_count = 0;
+
+	for (i = 0; i < MAXIMUM_BASE_NODES; i++) {
+		global_history_deferred[i] = NULL;
+		global_history_deferred_last[i] = NULL;
+		global_history_base_node_populated[i] = false;
+	}
+
+	global_history_tree = NULL;
+
 	hlcache_handle_release(folder_icon);
 	tree_url_node_cleanup();
 }
@@ -346,6 +603,11 @@ void global_history_add(nsurl *url)
  */
 bool history_global_export(const char *path)
 {
+	int i;
+
+	for (i = 0; i < global_history_base_node_count; i++)
+		history_global_populate(i);
+
 	return tree_urlfile_save(global_history_tree, path, "NetSurf history");
 }
 
@@ -255,10 +255,18 @@ int netsurf_main_loop(void)
 
 /**
  * Clean up components used by gui NetSurf.
+ *
+ * If NETSURF_TRACE is set in the environment, the trace recorded by
+ * nslog_trace_record() is first written to the file it names.
  */
 
 void netsurf_exit(void)
 {
+	const char *trace = getenv("NETSURF_TRACE");
+
+	if (trace != NULL && nslog_trace_dump(trace) != NSERROR_OK)
+		LOG(("Unable to write trace to %s", trace));
+
 	hlcache_stop();
 	
 	LOG(("Closing GUI"));
@@ -79,6 +79,8 @@
 	int minimum_gif_delay;					\
 	/** Whether to send the referer HTTP header */		\
 	bool send_referer;					\
+	/** Whether to fetch pages hinted by link rel=prefetch */	\
+	bool enable_prefetch;					\
 	/** Whether to fetch foreground images */		\
 	bool foreground_images;					\
 	/** Whether to fetch background images */		\
@@ -228,6 +230,7 @@
 	.do_not_track = false,				\
 	.minimum_gif_delay = 10,			\
 	.send_referer = true,				\
+	.enable_prefetch = true,			\
 	.foreground_images = true,			\
 	.background_images = true,			\
 	.animate_images = true,				\
@@ -324,6 +327,7 @@
 	{ "do_not_track", OPTION_BOOL,	&nsoptions.do_not_track },	\
 	{ "minimum_gif_delay",	OPTION_INTEGER,	&nsoptions.minimum_gif_delay },	\
 	{ "send_referer",	OPTION_BOOL,	&nsoptions.send_referer }, \
+	{ "enable_prefetch",	OPTION_BOOL,	&nsoptions.enable_prefetch }, \
 	{ "foreground_images",	OPTION_BOOL,	&nsoptions.foreground_images },	\
 	{ "background_images",	OPTION_BOOL,	&nsoptions.background_images },	\
 	{ "animate_images",	OPTION_BOOL,	&nsoptions.animate_images }, \
@@ -50,6 +50,9 @@
 #define TREE_ICON_SIZE 17
 #define NODE_INSTEP 20
 
+/** Number of children above which a folder's children are indexed */
+#define TREE_INDEX_MIN_CHILDREN 32
+
 static int tree_text_size_px;
 static int TREE_LINE_HEIGHT;
 
@@ -126,6 +129,8 @@ struct node_element {
 					 * modified, editable text is deleted
 					 * without noticing the tree user
 					 */
+	bool width_pending;		/**< Whether the text is yet to be
+					   measured */
 };
 
 struct node {
@@ -138,6 +143,9 @@ struct node {
 	bool deleted;			/**< Whether the node is currently
 					   deleted */
 	bool processing;		/**< Internal flag used when moving */
+	bool deferred;			/**< Whether the node has children
+					   which are created when first
+					   needed */
 	struct node_element_box box;	/**< Bounding box of all elements */
 	struct node_element data;	/**< Data to display */
 	struct node *parent;		/**< Parent entry (NULL for root) */
@@ -152,6 +160,9 @@ struct node {
 	tree_node_user_callback user_callback;
 	/** User data to be passed to delete_callback */
 	void *callback_data;
+	/** Children in order, for binary searching by position, or NULL */
+	struct node **index;
+	int index_count;		/**< Number of entries in index */
 };
 
 struct tree {
@@ -171,6 +182,8 @@ struct tree {
 	void *client_data;		/* User assigned data for the
 					   callbacks */
 	struct node *def_folder;	/* Node to be used for additions by default */
+	bool layout_dirty;		/* Node positions and tree size need
+					   recalculating before use */
 };
 
 void tree_set_icon_dir(char *icon_dir)
@@ -287,9 +300,43 @@ struct tree *tree_create(unsigned int flags,
 }
 
 
+/**
+ * Measures the width of some text, caching the last result.
+ *
+ * \param text	   the text to measure
+ * \param fstyle  the style the text is plotted with
+ * \return the width of the text in pixels
+ */
+static int tree_get_text_width(const char *text, plot_font_style_t *fstyle)
+{
+	static char *cache_text = NULL;
+	static int cache_size = 0;
+	static plot_font_style_t *cache_fstyle = NULL;
+
+	if ((cache_text != NULL) &&
+		(strcmp(cache_text, text) == 0) &&
+		(cache_fstyle == fstyle)) {
+		#ifdef TREE_NOISY_DEBUG
+			LOG(("Tree font width cache hit"));
+		#endif
+		return cache_size;
+	}
+
+	if(cache_text != NULL) free(cache_text);
+	nsfont.font_width(fstyle, text, strlen(text), &cache_size);
+	cache_text = strdup(text);
+	cache_fstyle = fstyle;
+
+	return cache_size;
+}
+
+
 /**
  * Recalculates the dimensions of a node element.
  *
+ * While the tree is not being redrawn the width of text is left to be
+ * measured when the element is first drawn or hit tested.
+ *
  * \param tree	   the tree to which the element belongs, may be NULL
  * \param element  the element to recalculate
  */
@@ -298,10 +345,7 @@ static void tree_recalculate_node_element(struct tree *tree,
 {
 	struct bitmap *bitmap = NULL;
 	int width, height;
-	static char *cache_text = NULL;
-	static int cache_size = 0;
 	plot_font_style_t *fstyle;
-	static plot_font_style_t *cache_fstyle = NULL;
 
 	assert(element != NULL);
 
@@ -316,27 +360,16 @@ static void tree_recalculate_node_element(struct tree *tree,
 		if(element->text == NULL)
 			break;
 
+		element->width_pending = false;
 		if (tree != NULL && element == tree->editing) {
 			textarea_get_dimensions(tree->textarea,
 						&element->box.width, NULL);
+		} else if (tree != NULL && !tree->redraw) {
+			element->box.width = 0;
+			element->width_pending = true;
 		} else {
-			if ((cache_text != NULL) &&
-				(strcmp(cache_text, element->text) == 0) &&
-				(cache_fstyle == fstyle)) {
-				element->box.width = cache_size;
-				#ifdef TREE_NOISY_DEBUG
-					LOG(("Tree font width cache hit"));
-				#endif
-			} else {
-				if(cache_text != NULL) free(cache_text);
-				nsfont.font_width(fstyle,
-						  element->text,
-						  strlen(element->text),
-						  &cache_size);
-				element->box.width = cache_size;
-				cache_text = strdup(element->text);
-				cache_fstyle = fstyle;
-			}
+			element->box.width = tree_get_text_width(
+					element->text, fstyle);
 		}
 
 		element->box.width += 8;
@@ -548,8 +581,103 @@ static void tree_recalculate_node_sizes(struct tree *tree, struct node *node,
 		node->box.height = node->data.box.height;
 	}
 
-	if (tree != NULL && height != node->box.height)
-		tree_recalculate_node_positions(tree, tree->root);
+	/* Unlinked nodes are positioned when they are linked */
+	if (tree != NULL && height != node->box.height &&
+	    (node->parent != NULL || node == tree->root)) {
+		if (tree->redraw)
+			tree_recalculate_node_positions(tree, tree->root);
+		else
+			tree->layout_dirty = true;
+	}
+}
+
+
+/**
+ * Measures any text of a node which was left unmeasured when the node was
+ * laid out.
+ *
+ * \param tree	the tree to which node belongs
+ * \param node	the node to measure
+ */
+static void tree_measure_node(struct tree *tree, struct node *node)
+{
+	struct node_element *element;
+	bool measured = false;
+
+	for (element = &node->data; element != NULL; element = element->next) {
+		if (element->width_pending) {
+			tree_recalculate_node_element(NULL, element);
+			measured = true;
+		}
+	}
+
+	if (measured)
+		tree_recalculate_node_sizes(tree, node, false);
+}
+
+
+/**
+ * Frees the index of a node's children, after they have changed.
+ *
+ * \param node	the node whose children have changed
+ */
+static void tree_invalidate_index(struct node *node)
+{
+	free(node->index);
+	node->index = NULL;
+	node->index_count = 0;
+}
+
+
+/**
+ * Finds the child of an expanded node displayed at a given y coordinate.
+ * Folders with many children have an index of them built, so the search
+ * takes logarithmic time.
+ *
+ * \param node	the node to search the children of
+ * \param y	the y coordinate, in tree coordinates
+ * \return the last child starting above y, or the first child if none do
+ */
+static struct node *tree_find_child_at(struct node *node, int y)
+{
+	struct node *child;
+	int count, low, high, mid;
+
+	if (node->index == NULL) {
+		count = 0;
+		for (child = node->child; child != NULL; child = child->next)
+			count++;
+
+		if (count >= TREE_INDEX_MIN_CHILDREN)
+			node->index = malloc(count * sizeof(struct node *));
+
+		if (node->index == NULL) {
+			/* Few enough children to walk, or no memory */
+			child = node->child;
+			while (child != NULL && child->next != NULL &&
+			       child->next->box.y < y)
+				child = child->next;
+			return child;
+		}
+
+		node->index_count = 0;
+		for (child = node->child; child != NULL; child = child->next)
+			node->index[node->index_count++] = child;
+	}
+
+	/* Children are positioned in order, so their y coordinates are
+	 * sorted */
+	low = 0;
+	high = node->index_count - 1;
+	while (low < high) {
+		mid = (low + high + 1) / 2;
+		if (node->index[mid]->box.y < y)
+			low = mid;
+		else
+			high = mid - 1;
+	}
+
+	return node->index[low];
 }
 
 
@@ -712,6 +840,7 @@ static void tree_sort_insert(struct node *parent, struct node *node)
 		parent->last_child = node;
 
 	node->parent = parent;
+	tree_invalidate_index(parent);
 }
 
 
@@ -737,6 +866,23 @@ static void tree_recalculate_size(struct tree *tree)
 					 tree->client_data);
 }
 
+
+/**
+ * Recalculates the node positions and size of a tree, if changes were made
+ * to it while it was not being redrawn.
+ *
+ * \param tree	the tree to update
+ */
+static void tree_update_layout(struct tree *tree)
+{
+	if (!tree->layout_dirty)
+		return;
+
+	tree->layout_dirty = false;
+	tree_recalculate_node_positions(tree, tree->root);
+	tree_recalculate_size(tree);
+}
+
 /**
  * Recalculate the node data and redraw the relevant section of the tree.
  *
@@ -762,8 +908,13 @@ static void tree_handle_node_changed(struct tree *tree, struct node *node,
 		tree_recalculate_node_sizes(tree, node, true);
 	}
 
-	if (tree != NULL) {
-		if ((node->box.height != node_height) || (expansion)) {
+	if (tree != NULL && !tree->redraw) {
+		/* Nothing is shown, so leave the layout until it's needed */
+		tree->layout_dirty = true;
+	} else if (tree != NULL) {
+		if ((node->box.height != node_height) || (expansion) ||
+		    (tree->layout_dirty)) {
+			tree->layout_dirty = false;
 			tree_recalculate_node_positions(tree, tree->root);
 			tree_recalculate_size(tree);
 			if (tree->width > tree_width)
@@ -855,6 +1006,8 @@ void tree_link_node(struct tree *tree, struct node *link, struct node *node,
 
 	if (sort) {
 		tree_sort_insert(parent, node);
+	} else {
+		tree_invalidate_index(parent);
 	}
 
 	tree_handle_node_changed(tree, link, false, true);
@@ -1040,11 +1193,46 @@ void tree_delink_node(struct tree *tree, struct node *node)
 		node->next->previous = node->previous;
 	node->previous = NULL;
 	node->next = NULL;
+	tree_invalidate_index(parent);
 
 	tree_handle_node_changed(tree, parent, false, true);
 }
 
 
+/**
+ * Asks the user of a node to create any children it has deferred.
+ *
+ * \param node	the node whose children are required
+ */
+static void tree_populate_node(struct node *node)
+{
+	struct node_msg_data msg_data;
+
+	node->deferred = false;
+
+	if (node->user_callback == NULL)
+		return;
+
+	msg_data.msg = NODE_POPULATE;
+	msg_data.flag = TREE_ELEMENT_TITLE;
+	msg_data.node = node;
+	msg_data.data.text = NULL;
+	node->user_callback(node->callback_data, &msg_data);
+}
+
+
+/**
+ * Checks whether a node has children, or will have once populated.
+ *
+ * \param node	the node to check
+ * \return true if the node has children
+ */
+static inline bool tree_node_has_children(struct node *node)
+{
+	return (node->child != NULL) || node->deferred;
+}
+
+
 /**
  * Deletes a node from the tree.
  *
@@ -1071,6 +1259,7 @@ static void tree_delete_node_internal(struct tree *tree, struct node *node,
 		parent = NULL;
 	if ((tree != NULL) && (tree->def_folder == node))
 		tree->def_folder = NULL;
+	tree_populate_node(node);
 	tree_delink_node(tree, node);
 	child = node->child;
 	node->child = NULL;
@@ -1120,6 +1309,7 @@ static void tree_delete_node_internal(struct tree *tree, struct node *node,
 			if (e != &node->data)
 				free(e);
 		}
+		free(node->index);
 		free(node);
 	}
 
@@ -1144,6 +1334,7 @@ void tree_delete(struct tree *tree)
 		tree_delete_node_internal(tree, tree->root->child, true);
 
 	free((void *)tree->root->data.text);
+	free(tree->root->index);
 	free(tree->root);
 	free(tree);
 }
@@ -1178,13 +1369,18 @@ void tree_delete_node(struct tree *tree, struct node *node, bool siblings)
 	tree->redraw = false;
 
 	tree_delete_node_internal(tree, node, siblings);
-	tree_recalculate_node_positions(tree, tree->root);
 
 	tree->redraw = redraw_setting;
 
-	if (tree->redraw)
-		tree->callbacks->redraw_request(0, y,
-				width, height, tree->client_data);
+	if (!tree->redraw) {
+		tree->layout_dirty = true;
+		return;
+	}
+
+	tree->layout_dirty = false;
+	tree_recalculate_node_positions(tree, tree->root);
+	tree->callbacks->redraw_request(0, y,
+			width, height, tree->client_data);
 	tree_recalculate_size(tree);
 }
 
@@ -1252,6 +1448,9 @@ static bool tree_set_node_expanded_internal(struct tree *tree,
 		    ((folder && (node->folder)) ||
 		     (leaf && (!node->folder)) ||
 		     (!folder && !leaf))) {
+			/* Children are cheapest to add while collapsed */
+			if (expanded)
+				tree_populate_node(node);
 			node->expanded = expanded;
 			if (node->child != NULL)
 				tree_set_node_expanded_all(tree,
@@ -1380,9 +1579,24 @@ void tree_set_node_user_callback(struct node *node,
 }
 
 
+/**
+ * Marks a node as having children whose creation is deferred.  The node is
+ * shown as expandable, and its user callback is sent NODE_POPULATE before
+ * it is expanded or deleted.
+ *
+ * \param node	    the node to mark
+ * \param deferred  whether the node has deferred children
+ */
+void tree_set_node_deferred(struct node *node, bool deferred)
+{
+	node->deferred = deferred;
+}
+
+
 /**
  * Sets the redraw property to the given value. If redraw is true, the tree will
- * be redrawn on layout/appearance changes.
+ * be redrawn on layout/appearance changes. While it is false, the layout of
+ * the tree is not kept up to date.
  *
  * \param tree	  the tree for which the property is set
  * \param redraw  the value to set
@@ -1394,6 +1608,12 @@ void tree_set_redraw(struct tree *tree, bool redraw)
 	if (tree->callbacks == NULL)
 		return;
 	tree->redraw = redraw;
+
+	if (redraw && tree->layout_dirty) {
+		tree_update_layout(tree);
+		tree->callbacks->redraw_request(0, 0, tree->width,
+				tree->height, tree->client_data);
+	}
 }
 
 
@@ -1724,7 +1944,7 @@ static void tree_draw_node_expansion_toggle(struct tree *tree,
 	assert(tree != NULL);
 	assert(node != NULL);
 
-	if ((node->child != NULL) || (node->data.next != NULL)) {
+	if (tree_node_has_children(node) || (node->data.next != NULL)) {
 		x = tree_x + node->box.x - (NODE_INSTEP / 2) - 4;
 		y = tree_y + node->box.y + (TREE_LINE_HEIGHT - 9) / 2;
 		plot->rectangle(x, y, x + 9, y + 9,
@@ -2004,7 +2224,10 @@ static void tree_draw_tree(struct tree *tree, struct node *node,
 	assert(tree != NULL);
 	assert(node != NULL);
 
-	for (child = node->child; child != NULL; child = child->next) {
+	/* Skip the children above the clip region */
+	child = tree_find_child_at(node, clip.y0 - tree_y);
+
+	for (; child != NULL; child = child->next) {
 		/* Draw children that are inside the clip region */
 
 		if (child->next != NULL &&
@@ -2017,6 +2240,9 @@ static void tree_draw_tree(struct tree *tree, struct node *node,
 			return;
 
 		/* Draw current child */
+		tree_measure_node(tree, child);
+		if (tree->width < child->box.x + child->box.width)
+			tree->width = child->box.x + child->box.width;
 		tree_draw_node(tree, child, tree_x, tree_y, clip, ctx);
 		/* And its children */
 		if ((child->child != NULL) && (child->expanded)) {
@@ -2045,10 +2271,14 @@ void tree_draw(struct tree *tree, int x, int y,
 {
 	struct redraw_context new_ctx = *ctx;
 	struct rect clip;
+	int width;
 
 	assert(tree != NULL);
 	assert(tree->root != NULL);
 
+	tree_update_layout(tree);
+	width = tree->width;
+
 	/* Start knockout rendering if it's available for this plotter */
 	if (ctx->plot->option_knockout)
 		knockout_plot_start(ctx, &new_ctx);
@@ -2086,6 +2316,11 @@ void tree_draw(struct tree *tree, int x, int y,
 	/* Rendering complete */
 	if (ctx->plot->option_knockout)
 		knockout_plot_end();
+
+	/* Text measured while drawing may have widened the tree */
+	if (tree->width != width)
+		tree->callbacks->resized(tree, tree->width, tree->height,
+					 tree->client_data);
 }
 
 
@@ -2198,21 +2433,28 @@ struct node *tree_get_selected_node(struct node *node)
 /**
  * Finds a node element at a specific location.
  *
+ * \param tree	     the tree to which node belongs
  * \param node	     the root node to check from
  * \param x	     the x co-ordinate
  * \param y	     the y co-ordinate
  * \param expansion_toggle  whether the coordinate was in an expansion toggle
  * \return the node at the specified position, or NULL for none
  */
-static struct node_element *tree_get_node_element_at(struct node *node,
-		int x, int y, bool *expansion_toggle)
+static struct node_element *tree_get_node_element_at(struct tree *tree,
+		struct node *node, int x, int y, bool *expansion_toggle)
 {
 	struct node_element *element;
 	int x0, x1, y0, y1;
 
 	*expansion_toggle = false;
+	if (node != NULL && node->parent != NULL)
+		node = tree_find_child_at(node->parent, y);
+
 	for (; node != NULL; node = node->next) {
 		if (node->box.y > y) return NULL;
+		if ((node->box.y < y) &&
+		    (node->box.y + node->box.height >= y))
+			tree_measure_node(tree, node);
 		if ((node->box.x - NODE_INSTEP < x) && (node->box.y < y) &&
 		    (node->box.x + node->box.width >= x) &&
 		    (node->box.y + node->box.height >= y)) {
@@ -2238,7 +2480,7 @@ static struct node_element *tree_get_node_element_at(struct node *node,
 				    (y1>= y))
 					return &node->data;
 			}
-			if (((node->child != NULL) ||
+			if ((tree_node_has_children(node) ||
 			     (node->data.next != NULL)) &&
 			    (node->data.box.x - NODE_INSTEP + 4 < x)
 			    && (node->data.box.y + 4 < y) &&
@@ -2253,10 +2495,12 @@ static struct node_element *tree_get_node_element_at(struct node *node,
 			}
 		}
 
-		element = tree_get_node_element_at(node->child, x, y,
+		if ((node->child == NULL) || (!node->expanded))
+			continue;
+
+		element = tree_get_node_element_at(tree, node->child, x, y,
 				expansion_toggle);
-		if ((node->child != NULL) && (node->expanded) &&
-		    (element != NULL))
+		if (element != NULL)
 			return element;
 	}
 	return NULL;
@@ -2266,18 +2510,20 @@ static struct node_element *tree_get_node_element_at(struct node *node,
 /**
  * Finds a node at a specific location.
  *
+ * \param tree	     the tree to which root belongs
  * \param root	     the root node to check from
  * \param x	     the x co-ordinate
  * \param y	     the y co-ordinate
  * \param expansion_toggle  whether the coordinate was in an expansion toggle
  * \return the node at the specified position, or NULL for none
  */
-static struct node *tree_get_node_at(struct node *root, int x, int y,
-		bool *expansion_toggle)
+static struct node *tree_get_node_at(struct tree *tree, struct node *root,
+		int x, int y, bool *expansion_toggle)
 {
 	struct node_element *result;
 
-	if ((result = tree_get_node_element_at(root, x, y, expansion_toggle)))
+	if ((result = tree_get_node_element_at(tree, root, x, y,
+			expansion_toggle)))
 		return result->parent;
 	return NULL;
 }
@@ -2301,9 +2547,11 @@ struct node *tree_get_link_details(struct tree *tree, int x, int y,
 	assert(tree != NULL);
 	assert(tree->root != NULL);
 
+	tree_update_layout(tree);
+
 	*before = false;
 	if (tree->root->child != NULL)
-		node = tree_get_node_at(tree->root->child, x, y,
+		node = tree_get_node_at(tree, tree->root->child, x, y,
 				&expansion_toggle);
 	if ((node == NULL) || (expansion_toggle))
 		return tree->root;
@@ -2378,7 +2626,9 @@ void tree_set_node_selected_at(struct tree *tree, int x, int y, bool selected)
 	bool expansion_toggle;
 	struct node *node;
 
-	node = tree_get_node_at(tree->root, x, y, &expansion_toggle);
+	tree_update_layout(tree);
+
+	node = tree_get_node_at(tree, tree->root, x, y, &expansion_toggle);
 
 	if ((node == NULL) || (expansion_toggle == true))
 		return;
@@ -2416,7 +2666,9 @@ bool tree_mouse_action(struct tree *tree, browser_mouse_state mouse, int x,
 	if (tree->root->child == NULL)
 		return true;
 
-	element = tree_get_node_element_at(tree->root->child, x, y,
+	tree_update_layout(tree);
+
+	element = tree_get_node_element_at(tree, tree->root->child, x, y,
 			&expansion_toggle);
 
 	/* pass in-textarea mouse action and drags which started in it
@@ -2482,7 +2734,8 @@ bool tree_mouse_action(struct tree *tree, browser_mouse_state mouse, int x,
 	 * expansion */
 	if (((expansion_toggle) && (mouse & (BROWSER_MOUSE_CLICK_1 |
 			BROWSER_MOUSE_CLICK_2))) ||
-			(((!expansion_toggle) && (node->child != NULL)) &&
+			(((!expansion_toggle) &&
+			tree_node_has_children(node)) &&
 			(double_click_1 || double_click_2))) {
 
 		/* clear any selection */
@@ -2618,6 +2871,9 @@ static void tree_handle_selection_area_node(struct tree *tree,
 
 	y_max = y + height;
 
+	if (node->parent != NULL)
+		node = tree_find_child_at(node->parent, y);
+
 	for (; node != NULL; node = node->next) {
 		if (node->box.y > y_max) return;
 		y0 = node->box.y;
@@ -2819,6 +3075,8 @@ void tree_drag_end(struct tree *tree, browser_mouse_state mouse, int x0, int y0,
 	struct node *node;
 	int x, y;
 
+	tree_update_layout(tree);
+
 	switch (tree->drag) {
 	case TREE_NO_DRAG:
 	case TREE_UNKNOWN_DRAG:
@@ -2964,6 +3222,8 @@ void tree_start_edit(struct tree *tree, struct node_element *element)
 		}
 	}
 
+	tree_update_layout(tree);
+
 	tree->editing = element;
 	tree->callbacks->get_window_dimensions(&width, NULL, tree->client_data);
 	width -= element->box.x;
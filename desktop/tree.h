@@ -83,8 +83,11 @@ typedef enum {
 	NODE_ELEMENT_EDIT_CANCELLED, /**< Editing opperation cancelled.  */
 	NODE_ELEMENT_EDIT_FINISHING, /**< New text has to be accepted
 				      * or rejected.  */
-  	NODE_ELEMENT_EDIT_FINISHED /**< Editing of a node_element has
+  	NODE_ELEMENT_EDIT_FINISHED, /**< Editing of a node_element has
 				    * been finished. */
+	NODE_POPULATE /**< The children of the node are about to be
+		       * shown or deleted, so any whose creation was
+		       * deferred must be created now. */
 } node_msg;
 
 typedef enum {
@@ -163,6 +166,7 @@ void tree_set_node_sort_function(struct tree *tree, struct node *node,
 		int (*sort) (struct node *, struct node *));
 void tree_set_node_user_callback(struct node *node,
 		tree_node_user_callback callback, void *data);
+void tree_set_node_deferred(struct node *node, bool deferred);
 void tree_set_redraw(struct tree *tree, bool redraw);
 bool tree_get_redraw(struct tree *tree);
 bool tree_node_has_selection(struct node *node);
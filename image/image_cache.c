@@ -794,6 +794,17 @@ void *image_cache_get_internal(const struct content *c, void *context)
 	return image_cache_get_bitmap(c);
 }
 
+void image_cache_get_memory_usage(const struct content *c,
+				  struct content_memory_usage *usage)
+{
+	struct image_cache_entry_s *centry;
+
+	centry = image_cache__find(c);
+	if ((centry != NULL) && (centry->bitmap != NULL)) {
+		usage->bitmap += centry->bitmap_size;
+	}
+}
+
 content_type image_cache_content_type(void)
 {
 	return CONTENT_IMAGE;
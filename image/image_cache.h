@@ -183,6 +183,15 @@ void image_cache_destroy(struct content *c);
 
 void *image_cache_get_internal(const struct content *c, void *context);
 
+/** Generic content memory usage callback
+ *
+ * May be used by image content handlers as their get_memory_usage
+ * callback. Reports the size of the bitmap currently held in the cache
+ * for the content, if any.
+ */
+void image_cache_get_memory_usage(const struct content *c,
+				  struct content_memory_usage *usage);
+
 content_type image_cache_content_type(void);
 
 #endif
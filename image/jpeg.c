@@ -382,6 +382,7 @@ static const content_handler nsjpeg_content_handler = {
 	.redraw = image_cache_redraw,
 	.clone = nsjpeg_clone,
 	.get_internal = image_cache_get_internal,
+	.get_memory_usage = image_cache_get_memory_usage,
 	.type = image_cache_content_type,
 	.no_share = false,
 };
@@ -596,6 +596,7 @@ static const content_handler nspng_content_handler = {
 	.destroy = image_cache_destroy,
 	.redraw = image_cache_redraw,
 	.get_internal = image_cache_get_internal,
+	.get_memory_usage = image_cache_get_memory_usage,
 	.type = image_cache_content_type,
 	.no_share = false,
 };
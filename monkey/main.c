@@ -32,6 +32,7 @@
 #include "desktop/netsurf.h"
 #include "desktop/sslcert.h"
 #include "utils/filepath.h"
+#include "utils/log.h"
 #include "utils/url.h"
 
 static char **respaths; /** resource search path vector */
@@ -91,6 +92,19 @@ static void quit_handler(int argc, char **argv)
   netsurf_quit = true;
 }
 
+static void trace_handler(int argc, char **argv)
+{
+  if (argc != 2) {
+    fprintf(stdout, "ERROR TRACE NEEDS PATH\n");
+    return;
+  }
+
+  if (nslog_trace_dump(argv[1]) == NSERROR_OK)
+    fprintf(stdout, "GENERIC TRACE SAVED %s\n", argv[1]);
+  else
+    fprintf(stdout, "ERROR TRACE SAVE FAILED %s\n", argv[1]);
+}
+
 /* Documented in desktop/options.h */
 void gui_options_init_defaults(void)
 {
@@ -130,6 +144,7 @@ main(int argc, char **argv)
   
   monkey_prepare_input();
   monkey_register_handler("QUIT", quit_handler);
+  monkey_register_handler("TRACE", trace_handler);
   monkey_register_handler("WINDOW", monkey_window_handle_command);
   
   fprintf(stdout, "GENERIC STARTED\n");
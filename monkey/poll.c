@@ -40,10 +40,14 @@ typedef struct {
   GPollFD pf;
 } MonkeySource;
 
+/** Milliseconds until the next scheduled callback, or -1 for none */
+static int monkey_schedule_timeout = -1;
+
 static gboolean monkey_source_prepare(GSource    *source,
                                gint       *timeout_)
 {
-  *timeout_ = -1;
+  /* Wake up in time for the next scheduled callback */
+  *timeout_ = monkey_schedule_timeout;
   return FALSE;
 }
 
@@ -97,9 +101,9 @@ gui_poll(bool active)
   unsigned int fd_count = 0;
   bool block = true;
         
-  schedule_run();
+  monkey_schedule_timeout = schedule_run();
 
-  if (browser_reformat_pending)
+  if (browser_reformat_pending || monkey_schedule_timeout == 0)
     block = false;
 
   if (active) {
@@ -39,7 +39,7 @@
 #include "render/form.h"
 #include "render/html_internal.h"
 #include "utils/log.h"
-#include "utils/talloc.h"
+#include "utils/arena.h"
 #include "utils/utils.h"
 
 static bool box_contains_point(struct box *box, int x, int y, bool *physically);
@@ -49,6 +49,8 @@ static bool box_nearer_text_box(struct box *box, int bx, int by,
 static bool box_nearest_text_box(struct box *box, int bx, int by,
 		int fx, int fy, int x, int y, int dir, struct box **nearest,
 		int *tx, int *ty, int *nr_xd, int *nr_yd);
+static void box_count(struct box *box, unsigned long *boxes,
+		unsigned long *extras);
 
 #define box_is_float(box) (box->type == BOX_FLOAT_LEFT || \
 		box->type == BOX_FLOAT_RIGHT)
@@ -72,13 +74,17 @@ void *box_style_alloc(void *ptr, size_t len, void *pw)
 }
 
 /**
- * Destructor for box nodes which own styles
+ * Destructor for box nodes which hold styles or references
  *
- * \param b The box being destroyed.
- * \return 0 to allow talloc to continue destroying the tree.
+ * \param p The box being destroyed.
+ *
+ * This is run when the box tree arena is destroyed, or when the box is freed
+ * early by box_free_box().
  */
-static int box_talloc_destructor(struct box *b)
+static void box_destructor(void *p)
 {
+	struct box *b = p;
+
 	if ((b->flags & STYLE_OWNED) && b->style != NULL) {
 		css_computed_style_destroy(b->style);
 		b->style = NULL;
@@ -89,18 +95,20 @@ static int box_talloc_destructor(struct box *b)
 		b->styles = NULL;
 	}
 
-	if (b->href != NULL)
+	if (b->href != NULL) {
 		nsurl_unref(b->href);
+		b->href = NULL;
+	}
 
-	if (b->id != NULL) {
-		lwc_string_unref(b->id);
+	if (b->extra != NULL && b->extra->id != NULL) {
+		lwc_string_unref(b->extra->id);
+		b->extra->id = NULL;
 	}
 
 	if (b->node != NULL) {
 		dom_node_unref(b->node);
+		b->node = NULL;
 	}
-
-	return 0;
 }
 
 /**
@@ -113,26 +121,39 @@ static int box_talloc_destructor(struct box *b)
  * \param  target       target for the box (not copied), or 0
  * \param  title        title for the box (not copied), or 0
  * \param  id           id for the box (not copied), or 0
- * \param  context      context for allocations
+ * \param  arena        box tree arena to allocate from
  * \return  allocated and initialised box, or 0 on memory exhaustion
  *
  * styles is always owned by the box, if it is set.
  * style is only owned by the box in the case of implied boxes.
+ *
+ * Only boxes created holding styles or references get a destructor.  A DOM
+ * node may only be attached to a box created with styles.
  */
 
 struct box * box_create(css_select_results *styles, css_computed_style *style,
 		bool style_owned, nsurl *href, const char *target, 
-		const char *title, lwc_string *id, void *context)
+		const char *title, lwc_string *id, struct arena *arena)
 {
 	unsigned int i;
 	struct box *box;
 
-	box = talloc(context, struct box);
+	box = arena_alloc(arena, sizeof(struct box));
 	if (!box) {
 		return 0;
 	}
 
-	talloc_set_destructor(box, box_talloc_destructor);
+	box->extra = NULL;
+	if (id != NULL && box_get_extra(box, arena) == NULL) {
+		return 0;
+	}
+
+	if ((styles != NULL || (style_owned && style != NULL) ||
+			href != NULL || id != NULL) &&
+			arena_add_destructor(arena, box_destructor,
+			box) == false) {
+		return 0;
+	}
 
 	box->type = BOX_INLINE;
 	box->flags = 0;
@@ -169,19 +190,32 @@ struct box * box_create(css_select_results *styles, css_computed_style *style,
 	box->float_container = NULL;
 	box->next_float = NULL;
 	box->list_marker = NULL;
-	box->col = NULL;
 	box->gadget = NULL;
-	box->usemap = NULL;
-	box->id = id;
 	box->background = NULL;
 	box->object = NULL;
-	box->object_params = NULL;
-	box->iframe = NULL;
 	box->node = NULL;
+	if (id != NULL)
+		box->extra->id = id;
 
 	return box;
 }
 
+/**
+ * Get the rarely used data for a box, creating it if necessary.
+ *
+ * \param  box    box to get data for
+ * \param  arena  box tree arena to allocate from
+ * \return  the box's extra data, or 0 on memory exhaustion
+ */
+
+struct box_extra *box_get_extra(struct box *box, struct arena *arena)
+{
+	if (box->extra == NULL)
+		box->extra = arena_zalloc(arena, sizeof(struct box_extra));
+
+	return box->extra;
+}
+
 /**
  * Add a child to a box tree node.
  *
@@ -293,11 +327,11 @@ void box_free_box(struct box *box)
 			scrollbar_destroy(box->scroll_x);
 		if (box->scroll_y != NULL)
 			scrollbar_destroy(box->scroll_y);
-		if (box->styles != NULL)
-			css_select_results_destroy(box->styles);
-	}
 
-	talloc_free(box);
+		/* The box's memory stays in the arena until the box tree is
+		 * destroyed, but what it refers to can go now */
+		box_destructor(box);
+	}
 }
 
 
@@ -842,8 +876,9 @@ struct box *box_find_by_id(struct box *box, lwc_string *id)
 	struct box *a, *b;
 	bool m;
 
-	if (box->id != NULL &&
-			lwc_string_isequal(id, box->id, &m) == lwc_error_ok &&
+	if (box->extra != NULL && box->extra->id != NULL &&
+			lwc_string_isequal(id, box->extra->id, &m) ==
+					lwc_error_ok &&
 			m == true)
 		return box;
 
@@ -928,7 +963,7 @@ void box_dump(FILE *stream, struct box *box, unsigned int depth)
 		fprintf(stream, "(object '%s') ", 
 				nsurl_access(hlcache_handle_get_url(box->object)));
 	}
-	if (box->iframe) {
+	if (box->extra && box->extra->iframe) {
 		fprintf(stream, "(iframe) ");
 	}
 	if (box->gadget)
@@ -941,26 +976,28 @@ void box_dump(FILE *stream, struct box *box, unsigned int depth)
 		fprintf(stream, " |%s|", box->target);
 	if (box->title)
 		fprintf(stream, " [%s]", box->title);
-	if (box->id)
-		fprintf(stream, " <%s>", lwc_string_data(box->id));
+	if (box->extra && box->extra->id)
+		fprintf(stream, " <%s>", lwc_string_data(box->extra->id));
 	if (box->type == BOX_INLINE || box->type == BOX_INLINE_END)
 		fprintf(stream, " inline_end %p", box->inline_end);
 	if (box->float_children)
 		fprintf(stream, " float_children %p", box->float_children);
 	if (box->next_float)
 		fprintf(stream, " next_float %p", box->next_float);
-	if (box->col) {
+	if (box->extra && box->extra->col) {
+		struct column *col = box->extra->col;
+
 		fprintf(stream, " (columns");
 		for (i = 0; i != box->columns; i++)
 			fprintf(stream, " (%s %s %i %i %i)",
 					((const char *[]) {"UNKNOWN", "FIXED",
 					"AUTO", "PERCENT", "RELATIVE"})
-					[box->col[i].type],
+					[col[i].type],
 					((const char *[]) {"normal",
 					"positioned"})
-					[box->col[i].positioned],
-					box->col[i].width,
-					box->col[i].min, box->col[i].max);
+					[col[i].positioned],
+					col[i].width,
+					col[i].min, col[i].max);
 		fprintf(stream, ")");
 	}
 	fprintf(stream, "\n");
@@ -990,6 +1027,53 @@ void box_dump(FILE *stream, struct box *box, unsigned int depth)
 	}
 }
 
+/**
+ * Print the number of boxes in a box tree, and the memory they use, to a
+ * file.
+ *
+ * \param  stream  file to print to
+ * \param  box     root of box tree
+ */
+
+void box_dump_stats(FILE *stream, struct box *box)
+{
+	unsigned long boxes = 0, extras = 0;
+
+	box_count(box, &boxes, &extras);
+
+	fprintf(stream, "%lu boxes of %lu bytes, %lu with extra data of "
+			"%lu bytes: %lu bytes, %.1f per box\n",
+			boxes, (unsigned long) sizeof(struct box),
+			extras, (unsigned long) sizeof(struct box_extra),
+			boxes * sizeof(struct box) +
+			extras * sizeof(struct box_extra),
+			boxes == 0 ? 0.0 : (double) (boxes * sizeof(struct box) +
+			extras * sizeof(struct box_extra)) / boxes);
+}
+
+/**
+ * Count the boxes in a box tree, and those with extra data.
+ *
+ * \param  box     root of box tree
+ * \param  boxes   updated with number of boxes
+ * \param  extras  updated with number of boxes with extra data
+ */
+
+void box_count(struct box *box, unsigned long *boxes, unsigned long *extras)
+{
+	struct box *c;
+
+	(*boxes)++;
+	if (box->extra != NULL)
+		(*extras)++;
+
+	if (box->list_marker != NULL)
+		box_count(box->list_marker, boxes, extras);
+
+	for (c = box->children; c != NULL; c = c->next)
+		box_count(c, boxes, extras);
+}
+
 /**
  * Applies the given scroll setup to a box. This includes scroll
  * creation/deletion as well as scroll dimension updates.
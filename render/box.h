@@ -101,6 +101,7 @@ struct column;
 struct object_params;
 struct object_param;
 struct html_content;
+struct arena;
 
 struct dom_node;
 
@@ -148,7 +149,29 @@ struct box_border {
 	int width;			/**< border-width (pixels) */
 };
 
-/** Node in box tree. All dimensions are in pixels. */
+/**
+ * Rarely used data for a box.  Only tables, image maps, objects, iframes
+ * and elements with an id have this.
+ */
+struct box_extra {
+	struct column *col;  /**< Array of table column data for TABLE only. */
+
+	char *usemap; /** (Image)map to use with this object, or 0 if none */
+	lwc_string *id; /**<  value of id attribute (or name for anchors) */
+
+	/** Parameters for the object, or 0. */
+	struct object_params *object_params;
+
+	/** Iframe's browser_window, or NULL if none */
+	struct browser_window *iframe;
+};
+
+/**
+ * Node in box tree. All dimensions are in pixels.
+ *
+ * The fields used by layout and redraw of every box come first, so that they
+ * share as few cache lines as possible.
+ */
 struct box {
 	/** Type of box. */
 	box_type type;
@@ -156,10 +179,6 @@ struct box {
 	/** Box flags */
 	box_flags flags;
 
-	/** Computed styles for elements and their pseudo elements.  NULL on
-	 *  non-element boxes. */
-	css_select_results *styles;
-
 	/** Style for this box. 0 for INLINE_CONTAINER and FLOAT_*. Pointer into
 	 *  a box's 'styles' select results, except for implied boxes, where it
 	 *  is a pointer to an owned computed style. */
@@ -174,6 +193,26 @@ struct box {
 	int width;   /**< Width of content box (excluding padding etc.). */
 	int height;  /**< Height of content box (excluding padding etc.). */
 
+	struct box *next;      /**< Next sibling box, or 0. */
+	struct box *prev;      /**< Previous sibling box, or 0. */
+	struct box *children;  /**< First child box, or 0. */
+	struct box *last;      /**< Last child box, or 0. */
+	struct box *parent;    /**< Parent box, or 0. */
+
+	char *text;     /**< Text, or 0 if none. Unterminated. */
+	size_t length;  /**< Length of text. */
+
+	/** Width of space after current text (depends on font and size). */
+	int space;
+
+	/** Level below which subsequent floats must be cleared.
+	 * This is used only for boxes with float_children */
+	int clear_level;
+
+	/** INLINE_END box corresponding to this INLINE box, or INLINE box
+	 * corresponding to this INLINE_END box. */
+	struct box *inline_end;
+
 	/* These four variables determine the maximum extent of a box's
 	 * descendants. They are relative to the x,y coordinates of the box.
 	 *
@@ -197,9 +236,6 @@ struct box {
 	int padding[4];  /**< Padding: TOP, RIGHT, BOTTOM, LEFT. */
 	struct box_border border[4];   /**< Border: TOP, RIGHT, BOTTOM, LEFT. */
 
-	struct scrollbar *scroll_x;  /**< Horizontal scroll. */
-	struct scrollbar *scroll_y;  /**< Vertical scroll. */
-
 	/** Width of box taking all line breaks (including margins etc). Must
 	 * be non-negative. */
 	int min_width;
@@ -207,32 +243,6 @@ struct box {
 	 * non-negative. */
 	int max_width;
 
-	/**< Byte offset within a textual representation of this content. */
-	size_t byte_offset;
-
-	char *text;     /**< Text, or 0 if none. Unterminated. */
-	size_t length;  /**< Length of text. */
-
-	/** Width of space after current text (depends on font and size). */
-	int space;
-
-	nsurl *href;   /**< Link, or 0. */
-	const char *target;  /**< Link target, or 0. */
-	const char *title;  /**< Title, or 0. */
-
-	unsigned int columns;  /**< Number of columns for TABLE / TABLE_CELL. */
-	unsigned int rows;     /**< Number of rows for TABLE only. */
-	unsigned int start_column;  /**< Start column for TABLE_CELL only. */
-
-	struct box *next;      /**< Next sibling box, or 0. */
-	struct box *prev;      /**< Previous sibling box, or 0. */
-	struct box *children;  /**< First child box, or 0. */
-	struct box *last;      /**< Last child box, or 0. */
-	struct box *parent;    /**< Parent box, or 0. */
-	/** INLINE_END box corresponding to this INLINE box, or INLINE box
-	 * corresponding to this INLINE_END box. */
-	struct box *inline_end;
-
 	/** First float child box, or 0. Float boxes are in the tree twice, in
 	 * this list for the block box which defines the area for floats, and
 	 * also in the standard tree given by children, next, prev, etc. */
@@ -241,33 +251,40 @@ struct box {
 	struct box *next_float;
 	/** If box is a float, points to box's containing block */
 	struct box *float_container;
-	/** Level below which subsequent floats must be cleared.
-	 * This is used only for boxes with float_children */
-	int clear_level;
 
-	/** List marker box if this is a list-item, or 0. */
-	struct box *list_marker;
+	/** Object in this box (usually an image), or 0 if none. */
+	struct hlcache_handle* object;
+	/** Background image for this box, or 0 if none */
+	struct hlcache_handle *background;
 
-	struct column *col;  /**< Array of table column data for TABLE only. */
+	struct scrollbar *scroll_x;  /**< Horizontal scroll. */
+	struct scrollbar *scroll_y;  /**< Vertical scroll. */
 
 	/** Form control data, or 0 if not a form control. */
 	struct form_control* gadget;
 
-	char *usemap; /** (Image)map to use with this object, or 0 if none */
-	lwc_string *id; /**<  value of id attribute (or name for anchors) */
+	/** List marker box if this is a list-item, or 0. */
+	struct box *list_marker;
 
-	/** Background image for this box, or 0 if none */
-	struct hlcache_handle *background;
+	/**< Byte offset within a textual representation of this content. */
+	size_t byte_offset;
 
-	/** Object in this box (usually an image), or 0 if none. */
-	struct hlcache_handle* object;
-	/** Parameters for the object, or 0. */
-	struct object_params *object_params;
+	unsigned int columns;  /**< Number of columns for TABLE / TABLE_CELL. */
+	unsigned int rows;     /**< Number of rows for TABLE only. */
+	unsigned int start_column;  /**< Start column for TABLE_CELL only. */
 
-	/** Iframe's browser_window, or NULL if none */
-	struct browser_window *iframe;
+	/** Computed styles for elements and their pseudo elements.  NULL on
+	 *  non-element boxes. */
+	css_select_results *styles;
+
+	nsurl *href;   /**< Link, or 0. */
+	const char *target;  /**< Link target, or 0. */
+	const char *title;  /**< Title, or 0. */
 
 	struct dom_node *node; /**< DOM node that generated this box or NULL */
+
+	/** Rarely used data, or 0 if none. */
+	struct box_extra *extra;
 };
 
 /** Table column data. */
@@ -318,7 +335,8 @@ extern const char *TARGET_BLANK;
 void *box_style_alloc(void *ptr, size_t len, void *pw);
 struct box * box_create(css_select_results *styles, css_computed_style *style,
 		bool style_owned, nsurl *href, const char *target, 
-		const char *title, lwc_string *id, void *context);
+		const char *title, lwc_string *id, struct arena *arena);
+struct box_extra *box_get_extra(struct box *box, struct arena *arena);
 void box_add_child(struct box *parent, struct box *child);
 void box_insert_sibling(struct box *box, struct box *new_box);
 void box_unlink_and_free(struct box *box);
@@ -333,6 +351,7 @@ struct box *box_pick_text_box(struct html_content *html,
 struct box *box_find_by_id(struct box *box, lwc_string *id);
 bool box_visible(struct box *box);
 void box_dump(FILE *stream, struct box *box, unsigned int depth);
+void box_dump_stats(FILE *stream, struct box *box);
 bool box_extract_link(const char *rel, nsurl *base, nsurl **result);
 
 bool box_handle_scrollbars(struct content *c, struct box *box,
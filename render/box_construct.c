@@ -46,7 +46,7 @@
 #include "utils/log.h"
 #include "utils/messages.h"
 #include "utils/schedule.h"
-#include "utils/talloc.h"
+#include "utils/arena.h"
 #include "utils/url.h"
 #include "utils/utils.h"
 
@@ -62,7 +62,7 @@ struct box_construct_ctx {
 
 	box_construct_complete_cb cb;	/**< Callback to invoke on completion */
 
-	int *bctx;                      /**< talloc context */
+	struct arena *bctx;             /**< box tree arena */
 };
 
 /**
@@ -123,7 +123,7 @@ static bool box_embed(BOX_SPECIAL_PARAMS);
 static bool box_pre(BOX_SPECIAL_PARAMS);
 static bool box_iframe(BOX_SPECIAL_PARAMS);
 static bool box_get_attribute(dom_node *n, const char *attribute,
-		void *context, char **value);
+		struct arena *arena, char **value);
 static struct frame_dimension *box_parse_multi_lengths(const char *s,
 		unsigned int *count);
 
@@ -165,8 +165,8 @@ nserror dom_to_box(dom_node *n, html_content *c, box_construct_complete_cb cb)
 	struct box_construct_ctx *ctx;
 
 	if (c->bctx == NULL) {
-		/* create a context allocation for this box tree */
-		c->bctx = talloc_zero(0, int);
+		/* create an arena for this box tree's allocations */
+		c->bctx = arena_create();
 		if (c->bctx == NULL) {
 			return NSERROR_NOMEM;
 		}
@@ -641,7 +641,7 @@ static bool box_construct_marker(struct box *box, const char *title,
 			}
 		}
 
-		marker->text = talloc_array(ctx->bctx, char, 20);
+		marker->text = arena_alloc(ctx->bctx, 20);
 		if (marker->text == NULL)
 			return false;
 
@@ -871,7 +871,7 @@ bool box_construct_element(struct box_construct_ctx *ctx,
 		if (t == NULL)
 			return false;
 
-		props.title = talloc_strdup(ctx->bctx, t);
+		props.title = arena_strdup(ctx->bctx, t);
 
 		free(t);
 
@@ -985,8 +985,8 @@ bool box_construct_element(struct box_construct_ctx *ctx,
 		}
 
 		/* Can't do this, because the lifetimes of boxes and gadgets
-		 * are inextricably linked. Fortunately, talloc will save us
-		 * (for now) */
+		 * are inextricably linked. Fortunately, the box tree arena
+		 * will save us (for now) */
 		/* box_free_box(box); */
 
 		*convert_children = false;
@@ -1145,8 +1145,9 @@ void box_construct_element_after(dom_node *n, html_content *content)
 
 		inline_end = box_create(NULL, box->style, false,
 				box->href, box->target, box->title, 
-				box->id == NULL ? NULL :
-				lwc_string_ref(box->id), content->bctx);
+				(box->extra == NULL || box->extra->id == NULL) ?
+				NULL : lwc_string_ref(box->extra->id),
+				content->bctx);
 		if (inline_end != NULL) {
 			inline_end->type = BOX_INLINE_END;
 
@@ -1245,7 +1246,7 @@ bool box_construct_text(struct box_construct_ctx *ctx)
 
 		box->type = BOX_TEXT;
 
-		box->text = talloc_strdup(ctx->bctx, text);
+		box->text = arena_strdup(ctx->bctx, text);
 		free(text);
 		if (box->text == NULL)
 			return false;
@@ -1364,7 +1365,7 @@ bool box_construct_text(struct box_construct_ctx *ctx)
 
 			box->type = BOX_TEXT;
 
-			box->text = talloc_strdup(ctx->bctx, current);
+			box->text = arena_strdup(ctx->bctx, current);
 			if (box->text == NULL) {
 				free(text);
 				return false;
@@ -1642,12 +1643,17 @@ bool box_a(BOX_SPECIAL_PARAMS)
 		dom_string_unref(s);
 
 		if (err == DOM_NO_ERR) {
+			if (box_get_extra(box, content->bctx) == NULL) {
+				lwc_string_unref(lwc_name);
+				return false;
+			}
+
 			/* name replaces existing id
 			 * TODO: really? */
-			if (box->id != NULL)
-				lwc_string_unref(box->id);
+			if (box->extra->id != NULL)
+				lwc_string_unref(box->extra->id);
 
-			box->id = lwc_name;
+			box->extra->id = lwc_name;
 		}
 	}
 
@@ -1671,7 +1677,7 @@ bool box_a(BOX_SPECIAL_PARAMS)
 		else {
 			/* 6.16 says that frame names must begin with [a-zA-Z]
 			 * This doesn't match reality, so just take anything */
-			box->target = talloc_strdup(content->bctx, 
+			box->target = arena_strdup(content->bctx, 
 					dom_string_data(s));
 			if (!box->target) {
 				dom_string_unref(s);
@@ -1692,6 +1698,7 @@ bool box_a(BOX_SPECIAL_PARAMS)
 bool box_image(BOX_SPECIAL_PARAMS)
 {
 	bool ok;
+	char *usemap = NULL;
 	dom_string *s;
 	dom_exception err;
 	nsurl *url;
@@ -1712,7 +1719,7 @@ bool box_image(BOX_SPECIAL_PARAMS)
 		dom_string_unref(s);
 		if (alt == NULL)
 			return false;
-		box->text = talloc_strdup(content->bctx, alt);
+		box->text = arena_strdup(content->bctx, alt);
 		free(alt);
 		if (box->text == NULL)
 			return false;
@@ -1724,10 +1731,13 @@ bool box_image(BOX_SPECIAL_PARAMS)
 	}
 
 	/* imagemap associated with this image */
-	if (!box_get_attribute(n, "usemap", content->bctx, &box->usemap))
+	if (!box_get_attribute(n, "usemap", content->bctx, &usemap))
 		return false;
-	if (box->usemap && box->usemap[0] == '#')
-		box->usemap++;
+	if (usemap != NULL) {
+		if (box_get_extra(box, content->bctx) == NULL)
+			return false;
+		box->extra->usemap = (usemap[0] == '#') ? usemap + 1 : usemap;
+	}
 
 	/* get image URL */
 	err = dom_element_get_attribute(n, kstr_src, &s);
@@ -1781,19 +1791,18 @@ bool box_noscript(BOX_SPECIAL_PARAMS)
 /**
  * Destructor for object_params, for <object> elements
  *
- * \param b	The object params being destroyed.
- * \return 0 to allow talloc to continue destroying the tree.
+ * \param p	The object params being destroyed.
  */
-static int box_object_talloc_destructor(struct object_params *o)
+static void box_object_destructor(void *p)
 {
+	struct object_params *o = p;
+
 	if (o->codebase != NULL)
 		nsurl_unref(o->codebase);
 	if (o->classid != NULL)
 		nsurl_unref(o->classid);
 	if (o->data != NULL)
 		nsurl_unref(o->data);
-	
-	return 0;
 }
 
 /**
@@ -1804,6 +1813,7 @@ bool box_object(BOX_SPECIAL_PARAMS)
 {
 	struct object_params *params;
 	struct object_param *param;
+	char *usemap = NULL;
 	dom_string *codebase, *classid, *data;
 	dom_node *c;
 	dom_exception err;
@@ -1812,18 +1822,18 @@ bool box_object(BOX_SPECIAL_PARAMS)
 			box_is_root(n)) == CSS_DISPLAY_NONE)
 		return true;
 
-	if (box_get_attribute(n, "usemap", content->bctx, &box->usemap) ==
-			false)
+	if (box_get_attribute(n, "usemap", content->bctx, &usemap) == false)
 		return false;
-	if (box->usemap && box->usemap[0] == '#')
-		box->usemap++;
+	if (usemap != NULL) {
+		if (box_get_extra(box, content->bctx) == NULL)
+			return false;
+		box->extra->usemap = (usemap[0] == '#') ? usemap + 1 : usemap;
+	}
 
-	params = talloc(content->bctx, struct object_params);
+	params = arena_alloc(content->bctx, sizeof(struct object_params));
 	if (params == NULL)
 		return false;
 
-	talloc_set_destructor(params, box_object_talloc_destructor);
-
 	params->data = NULL;
 	params->type = NULL;
 	params->codetype = NULL;
@@ -1831,6 +1841,10 @@ bool box_object(BOX_SPECIAL_PARAMS)
 	params->classid = NULL;
 	params->params = NULL;
 
+	if (arena_add_destructor(content->bctx, box_object_destructor,
+			params) == false)
+		return false;
+
 	/* codebase, classid, and data are URLs
 	 * (codebase is the base for the other two) */
 	err = dom_element_get_attribute(n, kstr_codebase, &codebase);
@@ -1880,10 +1894,11 @@ bool box_object(BOX_SPECIAL_PARAMS)
 		return true;
 
 	/* codetype and type are MIME types */
-	if (box_get_attribute(n, "codetype", params, 
+	if (box_get_attribute(n, "codetype", content->bctx,
 			&params->codetype) == false)
 		return false;
-	if (box_get_attribute(n, "type", params, &params->type) == false)
+	if (box_get_attribute(n, "type", content->bctx,
+			&params->type) == false)
 		return false;
 
 	/* classid && !data => classid is used (consult codetype)
@@ -1962,7 +1977,8 @@ bool box_object(BOX_SPECIAL_PARAMS)
 				break;
 			}
 
-			param = talloc(params, struct object_param);
+			param = arena_alloc(content->bctx,
+					sizeof(struct object_param));
 			if (param == NULL) {
 				dom_node_unref(c);
 				return false;
@@ -1973,32 +1989,33 @@ bool box_object(BOX_SPECIAL_PARAMS)
 			param->valuetype = NULL;
 			param->next = NULL;
 
-			if (box_get_attribute(c, "name", param, 
+			if (box_get_attribute(c, "name", content->bctx, 
 					&param->name) == false) {
 				dom_node_unref(c);
 				return false;
 			}
 
-			if (box_get_attribute(c, "value", param, 
+			if (box_get_attribute(c, "value", content->bctx, 
 					&param->value) == false) {
 				dom_node_unref(c);
 				return false;
 			}
 
-			if (box_get_attribute(c, "type", param, 
+			if (box_get_attribute(c, "type", content->bctx, 
 					&param->type) == false) {
 				dom_node_unref(c);
 				return false;
 			}
 
-			if (box_get_attribute(c, "valuetype", param,
+			if (box_get_attribute(c, "valuetype", content->bctx,
 					&param->valuetype) == false) {
 				dom_node_unref(c);
 				return false;
 			}
 
 			if (param->valuetype == NULL) {
-				param->valuetype = talloc_strdup(param, "data");
+				param->valuetype = arena_strdup(content->bctx,
+						"data");
 				if (param->valuetype == NULL) {
 					dom_node_unref(c);
 					return false;
@@ -2019,7 +2036,9 @@ bool box_object(BOX_SPECIAL_PARAMS)
 		c = next;
 	}
 
-	box->object_params = params;
+	if (box_get_extra(box, content->bctx) == NULL)
+		return false;
+	box->extra->object_params = params;
 
 	/* start fetch (MIME type is ok or not specified) */
 	if (!html_fetch_object(content,
@@ -2051,7 +2070,8 @@ bool box_frameset(BOX_SPECIAL_PARAMS)
 		return true;
 	}
 
-	content->frameset = talloc_zero(content->bctx, struct content_html_frames);
+	content->frameset = arena_zalloc(content->bctx,
+			sizeof(struct content_html_frames));
 	if (!content->frameset)
 		return false;
 
@@ -2068,17 +2088,16 @@ bool box_frameset(BOX_SPECIAL_PARAMS)
 /**
  * Destructor for content_html_frames, for <frame> elements
  *
- * \param b	The frame params being destroyed.
- * \return 0 to allow talloc to continue destroying the tree.
+ * \param p	The frame params being destroyed.
  */
-static int box_frames_talloc_destructor(struct content_html_frames *f)
+static void box_frames_destructor(void *p)
 {
+	struct content_html_frames *f = p;
+
 	if (f->url != NULL) {
 		nsurl_unref(f->url);
 		f->url = NULL;
 	}
-	
-	return 0;
 }
 
 bool box_create_frameset(struct content_html_frames *f, dom_node *n,
@@ -2157,10 +2176,13 @@ bool box_create_frameset(struct content_html_frames *f, dom_node *n,
 	f->cols = cols;
 	f->rows = rows;
 	f->scrolling = SCROLLING_NO;
-	f->children = talloc_array(content->bctx, struct content_html_frames,
-								(rows * cols));
-
-	talloc_set_destructor(f->children, box_frames_talloc_destructor);
+	f->children = arena_alloc(content->bctx,
+			sizeof(struct content_html_frames) * rows * cols);
+	if (f->children == NULL) {
+		free(col_width);
+		free(row_height);
+		return false;
+	}
 
 	for (row = 0; row < rows; row++) {
 		for (col = 0; col < cols; col++) {
@@ -2179,6 +2201,14 @@ bool box_create_frameset(struct content_html_frames *f, dom_node *n,
 			frame->border = default_border;
 			frame->border_colour = default_border_colour;
 			frame->children = NULL;
+
+			if (arena_add_destructor(content->bctx,
+					box_frames_destructor,
+					frame) == false) {
+				free(col_width);
+				free(row_height);
+				return false;
+			}
 		}
 	}
 	free(col_width);
@@ -2288,7 +2318,7 @@ bool box_create_frameset(struct content_html_frames *f, dom_node *n,
 			/* fill in specified values */
 			err = dom_element_get_attribute(c, kstr_name, &s);
 			if (err == DOM_NO_ERR && s != NULL) {
-				frame->name = talloc_strdup(content->bctx, 
+				frame->name = arena_strdup(content->bctx, 
 						dom_string_data(s));
 				dom_string_unref(s);
 			}
@@ -2361,17 +2391,16 @@ bool box_create_frameset(struct content_html_frames *f, dom_node *n,
 /**
  * Destructor for content_html_iframe, for <iframe> elements
  *
- * \param b	The iframe params being destroyed.
- * \return 0 to allow talloc to continue destroying the tree.
+ * \param p	The iframe params being destroyed.
  */
-static int box_iframes_talloc_destructor(struct content_html_iframe *f)
+static void box_iframes_destructor(void *p)
 {
+	struct content_html_iframe *f = p;
+
 	if (f->url != NULL) {
 		nsurl_unref(f->url);
 		f->url = NULL;
 	}
-	
-	return 0;
 }
 
 
@@ -2418,14 +2447,12 @@ bool box_iframe(BOX_SPECIAL_PARAMS)
 	}
 
 	/* create a new iframe */
-	iframe = talloc(content->bctx, struct content_html_iframe);
+	iframe = arena_alloc(content->bctx, sizeof(struct content_html_iframe));
 	if (iframe == NULL) {
 		nsurl_unref(url);
 		return false;
 	}
 
-	talloc_set_destructor(iframe, box_iframes_talloc_destructor);
-
 	iframe->box = box;
 	iframe->margin_width = 0;
 	iframe->margin_height = 0;
@@ -2434,6 +2461,12 @@ bool box_iframe(BOX_SPECIAL_PARAMS)
 	iframe->scrolling = SCROLLING_AUTO;
 	iframe->border = true;
 
+	if (arena_add_destructor(content->bctx, box_iframes_destructor,
+			iframe) == false) {
+		nsurl_unref(url);
+		return false;
+	}
+
 	/* Add this iframe to the linked list of iframes */
 	iframe->next = content->iframe;
 	content->iframe = iframe;
@@ -2441,7 +2474,7 @@ bool box_iframe(BOX_SPECIAL_PARAMS)
 	/* fill in specified values */
 	err = dom_element_get_attribute(n, kstr_name, &s);
 	if (err == DOM_NO_ERR && s != NULL) {
-		iframe->name = talloc_strdup(content->bctx, dom_string_data(s));
+		iframe->name = arena_strdup(content->bctx, dom_string_data(s));
 		dom_string_unref(s);
 	}
 
@@ -2489,6 +2522,10 @@ bool box_iframe(BOX_SPECIAL_PARAMS)
 	assert(box->style);
 	box->flags |= IFRAME;
 
+	/* the iframe's browser_window gets attached to the box later */
+	if (box_get_extra(box, content->bctx) == NULL)
+		return false;
+
 	/* Showing iframe, so don't show alternate content */
 	if (convert_children)
 		*convert_children = false;
@@ -2519,7 +2556,7 @@ static bool box_input_text(html_content *html, struct box *box,
 	if (!inline_box)
 		return false;
 	inline_box->type = BOX_TEXT;
-	inline_box->text = talloc_strdup(html->bctx, "");
+	inline_box->text = arena_strdup(html->bctx, "");
 
 	box_add_child(inline_container, inline_box);
 	box_add_child(box, inline_container);
@@ -2595,16 +2632,16 @@ bool box_input(BOX_SPECIAL_PARAMS)
 		inline_box->type = BOX_TEXT;
 
 		if (box->gadget->value != NULL)
-			inline_box->text = talloc_strdup(content->bctx,
+			inline_box->text = arena_strdup(content->bctx,
 					box->gadget->value);
 		else if (box->gadget->type == GADGET_SUBMIT)
-			inline_box->text = talloc_strdup(content->bctx,
+			inline_box->text = arena_strdup(content->bctx,
 					messages_get("Form_Submit"));
 		else if (box->gadget->type == GADGET_RESET)
-			inline_box->text = talloc_strdup(content->bctx,
+			inline_box->text = arena_strdup(content->bctx,
 					messages_get("Form_Reset"));
 		else
-			inline_box->text = talloc_strdup(content->bctx, 
+			inline_box->text = arena_strdup(content->bctx, 
 							 "Button");
 
 		if (inline_box->text == NULL)
@@ -2819,13 +2856,13 @@ bool box_select(BOX_SPECIAL_PARAMS)
 	}
 
 	if (gadget->data.select.num_selected == 0)
-		inline_box->text = talloc_strdup(content->bctx,
+		inline_box->text = arena_strdup(content->bctx,
 				messages_get("Form_None"));
 	else if (gadget->data.select.num_selected == 1)
-		inline_box->text = talloc_strdup(content->bctx,
+		inline_box->text = arena_strdup(content->bctx,
 				gadget->data.select.current->text);
 	else
-		inline_box->text = talloc_strdup(content->bctx,
+		inline_box->text = arena_strdup(content->bctx,
 				messages_get("Form_Many"));
 	if (inline_box->text == NULL)
 		goto no_memory;
@@ -2944,12 +2981,10 @@ bool box_embed(BOX_SPECIAL_PARAMS)
 			box_is_root(n)) == CSS_DISPLAY_NONE)
 		return true;
 
-	params = talloc(content->bctx, struct object_params);
+	params = arena_alloc(content->bctx, sizeof(struct object_params));
 	if (params == NULL)
 		return false;
 
-	talloc_set_destructor(params, box_object_talloc_destructor);
-
 	params->data = NULL;
 	params->type = NULL;
 	params->codetype = NULL;
@@ -2957,6 +2992,10 @@ bool box_embed(BOX_SPECIAL_PARAMS)
 	params->classid = NULL;
 	params->params = NULL;
 
+	if (arena_add_destructor(content->bctx, box_object_destructor,
+			params) == false)
+		return false;
+
 	/* src is a URL */
 	err = dom_element_get_attribute(n, kstr_src, &src);
 	if (err != DOM_NO_ERR || src == NULL)
@@ -3015,7 +3054,7 @@ bool box_embed(BOX_SPECIAL_PARAMS)
 			return false;
 		}
 
-		param = talloc(content->bctx, struct object_param);
+		param = arena_alloc(content->bctx, sizeof(struct object_param));
 		if (param == NULL) {
 			dom_string_unref(value);
 			dom_string_unref(name);
@@ -3023,10 +3062,10 @@ bool box_embed(BOX_SPECIAL_PARAMS)
 			return false;
 		}
 
-		param->name = talloc_strdup(content->bctx, dom_string_data(name));
-		param->value = talloc_strdup(content->bctx, dom_string_data(value));
+		param->name = arena_strdup(content->bctx, dom_string_data(name));
+		param->value = arena_strdup(content->bctx, dom_string_data(value));
 		param->type = NULL;
-		param->valuetype = talloc_strdup(content->bctx, "data");
+		param->valuetype = arena_strdup(content->bctx, "data");
 		param->next = NULL;
 
 		dom_string_unref(value);
@@ -3044,7 +3083,9 @@ bool box_embed(BOX_SPECIAL_PARAMS)
 
 	dom_namednodemap_unref(attrs);
 
-	box->object_params = params;
+	if (box_get_extra(box, content->bctx) == NULL)
+		return false;
+	box->extra->object_params = params;
 
 	/* start fetch */
 	return html_fetch_object(content, params->data, box, CONTENT_ANY,
@@ -3061,7 +3102,7 @@ bool box_embed(BOX_SPECIAL_PARAMS)
  *
  * \param  n	      xmlNode, of type XML_ELEMENT_NODE
  * \param  attribute  name of attribute
- * \param  context    talloc context for result buffer
+ * \param  arena      arena to allocate result buffer from
  * \param  value      updated to value, if the attribute is present
  * \return  true on success, false if attribute present but memory exhausted
  *
@@ -3070,7 +3111,7 @@ bool box_embed(BOX_SPECIAL_PARAMS)
  */
 
 bool box_get_attribute(dom_node *n, const char *attribute,
-		void *context, char **value)
+		struct arena *arena, char **value)
 {
 	char *result;
 	dom_string *attr, *attr_name;
@@ -3090,7 +3131,7 @@ bool box_get_attribute(dom_node *n, const char *attribute,
 	dom_string_unref(attr_name);
 
 	if (attr != NULL) {
-		result = talloc_strdup(context, dom_string_data(attr));
+		result = arena_strdup(arena, dom_string_data(attr));
 
 		dom_string_unref(attr);
 	
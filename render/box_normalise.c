@@ -395,7 +395,7 @@ bool box_normalise_table(struct box *table, html_content * c)
 
 	free(col_info.spans);
 
-	if (table_calculate_column_types(table) == false)
+	if (table_calculate_column_types(table, c->bctx) == false)
 		return false;
 
 #ifdef BOX_NORMALISE_DEBUG
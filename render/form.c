@@ -52,7 +52,7 @@
 #include "render/layout.h"
 #include "utils/log.h"
 #include "utils/messages.h"
-#include "utils/talloc.h"
+#include "utils/arena.h"
 #include "utils/url.h"
 #include "utils/utf8.h"
 #include "utils/utils.h"
@@ -161,7 +161,7 @@ struct form *form_new(void *node, const char *action, const char *target,
  * \note There may exist controls attached to box tree nodes which are not
  * associated with any form. These will leak at present. Ideally, they will
  * be cleaned up when the box tree is destroyed. As that currently happens
- * via talloc, this won't happen. These controls are distinguishable, as their
+ * with the box tree arena, this won't happen. These controls are distinguishable, as their
  * form field will be NULL.
  */
 void form_free(struct form *form)
@@ -1149,16 +1149,15 @@ static void form__select_process_selection(html_content *html,
 			control->data.select.current = o;
 	}
 
-	talloc_free(inline_box->text);
 	inline_box->text = 0;
 	if (control->data.select.num_selected == 0)
-		inline_box->text = talloc_strdup(html->bctx,
+		inline_box->text = arena_strdup(html->bctx,
 				messages_get("Form_None"));
 	else if (control->data.select.num_selected == 1)
-		inline_box->text = talloc_strdup(html->bctx,
+		inline_box->text = arena_strdup(html->bctx,
 				control->data.select.current->text);
 	else
-		inline_box->text = talloc_strdup(html->bctx,
+		inline_box->text = arena_strdup(html->bctx,
 				messages_get("Form_Many"));
 	if (!inline_box->text) {
 		warn_user("NoMemory", 0);
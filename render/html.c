@@ -51,7 +51,7 @@
 #include "utils/log.h"
 #include "utils/messages.h"
 #include "utils/schedule.h"
-#include "utils/talloc.h"
+#include "utils/arena.h"
 #include "utils/url.h"
 #include "utils/utf8.h"
 #include "utils/utils.h"
@@ -64,6 +64,12 @@
 #define ALWAYS_DUMP_FRAMESET 0
 #define ALWAYS_DUMP_BOX 0
 
+/* Approximate heap cost of a DOM element and of a computed style, used
+ * when reporting memory usage as neither library exposes its own.
+ */
+#define HTML_DOM_ELEMENT_SIZE 128
+#define HTML_COMPUTED_STYLE_SIZE 192
+
 static const char *html_types[] = {
 	"application/xhtml+xml",
 	"text/html"
@@ -83,6 +89,7 @@ static void html_box_convert_done(html_content *c, bool success)
 	dom_node *html;
 
 	LOG(("Done XML to box (%p)", c));
+	TRACE_END(NSLOG_TRACE_BOX, c);
 
 	/* Clean up and report error if unsuccessful or aborted */
 	if ((success == false) || (c->aborted)) {
@@ -193,8 +200,10 @@ void html_finish_conversion(html_content *c)
 		return;
 	}
 
+	TRACE_BEGIN(NSLOG_TRACE_BOX, c);
 	error = dom_to_box(html, c, html_box_convert_done);
 	if (error != NSERROR_OK) {
+		TRACE_END(NSLOG_TRACE_BOX, c);
 		dom_node_unref(html);
 		html_object_free_objects(c);
 		content_broadcast_errorcode(&c->base, error);
@@ -308,6 +317,7 @@ html_create_html_data(html_content *c, const http_parameter *params)
 	c->base_url = nsurl_ref(content_get_url(&c->base));
 	c->base_target = NULL;
 	c->aborted = false;
+	c->parse_traced = false;
 	c->bctx = NULL;
 	c->layout = NULL;
 	c->background_colour = NS_TRANSPARENT;
@@ -441,6 +451,9 @@ html_create(const content_handler *handler,
 
 	*c = (struct content *) html;
 
+	TRACE_BEGIN(NSLOG_TRACE_PARSE, html);
+	html->parse_traced = true;
+
 	return NSERROR_OK;
 }
 
@@ -1090,6 +1103,14 @@ static nserror html_meta_refresh(html_content *c, dom_node *head)
  * On exit, the content status will be either CONTENT_STATUS_DONE if the
  * document is completely loaded or CONTENT_STATUS_READY if objects are still
  * being fetched.
+ *
+ * \todo HTML does not use content_set_ready_incremental(): nothing is
+ *       displayed until all data has arrived. dom_to_box() walks the DOM
+ *       from a scheduled callback holding node references, so the parser
+ *       and scripts must not modify the tree it walks. Building boxes while
+ *       the document is still being parsed needs the box constructor to
+ *       resume from the last node converted and to tolerate insertions
+ *       above it; see Docs/ideas/incremental-html.txt.
  */
 
 static bool html_convert(struct content *c)
@@ -1160,6 +1181,8 @@ html_begin_conversion(html_content *htmlc)
 	LOG(("Completing parse"));
 	/* complete parsing */
 	error = dom_hubbub_parser_completed(htmlc->parser);
+	TRACE_END(NSLOG_TRACE_PARSE, htmlc);
+	htmlc->parse_traced = false;
 	if (error != DOM_HUBBUB_OK) {
 		LOG(("Parsing failed"));
 
@@ -1424,20 +1447,15 @@ static void html_destroy_frameset(struct content_html_frames *frameset)
 {
 	int i;
 
-	if (frameset->name) {
-		talloc_free(frameset->name);
-		frameset->name = NULL;
-	}
+	/* Names and children live in the box tree arena */
+	frameset->name = NULL;
 	if (frameset->url) {
-		talloc_free(frameset->url);
+		nsurl_unref(frameset->url);
 		frameset->url = NULL;
 	}
 	if (frameset->children) {
 		for (i = 0; i < (frameset->rows * frameset->cols); i++) {
-			if (frameset->children[i].name) {
-				talloc_free(frameset->children[i].name);
-				frameset->children[i].name = NULL;
-			}
+			frameset->children[i].name = NULL;
 			if (frameset->children[i].url) {
 				nsurl_unref(frameset->children[i].url);
 				frameset->children[i].url = NULL;
@@ -1445,7 +1463,6 @@ static void html_destroy_frameset(struct content_html_frames *frameset)
 		  	if (frameset->children[i].children)
 		  		html_destroy_frameset(&frameset->children[i]);
 		}
-		talloc_free(frameset->children);
 		frameset->children = NULL;
 	}
 }
@@ -1455,14 +1472,12 @@ static void html_destroy_iframe(struct content_html_iframe *iframe)
 	struct content_html_iframe *next;
 	next = iframe;
 	while ((iframe = next) != NULL) {
+		/* The iframe itself lives in the box tree arena */
 		next = iframe->next;
-		if (iframe->name)
-			talloc_free(iframe->name);
 		if (iframe->url) {
 			nsurl_unref(iframe->url);
 			iframe->url = NULL;
 		}
-		talloc_free(iframe);
 	}
 }
 
@@ -1470,10 +1485,10 @@ static void html_destroy_iframe(struct content_html_iframe *iframe)
 static void html_free_layout(html_content *htmlc)
 {
 	if (htmlc->bctx != NULL) {
-		/* freeing talloc context should let the entire box
-		 * set be destroyed 
+		/* destroying the arena releases the entire box set,
+		 * one slab at a time
 		 */
-		talloc_free(htmlc->bctx);
+		arena_destroy(htmlc->bctx);
 	}
 }
 
@@ -1488,6 +1503,12 @@ static void html_destroy(struct content *c)
 
 	LOG(("content %p", c));
 
+	/* Close the parse span of a content which never converted */
+	if (html->parse_traced) {
+		TRACE_END(NSLOG_TRACE_PARSE, html);
+		html->parse_traced = false;
+	}
+
 	/* Destroy forms */
 	for (f = html->forms; f != NULL; f = g) {
 		g = f->prev;
@@ -1521,7 +1542,6 @@ static void html_destroy(struct content *c)
 	/* Free frameset */
 	if (html->frameset != NULL) {
 		html_destroy_frameset(html->frameset);
-		talloc_free(html->frameset);
 		html->frameset = NULL;
 	}
 
@@ -1717,8 +1737,9 @@ html_get_contextual_content(struct content *c,
 				CSS_VISIBILITY_HIDDEN)
 			continue;
 
-		if (box->iframe)
-			browser_window_get_contextual_content(box->iframe,
+		if (box->extra && box->extra->iframe)
+			browser_window_get_contextual_content(
+					box->extra->iframe,
 					x - box_x, y - box_y, data);
 
 		if (box->object)
@@ -1731,10 +1752,10 @@ html_get_contextual_content(struct content *c,
 		if (box->href)
 			data->link_url = nsurl_access(box->href);
 
-		if (box->usemap) {
+		if (box->extra && box->extra->usemap) {
 			const char *target = NULL;
-			nsurl *url = imagemap_get(html, box->usemap, box_x,
-					box_y, x, y, &target);
+			nsurl *url = imagemap_get(html, box->extra->usemap,
+					box_x, box_y, x, y, &target);
 			/* Box might have imagemap, but no actual link area
 			 * at point */
 			if (url != NULL)
@@ -1791,8 +1812,10 @@ html_scroll_at_point(struct content *c, int x, int y, int scrx, int scry)
 			continue;
 
 		/* Pass into iframe */
-		if (box->iframe && browser_window_scroll_at_point(box->iframe,
-				x - box_x, y - box_y, scrx, scry) == true)
+		if (box->extra && box->extra->iframe &&
+				browser_window_scroll_at_point(
+				box->extra->iframe, x - box_x, y - box_y,
+				scrx, scry) == true)
 			return true;
 
 		/* Pass into textarea widget */
@@ -1852,8 +1875,9 @@ static bool html_drop_file_at_point(struct content *c, int x, int y, char *file)
 				CSS_VISIBILITY_HIDDEN)
 			continue;
 
-		if (box->iframe)
-			return browser_window_drop_file_at_point(box->iframe,
+		if (box->extra && box->extra->iframe)
+			return browser_window_drop_file_at_point(
+					box->extra->iframe,
 					x - box_x, y - box_y, file);
 
 		if (box->object && content_drop_file_at_point(box->object,
@@ -2003,6 +2027,95 @@ static void html_debug_dump(struct content *c, FILE *f)
 	assert(html->layout != NULL);
 
 	box_dump(f, html->layout, 0);
+	box_dump_stats(f, html->layout);
+}
+
+
+/**
+ * Count the computed styles owned by a box tree
+ *
+ * \param  box  root of box tree to examine
+ * \return number of computed styles owned by boxes in the tree
+ */
+static size_t html_count_box_styles(struct box *box)
+{
+	struct box *child;
+	size_t count = 0;
+	int i;
+
+	if (box->styles != NULL) {
+		for (i = 0; i != CSS_PSEUDO_ELEMENT_COUNT; i++) {
+			if (box->styles->styles[i] != NULL)
+				count++;
+		}
+	} else if ((box->flags & STYLE_OWNED) && box->style != NULL) {
+		count++;
+	}
+
+	for (child = box->children; child != NULL; child = child->next)
+		count += html_count_box_styles(child);
+
+	return count;
+}
+
+/** DOM tree walk callback counting elements */
+static bool html_count_dom_element(dom_node *node, dom_string *name,
+		void *ctx)
+{
+	size_t *count = ctx;
+
+	(*count)++;
+
+	return true;
+}
+
+/**
+ * Report memory used by an HTML content
+ *
+ * \param  c      The content to examine
+ * \param  usage  Memory usage record to add to
+ *
+ * Neither libdom nor libcss expose allocation sizes, so the document
+ * tree and computed styles are estimated from element and style counts.
+ * Stylesheets and objects used by the page are included; where these are
+ * shared with other pages they will be counted against each of them.
+ */
+static void html_get_memory_usage(const struct content *c,
+		struct content_memory_usage *usage)
+{
+	html_content *html = (html_content *) c;
+	struct content_html_object *object;
+	size_t elements = 0;
+	unsigned int i;
+
+	usage->other += sizeof(html_content) - sizeof(struct content);
+
+	if (html->document != NULL) {
+		libdom_treewalk((dom_node *) html->document,
+				html_count_dom_element, &elements);
+		usage->dom += elements * HTML_DOM_ELEMENT_SIZE;
+	}
+
+	if (html->bctx != NULL)
+		usage->box += arena_size(html->bctx);
+
+	if (html->layout != NULL) {
+		usage->style += html_count_box_styles(html->layout) *
+				HTML_COMPUTED_STYLE_SIZE;
+	}
+
+	for (i = 0; i != html->stylesheet_count; i++) {
+		if (html->stylesheets[i].sheet != NULL) {
+			content_get_memory_usage(html->stylesheets[i].sheet,
+					usage);
+		}
+	}
+
+	for (object = html->object_list; object != NULL;
+			object = object->next) {
+		if (object->content != NULL)
+			content_get_memory_usage(object->content, usage);
+	}
 }
 
 
@@ -2277,6 +2390,7 @@ static const content_handler html_content_handler = {
 	.scroll_at_point = html_scroll_at_point,
 	.drop_file_at_point = html_drop_file_at_point,
 	.debug_dump = html_debug_dump,
+	.get_memory_usage = html_get_memory_usage,
 	.clone = html_clone,
 	.type = html_content_type,
 	.no_share = true,
@@ -499,8 +499,8 @@ void html_mouse_action(struct content *c, struct browser_window *bw,
 			}
 		}
 
-		if (box->iframe) {
-			iframe = box->iframe;
+		if (box->extra && box->extra->iframe) {
+			iframe = box->extra->iframe;
 		}
 
 		if (box->href) {
@@ -509,8 +509,8 @@ void html_mouse_action(struct content *c, struct browser_window *bw,
 			url_box = box;
 		}
 
-		if (box->usemap) {
-			url = imagemap_get(html, box->usemap,
+		if (box->extra && box->extra->usemap) {
+			url = imagemap_get(html, box->extra->usemap,
 					box_x, box_y, x, y, &target);
 			if (url) {
 				imagemap = true;
@@ -90,8 +90,11 @@ typedef struct html_content {
 	/** Content has been aborted in the LOADING state */
 	bool aborted;
 
-        /** A talloc context purely for the render box tree */
-	int *bctx;
+	/** Parse trace span has begun and not yet ended */
+	bool parse_traced;
+
+	/** An arena purely for the render box tree */
+	struct arena *bctx;
 	/** Box tree, or NULL. */
 	struct box *layout;
 	/** Document background colour. */
@@ -128,7 +128,8 @@ html_object_callback(hlcache_handle *object,
 		if (c->base.status != CONTENT_STATUS_LOADING && c->bw != NULL)
 			content_open(object,
 					c->bw, &c->base,
-					box->object_params);
+					box->extra ?
+					box->extra->object_params : NULL);
 		break;
 
 	case CONTENT_MSG_READY:
@@ -479,7 +480,8 @@ nserror html_object_open_objects(html_content *html, struct browser_window *bw)
 		content_open(object->content,
 			     bw,
 			     &html->base,
-			     object->box->object_params);
+			     object->box->extra ?
+			     object->box->extra->object_params : NULL);
 	}
 	return NSERROR_OK;
 }
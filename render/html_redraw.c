@@ -2382,9 +2382,9 @@ bool html_redraw_box(const html_content *html, struct box *box,
 		}
 			
 
-	} else if (box->iframe) {
+	} else if (box->extra && box->extra->iframe) {
 		/* Offset is passed to browser window redraw unscaled */
-		browser_window_redraw(box->iframe,
+		browser_window_redraw(box->extra->iframe,
 				(x + padding_left) / scale,
 				(y + padding_top) / scale, &r, ctx);
 
@@ -54,7 +54,7 @@
 #include "render/layout.h"
 #include "render/table.h"
 #include "utils/log.h"
-#include "utils/talloc.h"
+#include "utils/arena.h"
 #include "utils/utils.h"
 
 
@@ -146,6 +146,8 @@ bool layout_document(html_content *content, int width, int height)
 	struct box *doc = content->layout;
 	const struct font_functions *font_func = content->font_func;
 
+	TRACE_BEGIN(NSLOG_TRACE_LAYOUT, content);
+
 	layout_minmax_block(doc, font_func);
 
 	layout_block_find_dimensions(width, height, 0, 0, doc);
@@ -184,6 +186,8 @@ bool layout_document(html_content *content, int width, int height)
 
 	layout_calculate_descendant_bboxes(doc);
 
+	TRACE_END(NSLOG_TRACE_LAYOUT, content);
+
 	return ret;
 }
 
@@ -514,7 +518,8 @@ bool layout_block_context(struct box *block, int viewport_height,
 		}
 
 		/* Advance to next box. */
-		if (box->type == BOX_BLOCK && !box->object && !(box->iframe) &&
+		if (box->type == BOX_BLOCK && !box->object &&
+				!(box->flags & IFRAME) &&
 				box->children) {
 			/* Down into children. */
 
@@ -2178,7 +2183,7 @@ static bool layout_text_box_split(html_content *content,
 		space_width = 0;
 
 	/* Create clone of split_box, c2 */
-	c2 = talloc_memdup(content->bctx, split_box, sizeof *c2);
+	c2 = arena_memdup(content->bctx, split_box, sizeof *c2);
 	if (!c2)
 		return false;
 	c2->flags |= CLONE;
@@ -2188,7 +2193,7 @@ static bool layout_text_box_split(html_content *content,
 		/* Inside a form text input / textarea, special case */
 		/* TODO: Move text inputs to core textarea widget and remove
 		 *       this */
-		c2->text = talloc_strndup(content->bctx,
+		c2->text = arena_strndup(content->bctx,
 				split_box->text + used_length,
 				split_box->length - used_length);
 		if (!c2->text)
@@ -3418,7 +3423,7 @@ bool layout_table(struct box *table, int available_width,
 		return false;
 	}
 
-	memcpy(col, table->col, sizeof(col[0]) * columns);
+	memcpy(col, table->extra->col, sizeof(col[0]) * columns);
 
 	/* find margins, paddings, and borders for table and cells */
 	layout_find_dimensions(available_width, -1, table, style, 0, 0, 0, 0,
@@ -3920,7 +3925,7 @@ void layout_minmax_table(struct box *table,
 	int table_min = 0, table_max = 0;
 	int extra_fixed = 0;
 	float extra_frac = 0;
-	struct column *col = table->col;
+	struct column *col = table->extra->col;
 	struct box *row_group, *row, *cell;
 	enum css_width_e wtype;
 	css_fixed value = 0;
@@ -5038,14 +5043,15 @@ void layout_calculate_descendant_bboxes(struct box *box)
 			box->descendant_y1 = content_get_height(box->object);
 	}
 
-	if (box->iframe != NULL) {
+	if (box->extra != NULL && box->extra->iframe != NULL) {
+		struct browser_window *iframe = box->extra->iframe;
 		int x, y;
 		box_coords(box, &x, &y);
 
-		browser_window_set_position(box->iframe, x, y);
-		browser_window_set_dimensions(box->iframe,
+		browser_window_set_position(iframe, x, y);
+		browser_window_set_dimensions(iframe,
 				box->width, box->height);
-		browser_window_reformat(box->iframe, true,
+		browser_window_reformat(iframe, true,
 				box->width, box->height);
 	}
 
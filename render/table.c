@@ -30,7 +30,7 @@
 #include "render/box.h"
 #include "render/table.h"
 #include "utils/log.h"
-#include "utils/talloc.h"
+#include "utils/arena.h"
 
 /* Define to enable verbose table debug */
 #undef TABLE_DEBUG
@@ -64,23 +64,28 @@ static bool table_cell_top_process_row(struct box *cell, struct box *row,
  * Determine the column width types for a table.
  *
  * \param  table  box of type BOX_TABLE
+ * \param  arena  box tree arena to allocate the column array from
  * \return  true on success, false on memory exhaustion
  *
- * The table->col array is allocated and type and width are filled in for each
+ * The table->extra->col array is allocated and type and width are filled in for each
  * column.
  */
 
-bool table_calculate_column_types(struct box *table)
+bool table_calculate_column_types(struct box *table, struct arena *arena)
 {
 	unsigned int i, j;
 	struct column *col;
 	struct box *row_group, *row, *cell;
 
-	if (table->col)
-		/* table->col already constructed, for example frameset table */
+	if (table->extra && table->extra->col)
+		/* column data already constructed, for example frameset table */
 		return true;
 
-	table->col = col = talloc_array(table, struct column, table->columns);
+	if (box_get_extra(table, arena) == NULL)
+		return false;
+
+	table->extra->col = col = arena_alloc(arena,
+			sizeof(struct column) * table->columns);
 	if (!col)
 		return false;
 
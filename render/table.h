@@ -27,8 +27,9 @@
 #include <stdbool.h>
 
 struct box;
+struct arena;
 
-bool table_calculate_column_types(struct box *table);
+bool table_calculate_column_types(struct box *table, struct arena *arena);
 void table_used_border_for_cell(struct box *cell);
 
 #endif
@@ -118,6 +118,8 @@ static void textplain_open(struct content *c, struct browser_window *bw,
 void textplain_close(struct content *c);
 char *textplain_get_selection(struct content *c);
 struct search_context *textplain_get_search(struct content *c);
+static void textplain_get_memory_usage(const struct content *c,
+		struct content_memory_usage *usage);
 static nserror textplain_clone(const struct content *old, 
 		struct content **newc);
 static content_type textplain_content_type(void);
@@ -146,6 +148,7 @@ static const content_handler textplain_content_handler = {
 	.open = textplain_open,
 	.close = textplain_close,
 	.get_selection = textplain_get_selection,
+	.get_memory_usage = textplain_get_memory_usage,
 	.clone = textplain_clone,
 	.type = textplain_content_type,
 	.no_share = true,
@@ -418,6 +421,14 @@ bool textplain_process_data(struct content *c,
 	if (textplain_drain_input(text, stream, PARSERUTILS_NEEDDATA) == false)
 		goto no_memory;
 
+	/* Once there is enough text to fill a window, display what we
+	 * have while the rest arrives */
+	if (c->status == CONTENT_STATUS_LOADING &&
+			nsoption_bool(incremental_reflow) &&
+			text->utf8_data_size >= CHUNK) {
+		content_set_ready_incremental(c);
+	}
+
 	return true;
 
 no_memory:
@@ -448,7 +459,12 @@ bool textplain_convert(struct content *c)
 	parserutils_inputstream_destroy(stream);
 	text->inputstream = NULL;
 
-	content_set_ready(c);
+	if (c->status == CONTENT_STATUS_LOADING) {
+		content_set_ready(c);
+	} else {
+		/* Already displayed incrementally; lay out the remainder */
+		content__reformat(c, false, c->available_width, c->height);
+	}
 	content_set_done(c);
 	content_set_status(c, messages_get("Done"));
 
@@ -543,6 +559,10 @@ void textplain_reformat(struct content *c, int width, int height)
 	c->width = width;
 	c->height = line_count * textplain_line_height() + MARGIN + MARGIN;
 
+	/* Don't reflow partially fetched text more often than the minimum
+	 * reflow period */
+	c->reformat_time = wallclock() + nsoption_int(min_reflow_period);
+
 	return;
 
 no_memory:
@@ -608,8 +628,11 @@ nserror textplain_clone(const struct content *old, struct content **newc)
 		}
 	}
 
-	if (old->status == CONTENT_STATUS_READY ||
-			old->status == CONTENT_STATUS_DONE) {
+	/* Only complete conversion if the original has had all its data;
+	 * it may be READY while still arriving */
+	if (old_text->inputstream == NULL &&
+			(old->status == CONTENT_STATUS_READY ||
+			old->status == CONTENT_STATUS_DONE)) {
 		if (textplain_convert(&text->base) == false) {
 			content_destroy(&text->base);
 			return NSERROR_CLONE_FAILED;
@@ -619,6 +642,30 @@ nserror textplain_clone(const struct content *old, struct content **newc)
 	return NSERROR_OK;
 }
 
+/**
+ * Report memory used by a TEXTPLAIN content.
+ *
+ * \param  c      content of type textplain
+ * \param  usage  memory usage record to add to
+ */
+
+void textplain_get_memory_usage(const struct content *c,
+		struct content_memory_usage *usage)
+{
+	const textplain_content *text = (const textplain_content *) c;
+
+	usage->other += sizeof(textplain_content) - sizeof(struct content);
+	usage->other += text->utf8_data_allocated;
+
+	/* the physical line table is the layout of a text document; it is
+	 * grown in blocks of 1024 lines by textplain_reformat() */
+	if (text->physical_line != NULL) {
+		usage->box += sizeof(struct textplain_line) *
+				((text->physical_line_count / 1024 + 1) *
+				1024 + 3);
+	}
+}
+
 content_type textplain_content_type(void)
 {
 	return CONTENT_TEXTPLAIN;
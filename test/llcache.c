@@ -105,6 +105,7 @@ char *url_to_path(const char *url)
  * Things that are absolutely not reasonable, and should disappear            *
  ******************************************************************************/
 
+#include "desktop/browser.h"
 #include "desktop/cookies.h"
 #include "desktop/gui.h"
 #include "desktop/tree.h"
@@ -149,6 +150,20 @@ nsurl* gui_get_resource_url(const char *path)
 	return NULL;
 }
 
+/* desktop/browser.h -- used by about:memory handler
+ *
+ * Simpler to stub these than haul in the whole of the browser window code
+ */
+struct browser_window *browser_window_get_next_root(struct browser_window *bw)
+{
+	return NULL;
+}
+
+void browser_window_get_memory_usage(struct browser_window *bw,
+		struct content_memory_usage *usage)
+{
+}
+
 /******************************************************************************
  * test: protocol handler                                                     *
  ******************************************************************************/
@@ -176,6 +191,11 @@ void test_finalise(lwc_string *scheme)
 	/* Nothing to do */
 }
 
+bool test_can_fetch(const nsurl *url)
+{
+	return true;
+}
+
 void *test_setup_fetch(struct fetch *parent, nsurl *url, bool only_2xx, 
 		const char *post_urlenc, 
 		const struct fetch_multipart_data *post_multipart, 
@@ -217,7 +237,13 @@ void test_free_fetch(void *handle)
 
 void test_process(test_context *ctx)
 {
-	/** \todo Implement */
+	fetch_msg msg;
+
+	/* Every test: URL requires authentication */
+	msg.type = FETCH_AUTH;
+	msg.data.auth.realm = "test";
+
+	fetch_send_callback(&msg, ctx->parent);
 }
 
 void test_poll(lwc_string *scheme)
@@ -247,12 +273,17 @@ void test_poll(lwc_string *scheme)
  * The actual test code                                                       *
  ******************************************************************************/
 
+static int auth_queries;
+
 nserror query_handler(const llcache_query *query, void *pw,
 		llcache_query_response cb, void *cbpw)
 {
 	/* I'm too lazy to actually implement this. It should queue the query, 
 	 * then deliver the response from main(). */
 
+	if (query->type == LLCACHE_QUERY_AUTH)
+		auth_queries++;
+
 	return NSERROR_OK;
 }
 
@@ -268,12 +299,57 @@ nserror event_handler(llcache_handle *handle,
 		fprintf(stdout, "%p : %s\n", handle, event_names[event->type]);
 
 	/* Inform main() that the fetch completed */
-	if (event->type == LLCACHE_EVENT_DONE)
+	if (event->type == LLCACHE_EVENT_DONE ||
+			event->type == LLCACHE_EVENT_ERROR)
 		*done = true;
 
 	return NSERROR_OK;
 }
 
+/**
+ * Check that a navigation which joins a speculative fetch in progress is
+ * asked for authentication, rather than failing as the prefetch would.
+ */
+static bool test_prefetch_auth(void)
+{
+	llcache_handle *prefetch, *navigate;
+	bool prefetch_done = false, navigate_done = false;
+	nsurl *url;
+	int i;
+
+	if (nsurl_create("test://auth.example/", &url) != NSERROR_OK)
+		return false;
+
+	if (llcache_handle_retrieve(url, LLCACHE_RETRIEVE_SPECULATIVE, NULL,
+			NULL, event_handler, &prefetch_done, &prefetch) !=
+			NSERROR_OK) {
+		nsurl_unref(url);
+		return false;
+	}
+
+	/* Join the prefetch before its fetch has replied */
+	if (llcache_handle_retrieve(url, LLCACHE_RETRIEVE_VERIFIABLE, NULL,
+			NULL, event_handler, &navigate_done, &navigate) !=
+			NSERROR_OK) {
+		llcache_handle_release(prefetch);
+		nsurl_unref(url);
+		return false;
+	}
+
+	for (i = 0; i < 100 && auth_queries == 0 && navigate_done == false;
+			i++)
+		llcache_poll();
+
+	fprintf(stdout, "prefetch auth: %d queries, %s\n", auth_queries,
+			navigate_done ? "failed" : "waiting");
+
+	llcache_handle_release(navigate);
+	llcache_handle_release(prefetch);
+	nsurl_unref(url);
+
+	return auth_queries == 1 && navigate_done == false;
+}
+
 int main(int argc, char **argv)
 {
 	nserror error;
@@ -291,7 +367,8 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
-	fetch_add_fetcher(scheme, test_initialise, test_setup_fetch, 
+	fetch_add_fetcher(scheme, test_initialise, test_can_fetch,
+			test_setup_fetch, 
 			test_start_fetch, test_abort_fetch, test_free_fetch, 
 			test_poll, test_finalise);
 
@@ -302,6 +379,11 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
+	if (test_prefetch_auth() == false) {
+		fprintf(stderr, "Navigation joining prefetch not queried\n");
+		return 1;
+	}
+
 	if (nsurl_create("http://www.netsurf-browser.org", &url) != NSERROR_OK) {
 		fprintf(stderr, "Failed creating url\n");
 		return 1;
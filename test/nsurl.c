@@ -2,12 +2,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <libwapcaplet/libwapcaplet.h>
 
 #include "desktop/netsurf.h"
 #include "utils/log.h"
 #include "utils/nsurl.h"
+#include "utils/utils.h"
 
 /* desktop/netsurf.h */
 bool verbose_log = true;
@@ -23,6 +25,13 @@ struct test_triplets {
 	const char* res;
 };
 
+struct test_compare {
+	const char* test1;
+	const char* test2;
+	nsurl_component parts;
+	bool res;
+};
+
 static void netsurf_lwc_iterator(lwc_string *str, void *pw)
 {
 	LOG(("[%3u] %.*s", str->refcnt, (int) lwc_string_length(str),
@@ -142,12 +151,35 @@ static const struct test_pairs join_tests[] = {
 	{ "  /  ",		"http://a/" },
 	{ "  ?  ",		"http://a/b/c/d;p?" },
 	{ "  h  ",		"http://a/b/c/h" },
+	/* Empty path segments, which the fast join must leave alone */
+	{ "a//b",		"http://b/" },
+	{ "/a//b",		"http://a/a//b" },
+	{ "a/b//",		"http://a/b/c/a/b//" },
+	{ "a?x//y",		"http://a/b/c/a?x//y" },
+	{ "a#//",		"http://a/b/c/a#//" },
 	/* [1] Extra slash beyond rfc3986 5.4.1 example, since we're
 	 *     testing normalisation in addition to joining */
 	/* [2] Using the strict parsers option */
 	{ NULL,			NULL }
 };
 
+/* Relative URLs of the sort found in documents, for timing nsurl_join */
+static const char *join_bench[] = {
+	"/",
+	"/images/logo.png",
+	"/style/main.css?v=3",
+	"page2.html",
+	"sub/dir/page.html#section",
+	"?page=2",
+	"#top",
+	"../up/page.html",
+	"http://www.example.org/elsewhere/",
+	"page with spaces.html",
+	NULL
+};
+
+#define JOIN_BENCH_ROUNDS 20000
+
 static const struct test_triplets replace_query_tests[] = {
 	{ "http://netsurf-browser.org/?magical=true",
 	  "?magical=true&result=win",
@@ -168,6 +200,22 @@ static const struct test_triplets replace_query_tests[] = {
 	{ NULL,	NULL, NULL }
 };
 
+static const struct test_compare compare_tests[] = {
+	{ "http://a/b/c/d;p?q", "http://a/b/c/d;p?q", NSURL_COMPLETE, true },
+	{ "http://a/b/c/d;p?q", "http://a:80/b/c/d;p?q", NSURL_COMPLETE, true },
+	{ "http://a/b/c/d;p?q", "http://a/b/c/d;p?q#s", NSURL_COMPLETE, true },
+	{ "http://a/b/c/d;p?q#s", "http://a/b/c/d;p?q#t", NSURL_COMPLETE, true },
+	{ "http://a/b/c/d;p?q#s", "http://a/b/c/d;p?q#t",
+			NSURL_WITH_FRAGMENT, false },
+	{ "http://a/b/c/d;p?q", "http://a/b/c/d;p?r", NSURL_COMPLETE, false },
+	{ "http://a/b/c/d;p?q", "http://a/b/c/d;p?r", NSURL_HOST, true },
+	{ "http://a/b/c/d;p?q", "https://a/b/c/d;p?q", NSURL_COMPLETE, false },
+	{ "http://a/b/c/d;p?q", "https://a/b/c/d;p?q",
+			NSURL_COMPLETE & ~NSURL_SCHEME, true },
+	{ "http://u@a/b", "http://a/b", NSURL_COMPLETE, false },
+	{ NULL, NULL, 0, false }
+};
+
 /**
  * Test nsurl
  */
@@ -180,6 +228,7 @@ int main(void)
 	const char *url;
 	const struct test_pairs *test;
 	const struct test_triplets *ttest;
+	const struct test_compare *ctest;
 	int passed = 0;
 	int count = 0;
 
@@ -191,6 +240,8 @@ int main(void)
 	if (nsurl_get(base, NSURL_WITH_FRAGMENT, &string, &len) != NSERROR_OK) {
 		LOG(("Failed to get string"));
 	} else {
+		/* Built with NSURL_JOIN_CHECK, joins which take the fast
+		 * path are checked against the general join */
 		LOG(("Testing nsurl_join with base %s", string));
 		free(string);
 	}
@@ -231,10 +282,23 @@ int main(void)
 		if (nsurl_create(test->test, &base) != NSERROR_OK) {
 			LOG(("Failed to create URL:\n\t\t%s.", test->test));
 		} else {
-			if (strcmp(nsurl_access(base), test->res) == 0) {
-				LOG(("\tPASS: \"%s\"\t--> %s",
-					test->test, nsurl_access(base)));
-				passed++;
+			/* A normalised URL must create itself, as
+			 * creating it may give the existing URL */
+			if (strcmp(nsurl_access(base), test->res) == 0 &&
+					nsurl_create(test->res, &joined) ==
+					NSERROR_OK) {
+				if (strcmp(nsurl_access(joined),
+						test->res) == 0) {
+					LOG(("\tPASS: \"%s\"\t--> %s",
+						test->test,
+						nsurl_access(base)));
+					passed++;
+				} else {
+					LOG(("\tFAIL: \"%s\"\t--> %s",
+						test->res,
+						nsurl_access(joined)));
+				}
+				nsurl_unref(joined);
 			} else {
 				LOG(("\tFAIL: \"%s\"\t--> %s",
 					test->test, nsurl_access(base)));
@@ -279,6 +343,156 @@ int main(void)
 		count++;
 	}
 
+	/* Compare tests */
+	LOG(("Testing nsurl_compare"));
+	for (ctest = compare_tests; ctest->test1 != NULL; ctest++) {
+		if (nsurl_create(ctest->test1, &base) != NSERROR_OK) {
+			LOG(("Failed to create URL:\n\t\t%s.", ctest->test1));
+		} else if (nsurl_create(ctest->test2, &joined) != NSERROR_OK) {
+			LOG(("Failed to create URL:\n\t\t%s.", ctest->test2));
+			nsurl_unref(base);
+		} else {
+			bool match = nsurl_compare(base, joined, ctest->parts);
+
+			/* URLs which match in full must hash the same */
+			if (match == ctest->res && (match == false ||
+					(ctest->parts & NSURL_COMPLETE) !=
+					NSURL_COMPLETE ||
+					nsurl_hash(base) == nsurl_hash(joined))) {
+				LOG(("\tPASS: \"%s\" vs \"%s\"",
+					ctest->test1, ctest->test2));
+				passed++;
+			} else {
+				LOG(("\tFAIL: \"%s\" vs \"%s\"",
+					ctest->test1, ctest->test2));
+				LOG(("\t\tExpecting %s",
+					ctest->res ? "match" : "mismatch"));
+			}
+
+			nsurl_unref(joined);
+			nsurl_unref(base);
+		}
+		count++;
+	}
+
+	/* Interning tests */
+	LOG(("Testing URL interning"));
+	if (nsurl_create("HTTP://Example.COM", &base) != NSERROR_OK) {
+		LOG(("Failed to create URL"));
+	} else {
+		nsurl *other;
+		lwc_string *frag;
+
+		/* Equivalent URLs share an object */
+		if (nsurl_create("http://example.com/", &joined) ==
+				NSERROR_OK) {
+			if (joined == base) {
+				LOG(("\tPASS: equivalent URLs shared"));
+				passed++;
+			} else {
+				LOG(("\tFAIL: equivalent URLs not shared"));
+			}
+			nsurl_unref(joined);
+		}
+		count++;
+
+		/* URLs made with unnormalised parts must not be returned
+		 * when creating from their strings */
+		if (lwc_intern_string("x y", SLEN("x y"), &frag) ==
+				lwc_error_ok) {
+			if (nsurl_refragment(base, frag, &joined) ==
+					NSERROR_OK) {
+				if (nsurl_create(nsurl_access(joined),
+						&other) == NSERROR_OK) {
+					if (other != joined) {
+						LOG(("\tPASS: %s not shadowed",
+							nsurl_access(other)));
+						passed++;
+					} else {
+						LOG(("\tFAIL: %s shadowed",
+							nsurl_access(other)));
+					}
+					nsurl_unref(other);
+				}
+				nsurl_unref(joined);
+			}
+			lwc_string_unref(frag);
+		}
+		count++;
+
+		if (nsurl_replace_query(base, "?q=a b", &joined) ==
+				NSERROR_OK) {
+			if (nsurl_create(nsurl_access(joined), &other) ==
+					NSERROR_OK) {
+				if (other != joined) {
+					LOG(("\tPASS: %s not shadowed",
+						nsurl_access(other)));
+					passed++;
+				} else {
+					LOG(("\tFAIL: %s shadowed",
+						nsurl_access(other)));
+				}
+				nsurl_unref(other);
+			}
+			nsurl_unref(joined);
+		}
+		count++;
+
+		nsurl_unref(base);
+
+		/* Releasing the last reference removes the URL from the
+		 * table, so a new create must not find the freed one */
+		if (nsurl_create("http://example.com/", &base) == NSERROR_OK) {
+			if (nsurl_create("HTTP://EXAMPLE.COM/", &joined) ==
+					NSERROR_OK) {
+				if (joined == base && strcmp(
+						nsurl_access(base),
+						"http://example.com/") == 0) {
+					LOG(("\tPASS: released URL recreated"));
+					passed++;
+				} else {
+					LOG(("\tFAIL: released URL not "
+							"recreated"));
+				}
+				nsurl_unref(joined);
+			}
+			nsurl_unref(base);
+		}
+		count++;
+	}
+
+	/* Join benchmark */
+	LOG(("Timing nsurl_join"));
+#ifdef NSURL_JOIN_CHECK
+	LOG(("\tFast joins are also joined the general way"));
+#endif
+	if (nsurl_create("http://www.example.com/dir/index.html?q#f",
+			&base) != NSERROR_OK) {
+		LOG(("Failed to create URL"));
+	} else {
+		const char **rel;
+		clock_t start = clock();
+		double secs;
+		int joins = 0;
+		int round;
+
+		for (round = 0; round < JOIN_BENCH_ROUNDS; round++) {
+			for (rel = join_bench; *rel != NULL; rel++) {
+				if (nsurl_join(base, *rel, &joined) ==
+						NSERROR_OK) {
+					nsurl_unref(joined);
+					joins++;
+				}
+			}
+		}
+
+		secs = (double) (clock() - start) / CLOCKS_PER_SEC;
+		LOG(("\t%d joins in %.3fs: %.0f joins per second", joins,
+				secs, (secs > 0) ? joins / secs : 0));
+
+		nsurl_unref(base);
+	}
+
 	if (passed == count) {
 		LOG(("Testing complete: SUCCESS"));
 	} else {
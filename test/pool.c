@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "desktop/netsurf.h"
+#include "utils/log.h"
+#include "utils/pool.h"
+
+/* desktop/netsurf.h */
+bool verbose_log = true;
+
+/* Objects of about the size of an llcache object */
+#define ITEM_SIZE 200
+
+/* Objects live at once in each benchmark round */
+#define BENCH_ITEMS 2000
+
+#define BENCH_ROUNDS 500
+
+static void *items[BENCH_ITEMS];
+
+static double time_calloc(void)
+{
+	clock_t start = clock();
+	int round, i;
+
+	for (round = 0; round < BENCH_ROUNDS; round++) {
+		for (i = 0; i < BENCH_ITEMS; i++)
+			items[i] = calloc(1, ITEM_SIZE);
+		for (i = 0; i < BENCH_ITEMS; i++)
+			free(items[i]);
+	}
+
+	return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+static double time_pool(struct pool *pool)
+{
+	clock_t start = clock();
+	int round, i;
+
+	for (round = 0; round < BENCH_ROUNDS; round++) {
+		for (i = 0; i < BENCH_ITEMS; i++)
+			items[i] = pool_alloc(pool);
+		for (i = 0; i < BENCH_ITEMS; i++)
+			pool_free(pool, items[i]);
+	}
+
+	return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(void)
+{
+	struct pool *pool;
+	struct pool_stats stats;
+	char *a, *b;
+	double secs_calloc, secs_pool;
+	bool passed = true;
+
+	pool = pool_create("test", ITEM_SIZE);
+	if (pool == NULL) {
+		LOG(("Failed to create pool"));
+		return 1;
+	}
+
+	LOG(("Testing allocation and reuse"));
+
+	a = pool_alloc(pool);
+	b = pool_alloc(pool);
+	if (a == NULL || b == NULL || a == b) {
+		LOG(("\tFAIL: allocation"));
+		return 1;
+	}
+
+	memset(a, 0xff, ITEM_SIZE);
+	pool_free(pool, a);
+
+	/* The most recently freed object is reused, zeroed */
+	if (pool_alloc(pool) != a || a[0] != 0 || a[ITEM_SIZE - 1] != 0) {
+		LOG(("\tFAIL: freed object not reused"));
+		passed = false;
+	}
+
+	pool_free(pool, a);
+	pool_free(pool, b);
+
+	pool_get_stats(pool, &stats);
+	if (stats.in_use != 0 || stats.peak != 2 || stats.allocs != 3 ||
+			stats.reused != 1 || stats.item_size < ITEM_SIZE) {
+		LOG(("\tFAIL: statistics %u in use, peak %u, %lu allocs, "
+				"%lu reused", stats.in_use, stats.peak,
+				stats.allocs, stats.reused));
+		passed = false;
+	} else {
+		LOG(("\tPASS"));
+	}
+
+	LOG(("Timing %d allocations and frees of %d byte objects",
+			BENCH_ITEMS, ITEM_SIZE));
+
+	secs_calloc = time_calloc();
+	secs_pool = time_pool(pool);
+
+	LOG(("\tcalloc/free: %.3fs, pool: %.3fs (%.1f times faster)",
+			secs_calloc, secs_pool,
+			(secs_pool > 0) ? secs_calloc / secs_pool : 0));
+
+	pool_get_stats(pool, &stats);
+	LOG(("\t%u chunks for a peak of %u objects", stats.chunks,
+			stats.peak));
+
+	pool_destroy(pool);
+
+	if (passed) {
+		LOG(("Testing complete: SUCCESS"));
+	} else {
+		LOG(("Testing complete: FAILURE"));
+	}
+
+	return passed ? 0 : 1;
+}
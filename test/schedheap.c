@@ -0,0 +1,148 @@
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "desktop/netsurf.h"
+#include "utils/log.h"
+#include "utils/schedheap.h"
+
+/* desktop/netsurf.h */
+bool verbose_log = true;
+
+/* Callbacks live while timing schedule and remove */
+#define BENCH_LIVE 5000
+
+#define BENCH_PAIRS 1000000
+
+#define MAX_RUN 100
+
+static int run_order[MAX_RUN];
+static int run_count;
+
+static void record(void *p)
+{
+	if (run_count < MAX_RUN)
+		run_order[run_count] = (int) (intptr_t) p;
+	run_count++;
+}
+
+static void reschedule(void *p)
+{
+	run_count++;
+	schedheap_schedule(0, reschedule, p);
+}
+
+static void never(void *p)
+{
+}
+
+int main(void)
+{
+	bool passed = true;
+	clock_t start;
+	int ms;
+	int i;
+
+	LOG(("Testing ordering, replacement and removal"));
+
+	for (i = 0; i < 50; i++)
+		schedheap_schedule(0, record, (void *) (intptr_t) i);
+
+	/* Scheduling again replaces, so 3 runs once and last */
+	schedheap_schedule(0, record, (void *) (intptr_t) 3);
+	schedheap_remove(record, (void *) (intptr_t) 7);
+
+	schedheap_run();
+
+	if (run_count != 49 || run_order[48] != 3) {
+		LOG(("\tFAIL: %d callbacks run", run_count));
+		passed = false;
+	} else {
+		int expected = 0;
+
+		for (i = 0; i < 48; i++) {
+			while (expected == 3 || expected == 7)
+				expected++;
+			if (run_order[i] != expected++)
+				break;
+		}
+
+		if (i == 48) {
+			LOG(("\tPASS"));
+		} else {
+			LOG(("\tFAIL: callback %d ran at %d", run_order[i], i));
+			passed = false;
+		}
+	}
+
+	LOG(("Testing deadlines"));
+
+	run_count = 0;
+	schedheap_schedule(2, record, (void *) (intptr_t) 2);
+	schedheap_schedule(1, record, (void *) (intptr_t) 1);
+	schedheap_schedule(0, record, (void *) (intptr_t) 0);
+
+	while ((ms = schedheap_run()) >= 0)
+		poll(NULL, 0, ms);
+
+	if (run_count == 3 && run_order[0] == 0 && run_order[1] == 1 &&
+			run_order[2] == 2) {
+		LOG(("\tPASS"));
+	} else {
+		LOG(("\tFAIL: %d callbacks run", run_count));
+		passed = false;
+	}
+
+	LOG(("Testing callback which reschedules itself"));
+
+	run_count = 0;
+	schedheap_schedule(0, reschedule, NULL);
+	ms = schedheap_run();
+	schedheap_remove(reschedule, NULL);
+
+	if (run_count == 1 && ms == 0) {
+		LOG(("\tPASS"));
+	} else {
+		LOG(("\tFAIL: ran %d times, next in %dms", run_count, ms));
+		passed = false;
+	}
+
+	if (schedheap_run() != -1) {
+		LOG(("\tFAIL: callbacks left after removal"));
+		passed = false;
+	}
+
+	LOG(("Timing schedule and remove"));
+
+	for (i = 0; i < BENCH_LIVE; i++)
+		schedheap_schedule(1000 + i, never, (void *) (intptr_t) i);
+
+	start = clock();
+	for (i = 0; i < BENCH_PAIRS; i++) {
+		void *p = (void *) (intptr_t) (BENCH_LIVE + i % BENCH_LIVE);
+
+		schedheap_schedule(i % 1000, never, p);
+		schedheap_remove(never, p);
+	}
+	LOG(("\t%d schedule/remove pairs with %d live in %.3fs",
+			BENCH_PAIRS, BENCH_LIVE,
+			(double) (clock() - start) / CLOCKS_PER_SEC));
+
+	for (i = 0; i < BENCH_LIVE; i++)
+		schedheap_remove(never, (void *) (intptr_t) i);
+
+	if (schedheap_run() != -1) {
+		LOG(("\tFAIL: callbacks left after removal"));
+		passed = false;
+	}
+
+	if (passed) {
+		LOG(("Testing complete: SUCCESS"));
+	} else {
+		LOG(("Testing complete: FAILURE"));
+	}
+
+	return passed ? 0 : 1;
+}
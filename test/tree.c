@@ -0,0 +1,465 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "content/content.h"
+#include "content/hlcache.h"
+#include "css/utils.h"
+#include "desktop/gui.h"
+#include "desktop/knockout.h"
+#include "desktop/plotters.h"
+#include "desktop/textarea.h"
+#include "desktop/tree.h"
+#include "image/bitmap.h"
+#include "render/font.h"
+#include "utils/log.h"
+#include "utils/nsurl.h"
+#include "utils/url.h"
+#include "utils/utils.h"
+
+/******************************************************************************
+ * Things that we'd reasonably expect to have to implement                    *
+ ******************************************************************************/
+
+/* desktop/netsurf.h */
+bool verbose_log = true;
+
+/* utils/utils.h */
+void warn_user(const char *warning, const char *detail)
+{
+	fprintf(stderr, "%s %s\n", warning, detail);
+}
+
+/* utils/utils.h */
+bool path_add_part(char *path, int length, const char *newpart)
+{
+	return false;
+}
+
+/* utils/url.h */
+char *path_to_url(const char *path)
+{
+	return NULL;
+}
+
+/* css/utils.h */
+css_fixed nscss_screen_dpi = INTTOFIX(90);
+
+/* desktop/gui.h */
+colour gui_system_colour_char(const char *name)
+{
+	return 0;
+}
+
+/* render/font.h: every character is 8 pixels wide */
+static int font_width_calls;
+
+static bool font_width(const plot_font_style_t *fstyle, const char *string,
+		size_t length, int *width)
+{
+	font_width_calls++;
+	*width = length * 8;
+	return true;
+}
+
+static bool font_position(const plot_font_style_t *fstyle,
+		const char *string, size_t length, int x, size_t *char_offset,
+		int *actual_x)
+{
+	*char_offset = x / 8 > (int) length ? length : x / 8;
+	*actual_x = *char_offset * 8;
+	return true;
+}
+
+const struct font_functions nsfont = {
+	font_width,
+	font_position,
+	font_position
+};
+
+/******************************************************************************
+ * Things that are absolutely not reasonable, and should disappear            *
+ ******************************************************************************/
+
+/* desktop/knockout.h */
+bool knockout_plot_start(const struct redraw_context *ctx,
+		struct redraw_context *knk_ctx)
+{
+	return true;
+}
+
+/* desktop/knockout.h */
+bool knockout_plot_end(void)
+{
+	return true;
+}
+
+/* content/content.h */
+content_status content_get_status(struct hlcache_handle *c)
+{
+	return CONTENT_STATUS_ERROR;
+}
+
+/* content/content.h */
+bool content_redraw(struct hlcache_handle *h, struct content_redraw_data *data,
+		const struct rect *clip, const struct redraw_context *ctx)
+{
+	return true;
+}
+
+/* content/hlcache.h */
+nserror hlcache_handle_retrieve(nsurl *url, uint32_t flags,
+		nsurl *referer, llcache_post_data *post,
+		hlcache_handle_callback cb, void *pw,
+		hlcache_child_context *child,
+		content_type accepted_types, hlcache_handle **result)
+{
+	return NSERROR_NOT_FOUND;
+}
+
+/* image/bitmap.h */
+int bitmap_get_width(void *bitmap)
+{
+	return 0;
+}
+
+/* image/bitmap.h */
+int bitmap_get_height(void *bitmap)
+{
+	return 0;
+}
+
+/* utils/nsurl.h */
+nserror nsurl_create(const char * const url_s, nsurl **url)
+{
+	return NSERROR_NOMEM;
+}
+
+/* utils/nsurl.h */
+void nsurl_unref(nsurl *url)
+{
+}
+
+/* desktop/textarea.h */
+struct textarea *textarea_create(const textarea_flags flags,
+		const textarea_setup *setup,
+		textarea_client_callback callback, void *data)
+{
+	return NULL;
+}
+
+void textarea_destroy(struct textarea *ta)
+{
+}
+
+bool textarea_set_text(struct textarea *ta, const char *text)
+{
+	return false;
+}
+
+int textarea_get_text(struct textarea *ta, char *buf, unsigned int len)
+{
+	return -1;
+}
+
+void textarea_redraw(struct textarea *ta, int x, int y, colour bg, float scale,
+		const struct rect *clip, const struct redraw_context *ctx)
+{
+}
+
+bool textarea_keypress(struct textarea *ta, uint32_t key)
+{
+	return false;
+}
+
+textarea_mouse_status textarea_mouse_action(struct textarea *ta,
+		browser_mouse_state mouse, int x, int y)
+{
+	return TEXTAREA_MOUSE_NONE;
+}
+
+void textarea_get_dimensions(struct textarea *ta, int *width, int *height)
+{
+	*width = *height = 0;
+}
+
+/******************************************************************************
+ * The actual test code                                                       *
+ ******************************************************************************/
+
+/* A plotter which records where expansion toggles and titles are drawn */
+
+#define MAX_TITLES 8
+
+static int toggle_count;
+static int toggle_x, toggle_y;
+
+static struct {
+	char text[32];
+	int x, y;
+} titles[MAX_TITLES];
+static int title_count;
+
+static bool plot_clip(const struct rect *clip)
+{
+	return true;
+}
+
+static bool plot_line(int x0, int y0, int x1, int y1,
+		const plot_style_t *pstyle)
+{
+	return true;
+}
+
+static bool plot_rectangle(int x0, int y0, int x1, int y1,
+		const plot_style_t *pstyle)
+{
+	/* Expansion toggles are the only 9 pixel squares */
+	if (x1 - x0 == 9 && y1 - y0 == 9) {
+		toggle_x = x0 + 4;
+		toggle_y = y0 + 4;
+		toggle_count++;
+	}
+	return true;
+}
+
+static bool plot_text(int x, int y, const char *text, size_t length,
+		const plot_font_style_t *fstyle)
+{
+	if (title_count < MAX_TITLES && length < sizeof(titles[0].text)) {
+		memcpy(titles[title_count].text, text, length);
+		titles[title_count].text[length] = '\0';
+		titles[title_count].x = x;
+		titles[title_count].y = y;
+		title_count++;
+	}
+	return true;
+}
+
+static const struct plotter_table plotters = {
+	.clip = plot_clip,
+	.line = plot_line,
+	.rectangle = plot_rectangle,
+	.text = plot_text
+};
+
+static const struct redraw_context ctx = {
+	.interactive = true,
+	.background_images = true,
+	.plot = &plotters
+};
+
+static void draw(struct tree *tree)
+{
+	toggle_count = 0;
+	title_count = 0;
+	tree_draw(tree, 0, 0, 0, 0, 1000, 1000, &ctx);
+}
+
+static bool find_title(const char *text, int *x, int *y)
+{
+	int i;
+
+	for (i = 0; i < title_count; i++) {
+		if (strcmp(titles[i].text, text) == 0) {
+			*x = titles[i].x + 4;
+			*y = titles[i].y - 4;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Tree callbacks */
+
+static void redraw_request(int x, int y, int width, int height, void *data)
+{
+}
+
+static int tree_height;
+
+static void resized(struct tree *tree, int width, int height, void *data)
+{
+	tree_height = height;
+}
+
+static void scroll_visible(int y, int height, void *data)
+{
+}
+
+static void get_window_dimensions(int *width, int *height, void *data)
+{
+	*width = *height = 1000;
+}
+
+static const struct treeview_table tree_callbacks = {
+	redraw_request,
+	resized,
+	scroll_visible,
+	get_window_dimensions
+};
+
+/* Size of the folder used to time layout and redraw */
+#define LARGE_FOLDER 20000
+
+#define REDRAW_ROUNDS 1000
+
+/* A folder whose children are created when it is first populated */
+
+static struct tree *tree;
+static int populated;
+
+static node_callback_resp populate(void *user_data,
+		struct node_msg_data *msg_data)
+{
+	if (msg_data->msg != NODE_POPULATE)
+		return NODE_CALLBACK_NOT_HANDLED;
+
+	populated++;
+	tree_create_leaf_node(tree, msg_data->node, strdup(user_data),
+			false, false, false);
+
+	return NODE_CALLBACK_HANDLED;
+}
+
+static struct node *deferred_folder(const char *title, const char *child)
+{
+	struct node *folder;
+
+	folder = tree_create_folder_node(tree, tree_get_root(tree),
+			strdup(title), false, false, false);
+	if (folder == NULL)
+		return NULL;
+
+	tree_set_node_user_callback(folder, populate, (void *) child);
+	tree_set_node_deferred(folder, true);
+
+	return folder;
+}
+
+int main(void)
+{
+	struct node *folder;
+	bool passed = true;
+	int x, y;
+
+	tree = tree_create(0, &tree_callbacks, NULL);
+	if (tree == NULL) {
+		LOG(("Failed to create tree"));
+		return 1;
+	}
+	tree_set_redraw(tree, true);
+
+	LOG(("Testing expansion toggle of deferred folder"));
+
+	folder = deferred_folder("Toggled", "Toggled child");
+	draw(tree);
+
+	if (toggle_count != 1 || populated != 0) {
+		LOG(("\tFAIL: %d toggles drawn, %d populated", toggle_count,
+				populated));
+		passed = false;
+	} else {
+		tree_mouse_action(tree, BROWSER_MOUSE_CLICK_1,
+				toggle_x, toggle_y);
+		draw(tree);
+
+		if (populated == 1 && tree_node_get_child(folder) != NULL &&
+				find_title("Toggled child", &x, &y)) {
+			LOG(("\tPASS"));
+		} else {
+			LOG(("\tFAIL: toggle did not open folder"));
+			passed = false;
+		}
+	}
+
+	tree_delete_node(tree, folder, false);
+	populated = 0;
+
+	LOG(("Testing double click on deferred folder"));
+
+	folder = deferred_folder("Clicked", "Clicked child");
+	draw(tree);
+
+	if (find_title("Clicked", &x, &y) == false) {
+		LOG(("\tFAIL: folder not drawn"));
+		passed = false;
+	} else {
+		tree_mouse_action(tree, BROWSER_MOUSE_DOUBLE_CLICK |
+				BROWSER_MOUSE_CLICK_1, x, y);
+		draw(tree);
+
+		if (populated == 1 && tree_node_get_child(folder) != NULL &&
+				find_title("Clicked child", &x, &y)) {
+			LOG(("\tPASS"));
+		} else {
+			LOG(("\tFAIL: double click did not open folder"));
+			passed = false;
+		}
+	}
+
+	LOG(("Testing deletion of deferred folder"));
+
+	populated = 0;
+	folder = deferred_folder("Deleted", "Deleted child");
+	tree_delete_node(tree, folder, false);
+
+	if (populated == 1) {
+		LOG(("\tPASS"));
+	} else {
+		LOG(("\tFAIL: folder not populated before deletion"));
+		passed = false;
+	}
+
+	LOG(("Testing layout of large folder"));
+
+	tree_set_redraw(tree, false);
+	font_width_calls = 0;
+
+	folder = tree_create_folder_node(tree, tree_get_root(tree),
+			strdup("Large"), false, false, false);
+	for (x = 0; x < LARGE_FOLDER; x++) {
+		char title[16];
+
+		snprintf(title, sizeof title, "Leaf %d", x);
+		tree_create_leaf_node(tree, folder, strdup(title),
+				false, false, false);
+	}
+	tree_set_node_expanded(tree, folder, true, false, false);
+
+	/* Text isn't measured until the tree is laid out for drawing */
+	LOG(("\t%d leaves added with %d measurements", LARGE_FOLDER,
+			font_width_calls));
+	if (font_width_calls < LARGE_FOLDER) {
+		LOG(("\tPASS"));
+	} else {
+		LOG(("\tFAIL: text measured while not redrawing"));
+		passed = false;
+	}
+
+	tree_set_redraw(tree, true);
+	draw(tree);
+
+	LOG(("Timing redraw of large folder"));
+	{
+		clock_t start = clock();
+
+		for (x = 0; x < REDRAW_ROUNDS; x++)
+			tree_draw(tree, 0, 0, 0, tree_height / 2, 400, 200,
+					&ctx);
+
+		LOG(("\t%d redraws of a 200px clip in %.3fs", REDRAW_ROUNDS,
+				(double) (clock() - start) / CLOCKS_PER_SEC));
+	}
+
+	tree_delete(tree);
+
+	if (passed) {
+		LOG(("Testing complete: SUCCESS"));
+	} else {
+		LOG(("Testing complete: FAILURE"));
+	}
+
+	return passed ? 0 : 1;
+}
@@ -26,6 +26,7 @@
 #include <string.h>
 #include <strings.h>
 #include <time.h>
+#include <unistd.h>
 
 #include <curl/curl.h>
 
@@ -41,6 +42,7 @@
 #include "utils/log.h"
 #include "utils/corestrings.h"
 #include "utils/filename.h"
+#include "utils/schedule.h"
 #include "utils/url.h"
 #include "utils/utils.h"
 
@@ -61,6 +63,33 @@ void cookies_remove(const struct cookie_data *data)
 {
 }
 
+static schedule_callback_fn scheduled_callback;
+
+void schedule(int t, schedule_callback_fn callback, void *p)
+{
+	scheduled_callback = callback;
+}
+
+void schedule_remove(schedule_callback_fn callback, void *p)
+{
+	if (scheduled_callback == callback)
+		scheduled_callback = NULL;
+}
+
+static long test_file_size(const char *filename)
+{
+	FILE *fp = fopen(filename, "rb");
+	long size = -1;
+
+	if (fp != NULL) {
+		fseek(fp, 0, SEEK_END);
+		size = ftell(fp);
+		fclose(fp);
+	}
+
+	return size;
+}
+
 void die(const char *error)
 {
 	printf("die: %s\n", error);
@@ -144,12 +173,63 @@ char *test_urldb_get_cookie(const char *url)
 	nsurl *nsurl = make_url(url);
 	char *ret;
 
-	ret = urldb_get_cookie(nsurl);
+	ret = urldb_get_cookie(nsurl, true);
 	nsurl_unref(nsurl);
 
 	return ret;
 }
 
+#define MAX_COMPLETIONS 8
+
+static char *completions[MAX_COMPLETIONS];
+static int completion_count;
+
+static bool test_completion_cb(nsurl *url, const struct url_data *data)
+{
+	if (completion_count < MAX_COMPLETIONS)
+		completions[completion_count] = strdup(nsurl_access(url));
+	completion_count++;
+
+	return true;
+}
+
+/* Return the number of completions of prefix, which are put in completions */
+int test_urldb_complete(const char *prefix)
+{
+	int i;
+
+	for (i = 0; i < completion_count && i < MAX_COMPLETIONS; i++)
+		free(completions[i]);
+	completion_count = 0;
+
+	urldb_iterate_partial(prefix, test_completion_cb);
+
+	return completion_count;
+}
+
+static nsurl *iterated_url;
+static bool iterated_found;
+
+static bool test_iterate_cb(nsurl *url, const struct url_data *data)
+{
+	if (nsurl_compare(url, iterated_url, NSURL_COMPLETE)) {
+		assert(data->visits == 1 && strcmp(data->title, "Saved page") == 0);
+		iterated_found = true;
+	}
+
+	return true;
+}
+
+void test_urldb_visit(const char *url, int visits)
+{
+	nsurl *nsurl = make_url(url);
+
+	assert(urldb_add_url(nsurl));
+	while (visits-- > 0)
+		urldb_update_url_visit_data(nsurl);
+	nsurl_unref(nsurl);
+}
+
 int main(void)
 {
 	struct host_part *h;
@@ -161,6 +241,10 @@ int main(void)
 	nsurl *url;
 	nsurl *urlr;
 	char *path_query;
+	char header[80];
+	char long_host[300];
+	char long_url[400];
+	time_t expires;
 
 	corestrings_init();
 	url_init();
@@ -192,6 +276,31 @@ int main(void)
 	assert(u && strcmp(u->title, "foo") == 0);
 	nsurl_unref(url);
 
+	/* Test host lookup, which is case insensitive */
+	assert(urldb_add_host("intranet") == h);
+	assert(urldb_add_host("INTRANET") == h);
+	h = urldb_add_host("www.Hash.example.org");
+	assert(h != NULL);
+	assert(urldb_add_host("WWW.hash.EXAMPLE.org") == h);
+	assert(urldb_add_host("hash.example.org") != h);
+	assert(urldb_add_host("www.hash.example.org.uk") != h);
+
+	/* IP hosts are stored whole, and don't match names */
+	h = urldb_add_host("192.168.1.1");
+	assert(h != NULL);
+	assert(urldb_add_host("192.168.1.1") == h);
+	assert(urldb_add_host("1.1") != h);
+
+	/* Host names longer than a domain name may be are refused */
+	memset(long_host, 'a', sizeof long_host - 1);
+	long_host[sizeof long_host - 1] = '\0';
+	for (i = 1; i < (int) sizeof long_host - 1; i += 2)
+		long_host[i] = '.';
+	assert(urldb_add_host(long_host) == NULL);
+	long_host[255] = '\0';
+	assert(urldb_add_host(long_host) != NULL);
+	assert(urldb_add_host(long_host) == urldb_add_host(long_host));
+
 	/* Get host entry */
 	h = urldb_add_host("netsurf.strcprstskrzkrk.co.uk");
 	if (!h) {
@@ -263,7 +372,7 @@ int main(void)
 	nsurl_unref(urlr);
 
 	url = make_url("https://www.foo.com/blah/wxyzabc");
-	urldb_get_cookie(url);
+	urldb_get_cookie(url, true);
 	nsurl_unref(url);
 
 	/* 1563546 */
@@ -371,6 +480,119 @@ int main(void)
 	assert(test_urldb_set_cookie("foo=bar; expires=Thu, 01-Jan-1970 00:00:01 GMT\r\n", "http://expires.com/", NULL));
 	assert(test_urldb_get_cookie("http://expires.com/") == NULL);
 
+	/* Test replay of a journalled cookie which has since expired */
+	remove("urldbtest.cookies");
+	remove("urldbtest.cookies.journal");
+	urldb_load_cookies("urldbtest.cookies");
+	assert(test_urldb_set_cookie("foo=bar; expires=Thu, 31-Dec-2099 00:00:00 GMT\r\n", "http://journal.com/", NULL));
+	urldb_save_cookies("urldbtest.cookies");
+	expires = time(NULL) + 1;
+	strftime(header, sizeof header, "foo=baz; expires=%a, %d-%b-%Y %H:%M:%S GMT\r\n", gmtime(&expires));
+	assert(test_urldb_set_cookie(header, "http://journal.com/", NULL));
+	sleep(2);
+	urldb_destroy();
+	urldb_load_cookies("urldbtest.cookies");
+	assert(test_urldb_get_cookie("http://journal.com/") == NULL);
+
+	/* Test that a large journal is merged later, not while setting */
+	for (i = 0; i < 5000 && scheduled_callback == NULL; i++) {
+		sprintf(header, "foo=%d; expires=Thu, 31-Dec-2099 00:00:00 GMT\r\n", i);
+		assert(test_urldb_set_cookie(header, "http://journal.com/", NULL));
+	}
+	assert(scheduled_callback != NULL);
+	assert(test_file_size("urldbtest.cookies.journal") > 4);
+	scheduled_callback(NULL);
+	assert(test_file_size("urldbtest.cookies.journal") == 4);
+	urldb_destroy();
+	urldb_load_cookies("urldbtest.cookies");
+	sprintf(header, "foo=%d", i - 1);
+	assert(strcmp(test_urldb_get_cookie("http://journal.com/"), header) == 0);
+
+	/* Test that saving elsewhere takes the journal with it */
+	remove("urldbtest.jar");
+	remove("urldbtest.jar.journal");
+	urldb_save_cookies("urldbtest.jar");
+	assert(test_file_size("urldbtest.cookies.journal") == -1);
+	assert(test_urldb_set_cookie("foo=bar; expires=Thu, 01-Jan-1970 00:00:01 GMT\r\n", "http://journal.com/", NULL));
+	urldb_destroy();
+	urldb_load_cookies("urldbtest.cookies");
+	sprintf(header, "foo=%d", i - 1);
+	assert(strcmp(test_urldb_get_cookie("http://journal.com/"), header) == 0);
+	urldb_destroy();
+	urldb_load_cookies("urldbtest.jar");
+	assert(test_urldb_get_cookie("http://journal.com/") == NULL);
+	urldb_destroy();
+	remove("urldbtest.cookies");
+	remove("urldbtest.cookies.journal");
+	remove("urldbtest.jar");
+	remove("urldbtest.jar.journal");
+
+	/* Test completion ranking, with and without "www." */
+	test_urldb_visit("http://www.rank.com/a", 1);
+	test_urldb_visit("http://www.rank.com/b", 3);
+	test_urldb_visit("http://rank.com/c", 2);
+	assert(test_urldb_complete("rank.com/") == 3);
+	assert(strcmp(completions[0], "http://www.rank.com/b") == 0);
+	assert(strcmp(completions[1], "http://rank.com/c") == 0);
+	assert(strcmp(completions[2], "http://www.rank.com/a") == 0);
+	assert(test_urldb_complete("http://www.rank.com/") == 2);
+	assert(strcmp(completions[0], "http://www.rank.com/b") == 0);
+
+	/* Test that completion ignores case and repeated slashes */
+	assert(test_urldb_complete("RANK.com//b") == 1);
+	assert(strcmp(completions[0], "http://www.rank.com/b") == 0);
+	assert(test_urldb_complete("rank.com/d") == 0);
+
+	/* Test completion of prefixes longer than a host name */
+	strcpy(long_url, "http://rank.com/");
+	memset(long_url + 16, 'x', 300);
+	long_url[316] = '\0';
+	test_urldb_visit(long_url, 1);
+	assert(test_urldb_complete(long_url + 7) == 1);
+	strcat(long_url, "y");
+	assert(test_urldb_complete(long_url + 7) == 0);
+
+	/* Test saving and lazily reloading URL data */
+	url = make_url("http://www.example.org/saved/page.html?a=b");
+	assert(urldb_add_url(url));
+	urldb_set_url_title(url, "Saved page");
+	urldb_update_url_visit_data(url);
+	urldb_save("urldbtest.db");
+	urldb_destroy();
+	urldb_load("urldbtest.db");
+
+	/* Test iteration over URLs which are still only in the file */
+	iterated_url = url;
+	urldb_iterate_entries_transient(test_iterate_cb);
+	assert(iterated_found);
+
+	/* Test completion of URLs which are still only in the file */
+	assert(test_urldb_complete("example.org/saved/") == 1);
+	assert(strcmp(completions[0], nsurl_access(url)) == 0);
+	assert(test_urldb_complete("rank.com/") == 4);
+	assert(strcmp(completions[0], "http://www.rank.com/b") == 0);
+	assert(strcmp(completions[1], "http://rank.com/c") == 0);
+
+	u = urldb_get_url_data(url);
+	assert(u && u->visits == 1 && strcmp(u->title, "Saved page") == 0);
+
+	/* Test replay of the journal */
+	urldb_update_url_visit_data(url);
+	urldb_destroy();
+	urldb_load("urldbtest.db");
+	u = urldb_get_url_data(url);
+	assert(u && u->visits == 2 && strcmp(u->title, "Saved page") == 0);
+
+	/* Test that destroying the database removes its hosts */
+	urldb_destroy();
+	assert(urldb_get_url_data(url) == NULL);
+	assert(urldb_add_host("www.example.org") != NULL);
+	assert(urldb_get_url_data(url) == NULL);
+	nsurl_unref(url);
+
+	remove("urldbtest.db");
+	remove("urldbtest.db.journal");
+
 	urldb_dump();
 	urldb_destroy();
 
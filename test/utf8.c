@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "desktop/netsurf.h"
+#include "utils/log.h"
+#include "utils/utf8.h"
+
+/* desktop/netsurf.h */
+bool verbose_log = true;
+
+/* utils/utf8.h */
+utf8_convert_ret utf8_to_local_encoding(const char *string, size_t len,
+		char **result)
+{
+	return UTF8_CONVERT_BADENC;
+}
+
+struct test_length {
+	const char *test;
+	size_t len;
+	bool valid;
+};
+
+static const struct test_length length_tests[] = {
+	{ "", 0, true },
+	{ "a", 1, true },
+	{ "NetSurf web browser", 19, true },
+	{ "caf\xc3\xa9", 4, true },
+	{ "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e", 3, true },
+	{ "\xf0\x9f\x98\x80 smile", 7, true },
+	{ "abcdefghijklmnop\xc3\xa9qrstuvwxyz0123456789", 37, true },
+	{ "\xe3\x81\x82\xe3\x81\x84\xe3\x81\x86\xe3\x81\x88\xe3\x81\x8a"
+	  "\xe3\x81\x8b\xe3\x81\x8d\xe3\x81\x8f", 8, true },
+	/* Malformed input: characters are counted as utf8_next steps */
+	{ "\x80\x80x", 2, false },
+	{ "a\xe3\x81", 2, false },
+	{ "\xc0\xaf", 1, false },
+	{ "\xed\xa0\x80", 1, false },
+	{ "\xf4\x90\x80\x80", 1, false },
+	{ "\xfe", 1, false },
+	{ NULL, 0, false }
+};
+
+struct test_decode {
+	const char *test;
+	uint32_t ucs4;
+};
+
+static const struct test_decode decode_tests[] = {
+	{ "A", 0x41 },
+	{ "\xc3\xa9", 0xe9 },
+	{ "\xe2\x82\xac", 0x20ac },
+	{ "\xf0\x9f\x98\x80", 0x1f600 },
+	{ "\xc0\xaf", 0xfffd },
+	{ "\xe3\x81", 0xfffd },
+	{ "\xed\xa0\x80", 0xfffd },
+	{ "\x80", 0xfffd },
+	{ NULL, 0 }
+};
+
+/**
+ * Convert through a stream, feeding input and taking output a few bytes
+ * at a time so that sequences are split across calls
+ */
+static bool test_stream(const char *from, const char *to, const char *in,
+		size_t inlen, const char *expect, size_t expect_len)
+{
+	struct utf8_stream *stream;
+	char result[256], *out = result;
+	size_t avail = 0, pending = 0;
+	utf8_convert_ret ret;
+
+	if (utf8_stream_open(from, to, &stream) != UTF8_CONVERT_OK)
+		return false;
+
+	while (inlen > 0 || pending > 0) {
+		size_t feed = inlen > 3 ? 3 : inlen;
+		size_t room = 2;
+		const char *chunk;
+
+		/* Unconsumed input is offered again with the next chunk */
+		in += feed;
+		inlen -= feed;
+		feed += pending;
+		chunk = in - feed;
+
+		ret = utf8_stream_convert(stream, &chunk, &feed, &out, &room);
+		avail += 2 - room;
+		pending = feed;
+
+		if (ret == UTF8_CONVERT_BADSEQ ||
+				(inlen == 0 && pending > 0 &&
+				ret != UTF8_CONVERT_NOSPACE) ||
+				avail + 2 > sizeof(result)) {
+			utf8_stream_close(stream);
+			return false;
+		}
+	}
+
+	utf8_stream_close(stream);
+
+	return avail == expect_len && memcmp(result, expect, avail) == 0;
+}
+
+#define BENCH_SIZE (1024 * 1024)
+#define BENCH_ROUNDS 50
+
+static void bench(const char *name, const char *unit, size_t unit_len)
+{
+	char *text = malloc(BENCH_SIZE);
+	uint32_t *ucs4 = malloc(BENCH_SIZE * sizeof(uint32_t));
+	size_t size = 0, chars = 0, i;
+	clock_t t;
+	double secs;
+	int round;
+
+	if (text == NULL || ucs4 == NULL) {
+		free(text);
+		free(ucs4);
+		return;
+	}
+
+	while (size + unit_len <= BENCH_SIZE) {
+		memcpy(text + size, unit, unit_len);
+		size += unit_len;
+	}
+
+	t = clock();
+	for (round = 0; round < BENCH_ROUNDS; round++)
+		chars += utf8_bounded_length(text, size);
+	secs = (double) (clock() - t) / CLOCKS_PER_SEC;
+	LOG(("%s: length %.0f MB/s", name, size * BENCH_ROUNDS / 1e6 /
+			(secs > 0 ? secs : 1e-9)));
+
+	t = clock();
+	for (round = 0; round < BENCH_ROUNDS; round++)
+		chars += utf8_validate(text, size);
+	secs = (double) (clock() - t) / CLOCKS_PER_SEC;
+	LOG(("%s: validate %.0f MB/s", name, size * BENCH_ROUNDS / 1e6 /
+			(secs > 0 ? secs : 1e-9)));
+
+	t = clock();
+	for (round = 0; round < BENCH_ROUNDS; round++)
+		chars += utf8_to_ucs4_string(text, size, ucs4);
+	secs = (double) (clock() - t) / CLOCKS_PER_SEC;
+	LOG(("%s: decode %.0f MB/s", name, size * BENCH_ROUNDS / 1e6 /
+			(secs > 0 ? secs : 1e-9)));
+
+	t = clock();
+	for (round = 0; round < BENCH_ROUNDS; round++) {
+		for (i = 0; i < size; i = utf8_next(text, size, i))
+			chars += utf8_to_ucs4(text + i, size - i);
+	}
+	secs = (double) (clock() - t) / CLOCKS_PER_SEC;
+	LOG(("%s: utf8_next/utf8_to_ucs4 %.0f MB/s (%u)", name,
+			size * BENCH_ROUNDS / 1e6 / (secs > 0 ? secs : 1e-9),
+			(unsigned int) (chars & 0xff)));
+
+	free(ucs4);
+	free(text);
+}
+
+int main(void)
+{
+	const struct test_length *test;
+	const struct test_decode *dtest;
+	uint32_t ucs4[64];
+	bool passed = true;
+	size_t len, count, i, o;
+
+	LOG(("Testing length, validation and decoding"));
+
+	for (test = length_tests; test->test != NULL; test++) {
+		len = strlen(test->test);
+
+		/* Count the characters by stepping through them */
+		for (count = 0, o = 0; o < len; count++)
+			o = utf8_next(test->test, len, o);
+
+		/* And again, backwards */
+		for (i = 0, o = len; o > 0; i++)
+			o = utf8_prev(test->test, o);
+
+		if (utf8_bounded_length(test->test, len) == test->len &&
+				utf8_length(test->test) == test->len &&
+				count == test->len &&
+				(test->valid == false || i == test->len) &&
+				utf8_to_ucs4_string(test->test, len,
+						ucs4) == test->len &&
+				utf8_validate(test->test, len) ==
+						test->valid) {
+			LOG(("\tPASS: \"%s\"", test->test));
+		} else {
+			LOG(("\tFAIL: \"%s\"\t--> %u, expected %u",
+					test->test, (unsigned int)
+					utf8_bounded_length(test->test, len),
+					(unsigned int) test->len));
+			passed = false;
+		}
+
+		/* Batch decoding matches decoding a character at a time */
+		for (count = 0, o = 0; o < len; count++) {
+			if (ucs4[count] != utf8_to_ucs4(test->test + o,
+					len - o)) {
+				LOG(("\tFAIL: \"%s\" decode at %u",
+						test->test, (unsigned int) o));
+				passed = false;
+			}
+			o = utf8_next(test->test, len, o);
+		}
+	}
+
+	for (dtest = decode_tests; dtest->test != NULL; dtest++) {
+		if (utf8_to_ucs4(dtest->test, strlen(dtest->test)) ==
+				dtest->ucs4) {
+			LOG(("\tPASS: \"%s\"\t--> U+%04X", dtest->test,
+					dtest->ucs4));
+		} else {
+			LOG(("\tFAIL: \"%s\"\t--> U+%04X, expected U+%04X",
+					dtest->test,
+					utf8_to_ucs4(dtest->test,
+						strlen(dtest->test)),
+					dtest->ucs4));
+			passed = false;
+		}
+	}
+
+	LOG(("Testing conversion"));
+
+	if (test_stream("UTF-8", "ISO-8859-1", "caf\xc3\xa9 cr\xc3\xa8me", 13,
+			"caf\xe9 cr\xe8me", 11) &&
+			test_stream("UTF-8", "UTF-16BE", "\xe2\x82\xac!", 4,
+			"\x20\xac\x00!", 4)) {
+		LOG(("\tPASS: streams"));
+	} else {
+		LOG(("\tFAIL: streams"));
+		passed = false;
+	}
+
+	for (i = 0; i < 3; i++) {
+		char *converted;
+
+		/* Output four times the size of the input */
+		if (utf8_to_enc("NetSurf", "UCS-4BE", 0, &converted) ==
+				UTF8_CONVERT_OK &&
+				memcmp(converted, "\0\0\0N\0\0\0e", 8) == 0 &&
+				memcmp(converted + 24, "\0\0\0f\0\0\0\0", 8) ==
+						0) {
+			free(converted);
+		} else {
+			LOG(("\tFAIL: utf8_to_enc"));
+			passed = false;
+			break;
+		}
+	}
+
+	utf8_finalise();
+
+	if (passed) {
+		LOG(("Testing complete: SUCCESS"));
+	} else {
+		LOG(("Testing complete: FAILURE"));
+	}
+
+	bench("ASCII", "The quick brown fox jumps over the lazy dog. ", 45);
+	bench("Mixed", "Caf\xc3\xa9 na\xc3\xafve r\xc3\xa9sum\xc3\xa9 "
+			"\xe2\x82\xac" "5 ", 27);
+	bench("CJK", "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e\xe3\x81\xae"
+			"\xe6\x96\x87\xe7\xab\xa0\xe3\x80\x82", 21);
+
+	return passed ? 0 : 1;
+}
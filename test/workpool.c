@@ -0,0 +1,156 @@
+#include <assert.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "desktop/netsurf.h"
+#include "utils/log.h"
+#include "utils/schedule.h"
+#include "utils/workpool.h"
+
+/* desktop/netsurf.h */
+bool verbose_log = true;
+
+/* utils/schedule.h, only used when built without threads */
+void schedule(int t, schedule_callback_fn cb, void *pw)
+{
+}
+
+void schedule_remove(schedule_callback_fn cb, void *pw)
+{
+}
+
+#define JOB_COUNT 1000
+
+struct test_job {
+	unsigned int input;
+	unsigned long output;
+	pthread_t ran_on;
+	bool done;
+};
+
+static struct test_job jobs[JOB_COUNT];
+static pthread_t main_thread;
+static unsigned int done_count;
+static bool done_on_main = true;
+static struct workpool *pool;
+static nserror resubmit_error = NSERROR_OK;
+
+static void test_job(void *pw)
+{
+	struct test_job *job = pw;
+	unsigned long sum = 0;
+	unsigned int i;
+
+	for (i = 0; i <= job->input * 100; i++)
+		sum += i;
+
+	job->output = sum;
+	job->ran_on = pthread_self();
+}
+
+static void test_done(void *pw)
+{
+	struct test_job *job = pw;
+
+	if (pthread_equal(pthread_self(), main_thread) == 0)
+		done_on_main = false;
+
+	job->done = true;
+	done_count++;
+}
+
+/* Completion which tries to submit more work */
+static void test_resubmit(void *pw)
+{
+	resubmit_error = workpool_submit(pool, test_job, test_done, pw);
+}
+
+int main(void)
+{
+	struct pollfd pfd;
+	unsigned int i, off_main = 0;
+	bool passed = true;
+
+	main_thread = pthread_self();
+
+	if (workpool_create(4, &pool) != NSERROR_OK) {
+		LOG(("Failed to create pool"));
+		return 1;
+	}
+
+	for (i = 0; i < JOB_COUNT; i++) {
+		jobs[i].input = i;
+		if (workpool_submit(pool, test_job, test_done,
+				&jobs[i]) != NSERROR_OK) {
+			LOG(("Failed to submit job %u", i));
+			return 1;
+		}
+	}
+
+	/* Wait for completions as a frontend poll loop would */
+	pfd.fd = workpool_wake_fd(pool);
+	pfd.events = POLLIN;
+	while (done_count < JOB_COUNT) {
+		if (poll(&pfd, 1, 1000) == 0) {
+			LOG(("Timed out with %u of %u jobs complete",
+					done_count, JOB_COUNT));
+			passed = false;
+			break;
+		}
+
+		workpool_complete(pool);
+	}
+
+	for (i = 0; i < JOB_COUNT; i++) {
+		unsigned long n = i * 100;
+
+		if (jobs[i].done == false ||
+				jobs[i].output != n * (n + 1) / 2) {
+			LOG(("\tFAIL: job %u", i));
+			passed = false;
+		}
+
+		if (pthread_equal(jobs[i].ran_on, main_thread) == 0)
+			off_main++;
+	}
+
+	LOG(("%u of %u jobs ran on workers", off_main, JOB_COUNT));
+	if (off_main != JOB_COUNT || done_on_main == false) {
+		LOG(("\tFAIL: jobs and completions on the wrong threads"));
+		passed = false;
+	}
+
+	/* Destroying the pool finishes outstanding work */
+	done_count = 0;
+	for (i = 0; i < JOB_COUNT; i++) {
+		jobs[i].done = false;
+		workpool_submit(pool, test_job, test_done, &jobs[i]);
+	}
+
+	/* Completions run by destroy can't submit more work */
+	workpool_submit(pool, test_job, test_resubmit, &jobs[0]);
+
+	workpool_destroy(pool);
+
+	if (done_count != JOB_COUNT) {
+		LOG(("\tFAIL: %u of %u jobs complete after destroy",
+				done_count, JOB_COUNT));
+		passed = false;
+	}
+
+	if (resubmit_error != NSERROR_INVALID) {
+		LOG(("\tFAIL: submission during destroy returned %d",
+				resubmit_error));
+		passed = false;
+	}
+
+	if (passed) {
+		LOG(("Testing complete: SUCCESS"));
+	} else {
+		LOG(("Testing complete: FAILURE"));
+	}
+
+	return passed ? 0 : 1;
+}
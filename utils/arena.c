@@ -0,0 +1,283 @@
+/*
+ * Copyright 2012 NetSurf Browser Project
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Arena allocator (implementation).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils/arena.h"
+
+/** Size of a slab, including its header */
+#define ARENA_SLAB_SIZE 16384
+
+/** Alignment of allocations */
+#define ARENA_ALIGN (sizeof(union arena_align))
+
+/** Type with the strictest alignment an allocation may need */
+union arena_align {
+	void *p;
+	long l;
+	double d;
+};
+
+/** A slab of memory in an arena */
+struct arena_slab {
+	struct arena_slab *next;	/**< Next (older) slab */
+	size_t size;			/**< Usable bytes in slab */
+	union arena_align data[];	/**< Slab memory */
+};
+
+/** A registered destructor */
+struct arena_destructor_entry {
+	arena_destructor destroy;	/**< Destructor function */
+	void *p;			/**< Object to destroy */
+	struct arena_destructor_entry *next; /**< Next (older) entry */
+};
+
+/** An arena */
+struct arena {
+	struct arena_slab *slabs;	/**< Slabs, current first */
+	size_t used;			/**< Bytes used in current slab */
+	size_t total;			/**< Total bytes in all slabs */
+	struct arena_destructor_entry *destructors; /**< Newest first */
+};
+
+
+/**
+ * Create an arena
+ *
+ * \return New arena, or NULL on memory exhaustion
+ */
+struct arena *arena_create(void)
+{
+	struct arena *arena = malloc(sizeof(struct arena));
+	if (arena == NULL)
+		return NULL;
+
+	arena->slabs = NULL;
+	arena->used = 0;
+	arena->total = 0;
+	arena->destructors = NULL;
+
+	return arena;
+}
+
+
+/**
+ * Destroy an arena, running its destructors and freeing all its memory
+ *
+ * \param arena  Arena to destroy
+ *
+ * Destructors are run newest first, before any memory is freed.
+ */
+void arena_destroy(struct arena *arena)
+{
+	struct arena_destructor_entry *d;
+	struct arena_slab *slab, *next;
+
+	if (arena == NULL)
+		return;
+
+	for (d = arena->destructors; d != NULL; d = d->next)
+		d->destroy(d->p);
+
+	for (slab = arena->slabs; slab != NULL; slab = next) {
+		next = slab->next;
+		free(slab);
+	}
+
+	free(arena);
+}
+
+
+/**
+ * Allocate memory from an arena
+ *
+ * \param arena  Arena to allocate from
+ * \param size   Number of bytes required
+ * \return Pointer to suitably aligned memory, or NULL on memory exhaustion
+ *
+ * The memory lasts until the arena is destroyed.
+ */
+void *arena_alloc(struct arena *arena, size_t size)
+{
+	struct arena_slab *slab = arena->slabs;
+	size_t slab_size;
+
+	/* Round up to keep following allocations aligned */
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	if (size == 0)
+		size = ARENA_ALIGN;
+
+	if (slab == NULL || slab->size - arena->used < size) {
+		slab_size = ARENA_SLAB_SIZE - sizeof(struct arena_slab);
+
+		if (size > slab_size / 4) {
+			/* Large allocations get a slab of their own, which
+			 * goes behind the current one so it keeps filling */
+			slab = malloc(sizeof(struct arena_slab) + size);
+			if (slab == NULL)
+				return NULL;
+
+			slab->size = size;
+			arena->total += size;
+
+			if (arena->slabs != NULL) {
+				slab->next = arena->slabs->next;
+				arena->slabs->next = slab;
+			} else {
+				slab->next = NULL;
+				arena->slabs = slab;
+				arena->used = size;
+			}
+
+			return slab->data;
+		}
+
+		slab = malloc(sizeof(struct arena_slab) + slab_size);
+		if (slab == NULL)
+			return NULL;
+
+		slab->size = slab_size;
+		slab->next = arena->slabs;
+		arena->slabs = slab;
+		arena->used = 0;
+		arena->total += slab_size;
+	}
+
+	arena->used += size;
+
+	return (char *) slab->data + arena->used - size;
+}
+
+
+/**
+ * Allocate zeroed memory from an arena
+ *
+ * \param arena  Arena to allocate from
+ * \param size   Number of bytes required
+ * \return Pointer to zeroed memory, or NULL on memory exhaustion
+ */
+void *arena_zalloc(struct arena *arena, size_t size)
+{
+	void *p = arena_alloc(arena, size);
+
+	if (p != NULL)
+		memset(p, 0, size);
+
+	return p;
+}
+
+
+/**
+ * Copy a block of memory into an arena
+ *
+ * \param arena  Arena to allocate from
+ * \param p      Memory to copy
+ * \param size   Number of bytes to copy
+ * \return Pointer to the copy, or NULL on memory exhaustion
+ */
+void *arena_memdup(struct arena *arena, const void *p, size_t size)
+{
+	void *copy = arena_alloc(arena, size);
+
+	if (copy != NULL)
+		memcpy(copy, p, size);
+
+	return copy;
+}
+
+
+/**
+ * Copy a string into an arena
+ *
+ * \param arena  Arena to allocate from
+ * \param s      String to copy
+ * \return Pointer to the copy, or NULL on memory exhaustion
+ */
+char *arena_strdup(struct arena *arena, const char *s)
+{
+	return arena_memdup(arena, s, strlen(s) + 1);
+}
+
+
+/**
+ * Copy at most n characters of a string into an arena
+ *
+ * \param arena  Arena to allocate from
+ * \param s      String to copy
+ * \param n      Maximum number of characters to copy
+ * \return Pointer to the NUL terminated copy, or NULL on memory exhaustion
+ */
+char *arena_strndup(struct arena *arena, const char *s, size_t n)
+{
+	const char *end = memchr(s, '\0', n);
+	char *copy;
+
+	if (end != NULL)
+		n = end - s;
+
+	copy = arena_alloc(arena, n + 1);
+	if (copy != NULL) {
+		memcpy(copy, s, n);
+		copy[n] = '\0';
+	}
+
+	return copy;
+}
+
+
+/**
+ * Register a destructor to be run when an arena is destroyed
+ *
+ * \param arena    Arena to register with
+ * \param destroy  Destructor function
+ * \param p        Object to pass to the destructor
+ * \return true on success, false on memory exhaustion
+ */
+bool arena_add_destructor(struct arena *arena, arena_destructor destroy,
+		void *p)
+{
+	struct arena_destructor_entry *d;
+
+	d = arena_alloc(arena, sizeof(struct arena_destructor_entry));
+	if (d == NULL)
+		return false;
+
+	d->destroy = destroy;
+	d->p = p;
+	d->next = arena->destructors;
+	arena->destructors = d;
+
+	return true;
+}
+
+
+/**
+ * Find the amount of memory an arena holds
+ *
+ * \param arena  Arena to measure
+ * \return Size of the arena's slabs in bytes
+ */
+size_t arena_size(const struct arena *arena)
+{
+	return sizeof(struct arena) + arena->total;
+}
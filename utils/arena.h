@@ -0,0 +1,53 @@
+/*
+ * Copyright 2012 NetSurf Browser Project
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Arena allocator (interface).
+ *
+ * Memory is handed out from large slabs and is only released, all at once,
+ * when the arena is destroyed.  Objects which hold references to things
+ * outside the arena register a destructor to release them.
+ */
+
+#ifndef _NETSURF_UTILS_ARENA_H_
+#define _NETSURF_UTILS_ARENA_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct arena;
+
+/**
+ * Destructor for an object in an arena
+ *
+ * \param p  The object being destroyed
+ */
+typedef void (*arena_destructor)(void *p);
+
+struct arena *arena_create(void);
+void arena_destroy(struct arena *arena);
+void *arena_alloc(struct arena *arena, size_t size);
+void *arena_zalloc(struct arena *arena, size_t size);
+void *arena_memdup(struct arena *arena, const void *p, size_t size);
+char *arena_strdup(struct arena *arena, const char *s);
+char *arena_strndup(struct arena *arena, const char *s, size_t n);
+bool arena_add_destructor(struct arena *arena, arena_destructor destroy,
+		void *p);
+size_t arena_size(const struct arena *arena);
+
+#endif
@@ -0,0 +1,60 @@
+#!/usr/bin/perl -w
+
+# Compile a Messages file into a binary catalogue which NetSurf can map
+# and search directly, without parsing it at startup.
+#
+# The layout, all integers being 32 bit little endian, is:
+#
+#   "NSMC", version, count
+#   count key hashes, in ascending order
+#   count (key offset, value offset) pairs, in the same order
+#   NUL terminated strings
+#
+# Offsets are from the start of the file.  The hash is FNV-1a over the
+# bytes of the key, and must match messages_hash_key() in messages.c.
+
+use strict;
+
+die "usage: compile-messages < ThinMessages > MessagesCatalogue" if ($#ARGV != -1);
+
+my %messages;
+
+foreach (<STDIN>) {
+    next if (/^#/ or /^$/);
+    chomp;
+    next unless (/^([^:]*):(.*)$/);
+    $messages{$1} = $2;
+}
+
+sub fnv1a {
+    my $h = 0x811c9dc5;
+
+    foreach my $c (unpack("C*", $_[0])) {
+	$h ^= $c;
+	# h * 0x01000193, split so that no intermediate exceeds 53 bits
+	$h = (($h * 0x193) + (($h << 24) & 0xffffffff)) % 4294967296;
+    }
+
+    return $h;
+}
+
+my %hashes = map { $_ => fnv1a($_) } keys %messages;
+my @keys = sort { $hashes{$a} <=> $hashes{$b} or $a cmp $b } keys %messages;
+my $count = scalar @keys;
+
+my $offset = 12 + $count * 12;
+my $strings = "";
+my @offsets;
+
+foreach my $key (@keys) {
+    push @offsets, $offset + length($strings);
+    $strings .= $key . "\0";
+    push @offsets, $offset + length($strings);
+    $strings .= $messages{$key} . "\0";
+}
+
+binmode STDOUT;
+print "NSMC", pack("V2", 1, $count);
+print pack("V*", map { $hashes{$_} } @keys);
+print pack("V*", @offsets);
+print $strings;
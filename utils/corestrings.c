@@ -59,6 +59,7 @@ lwc_string *corestring_lwc_head;
 lwc_string *corestring_lwc_hidden;
 lwc_string *corestring_lwc_hr;
 lwc_string *corestring_lwc_html;
+lwc_string *corestring_lwc_http;
 lwc_string *corestring_lwc_https;
 lwc_string *corestring_lwc_iframe;
 lwc_string *corestring_lwc_image;
@@ -82,6 +83,7 @@ lwc_string *corestring_lwc_password;
 lwc_string *corestring_lwc_poly;
 lwc_string *corestring_lwc_polygon;
 lwc_string *corestring_lwc_post;
+lwc_string *corestring_lwc_prefetch;
 lwc_string *corestring_lwc_radio;
 lwc_string *corestring_lwc_rect;
 lwc_string *corestring_lwc_rectangle;
@@ -280,6 +282,7 @@ void corestrings_fini(void)
 	CSS_LWC_STRING_UNREF(hidden);
 	CSS_LWC_STRING_UNREF(hr);
 	CSS_LWC_STRING_UNREF(html);
+	CSS_LWC_STRING_UNREF(http);
 	CSS_LWC_STRING_UNREF(https);
 	CSS_LWC_STRING_UNREF(iframe);
 	CSS_LWC_STRING_UNREF(image);
@@ -303,6 +306,7 @@ void corestrings_fini(void)
 	CSS_LWC_STRING_UNREF(poly);
 	CSS_LWC_STRING_UNREF(polygon);
 	CSS_LWC_STRING_UNREF(post);
+	CSS_LWC_STRING_UNREF(prefetch);
 	CSS_LWC_STRING_UNREF(radio);
 	CSS_LWC_STRING_UNREF(rect);
 	CSS_LWC_STRING_UNREF(rectangle);
@@ -521,6 +525,7 @@ nserror corestrings_init(void)
 	CSS_LWC_STRING_INTERN(hidden);
 	CSS_LWC_STRING_INTERN(hr);
 	CSS_LWC_STRING_INTERN(html);
+	CSS_LWC_STRING_INTERN(http);
 	CSS_LWC_STRING_INTERN(https);
 	CSS_LWC_STRING_INTERN(iframe);
 	CSS_LWC_STRING_INTERN(image);
@@ -543,6 +548,7 @@ nserror corestrings_init(void)
 	CSS_LWC_STRING_INTERN(poly);
 	CSS_LWC_STRING_INTERN(polygon);
 	CSS_LWC_STRING_INTERN(post);
+	CSS_LWC_STRING_INTERN(prefetch);
 	CSS_LWC_STRING_INTERN(radio);
 	CSS_LWC_STRING_INTERN(rect);
 	CSS_LWC_STRING_INTERN(rectangle);
@@ -63,6 +63,7 @@ extern lwc_string *corestring_lwc_head;
 extern lwc_string *corestring_lwc_hidden;
 extern lwc_string *corestring_lwc_hr;
 extern lwc_string *corestring_lwc_html;
+extern lwc_string *corestring_lwc_http;
 extern lwc_string *corestring_lwc_https;
 extern lwc_string *corestring_lwc_iframe;
 extern lwc_string *corestring_lwc_image;
@@ -86,6 +87,7 @@ extern lwc_string *corestring_lwc_password;
 extern lwc_string *corestring_lwc_poly;
 extern lwc_string *corestring_lwc_polygon;
 extern lwc_string *corestring_lwc_post;
+extern lwc_string *corestring_lwc_prefetch;
 extern lwc_string *corestring_lwc_radio;
 extern lwc_string *corestring_lwc_rect;
 extern lwc_string *corestring_lwc_rectangle;
@@ -18,28 +18,59 @@
  */
 
 /** \file
- * Write-Once hash table for string to string mappings */
+ * Write-Once hash table for string to string mappings, or for fixed length
+ * keys to pointers
+ *
+ * The table uses open addressing with Robin Hood probing, and doubles in
+ * size as it fills, so lookups stay short however many entries are added.
+ * Keys and values are copied into large blocks owned by the table rather
+ * than being allocated individually.
+ *
+ * Tables made by hash_create_typed hold keys of a fixed length, hashed and
+ * compared by the callbacks given, which map to pointers owned by the caller.
+ */
 
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
-#ifdef TEST_RIG
 #include <assert.h>
+#ifdef TEST_RIG
+#include <ctype.h>
 #include <stdio.h>
+#include <strings.h>
+#include <time.h>
 #endif
 #include "utils/hashtable.h"
 #include "utils/log.h"
 
+/** Smallest number of slots in a table */
+#define HASH_MIN_SLOTS 16
+
+/** Size of the blocks which key/value pairs are allocated from */
+#define HASH_BLOCK_SIZE 4096
 
-struct hash_entry {
-	char *pairing;		 /**< block containing 'key\0value\0' */
+struct hash_slot {
+	const char *pairing;	 /**< 'key\0value\0', or key then value
+				  *   pointer if typed, or NULL if slot empty */
+	unsigned int hash;	 /**< hash of key */
 	unsigned int key_length; /**< length of key */
-	struct hash_entry *next; /**< next entry */
+};
+
+struct hash_block {
+	struct hash_block *next; /**< next block */
+	size_t used;		 /**< bytes used in data */
+	size_t size;		 /**< size of data */
+	char data[];		 /**< key/value pairs */
 };
 
 struct hash_table {
-	unsigned int nchains;
-	struct hash_entry **chain;
+	unsigned int nslots;	 /**< number of slots, a power of two */
+	unsigned int count;	 /**< number of occupied slots */
+	struct hash_slot *slot;
+	struct hash_block *blocks; /**< storage for key/value pairs */
+	size_t key_length;	 /**< length of typed keys, or 0 for strings */
+	hash_key_hash hash;	 /**< typed key hash, or NULL for strings */
+	hash_key_compare compare; /**< typed key compare, or NULL for strings */
 };
 
 /**
@@ -70,16 +101,157 @@ static inline unsigned int hash_string_fnv(const char *datum, unsigned int *len)
 	return z;
 }
 
+/**
+ * Allocate space for a key/value pair from a hash table's blocks.
+ *
+ * \param  ht	  The hash table to allocate from.
+ * \param  size	  Number of bytes required.
+ * \return Pointer to the space, or NULL on memory exhaustion.
+ */
+
+static char *hash_alloc(struct hash_table *ht, size_t size)
+{
+	struct hash_block *b = ht->blocks;
+	size_t block_size;
+
+	if (b == NULL || b->size - b->used < size) {
+		/* Pairs too big to share a block get one of their own */
+		block_size = (size > HASH_BLOCK_SIZE / 4) ? size :
+				HASH_BLOCK_SIZE - sizeof(struct hash_block);
+
+		b = malloc(sizeof(struct hash_block) + block_size);
+		if (b == NULL)
+			return NULL;
+
+		b->used = 0;
+		b->size = block_size;
+
+		if (block_size == size && ht->blocks != NULL) {
+			/* Keep filling the current block afterwards */
+			b->next = ht->blocks->next;
+			ht->blocks->next = b;
+		} else {
+			b->next = ht->blocks;
+			ht->blocks = b;
+		}
+	}
+
+	b->used += size;
+
+	return b->data + b->used - size;
+}
+
+/**
+ * Find the slot holding a key.
+ *
+ * \param  ht	       The hash table to search.
+ * \param  key	       The key to search for.
+ * \param  h	       Hash of key.
+ * \param  key_length  Length of key.
+ * \return The slot holding the key, or NULL if it is not in the table.
+ */
+
+static struct hash_slot *hash_find(struct hash_table *ht, const char *key,
+		unsigned int h, unsigned int key_length)
+{
+	unsigned int mask = ht->nslots - 1;
+	unsigned int i = h & mask;
+	unsigned int dist;
+	struct hash_slot *s;
+
+	for (dist = 0; ; dist++, i = (i + 1) & mask) {
+		s = &ht->slot[i];
+
+		/* Robin Hood ordering means the key can't be beyond an empty
+		 * slot or one nearer its home than the key would be */
+		if (s->pairing == NULL || ((i - (s->hash & mask)) & mask) < dist)
+			return NULL;
+
+		if (s->hash != h || s->key_length != key_length)
+			continue;
+
+		if (ht->compare != NULL ?
+				ht->compare(key, s->pairing, key_length) :
+				memcmp(key, s->pairing, key_length) == 0)
+			return s;
+	}
+}
+
+/**
+ * Place an entry in a hash table's slots.  The table must have a free slot
+ * and not already contain the key.
+ *
+ * \param  slot	   Array of slots.
+ * \param  nslots  Number of slots, a power of two.
+ * \param  e	   Entry to place.
+ */
+
+static void hash_place(struct hash_slot *slot, unsigned int nslots,
+		struct hash_slot e)
+{
+	unsigned int mask = nslots - 1;
+	unsigned int i = e.hash & mask;
+	unsigned int dist = 0;
+	unsigned int d;
+	struct hash_slot t;
+
+	while (slot[i].pairing != NULL) {
+		/* Displace entries nearer their home than this one */
+		d = (i - (slot[i].hash & mask)) & mask;
+		if (d < dist) {
+			t = slot[i];
+			slot[i] = e;
+			e = t;
+			dist = d;
+		}
+
+		i = (i + 1) & mask;
+		dist++;
+	}
+
+	slot[i] = e;
+}
+
+/**
+ * Double the number of slots in a hash table.
+ *
+ * \param  ht	The hash table to grow.
+ * \return true on success, false on memory exhaustion.
+ */
+
+static bool hash_grow(struct hash_table *ht)
+{
+	unsigned int nslots = ht->nslots * 2;
+	struct hash_slot *slot;
+	unsigned int i;
+
+	slot = calloc(nslots, sizeof(struct hash_slot));
+	if (slot == NULL) {
+		LOG(("Not enough memory for %d hash table slots.", nslots));
+		return false;
+	}
+
+	for (i = 0; i < ht->nslots; i++) {
+		if (ht->slot[i].pairing != NULL)
+			hash_place(slot, nslots, ht->slot[i]);
+	}
+
+	free(ht->slot);
+	ht->slot = slot;
+	ht->nslots = nslots;
+
+	return true;
+}
+
 
 /**
  * Create a new hash table, and return a context for it.  The memory consumption
- * of a hash table is approximately 8 + (nchains * 12) bytes if it is empty.
+ * of a hash table is approximately 16 + (slots * 16) bytes if it is empty.
  *
- * \param  chains Number of chains/buckets this hash table will have.  This
- *		  should be a prime number, and ideally a prime number just
- *		  over a power of two, for best performance and distribution.
+ * \param  chains Number of entries the hash table is expected to hold.  The
+ *		  table grows as required, so this is only a hint.
  * \return struct hash_table containing the context of this hash table or NULL
- *	   if there is insufficent memory to create it and its chains.
+ *	   if there is insufficent memory to create it and its slots.
  */
 
 struct hash_table *hash_create(unsigned int chains)
@@ -91,11 +263,19 @@ struct hash_table *hash_create(unsigned int chains)
 		return NULL;
 	}
 
-	r->nchains = chains;
-	r->chain = calloc(chains, sizeof(struct hash_entry *));
+	r->nslots = HASH_MIN_SLOTS;
+	while (r->nslots < chains)
+		r->nslots *= 2;
 
-	if (r->chain == NULL) {
-		LOG(("Not enough memory for %d hash table chains.", chains));
+	r->count = 0;
+	r->blocks = NULL;
+	r->key_length = 0;
+	r->hash = NULL;
+	r->compare = NULL;
+	r->slot = calloc(r->nslots, sizeof(struct hash_slot));
+
+	if (r->slot == NULL) {
+		LOG(("Not enough memory for %d hash table slots.", r->nslots));
 		free(r);
 		return NULL;
 	}
@@ -103,6 +283,38 @@ struct hash_table *hash_create(unsigned int chains)
 	return r;
 }
 
+/**
+ * Create a new hash table for fixed length keys, mapping to pointers.
+ *
+ * \param  chains      Number of entries the hash table is expected to hold.
+ * \param  key_length  Length of every key, in bytes.
+ * \param  hash	       Function to hash a key.
+ * \param  compare     Function to compare two keys.
+ * \return struct hash_table containing the context of this hash table or NULL
+ *	   if there is insufficent memory to create it and its slots.
+ *
+ * Keys are copied into the table, so a key holding a pointer copies the
+ * pointer, not what it points to.  Values are not copied.
+ */
+
+struct hash_table *hash_create_typed(unsigned int chains, size_t key_length,
+		hash_key_hash hash, hash_key_compare compare)
+{
+	struct hash_table *r;
+
+	assert(key_length > 0 && hash != NULL && compare != NULL);
+
+	r = hash_create(chains);
+	if (r == NULL)
+		return NULL;
+
+	r->key_length = key_length;
+	r->hash = hash;
+	r->compare = compare;
+
+	return r;
+}
+
 /**
  * Destroys a hash table, freeing all memory associated with it.
  *
@@ -112,32 +324,25 @@ struct hash_table *hash_create(unsigned int chains)
 
 void hash_destroy(struct hash_table *ht)
 {
-	unsigned int i;
+	struct hash_block *b, *n;
 
 	if (ht == NULL)
 		return;
 
-	for (i = 0; i < ht->nchains; i++) {
-		if (ht->chain[i] != NULL) {
-			struct hash_entry *e = ht->chain[i];
-			while (e) {
-				struct hash_entry *n = e->next;
-				free(e->pairing);
-				free(e);
-				e = n;
-			}
-		}
+	for (b = ht->blocks; b != NULL; b = n) {
+		n = b->next;
+		free(b);
 	}
 
-	free(ht->chain);
+	free(ht->slot);
 	free(ht);
 }
 
 /**
  * Adds a key/value pair to a hash table.  If the key you're adding is already
- * in the hash table, it does not replace it, but it does take precedent over
- * it.  The old key/value pair will be inaccessable but still in memory until
- * hash_destroy() is called on the hash table.
+ * in the hash table, it replaces the old value.  The old key/value pair will
+ * be inaccessable but still in memory until hash_destroy() is called on the
+ * hash table.
  *
  * \param  ht	  The hash table context to add the key/value pair to.
  * \param  key	  The key to associate the value with.  A copy is made.
@@ -148,33 +353,40 @@ void hash_destroy(struct hash_table *ht)
 
 bool hash_add(struct hash_table *ht, const char *key, const char *value)
 {
-	unsigned int h, c, v;
-	struct hash_entry *e;
+	unsigned int h, v;
+	struct hash_slot e;
+	struct hash_slot *s;
+	char *pairing;
 
-	if (ht == NULL || key == NULL || value == NULL)
+	if (ht == NULL || key == NULL || value == NULL || ht->hash != NULL)
 		return false;
 
-	e = malloc(sizeof(struct hash_entry));
-	if (e == NULL) {
-		LOG(("Not enough memory for hash entry."));
-		return false;
-	}
+	h = hash_string_fnv(key, &e.key_length);
+	e.hash = h;
 
-	h = hash_string_fnv(key, &(e->key_length));
-	c = h % ht->nchains;
+	s = hash_find(ht, key, h, e.key_length);
 
-	v = strlen(value) ;
-	e->pairing = malloc(v + e->key_length + 2);
-	if (e->pairing == NULL) {
+	/* Keep the load factor below 3/4 */
+	if (s == NULL && (ht->count + 1) * 4 > ht->nslots * 3 &&
+			hash_grow(ht) == false)
+		return false;
+
+	v = strlen(value);
+	pairing = hash_alloc(ht, v + e.key_length + 2);
+	if (pairing == NULL) {
 		LOG(("Not enough memory for string duplication."));
-		free(e);
 		return false;
 	}
-	memcpy(e->pairing, key, e->key_length + 1);
-	memcpy(e->pairing + e->key_length + 1, value, v + 1);
-
-	e->next = ht->chain[c];
-	ht->chain[c] = e;
+	memcpy(pairing, key, e.key_length + 1);
+	memcpy(pairing + e.key_length + 1, value, v + 1);
+
+	if (s != NULL) {
+		s->pairing = pairing;
+	} else {
+		e.pairing = pairing;
+		hash_place(ht->slot, ht->nslots, e);
+		ht->count++;
+	}
 
 	return true;
 }
@@ -189,21 +401,94 @@ bool hash_add(struct hash_table *ht, const char *key, const char *value)
 
 const char *hash_get(struct hash_table *ht, const char *key)
 {
-	unsigned int h, c, key_length;
-	struct hash_entry *e;
+	unsigned int h, key_length;
+	struct hash_slot *s;
 
-	if (ht == NULL || key == NULL)
+	if (ht == NULL || key == NULL || ht->hash != NULL)
 		return NULL;
 
 	h = hash_string_fnv(key, &key_length);
-	c = h % ht->nchains;
 
-	for (e = ht->chain[c]; e; e = e->next)
-		if ((key_length == e->key_length) &&
-				(memcmp(key, e->pairing, key_length) == 0))
-			return e->pairing + key_length + 1;
+	s = hash_find(ht, key, h, key_length);
+	if (s == NULL)
+		return NULL;
 
-	return NULL;
+	return s->pairing + key_length + 1;
+}
+
+/**
+ * Adds a key/value pair to a hash table made by hash_create_typed().  If the
+ * key is already in the hash table, its value is replaced.
+ *
+ * \param  ht	  The hash table context to add the key/value pair to.
+ * \param  key	  The key to associate the value with.  A copy is made.
+ * \param  value  The value to associate the key with.
+ * \return true if the add succeeded, false on memory exhaustion.
+ */
+
+bool hash_add_typed(struct hash_table *ht, const void *key, void *value)
+{
+	struct hash_slot e;
+	struct hash_slot *s;
+	char *pairing;
+
+	if (ht == NULL || key == NULL || ht->hash == NULL)
+		return false;
+
+	e.hash = ht->hash(key, ht->key_length);
+	e.key_length = ht->key_length;
+
+	s = hash_find(ht, key, e.hash, e.key_length);
+	if (s != NULL) {
+		/* The value follows the key, and may not be aligned */
+		memcpy((char *) s->pairing + e.key_length, &value,
+				sizeof(value));
+		return true;
+	}
+
+	/* Keep the load factor below 3/4 */
+	if ((ht->count + 1) * 4 > ht->nslots * 3 && hash_grow(ht) == false)
+		return false;
+
+	pairing = hash_alloc(ht, e.key_length + sizeof(value));
+	if (pairing == NULL) {
+		LOG(("Not enough memory for hash key."));
+		return false;
+	}
+	memcpy(pairing, key, e.key_length);
+	memcpy(pairing + e.key_length, &value, sizeof(value));
+
+	e.pairing = pairing;
+	hash_place(ht->slot, ht->nslots, e);
+	ht->count++;
+
+	return true;
+}
+
+/**
+ * Looks up the value associated with a key in a hash table made by
+ * hash_create_typed().
+ *
+ * \param  ht	  The hash table context to look up the key in.
+ * \param  key	  The key to search for.
+ * \return The value associated with the key, or NULL if it was not found.
+ */
+
+void *hash_get_typed(struct hash_table *ht, const void *key)
+{
+	struct hash_slot *s;
+	void *value;
+
+	if (ht == NULL || key == NULL || ht->hash == NULL)
+		return NULL;
+
+	s = hash_find(ht, key, ht->hash(key, ht->key_length), ht->key_length);
+	if (s == NULL)
+		return NULL;
+
+	memcpy(&value, s->pairing + ht->key_length, sizeof(value));
+
+	return value;
 }
 
 /**
@@ -212,30 +497,29 @@ const char *hash_get(struct hash_table *ht, const char *key)
  * \param  ht	The hash table context to iterate.
  * \param  c1	Pointer to first context
  * \param  c2	Pointer to second context (set to 0 on first call)
- * \return The next hash key, or NULL for no more keys
+ * \return The next hash key, or NULL for no more keys.  For a table made by
+ *	   hash_create_typed() this is the table's copy of the key.
  */
 
 const char *hash_iterate(struct hash_table *ht, unsigned int *c1, unsigned int **c2) {
-	struct hash_entry **he = (struct hash_entry **)c2;
+	struct hash_slot **hs = (struct hash_slot **)c2;
 
 	if (ht == NULL)
 		return NULL;
 
-	if (!*he)
-		*c1 = -1;
+	if (!*hs)
+		*c1 = 0;
 	else
-		*he = (*he)->next;
-
-	if (*he)
-		return (*he)->pairing;
-
-	while (!*he) {
 		(*c1)++;
-		if (*c1 >= ht->nchains)
-			return NULL;
-		*he = ht->chain[*c1];
+
+	for (; *c1 < ht->nslots; (*c1)++) {
+		if (ht->slot[*c1].pairing != NULL) {
+			*hs = &ht->slot[*c1];
+			return (*hs)->pairing;
+		}
 	}
-	return (*he)->pairing;
+
+	return NULL;
 }
 
 /* A simple test rig.  To compile, use:
@@ -249,11 +533,37 @@ const char *hash_iterate(struct hash_table *ht, unsigned int *c1, unsigned int *
 
 #ifdef TEST_RIG
 
+#define BENCH_ENTRIES 200000
+
+/* Typed keys are pointers to strings, which match regardless of case */
+
+static unsigned int test_key_hash(const void *key, size_t length)
+{
+	const char *k = *(const char * const *) key;
+	unsigned int z = 0x811c9dc5;
+
+	while (*k) {
+		z *= 0x01000193;
+		z ^= tolower((unsigned char) *k++);
+	}
+
+	return z;
+}
+
+static bool test_key_compare(const void *a, const void *b, size_t length)
+{
+	return strcasecmp(*(const char * const *) a,
+			*(const char * const *) b) == 0;
+}
+
 int main(int argc, char *argv[])
 {
 	struct hash_table *a, *b;
 	FILE *dict;
 	char keybuf[BUFSIZ], valbuf[BUFSIZ];
+	unsigned int c1, *c2;
+	clock_t start;
+	double secs;
 	int i;
 
 	a = hash_create(79);
@@ -287,6 +597,72 @@ int main(int argc, char *argv[])
 	hash_destroy(a);
 	hash_destroy(b);
 
+	/* Check typed keys use the table's hash and compare functions */
+	a = hash_create_typed(0, sizeof(const char *), test_key_hash,
+			test_key_compare);
+	assert(a != NULL);
+
+	{
+		const char *cow = "cow", *COW = "COW", *pig = "pig";
+		int moo, oink;
+
+		assert(hash_add_typed(a, &cow, &moo));
+		assert(hash_add_typed(a, &pig, &oink));
+		assert(hash_get_typed(a, &COW) == &moo);
+		assert(hash_get_typed(a, &pig) == &oink);
+
+		assert(hash_add_typed(a, &COW, &oink));
+		assert(hash_get_typed(a, &cow) == &oink);
+
+		/* String and typed interfaces don't mix */
+		assert(hash_get(a, "cow") == NULL);
+		assert(hash_add(a, "cow", "moo") == false);
+
+		c1 = 0;
+		c2 = NULL;
+		for (i = 0; hash_iterate(a, &c1, &c2) != NULL; i++)
+			;
+		assert(i == 2);
+	}
+
+	hash_destroy(a);
+
+	/* Check the table grows from its minimum size, and time it */
+	a = hash_create(0);
+	assert(a != NULL);
+
+	start = clock();
+	for (i = 0; i < BENCH_ENTRIES; i++) {
+		sprintf(keybuf, "key%d", i);
+		sprintf(valbuf, "value%d", i);
+		assert(hash_add(a, keybuf, valbuf));
+	}
+	secs = (double) (clock() - start) / CLOCKS_PER_SEC;
+	printf("%d adds in %.3fs\n", BENCH_ENTRIES, secs);
+
+	start = clock();
+	for (i = 0; i < BENCH_ENTRIES; i++) {
+		sprintf(keybuf, "key%d", i);
+		sprintf(valbuf, "value%d", i);
+		assert(strcmp(hash_get(a, keybuf), valbuf) == 0);
+	}
+	secs = (double) (clock() - start) / CLOCKS_PER_SEC;
+	printf("%d gets in %.3fs\n", BENCH_ENTRIES, secs);
+
+	assert(hash_get(a, "key") == NULL);
+
+	/* Replacing a value must not add a key */
+	assert(hash_add(a, "key0", "replaced"));
+	assert(strcmp(hash_get(a, "key0"), "replaced") == 0);
+
+	c1 = 0;
+	c2 = NULL;
+	for (i = 0; hash_iterate(a, &c1, &c2) != NULL; i++)
+		;
+	assert(i == BENCH_ENTRIES);
+
+	hash_destroy(a);
+
 	/* this test requires /usr/share/dict/words - a large list of English
 	 * words.  We load the entire file - odd lines are used as keys, and
 	 * even lines are used as the values for the previous line.  we then
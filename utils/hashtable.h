@@ -17,19 +17,44 @@
  */
 
 /** \file
- * Write-Once hash table for string to string mappings */
+ * Write-Once hash table for string to string mappings, or for fixed length
+ * keys to pointers */
 
 #ifndef _NETSURF_UTILS_HASHTABLE_H_
 #define _NETSURF_UTILS_HASHTABLE_H_
 
 #include <stdbool.h>
+#include <stddef.h>
 
 struct hash_table;
 
+/**
+ * Hash a fixed length key
+ *
+ * \param key	  The key to hash
+ * \param length  Length of key, as given to hash_create_typed
+ * \return hash of the key
+ */
+typedef unsigned int (*hash_key_hash)(const void *key, size_t length);
+
+/**
+ * Compare two fixed length keys
+ *
+ * \param a	  First key
+ * \param b	  Second key, as stored in the table
+ * \param length  Length of the keys, as given to hash_create_typed
+ * \return true iff the keys are equal
+ */
+typedef bool (*hash_key_compare)(const void *a, const void *b, size_t length);
+
 struct hash_table *hash_create(unsigned int chains);
 void hash_destroy(struct hash_table *ht);
 bool hash_add(struct hash_table *ht, const char *key, const char *value);
 const char *hash_get(struct hash_table *ht, const char *key);
+struct hash_table *hash_create_typed(unsigned int chains, size_t key_length,
+		hash_key_hash hash, hash_key_compare compare);
+bool hash_add_typed(struct hash_table *ht, const void *key, void *value);
+void *hash_get_typed(struct hash_table *ht, const void *key);
 const char *hash_iterate(struct hash_table *ht, unsigned int *c1,
 		unsigned int **c2);
 
@@ -21,11 +21,45 @@
  */
 
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <sys/time.h>
+#include <time.h>
 #include "desktop/netsurf.h"
 
 #include "utils/log.h"
+#include "utils/monotonic.h"
+
+/** Number of trace events kept, a power of two */
+#define TRACE_RING_SIZE 4096
+
+/** A recorded trace event */
+struct nslog_trace_entry {
+	uint64_t time;		/**< Monotonic time, in microseconds */
+	const void *id;		/**< Object the span belongs to */
+	unsigned char event;	/**< The nslog_trace_event */
+	char phase;		/**< 'B' or 'E' */
+};
+
+/** Names and kinds of the traced activities */
+static const struct {
+	const char *name;
+	bool async;
+} nslog_trace_events[NSLOG_TRACE_COUNT] = {
+	{ "fetch", true },
+	{ "parse", true },
+	{ "box", true },
+	{ "layout", false },
+	{ "redraw", false }
+};
+
+bool nslog_trace_enabled = true;
+
+/** Ring of recorded events, oldest overwritten first */
+static struct nslog_trace_entry nslog_trace_ring[TRACE_RING_SIZE];
+
+/** Number of events ever recorded */
+static unsigned long nslog_trace_count;
 
 nserror nslog_init(nslog_ensure_t *ensure, int *pargc, char **argv)
 {
@@ -55,6 +89,60 @@ nserror nslog_init(nslog_ensure_t *ensure, int *pargc, char **argv)
 	return ret;
 }
 
+void nslog_trace_record(nslog_trace_event event, char phase, const void *id)
+{
+	struct nslog_trace_entry *e;
+
+	e = &nslog_trace_ring[nslog_trace_count++ & (TRACE_RING_SIZE - 1)];
+	e->time = monotonic_us();
+	e->id = id;
+	e->event = event;
+	e->phase = phase;
+}
+
+nserror nslog_trace_dump(const char *path)
+{
+	const struct nslog_trace_entry *e;
+	const char *sep = "";
+	unsigned long i = 0;
+	FILE *fp;
+
+	fp = fopen(path, "w");
+	if (fp == NULL)
+		return NSERROR_SAVE_FAILED;
+
+	if (nslog_trace_count > TRACE_RING_SIZE)
+		i = nslog_trace_count - TRACE_RING_SIZE;
+
+	fprintf(fp, "{\"traceEvents\":[");
+
+	for (; i < nslog_trace_count; i++, sep = ",") {
+		e = &nslog_trace_ring[i & (TRACE_RING_SIZE - 1)];
+
+		fprintf(fp, "%s\n{\"name\":\"%s\",\"cat\":\"netsurf\","
+				"\"ts\":%llu,\"pid\":1,\"tid\":1,",
+				sep, nslog_trace_events[e->event].name,
+				(unsigned long long) e->time);
+
+		/* Asynchronous spans may overlap, so are matched up by id
+		 * and use the lower case phases */
+		if (nslog_trace_events[e->event].async) {
+			fprintf(fp, "\"ph\":\"%c\",\"id\":\"%p\"}",
+					e->phase - 'A' + 'a', e->id);
+		} else {
+			fprintf(fp, "\"ph\":\"%c\",\"args\":{\"id\":\"%p\"}}",
+					e->phase, e->id);
+		}
+	}
+
+	fprintf(fp, "\n]}\n");
+
+	if (fclose(fp) != 0)
+		return NSERROR_SAVE_FAILED;
+
+	return NSERROR_OK;
+}
+
 #ifndef NDEBUG
 
 /* Subtract the `struct timeval' values X and Y,
@@ -40,6 +40,54 @@ typedef bool(nslog_ensure_t)(FILE *fptr);
  */
 extern nserror nslog_init(nslog_ensure_t *ensure, int *pargc, char **argv);
 
+/**
+ * Traced activities.
+ *
+ * Each has a name in the trace, and is either synchronous, spanning a
+ * single call, or asynchronous, when its spans may overlap.
+ */
+typedef enum {
+	NSLOG_TRACE_FETCH,	/**< Fetch, from start to free (async) */
+	NSLOG_TRACE_PARSE,	/**< HTML parse, to completion (async) */
+	NSLOG_TRACE_BOX,	/**< Box tree construction (async) */
+	NSLOG_TRACE_LAYOUT,	/**< Document layout */
+	NSLOG_TRACE_REDRAW,	/**< Browser window content redraw */
+	NSLOG_TRACE_COUNT
+} nslog_trace_event;
+
+/** Whether trace events are being recorded, true by default */
+extern bool nslog_trace_enabled;
+
+/**
+ * Record a trace event in the ring buffer.
+ *
+ * \param event  Activity
+ * \param phase  'B' at the beginning of a span, 'E' at its end
+ * \param id     Object the span belongs to
+ */
+extern void nslog_trace_record(nslog_trace_event event, char phase,
+		const void *id);
+
+/**
+ * Write the recorded trace events in Chrome trace event format.
+ *
+ * \param path  Pathname of file to write
+ * \return NSERROR_OK on success, NSERROR_SAVE_FAILED otherwise
+ */
+extern nserror nslog_trace_dump(const char *path);
+
+#define TRACE_BEGIN(event, id) \
+	do {								\
+		if (nslog_trace_enabled)				\
+			nslog_trace_record((event), 'B', (id));		\
+	} while(0)
+
+#define TRACE_END(event, id) \
+	do {								\
+		if (nslog_trace_enabled)				\
+			nslog_trace_record((event), 'E', (id));		\
+	} while(0)
+
 #ifdef NDEBUG
 #  define LOG(x) ((void) 0)
 #else
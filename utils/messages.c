@@ -21,28 +21,283 @@
  * Localised message support (implementation).
  *
  * Native language messages are loaded from a file and stored hashed by key for
- * fast access.
+ * fast access.  Messages compiled by utils/compile-messages.pl into a binary
+ * catalogue are mapped into memory and searched in place instead.
  */
 
 #include <assert.h>
 #include <errno.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <zlib.h>
 #include <stdarg.h>
 
+#include "utils/config.h"
+
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
 #include "utils/log.h"
 #include "utils/messages.h"
 #include "utils/utils.h"
 #include "utils/hashtable.h"
 
-/** We store the messages in a fixed-size hash table. */
+/** Initial size of the messages hash table, which grows as needed. */
 #define HASH_SIZE 101
 
 /** The hash table used to store the standard Messages file for the old API */
 static struct hash_table *messages_hash = NULL;
 
+/** Identifier at the start of a compiled catalogue */
+#define CATALOGUE_MAGIC "NSMC"
+
+/** Catalogue format version understood */
+#define CATALOGUE_VERSION 1
+
+/** Size of the catalogue header: magic, version and count */
+#define CATALOGUE_HEADER 12
+
+/** A compiled messages catalogue, as written by compile-messages.pl */
+struct messages_catalogue {
+	const uint8_t *data;	/**< Catalogue contents */
+	size_t size;		/**< Size of contents, in bytes */
+	bool mapped;		/**< Contents are mapped, rather than read */
+	uint32_t count;		/**< Number of messages */
+	const uint8_t *hashes;	/**< Key hashes, in ascending order */
+	const uint8_t *offsets;	/**< Key and value offsets, by hash */
+	uint32_t first[257];	/**< Index of first hash with each top byte */
+};
+
+/** The catalogue used for the standard Messages, if one has been loaded */
+static struct messages_catalogue messages_cat;
+
+/**
+ * Read a little endian 32 bit value from a catalogue
+ */
+static inline uint32_t messages_le32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+/**
+ * Hash a message key, as compile-messages.pl does (FNV-1a)
+ *
+ * \param  key  key to hash
+ * \return hash of key
+ */
+static uint32_t messages_hash_key(const char *key)
+{
+	uint32_t h = 0x811c9dc5;
+
+	while (*key != '\0') {
+		h ^= (uint8_t) *key++;
+		h *= 0x01000193;
+	}
+
+	return h;
+}
+
+/**
+ * Release the contents of a catalogue
+ *
+ * \param  cat  catalogue to release
+ */
+static void messages_catalogue_close(struct messages_catalogue *cat)
+{
+	if (cat->data == NULL)
+		return;
+
+#ifdef HAVE_MMAP
+	if (cat->mapped)
+		munmap((void *) cat->data, cat->size);
+	else
+#endif
+		free((void *) cat->data);
+
+	cat->data = NULL;
+	cat->count = 0;
+}
+
+/**
+ * Open a compiled catalogue
+ *
+ * \param  path  pathname of file
+ * \param  cat   updated to the catalogue
+ * \return true on success, false if the file is not a valid catalogue
+ *
+ * The file is mapped into memory where possible, and read otherwise.
+ */
+static bool messages_catalogue_open(const char *path,
+		struct messages_catalogue *cat)
+{
+	uint8_t header[CATALOGUE_HEADER];
+	uint8_t *data = NULL;
+	bool mapped = false;
+	size_t size;
+	uint32_t count, i, top;
+	FILE *fp;
+
+	fp = fopen(path, "rb");
+	if (fp == NULL)
+		return false;
+
+	if (fread(header, 1, sizeof header, fp) != sizeof header ||
+			memcmp(header, CATALOGUE_MAGIC, 4) != 0 ||
+			messages_le32(header + 4) != CATALOGUE_VERSION ||
+			fseek(fp, 0, SEEK_END) != 0) {
+		fclose(fp);
+		return false;
+	}
+
+	size = ftell(fp);
+	count = messages_le32(header + 8);
+
+	/* Must have room for the tables, and end with a terminator so that
+	 * every string is bounded */
+	if (count > (size - CATALOGUE_HEADER) / 12 ||
+			size <= CATALOGUE_HEADER + (size_t) count * 12) {
+		fclose(fp);
+		return false;
+	}
+
+#ifdef HAVE_MMAP
+	data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+	if (data == MAP_FAILED)
+		data = NULL;
+	else
+		mapped = true;
+#endif
+
+	if (data == NULL) {
+		data = malloc(size);
+		if (data == NULL || fseek(fp, 0, SEEK_SET) != 0 ||
+				fread(data, 1, size, fp) != size) {
+			free(data);
+			fclose(fp);
+			return false;
+		}
+	}
+
+	fclose(fp);
+
+	cat->data = data;
+	cat->size = size;
+	cat->mapped = mapped;
+	cat->count = count;
+	cat->hashes = data + CATALOGUE_HEADER;
+	cat->offsets = cat->hashes + count * 4;
+
+	/* Check the offsets once, so that lookups needn't */
+	for (i = 0; i < count * 2; i++) {
+		if (messages_le32(cat->offsets + i * 4) >= size) {
+			LOG(("Bad offset in messages catalogue %s", path));
+			messages_catalogue_close(cat);
+			return false;
+		}
+	}
+
+	/* Index the hashes by their top byte, checking their order */
+	for (i = 0, top = 0; i < count; i++) {
+		uint32_t h = messages_le32(cat->hashes + i * 4);
+
+		if (i > 0 && h < messages_le32(cat->hashes + (i - 1) * 4)) {
+			LOG(("Unsorted messages catalogue %s", path));
+			messages_catalogue_close(cat);
+			return false;
+		}
+
+		while (top <= (h >> 24))
+			cat->first[top++] = i;
+	}
+	while (top <= 256)
+		cat->first[top++] = count;
+
+	if (data[size - 1] != '\0') {
+		LOG(("Unterminated messages catalogue %s", path));
+		messages_catalogue_close(cat);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Look up a message in a catalogue
+ *
+ * \param  cat  catalogue to search
+ * \param  key  key of message
+ * \return value of message, or NULL if not found
+ */
+static const char *messages_catalogue_get(const struct messages_catalogue *cat,
+		const char *key)
+{
+	uint32_t h = messages_hash_key(key);
+	uint32_t base, n;
+
+	if (cat->count == 0)
+		return NULL;
+
+	/* Search only the hashes with the same top byte */
+	base = cat->first[h >> 24];
+	n = cat->first[(h >> 24) + 1] - base;
+	if (n == 0)
+		return NULL;
+
+	/* Find the first hash which is not less than the key's, narrowing
+	 * the range without branching on the comparisons */
+	while (n > 1) {
+		uint32_t half = n / 2;
+
+		base = (messages_le32(cat->hashes + (base + half) * 4) < h) ?
+				base + half : base;
+		n -= half;
+	}
+	base += messages_le32(cat->hashes + base * 4) < h;
+
+	/* Keys with the same hash are adjacent */
+	for (; base < cat->count &&
+			messages_le32(cat->hashes + base * 4) == h; base++) {
+		const uint8_t *entry = cat->offsets + base * 8;
+		const char *k = (const char *) cat->data +
+				messages_le32(entry);
+
+		if (strcmp(k, key) == 0)
+			return (const char *) cat->data +
+					messages_le32(entry + 4);
+	}
+
+	return NULL;
+}
+
+/**
+ * Look up a message in the standard Messages
+ *
+ * \param  key  key of message
+ * \return value of message, or key if not found
+ *
+ * Messages loaded from text files take precedence over the catalogue.
+ */
+static const char *messages_lookup(const char *key)
+{
+	const char *r;
+
+	assert(key != NULL);
+
+	if (messages_hash != NULL) {
+		r = hash_get(messages_hash, key);
+		if (r != NULL)
+			return r;
+	}
+
+	r = messages_catalogue_get(&messages_cat, key);
+
+	return r ? r : key;
+}
+
 /**
  * Read keys and values from messages file.
  *
@@ -65,6 +320,34 @@ struct hash_table *messages_load_ctx(const char *path, struct hash_table *ctx)
 		return NULL;
 	}
 
+	/* Compiled catalogues are merged entry by entry */
+	{
+		struct messages_catalogue cat;
+		uint32_t i;
+
+		if (messages_catalogue_open(path, &cat)) {
+			for (i = 0; i < cat.count; i++) {
+				const uint8_t *entry = cat.offsets + i * 8;
+
+				if (hash_add(ctx, (const char *) cat.data +
+						messages_le32(entry),
+						(const char *) cat.data +
+						messages_le32(entry + 4)) ==
+						false) {
+					LOG(("Unable to add messages from %s",
+							path));
+					messages_catalogue_close(&cat);
+					hash_destroy(ctx);
+					return NULL;
+				}
+			}
+
+			messages_catalogue_close(&cat);
+
+			return ctx;
+		}
+	}
+
 	fp = gzopen(path, "r");
 	if (!fp) {
 		snprintf(s, sizeof s, "Unable to open messages file "
@@ -110,6 +393,9 @@ struct hash_table *messages_load_ctx(const char *path, struct hash_table *ctx)
  * The messages are merged with any previously loaded messages. Any keys which
  * are present already are replaced with the new value.
  *
+ * A compiled catalogue is used in place, replacing any catalogue loaded
+ * before.  Messages loaded from text files take precedence over it.
+ *
  * Exits through die() in case of error.
  */
 
@@ -122,6 +408,17 @@ void messages_load(const char *path)
 		return;
 			
 	LOG(("Loading Messages from '%s'", path));
+
+	{
+		struct messages_catalogue cat;
+
+		if (messages_catalogue_open(path, &cat)) {
+			messages_catalogue_close(&messages_cat);
+			messages_cat = cat;
+			LOG(("Mapped %u messages", cat.count));
+			return;
+		}
+	}
 	
 	m = messages_load_ctx(path, messages_hash);
 	if (m == NULL) {
@@ -168,7 +465,7 @@ char *messages_get_buff(const char *key, ...)
 	int buff_len = 0;
 	va_list ap;
 
-	msg_fmt = messages_get_ctx(key, messages_hash);
+	msg_fmt = messages_lookup(key);
 
 	va_start(ap, key);
 	buff_len = vsnprintf(buff, buff_len, msg_fmt, ap);
@@ -198,7 +495,7 @@ char *messages_get_buff(const char *key, ...)
 
 const char *messages_get(const char *key)
 {
-	return messages_get_ctx(key, messages_hash);
+	return messages_lookup(key);
 }
 
 
@@ -214,79 +511,79 @@ const char *messages_get_errorcode(nserror code)
 	switch (code) {
 	case NSERROR_OK:
 		/**< No error */
-		return messages_get_ctx("OK", messages_hash);
+		return messages_lookup("OK");
 
 	case NSERROR_NOMEM:
 		/**< Memory exhaustion */
-		return messages_get_ctx("NoMemory", messages_hash);
+		return messages_lookup("NoMemory");
 
 	case NSERROR_NO_FETCH_HANDLER:
 		/**< No fetch handler for URL scheme */
-		return messages_get_ctx("NoHandler", messages_hash);
+		return messages_lookup("NoHandler");
 
 	case NSERROR_NOT_FOUND:
 		/**< Requested item not found */
-		return messages_get_ctx("NotFound", messages_hash);
+		return messages_lookup("NotFound");
 
 	case NSERROR_SAVE_FAILED:
 		/**< Failed to save data */
-		return messages_get_ctx("SaveFailed", messages_hash);
+		return messages_lookup("SaveFailed");
 
 	case NSERROR_CLONE_FAILED:
 		/**< Failed to clone handle */
-		return messages_get_ctx("CloneFailed", messages_hash);
+		return messages_lookup("CloneFailed");
 
 	case NSERROR_INIT_FAILED:
 		/**< Initialisation failed */
-		return messages_get_ctx("InitFailed", messages_hash);
+		return messages_lookup("InitFailed");
 
 	case NSERROR_MNG_ERROR:
 		/**< An MNG error occurred */
-		return messages_get_ctx("MNGError", messages_hash);
+		return messages_lookup("MNGError");
 
 	case NSERROR_BAD_ENCODING:
 		/**< The character set is unknown */
-		return messages_get_ctx("BadEncoding", messages_hash);
+		return messages_lookup("BadEncoding");
 
 	case NSERROR_NEED_DATA:
 		/**< More data needed */
-		return messages_get_ctx("NeedData", messages_hash);
+		return messages_lookup("NeedData");
 
 	case NSERROR_ENCODING_CHANGE:
 		/**< The character set encoding change was unhandled */
-		return messages_get_ctx("EncodingChanged", messages_hash);
+		return messages_lookup("EncodingChanged");
 
 	case NSERROR_BAD_PARAMETER:
 		/**< Bad Parameter */
-		return messages_get_ctx("BadParameter", messages_hash);
+		return messages_lookup("BadParameter");
 
 	case NSERROR_INVALID:
 		/**< Invalid data */
-		return messages_get_ctx("Invalid", messages_hash);
+		return messages_lookup("Invalid");
 
 	case NSERROR_BOX_CONVERT:
 		/**< Box conversion failed */
-		return messages_get_ctx("BoxConvert", messages_hash);
+		return messages_lookup("BoxConvert");
 
 	case NSERROR_STOPPED:
 		/**< Content conversion stopped */
-		return messages_get_ctx("Stopped", messages_hash);
+		return messages_lookup("Stopped");
 
 	case NSERROR_DOM:
 		/**< DOM call returned error */
-		return messages_get_ctx("ParsingFail", messages_hash);
+		return messages_lookup("ParsingFail");
 
 	case NSERROR_CSS:
                 /**< CSS call returned error */
-		return messages_get_ctx("CSSGeneric", messages_hash);
+		return messages_lookup("CSSGeneric");
 
 	case NSERROR_CSS_BASE:
 		/**< CSS base sheet failed */
-		return messages_get_ctx("CSSBase", messages_hash);
+		return messages_lookup("CSSBase");
 
 	case NSERROR_BAD_URL:
 		/**< Bad URL */
-		return messages_get_ctx("BadURL", messages_hash);
+		return messages_lookup("BadURL");
 
 	default:
 	case NSERROR_UNKNOWN:
@@ -294,5 +591,5 @@ const char *messages_get_errorcode(nserror code)
 	}
 
 	/**< Unknown error */
-	return messages_get_ctx("Unknown", messages_hash);
+	return messages_lookup("Unknown");
 }
@@ -25,6 +25,9 @@
  * messages_load() to read the file into memory. To lookup a key, use
  * messages_get("key").
  *
+ * The messages file may instead be a binary catalogue compiled by
+ * utils/compile-messages.pl, which is used in place without parsing.
+ *
  * It can also load additional messages files into different contexts and allow
  * you to look up values in it independantly from the standard shared Messages
  * file table.  Use the _ctx versions of the functions to do this.
@@ -0,0 +1,54 @@
+/*
+ * Copyright 2012 NetSurf Browser Project
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Monotonic clock (implementation).
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "utils/monotonic.h"
+
+
+/**
+ * Read the monotonic clock
+ *
+ * \return Current time, in microseconds from an arbitrary origin
+ *
+ * Where CLOCK_MONOTONIC is missing, the time of day is used instead, which
+ * may jump if the system clock is changed.
+ */
+uint64_t monotonic_us(void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+	{
+		struct timeval tv;
+
+		gettimeofday(&tv, NULL);
+
+		return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+	}
+}
@@ -0,0 +1,30 @@
+/*
+ * Copyright 2012 NetSurf Browser Project
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Monotonic clock (interface).
+ */
+
+#ifndef _NETSURF_UTILS_MONOTONIC_H_
+#define _NETSURF_UTILS_MONOTONIC_H_
+
+#include <stdint.h>
+
+uint64_t monotonic_us(void);
+
+#endif
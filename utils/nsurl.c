@@ -23,6 +23,7 @@
 #include <assert.h>
 #include <ctype.h>
 #include <libwapcaplet/libwapcaplet.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -35,6 +36,15 @@
 /* Define to enable NSURL debugging */
 #undef NSURL_DEBUG
 
+/* Define NSURL_JOIN_CHECK to check every fast join against the general
+ * join.  The nsurl test is built with it. */
+
+/* Define to share a single NSURL object between identical URLs */
+#define NSURL_INTERN
+
+/** Initial number of buckets in the table of interned URLs */
+#define NSURL_INTERN_INITIAL_SIZE 256
+
 static bool nsurl__is_unreserved(unsigned char c)
 {
 	/* From RFC3986 section 2.3 (unreserved characters) 
@@ -154,12 +164,26 @@ struct nsurl {
 	struct nsurl_components components;
 
 	int count;	/* Number of references to NetSurf URL object */
+	uint32_t hash;	/* Hash of the NSURL_COMPLETE string */
+	struct nsurl *next;	/* Next URL in the interned URL table chain */
+	bool normalised;	/* nsurl_create of string gives this URL */
 
 	size_t length;	/* Length of string */
 	char string[FLEX_ARRAY_LEN_DECL];	/* Full URL as a string */
 };
 
 
+#ifdef NSURL_INTERN
+/** Table of interned URLs, chained by hash
+ *
+ * The table is not locked, so NetSurf URLs must only be created, referenced
+ * and released on the main thread. */
+static nsurl **nsurl__table = NULL;
+static uint32_t nsurl__table_size = 0;
+static uint32_t nsurl__table_count = 0;
+#endif
+
+
 /** Marker set, indicating positions of sections within a URL string */
 struct url_markers {
 	size_t start; /** start of URL */
@@ -1185,6 +1209,407 @@ static void nsurl_get_string(const struct nsurl_components *url, char *url_s,
 }
 
 
+/**
+ * Calculate the hash of a NetSurf URL
+ *
+ * \param url	NetSurf URL, with its components and string filled out
+ * \return the hash of the URL's NSURL_COMPLETE string
+ */
+static uint32_t nsurl__calc_hash(const nsurl *url)
+{
+	uint32_t hash = 0x811c9dc5; /* FNV-1a */
+	size_t length = url->length;
+	size_t i;
+
+	/* The fragment is not part of NSURL_COMPLETE */
+	if (url->components.fragment != NULL) {
+		length -= 1 + lwc_string_length(url->components.fragment);
+	}
+
+	for (i = 0; i < length; i++) {
+		hash ^= (unsigned char) url->string[i];
+		hash *= 0x01000193;
+	}
+
+	return hash;
+}
+
+
+/**
+ * Find an interned URL with the given string
+ *
+ * \param url_s	 URL string
+ * \param length  Length of url_s
+ * \param hash	 Hash of url_s, as nsurl__calc_hash would give
+ * \return the interned URL, or NULL if there is none
+ */
+static nsurl *nsurl__intern_find(const char *url_s, size_t length,
+		uint32_t hash)
+{
+#ifdef NSURL_INTERN
+	nsurl *url;
+
+	if (nsurl__table == NULL)
+		return NULL;
+
+	for (url = nsurl__table[hash & (nsurl__table_size - 1)]; url != NULL;
+			url = url->next) {
+		if (url->hash == hash && url->length == length &&
+				memcmp(url->string, url_s, length) == 0)
+			return url;
+	}
+#endif
+
+	return NULL;
+}
+
+
+/**
+ * Intern a newly created URL
+ *
+ * \param url	NetSurf URL with a single reference, which is taken
+ * \return the URL to use in its place, which may be an existing one
+ */
+static nsurl *nsurl__intern(nsurl *url)
+{
+#ifdef NSURL_INTERN
+	nsurl *existing;
+	nsurl **table;
+	nsurl *next;
+	uint32_t size;
+	uint32_t i;
+
+	url->next = NULL;
+	url->normalised = false;
+
+	existing = nsurl__intern_find(url->string, url->length, url->hash);
+	if (existing != NULL) {
+		nsurl_unref(url);
+		return nsurl_ref(existing);
+	}
+
+	if (nsurl__table_count >= nsurl__table_size) {
+		/* Grow the table; on failure the URL just isn't shared */
+		size = (nsurl__table_size == 0) ? NSURL_INTERN_INITIAL_SIZE :
+				nsurl__table_size * 2;
+		table = calloc(size, sizeof(nsurl *));
+		if (table == NULL)
+			return url;
+
+		for (i = 0; i < nsurl__table_size; i++) {
+			for (existing = nsurl__table[i]; existing != NULL;
+					existing = next) {
+				next = existing->next;
+				existing->next = table[existing->hash &
+						(size - 1)];
+				table[existing->hash & (size - 1)] = existing;
+			}
+		}
+
+		free(nsurl__table);
+		nsurl__table = table;
+		nsurl__table_size = size;
+	}
+
+	url->next = nsurl__table[url->hash & (nsurl__table_size - 1)];
+	nsurl__table[url->hash & (nsurl__table_size - 1)] = url;
+	nsurl__table_count++;
+#endif
+
+	return url;
+}
+
+
+/**
+ * Remove a URL from the table of interned URLs, if it is there
+ *
+ * \param url	NetSurf URL being destroyed
+ */
+static void nsurl__unintern(nsurl *url)
+{
+#ifdef NSURL_INTERN
+	nsurl **link;
+
+	if (nsurl__table == NULL)
+		return;
+
+	for (link = &nsurl__table[url->hash & (nsurl__table_size - 1)];
+			*link != NULL; link = &(*link)->next) {
+		if (*link == url) {
+			*link = url->next;
+			nsurl__table_count--;
+			break;
+		}
+	}
+
+	if (nsurl__table_count == 0) {
+		free(nsurl__table);
+		nsurl__table = NULL;
+		nsurl__table_size = 0;
+	}
+#endif
+}
+
+
+/**
+ * Release the references held by a set of URL components
+ *
+ * \param c	URL components
+ */
+static void nsurl__components_unref(struct nsurl_components *c)
+{
+	if (c->scheme)
+		lwc_string_unref(c->scheme);
+
+	if (c->username)
+		lwc_string_unref(c->username);
+
+	if (c->password)
+		lwc_string_unref(c->password);
+
+	if (c->host)
+		lwc_string_unref(c->host);
+
+	if (c->port)
+		lwc_string_unref(c->port);
+
+	if (c->path)
+		lwc_string_unref(c->path);
+
+	if (c->query)
+		lwc_string_unref(c->query);
+
+	if (c->fragment)
+		lwc_string_unref(c->fragment);
+}
+
+
+/**
+ * Create a NetSurf URL object from a set of components
+ *
+ * \param c	URL components, whose references are taken
+ * \param url	Returns new NetSurf URL
+ * \return NSERROR_OK on success, appropriate error otherwise
+ *
+ * On failure, the component references are released.
+ */
+static nserror nsurl__create_from_components(struct nsurl_components *c,
+		nsurl **url)
+{
+	struct nsurl_component_lengths str_len = { 0, 0, 0, 0,  0, 0, 0, 0 };
+	enum nsurl_string_flags str_flags = 0;
+	size_t length;
+
+	/* Get the string length and find which parts of url are present */
+	nsurl__get_string_data(c, NSURL_WITH_FRAGMENT, &length,
+			&str_len, &str_flags);
+
+	/* Create NetSurf URL object */
+	*url = malloc(sizeof(nsurl) + length + 1); /* Add 1 for \0 */
+	if (*url == NULL) {
+		nsurl__components_unref(c);
+		return NSERROR_NOMEM;
+	}
+
+	(*url)->components = *c;
+	(*url)->length = length;
+
+	/* Fill out the url string */
+	nsurl_get_string(c, (*url)->string, &str_len, str_flags);
+	(*url)->hash = nsurl__calc_hash(*url);
+
+	/* Give the URL a reference */
+	(*url)->count = 1;
+
+	*url = nsurl__intern(*url);
+
+	return NSERROR_OK;
+}
+
+
+/**
+ * Check whether a path has any "." or ".." segments
+ *
+ * \param path	Path string
+ * \param len	Length of path
+ * \return true iff removing dot segments would change the path
+ */
+static bool nsurl__has_dot_segment(const char *path, size_t len)
+{
+	size_t seg = 0;
+	size_t i;
+
+	for (i = 0; i <= len; i++) {
+		if (i == len || path[i] == '/') {
+			if (i - seg == 1 && path[seg] == '.')
+				return true;
+			if (i - seg == 2 && path[seg] == '.' &&
+					path[seg + 1] == '.')
+				return true;
+			seg = i + 1;
+		}
+	}
+
+	return false;
+}
+
+
+/**
+ * Join a common form of relative URL to a base URL without reparsing
+ *
+ * \param base	 NetSurf URL for the base of the join
+ * \param rel	 Relative URL string
+ * \param joined Returns joined NetSurf URL
+ * \return NSERROR_OK on success, NSERROR_NOT_FOUND if rel is not of a
+ *	   form handled here, or appropriate error otherwise
+ *
+ * Handles fragment-only, query-only, absolute path and relative path
+ * references without dot or empty segments, which need no escaping or
+ * normalisation, against a base with a hierarchical path.  The result is
+ * identical to that of the general join, which NSURL_JOIN_CHECK verifies,
+ * but the base's components are reused as they are.
+ */
+static nserror nsurl__join_fast(const nsurl *base, const char *rel,
+		nsurl **joined)
+{
+	struct nsurl_components c;
+	const char *pos;
+	const char *query = NULL;
+	const char *fragment = NULL;
+	const char *base_path = NULL;
+	size_t base_path_len = 0;
+	size_t path_len;
+	bool colon = false;
+	bool empty_segment = false;
+	char *buff;
+
+	/* Base must have a hierarchical path for merging */
+	if (base->components.path != NULL) {
+		base_path = lwc_string_data(base->components.path);
+		if (base_path[0] != '/')
+			return NSERROR_NOT_FOUND;
+	} else if (base->components.host == NULL) {
+		return NSERROR_NOT_FOUND;
+	}
+
+	/* Find the sections of rel, bailing out on anything which would
+	 * need escaping or unescaping.  Empty path segments are left to the
+	 * general join, which may parse them as an authority. */
+	for (pos = rel; *pos != '\0'; pos++) {
+		if (*pos == '%' || nsurl__is_no_escape(*pos) == false)
+			return NSERROR_NOT_FOUND;
+
+		if (fragment != NULL)
+			continue;
+
+		if (*pos == '#')
+			fragment = pos;
+		else if (query != NULL)
+			continue;
+		else if (*pos == '?')
+			query = pos;
+		else if (*pos == ':')
+			colon = true;
+		else if (*pos == '/' && pos != rel && *(pos - 1) == '/')
+			empty_segment = true;
+	}
+
+	path_len = ((query != NULL) ? query :
+			(fragment != NULL) ? fragment : pos) - rel;
+
+	if (path_len == 0) {
+		/* Fragment or query only; empty rel is left to nsurl_join */
+		if (query == NULL && fragment == NULL)
+			return NSERROR_NOT_FOUND;
+
+	} else if (empty_segment) {
+		return NSERROR_NOT_FOUND;
+
+	} else if (rel[0] == '/') {
+		/* Absolute path; network-path references have an authority */
+		if (rel[1] == '/' || nsurl__has_dot_segment(rel, path_len))
+			return NSERROR_NOT_FOUND;
+
+	} else {
+		/* Relative path; may not look like it has a scheme */
+		if (colon || nsurl__has_dot_segment(rel, path_len))
+			return NSERROR_NOT_FOUND;
+
+		if (base_path == NULL) {
+			/* Append relative path to "/" */
+			base_path = "/";
+			base_path_len = 1;
+		} else {
+			/* Keep all but last segment of base path */
+			base_path_len = lwc_string_length(
+					base->components.path);
+			while (base_path[base_path_len - 1] != '/')
+				base_path_len--;
+
+			if (nsurl__has_dot_segment(base_path,
+					base_path_len - 1))
+				return NSERROR_NOT_FOUND;
+		}
+	}
+
+	/* Scheme and authority always come from the base */
+	c.scheme_type = base->components.scheme_type;
+	c.scheme = nsurl__component_copy(base->components.scheme);
+	c.username = nsurl__component_copy(base->components.username);
+	c.password = nsurl__component_copy(base->components.password);
+	c.host = nsurl__component_copy(base->components.host);
+	c.port = nsurl__component_copy(base->components.port);
+	c.path = NULL;
+	c.query = NULL;
+	c.fragment = NULL;
+
+	if (path_len == 0) {
+		c.path = nsurl__component_copy(base->components.path);
+
+	} else if (base_path_len == 0) {
+		if (lwc_intern_string(rel, path_len, &c.path) != lwc_error_ok)
+			goto nomem;
+
+	} else {
+		buff = malloc(base_path_len + path_len);
+		if (buff == NULL)
+			goto nomem;
+
+		memcpy(buff, base_path, base_path_len);
+		memcpy(buff + base_path_len, rel, path_len);
+
+		if (lwc_intern_string(buff, base_path_len + path_len,
+				&c.path) != lwc_error_ok) {
+			free(buff);
+			goto nomem;
+		}
+		free(buff);
+	}
+
+	if (query != NULL) {
+		if (lwc_intern_string(query, ((fragment != NULL) ?
+				fragment : pos) - query,
+				&c.query) != lwc_error_ok)
+			goto nomem;
+
+	} else if (path_len == 0) {
+		c.query = nsurl__component_copy(base->components.query);
+	}
+
+	if (fragment != NULL && *(fragment + 1) != '\0') {
+		if (lwc_intern_string(fragment + 1, pos - fragment - 1,
+				&c.fragment) != lwc_error_ok)
+			goto nomem;
+	}
+
+	return nsurl__create_from_components(&c, joined);
+
+nomem:
+	nsurl__components_unref(&c);
+	return NSERROR_NOMEM;
+}
+
+
 #ifdef NSURL_DEBUG
 /**
  * Dump a NetSurf URL's internal components
@@ -1236,9 +1661,26 @@ nserror nsurl_create(const char * const url_s, nsurl **url)
 	struct nsurl_component_lengths str_len = { 0, 0, 0, 0,  0, 0, 0, 0 };
 	enum nsurl_string_flags str_flags = 0;
 	nserror e = NSERROR_OK;
+	uint32_t hash = 0x811c9dc5; /* FNV-1a, as nsurl__calc_hash */
+	const char *pos;
+	nsurl *existing;
 
 	assert(url_s != NULL);
 
+	/* A URL string which is already normalised creates the URL it came
+	 * from, so look for a live URL with the same string.  URLs made by
+	 * other means may hold strings nsurl_create would normalise
+	 * differently, so only URLs known to be normalised are used. */
+	for (pos = url_s; *pos != '\0' && *pos != '#'; pos++) {
+		hash ^= (unsigned char) *pos;
+		hash *= 0x01000193;
+	}
+	existing = nsurl__intern_find(url_s, pos - url_s + strlen(pos), hash);
+	if (existing != NULL && existing->normalised) {
+		*url = nsurl_ref(existing);
+		return NSERROR_OK;
+	}
+
 	/* Peg out the URL sections */
 	nsurl__get_string_markers(url_s, &m, false);
 
@@ -1281,10 +1723,17 @@ nserror nsurl_create(const char * const url_s, nsurl **url)
 
 	/* Fill out the url string */
 	nsurl_get_string(&c, (*url)->string, &str_len, str_flags);
+	(*url)->hash = nsurl__calc_hash(*url);
 
 	/* Give the URL a reference */
 	(*url)->count = 1;
 
+	*url = nsurl__intern(*url);
+
+	/* Let later creates from the same string skip parsing */
+	if (strcmp(url_s, (*url)->string) == 0)
+		(*url)->normalised = true;
+
 	return NSERROR_OK;
 }
 
@@ -1313,30 +1762,10 @@ void nsurl_unref(nsurl *url)
 	nsurl__dump(url);
 #endif
 
-	/* Release lwc strings */
-	if (url->components.scheme)
-		lwc_string_unref(url->components.scheme);
-
-	if (url->components.username)
-		lwc_string_unref(url->components.username);
-
-	if (url->components.password)
-		lwc_string_unref(url->components.password);
-
-	if (url->components.host)
-		lwc_string_unref(url->components.host);
+	nsurl__unintern(url);
 
-	if (url->components.port)
-		lwc_string_unref(url->components.port);
-
-	if (url->components.path)
-		lwc_string_unref(url->components.path);
-
-	if (url->components.query)
-		lwc_string_unref(url->components.query);
-
-	if (url->components.fragment)
-		lwc_string_unref(url->components.fragment);
+	/* Release lwc strings */
+	nsurl__components_unref(&url->components);
 
 	/* Free the NetSurf URL */
 	free(url);
@@ -1351,6 +1780,14 @@ bool nsurl_compare(const nsurl *url1, const nsurl *url2, nsurl_component parts)
 	assert(url1 != NULL);
 	assert(url2 != NULL);
 
+	if (url1 == url2)
+		return true;
+
+	/* URLs with matching NSURL_COMPLETE components have equal hashes */
+	if ((parts & NSURL_COMPLETE) == NSURL_COMPLETE &&
+			url1->hash != url2->hash)
+		return false;
+
 	/* Compare URL components */
 
 	/* Path, host and query first, since they're most likely to differ */
@@ -1423,6 +1860,15 @@ bool nsurl_compare(const nsurl *url1, const nsurl *url2, nsurl_component parts)
 }
 
 
+/* exported interface, documented in nsurl.h */
+uint32_t nsurl_hash(const nsurl *url)
+{
+	assert(url != NULL);
+
+	return url->hash;
+}
+
+
 /* exported interface, documented in nsurl.h */
 nserror nsurl_get(const nsurl *url, nsurl_component parts,
 		char **url_s, size_t *url_l)
@@ -1614,8 +2060,16 @@ size_t nsurl_length(const nsurl *url)
 }
 
 
-/* exported interface, documented in nsurl.h */
-nserror nsurl_join(const nsurl *base, const char *rel, nsurl **joined)
+/**
+ * Join a relative URL to a base URL, by parsing the relative URL
+ *
+ * \param base	 NetSurf URL for the base of the join
+ * \param rel	 Relative URL string
+ * \param joined Returns joined NetSurf URL
+ * \return NSERROR_OK on success, appropriate error otherwise
+ */
+static nserror nsurl__join(const nsurl *base, const char *rel,
+		nsurl **joined)
 {
 	struct url_markers m;
 	struct nsurl_components c;
@@ -1623,8 +2077,6 @@ nserror nsurl_join(const nsurl *base, const char *rel, nsurl **joined)
 	char *buff;
 	char *buff_pos;
 	char *buff_start;
-	struct nsurl_component_lengths str_len = { 0, 0, 0, 0,  0, 0, 0, 0 };
-	enum nsurl_string_flags str_flags = 0;
 	nserror error = 0;
 	enum {
 		NSURL_F_REL		=  0,
@@ -1635,9 +2087,6 @@ nserror nsurl_join(const nsurl *base, const char *rel, nsurl **joined)
 		NSURL_F_BASE_QUERY	= (1 << 4)
 	} joined_parts;
 
-	assert(base != NULL);
-	assert(rel != NULL);
-
 	/* Peg out the URL sections */
 	nsurl__get_string_markers(rel, &m, true);
 
@@ -1804,25 +2253,43 @@ nserror nsurl_join(const nsurl *base, const char *rel, nsurl **joined)
 	if (error != NSERROR_OK)
 		return NSERROR_NOMEM;
 
-	/* Get the string length and find which parts of url are present */
-	nsurl__get_string_data(&c, NSURL_WITH_FRAGMENT, &length,
-			&str_len, &str_flags);
+	return nsurl__create_from_components(&c, joined);
+}
 
-	/* Create NetSurf URL object */
-	*joined = malloc(sizeof(nsurl) + length + 1); /* Add 1 for \0 */
-	if (*joined == NULL)
-		return NSERROR_NOMEM;
 
-	(*joined)->components = c;
-	(*joined)->length = length;
+/* exported interface, documented in nsurl.h */
+nserror nsurl_join(const nsurl *base, const char *rel, nsurl **joined)
+{
+	nserror error;
 
-	/* Fill out the url string */
-	nsurl_get_string(&c, (*joined)->string, &str_len, str_flags);
+	assert(base != NULL);
+	assert(rel != NULL);
 
-	/* Give the URL a reference */
-	(*joined)->count = 1;
+	/* Most relative URLs in documents take a simple form that can be
+	 * joined without reparsing */
+	error = nsurl__join_fast(base, rel, joined);
+	if (error == NSERROR_NOT_FOUND)
+		return nsurl__join(base, rel, joined);
+
+#ifdef NSURL_JOIN_CHECK
+	if (error == NSERROR_OK) {
+		nsurl *general;
+
+		/* The fast join must agree with the general join */
+		if (nsurl__join(base, rel, &general) == NSERROR_OK) {
+			if (strcmp(general->string, (*joined)->string) != 0) {
+				LOG(("Join of %s to %s: fast %s, general %s",
+						rel, base->string,
+						(*joined)->string,
+						general->string));
+				assert(0 && "Fast and general joins differ");
+			}
+			nsurl_unref(general);
+		}
+	}
+#endif
 
-	return NSERROR_OK;
+	return error;
 }
 
 
@@ -1871,9 +2338,13 @@ nserror nsurl_defragment(const nsurl *url, nsurl **no_frag)
 	pos += length;
 	*pos = '\0';
 
+	(*no_frag)->hash = url->hash;
+
 	/* Give the URL a reference */
 	(*no_frag)->count = 1;
 
+	*no_frag = nsurl__intern(*no_frag);
+
 	return NSERROR_OK;
 }
 
@@ -1936,9 +2407,13 @@ nserror nsurl_refragment(const nsurl *url, lwc_string *frag, nsurl **new_url)
 
 	(*new_url)->components.scheme_type = url->components.scheme_type;
 
+	(*new_url)->hash = url->hash;
+
 	/* Give the URL a reference */
 	(*new_url)->count = 1;
 
+	*new_url = nsurl__intern(*new_url);
+
 	return NSERROR_OK;
 }
 
@@ -1971,6 +2446,9 @@ nserror nsurl_replace_query(const nsurl *url, const char *query,
 
 	/* Set new_url's length */
 	len = base_len + query_len;
+	if (url->components.fragment != NULL) {
+		len += 1 + lwc_string_length(url->components.fragment);
+	}
 
 	/* Create NetSurf URL object */
 	*new_url = malloc(sizeof(nsurl) + len + 1); /* Add 1 for \0 */
@@ -2019,9 +2497,13 @@ nserror nsurl_replace_query(const nsurl *url, const char *query,
 
 	(*new_url)->components.scheme_type = url->components.scheme_type;
 
+	(*new_url)->hash = nsurl__calc_hash(*new_url);
+
 	/* Give the URL a reference */
 	(*new_url)->count = 1;
 
+	*new_url = nsurl__intern(*new_url);
+
 	return NSERROR_OK;
 }
 
@@ -2114,9 +2596,13 @@ nserror nsurl_parent(const nsurl *url, nsurl **new_url)
 
 	(*new_url)->components.scheme_type = url->components.scheme_type;
 
+	(*new_url)->hash = nsurl__calc_hash(*new_url);
+
 	/* Give the URL a reference */
 	(*new_url)->count = 1;
 
+	*new_url = nsurl__intern(*new_url);
+
 	return NSERROR_OK;
 }
 
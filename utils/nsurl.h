@@ -23,11 +23,16 @@
 #ifndef _NETSURF_UTILS_NSURL_H_
 #define _NETSURF_UTILS_NSURL_H_
 
+#include <stdint.h>
 #include <libwapcaplet/libwapcaplet.h>
 #include "utils/errors.h"
 
 
-/** NetSurf URL object */
+/** NetSurf URL object
+ *
+ * Identical URLs share a single object through a table which is not
+ * locked, so NetSurf URLs must only be created, referenced and released
+ * on the main thread. */
 typedef struct nsurl nsurl;
 
 
@@ -59,6 +64,9 @@ typedef enum nsurl_component {
  *
  * It is up to the client to call nsurl_destroy when they are finished with
  * the created object.
+ *
+ * Identical URLs share a single NetSurf URL object, so the URL returned may
+ * be a new reference to an existing one.
  */
 nserror nsurl_create(const char * const url_s, nsurl **url);
 
@@ -98,6 +106,19 @@ void nsurl_unref(nsurl *url);
 bool nsurl_compare(const nsurl *url1, const nsurl *url2, nsurl_component parts);
 
 
+/**
+ * Get a hash of a NetSurf URL
+ *
+ * \param url	  NetSurf URL to get the hash of
+ * \return the hash of the URL's NSURL_COMPLETE components
+ *
+ * URLs which nsurl_compare finds to match for NSURL_COMPLETE have equal
+ * hashes, so the hash is suitable for keying hash tables of URLs.  The
+ * fragment is not included.
+ */
+uint32_t nsurl_hash(const nsurl *url);
+
+
 /**
  * Get URL (section) as a string, from a NetSurf URL object
  *
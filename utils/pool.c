@@ -0,0 +1,215 @@
+/*
+ * Copyright 2012 NetSurf Browser Project
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Fixed size object pool (implementation).
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils/log.h"
+#include "utils/pool.h"
+
+/** Target size of a chunk, including its header */
+#define POOL_CHUNK_SIZE 4096
+
+/** Minimum number of objects in a chunk */
+#define POOL_CHUNK_MIN_ITEMS 8
+
+/** Type with the strictest alignment an object may need */
+union pool_align {
+	void *p;
+	long l;
+	double d;
+};
+
+/** Alignment of objects */
+#define POOL_ALIGN (sizeof(union pool_align))
+
+/** A free object */
+struct pool_free_item {
+	struct pool_free_item *next;	/**< Next free object */
+};
+
+/** A chunk of objects */
+struct pool_chunk {
+	struct pool_chunk *next;	/**< Next (older) chunk */
+	union pool_align data[];	/**< Objects */
+};
+
+/** A pool */
+struct pool {
+	const char *name;		/**< Name, for diagnostics */
+	size_t item_size;		/**< Size of each object */
+	unsigned int chunk_items;	/**< Objects per chunk */
+	unsigned int unused;		/**< Untouched objects in first chunk */
+	struct pool_chunk *chunks;	/**< Chunks, current first */
+	struct pool_free_item *free_list; /**< Freed objects, newest first */
+	struct pool_stats stats;	/**< Usage statistics */
+};
+
+
+/**
+ * Create a pool
+ *
+ * \param name       Name of the pool, used in diagnostics; must outlive pool
+ * \param item_size  Size of the objects the pool hands out
+ * \return New pool, or NULL on memory exhaustion
+ */
+struct pool *pool_create(const char *name, size_t item_size)
+{
+	struct pool *pool;
+
+	pool = malloc(sizeof(struct pool));
+	if (pool == NULL)
+		return NULL;
+
+	if (item_size < sizeof(struct pool_free_item))
+		item_size = sizeof(struct pool_free_item);
+	item_size = (item_size + POOL_ALIGN - 1) & ~(POOL_ALIGN - 1);
+
+	pool->name = name;
+	pool->item_size = item_size;
+	pool->chunk_items = (POOL_CHUNK_SIZE - sizeof(struct pool_chunk)) /
+			item_size;
+	if (pool->chunk_items < POOL_CHUNK_MIN_ITEMS)
+		pool->chunk_items = POOL_CHUNK_MIN_ITEMS;
+	pool->unused = 0;
+	pool->chunks = NULL;
+	pool->free_list = NULL;
+
+	memset(&pool->stats, 0, sizeof(pool->stats));
+	pool->stats.item_size = item_size;
+
+	return pool;
+}
+
+
+/**
+ * Destroy a pool, freeing all its memory
+ *
+ * \param pool  Pool to destroy
+ *
+ * If any objects are still in use, the chunks are leaked rather than
+ * leaving their owners with dangling pointers.
+ */
+void pool_destroy(struct pool *pool)
+{
+	struct pool_chunk *chunk, *next;
+
+	if (pool == NULL)
+		return;
+
+	LOG(("%s: %u bytes, %u chunks, peak %u, %lu allocs (%lu reused)",
+			pool->name, (unsigned int) pool->stats.item_size,
+			pool->stats.chunks, pool->stats.peak,
+			pool->stats.allocs, pool->stats.reused));
+
+	if (pool->stats.in_use != 0) {
+		LOG(("%s: %u objects still in use", pool->name,
+				pool->stats.in_use));
+	} else {
+		for (chunk = pool->chunks; chunk != NULL; chunk = next) {
+			next = chunk->next;
+			free(chunk);
+		}
+	}
+
+	free(pool);
+}
+
+
+/**
+ * Allocate an object from a pool
+ *
+ * \param pool  Pool to allocate from
+ * \return Pointer to zeroed object, or NULL on memory exhaustion
+ */
+void *pool_alloc(struct pool *pool)
+{
+	struct pool_chunk *chunk;
+	void *p;
+
+	if (pool->free_list != NULL) {
+		p = pool->free_list;
+		pool->free_list = pool->free_list->next;
+		pool->stats.reused++;
+	} else {
+		if (pool->unused == 0) {
+			chunk = malloc(sizeof(struct pool_chunk) +
+					pool->chunk_items * pool->item_size);
+			if (chunk == NULL)
+				return NULL;
+
+			chunk->next = pool->chunks;
+			pool->chunks = chunk;
+			pool->unused = pool->chunk_items;
+			pool->stats.chunks++;
+		}
+
+		/* Hand out the chunk's objects in order */
+		p = (char *) pool->chunks->data +
+				(pool->chunk_items - pool->unused) *
+				pool->item_size;
+		pool->unused--;
+	}
+
+	pool->stats.allocs++;
+	pool->stats.in_use++;
+	if (pool->stats.in_use > pool->stats.peak)
+		pool->stats.peak = pool->stats.in_use;
+
+	memset(p, 0, pool->item_size);
+
+	return p;
+}
+
+
+/**
+ * Return an object to a pool
+ *
+ * \param pool  Pool the object was allocated from
+ * \param p     Object to free, or NULL
+ */
+void pool_free(struct pool *pool, void *p)
+{
+	struct pool_free_item *item = p;
+
+	if (p == NULL)
+		return;
+
+	assert(pool->stats.in_use > 0);
+
+	item->next = pool->free_list;
+	pool->free_list = item;
+	pool->stats.in_use--;
+}
+
+
+/**
+ * Retrieve a pool's usage statistics
+ *
+ * \param pool   Pool to examine
+ * \param stats  Updated with the statistics
+ */
+void pool_get_stats(const struct pool *pool, struct pool_stats *stats)
+{
+	*stats = pool->stats;
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright 2012 NetSurf Browser Project
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Fixed size object pool (interface).
+ *
+ * A pool hands out objects of a single size, carved from chunks holding
+ * many objects each.  Freed objects go on a free list and are reused by
+ * the next allocation.  Chunks are only released when the pool is
+ * destroyed, so a pool's footprint is that of its peak usage.
+ */
+
+#ifndef _NETSURF_UTILS_POOL_H_
+#define _NETSURF_UTILS_POOL_H_
+
+#include <stddef.h>
+
+struct pool;
+
+/** Pool usage statistics */
+struct pool_stats {
+	size_t item_size;	/**< Size of each object, after rounding */
+	unsigned int in_use;	/**< Objects currently allocated */
+	unsigned int peak;	/**< Greatest number of objects in use */
+	unsigned int chunks;	/**< Chunks allocated */
+	unsigned long allocs;	/**< Total allocations */
+	unsigned long reused;	/**< Allocations satisfied by the free list */
+};
+
+struct pool *pool_create(const char *name, size_t item_size);
+void pool_destroy(struct pool *pool);
+void *pool_alloc(struct pool *pool);
+void pool_free(struct pool *pool, void *p);
+void pool_get_stats(const struct pool *pool, struct pool_stats *stats);
+
+#endif
@@ -0,0 +1,373 @@
+/*
+ * Copyright 2012 NetSurf Browser Project
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Heap based callback scheduler (implementation).
+ */
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "utils/log.h"
+#include "utils/monotonic.h"
+#include "utils/pool.h"
+#include "utils/schedheap.h"
+
+/** Initial number of heap slots and hash buckets */
+#define SCHEDHEAP_MIN_SIZE 64
+
+/** A scheduled callback */
+struct schedheap_entry {
+	uint64_t deadline;		/**< When to run, in ms */
+	uint64_t seq;			/**< Order scheduled, breaks ties */
+	unsigned int index;		/**< Position in heap */
+	schedule_callback_fn callback;	/**< Function to call */
+	void *p;			/**< Parameter for callback */
+	struct schedheap_entry *next;	/**< Next entry in hash chain */
+};
+
+/** Heap of entries, soonest first */
+static struct schedheap_entry **heap;
+static unsigned int heap_count;
+static unsigned int heap_size;
+
+/** Hash of entries by callback and parameter */
+static struct schedheap_entry **buckets;
+static unsigned int bucket_count;
+
+/** Entry allocator */
+static struct pool *entry_pool;
+
+/** Sequence number for the next entry scheduled */
+static uint64_t next_seq;
+
+
+/**
+ * Find the hash bucket for a callback
+ *
+ * \param callback  Callback function
+ * \param p         Callback parameter
+ * \return Pointer to head of the bucket's chain
+ */
+static struct schedheap_entry **schedheap_bucket(schedule_callback_fn callback,
+		void *p)
+{
+	uintptr_t h = (uintptr_t) callback * 2654435761u;
+
+	h ^= (uintptr_t) p >> 3;
+	h ^= h >> 15;
+
+	return &buckets[h & (bucket_count - 1)];
+}
+
+
+/**
+ * Find the hash chain link which refers to a scheduled callback
+ *
+ * \param callback  Callback function
+ * \param p         Callback parameter
+ * \return Pointer to the link, or NULL if the callback is not scheduled
+ */
+static struct schedheap_entry **schedheap_find(schedule_callback_fn callback,
+		void *p)
+{
+	struct schedheap_entry **link;
+
+	if (bucket_count == 0)
+		return NULL;
+
+	for (link = schedheap_bucket(callback, p); *link != NULL;
+			link = &(*link)->next) {
+		if ((*link)->callback == callback && (*link)->p == p)
+			return link;
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Determine whether one entry is due before another
+ */
+static inline bool schedheap_before(const struct schedheap_entry *a,
+		const struct schedheap_entry *b)
+{
+	if (a->deadline != b->deadline)
+		return a->deadline < b->deadline;
+
+	return a->seq < b->seq;
+}
+
+
+/**
+ * Place an entry in a heap slot
+ */
+static inline void schedheap_set(unsigned int index,
+		struct schedheap_entry *e)
+{
+	heap[index] = e;
+	e->index = index;
+}
+
+
+/**
+ * Restore heap order around an entry whose key has changed
+ *
+ * \param e  Entry to move
+ */
+static void schedheap_sift(struct schedheap_entry *e)
+{
+	unsigned int index = e->index;
+	unsigned int child;
+
+	/* Towards the root */
+	while (index > 0 && schedheap_before(e, heap[(index - 1) / 2])) {
+		schedheap_set(index, heap[(index - 1) / 2]);
+		index = (index - 1) / 2;
+	}
+
+	/* Towards the leaves */
+	while ((child = index * 2 + 1) < heap_count) {
+		if (child + 1 < heap_count &&
+				schedheap_before(heap[child + 1], heap[child]))
+			child++;
+
+		if (schedheap_before(e, heap[child]) == false) {
+			schedheap_set(index, heap[child]);
+			index = child;
+		} else {
+			break;
+		}
+	}
+
+	schedheap_set(index, e);
+}
+
+
+/**
+ * Remove an entry from the heap and hash, and free it
+ *
+ * \param link  Hash chain link which refers to the entry
+ */
+static void schedheap_unlink(struct schedheap_entry **link)
+{
+	struct schedheap_entry *e = *link;
+	struct schedheap_entry *last;
+
+	*link = e->next;
+
+	last = heap[--heap_count];
+	if (last != e) {
+		last->index = e->index;
+		heap[e->index] = last;
+		schedheap_sift(last);
+	}
+
+	pool_free(entry_pool, e);
+}
+
+
+/**
+ * Double the size of the hash
+ *
+ * \return NSERROR_OK on success, NSERROR_NOMEM on memory exhaustion
+ */
+static nserror schedheap_rehash(void)
+{
+	struct schedheap_entry **old = buckets;
+	unsigned int old_count = bucket_count;
+	unsigned int i;
+
+	bucket_count = old_count == 0 ? SCHEDHEAP_MIN_SIZE : old_count * 2;
+	buckets = calloc(bucket_count, sizeof(*buckets));
+	if (buckets == NULL) {
+		buckets = old;
+		bucket_count = old_count;
+		return NSERROR_NOMEM;
+	}
+
+	for (i = 0; i < old_count; i++) {
+		struct schedheap_entry *e, *next;
+
+		for (e = old[i]; e != NULL; e = next) {
+			struct schedheap_entry **bucket;
+
+			next = e->next;
+			bucket = schedheap_bucket(e->callback, e->p);
+			e->next = *bucket;
+			*bucket = e;
+		}
+	}
+
+	free(old);
+
+	return NSERROR_OK;
+}
+
+
+/**
+ * Schedule a callback.
+ *
+ * \param t         interval before the callback should be made, in cs
+ * \param callback  callback function
+ * \param p         user parameter, passed to callback function
+ * \return NSERROR_OK on success, NSERROR_NOMEM on memory exhaustion
+ *
+ * If the callback is already scheduled with the same parameter, it is
+ * moved to the new time rather than being scheduled twice.
+ */
+nserror schedheap_schedule(int t, schedule_callback_fn callback, void *p)
+{
+	struct schedheap_entry **link;
+	struct schedheap_entry *e;
+	uint64_t deadline = monotonic_us() / 1000 +
+			(t > 0 ? (uint64_t) t * 10 : 0);
+
+	link = schedheap_find(callback, p);
+	if (link != NULL) {
+		e = *link;
+		e->deadline = deadline;
+		e->seq = next_seq++;
+		schedheap_sift(e);
+
+		return NSERROR_OK;
+	}
+
+	if (entry_pool == NULL) {
+		entry_pool = pool_create("scheduled callbacks",
+				sizeof(struct schedheap_entry));
+		if (entry_pool == NULL)
+			return NSERROR_NOMEM;
+	}
+
+	if (heap_count == heap_size) {
+		unsigned int size = heap_size == 0 ? SCHEDHEAP_MIN_SIZE :
+				heap_size * 2;
+		struct schedheap_entry **h;
+
+		h = realloc(heap, size * sizeof(*heap));
+		if (h == NULL)
+			return NSERROR_NOMEM;
+
+		heap = h;
+		heap_size = size;
+	}
+
+	if (heap_count >= bucket_count && schedheap_rehash() != NSERROR_OK)
+		return NSERROR_NOMEM;
+
+	e = pool_alloc(entry_pool);
+	if (e == NULL)
+		return NSERROR_NOMEM;
+
+	e->deadline = deadline;
+	e->seq = next_seq++;
+	e->callback = callback;
+	e->p = p;
+
+	link = schedheap_bucket(callback, p);
+	e->next = *link;
+	*link = e;
+
+	schedheap_set(heap_count++, e);
+	schedheap_sift(e);
+
+	return NSERROR_OK;
+}
+
+
+/**
+ * Unschedule a callback.
+ *
+ * \param callback  callback function
+ * \param p         user parameter, passed to callback function
+ */
+void schedheap_remove(schedule_callback_fn callback, void *p)
+{
+	struct schedheap_entry **link = schedheap_find(callback, p);
+
+	if (link != NULL)
+		schedheap_unlink(link);
+}
+
+
+/**
+ * Process scheduled callbacks up to current time.
+ *
+ * \return The number of milliseconds until the next scheduled event
+ * or -1 for no event.
+ *
+ * Callbacks scheduled by callbacks run during this call are left for the
+ * next call, even if they are already due.
+ */
+int schedheap_run(void)
+{
+	uint64_t now = monotonic_us() / 1000;
+	uint64_t limit = next_seq;
+	struct schedheap_entry *e;
+	schedule_callback_fn callback;
+	void *p;
+
+	while (heap_count > 0) {
+		e = heap[0];
+
+		if (e->deadline > now || e->seq >= limit)
+			break;
+
+		callback = e->callback;
+		p = e->p;
+
+		/* Remove before calling, as the callback may reschedule
+		 * itself */
+		schedheap_unlink(schedheap_find(callback, p));
+
+		callback(p);
+	}
+
+	if (heap_count == 0)
+		return -1;
+
+	now = monotonic_us() / 1000;
+	if (heap[0]->deadline <= now)
+		return 0;
+	if (heap[0]->deadline - now > INT_MAX)
+		return INT_MAX;
+
+	return heap[0]->deadline - now;
+}
+
+
+/**
+ * Log the scheduled callbacks, in heap order.
+ */
+void schedheap_list(void)
+{
+	uint64_t now = monotonic_us() / 1000;
+	unsigned int i;
+
+	LOG(("schedule list at %llu ms, %u entries",
+			(unsigned long long) now, heap_count));
+
+	for (i = 0; i < heap_count; i++) {
+		LOG(("Schedule %p at %llu ms: %p(%p)", heap[i],
+				(unsigned long long) heap[i]->deadline,
+				heap[i]->callback, heap[i]->p));
+	}
+}
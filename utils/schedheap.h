@@ -0,0 +1,40 @@
+/*
+ * Copyright 2012 NetSurf Browser Project
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Heap based callback scheduler (interface).
+ *
+ * Frontends without a native timer facility may implement schedule(),
+ * schedule_remove() and their poll loop on top of this.  Callbacks are
+ * kept in a binary min-heap ordered on a monotonic clock, with a hash of
+ * (callback, parameter) pairs so that rescheduling and removal do not
+ * have to search.
+ */
+
+#ifndef _NETSURF_UTILS_SCHEDHEAP_H_
+#define _NETSURF_UTILS_SCHEDHEAP_H_
+
+#include "utils/errors.h"
+#include "utils/schedule.h"
+
+nserror schedheap_schedule(int t, schedule_callback_fn callback, void *p);
+void schedheap_remove(schedule_callback_fn callback, void *p);
+int schedheap_run(void);
+void schedheap_list(void);
+
+#endif
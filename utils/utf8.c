@@ -27,6 +27,10 @@
 #include <strings.h>
 #include <iconv.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include <parserutils/charset/utf8.h>
 
 #include "utils/config.h"
@@ -36,6 +40,141 @@
 static utf8_convert_ret utf8_convert(const char *string, size_t len,
 		const char *from, const char *to, char **result);
 
+/** Number of bytes examined at once by the block loops */
+#define UTF8_BLOCK 16
+
+/** Whether a byte is a UTF-8 continuation byte */
+#define UTF8_CONTINUATION(b) (((b) & 0xC0) == 0x80)
+
+#ifndef __SSE2__
+/** Mask of the top bit of each byte in a 64 bit word */
+#define UTF8_HIGH_BITS 0x8080808080808080ULL
+
+/**
+ * Load a 64 bit word from an unaligned address
+ */
+static inline uint64_t utf8_load64(const uint8_t *p)
+{
+	uint64_t w;
+
+	memcpy(&w, p, sizeof(w));
+
+	return w;
+}
+
+/**
+ * Count the continuation bytes in a 64 bit word
+ */
+static inline unsigned int utf8_word_continuations(uint64_t w)
+{
+	/* Top bit set and next bit clear, gathered to the top bit */
+	uint64_t c = w & ~(w << 1) & UTF8_HIGH_BITS;
+
+	/* Sum the per-byte flags into the top byte */
+	return ((c >> 7) * 0x0101010101010101ULL) >> 56;
+}
+#endif
+
+/**
+ * Determine whether a block of UTF8_BLOCK bytes is all ASCII
+ *
+ * \param p  The block
+ * \return true if no byte has its top bit set
+ */
+static inline bool utf8_block_is_ascii(const uint8_t *p)
+{
+#ifdef __SSE2__
+	return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) p)) == 0;
+#else
+	return ((utf8_load64(p) | utf8_load64(p + 8)) & UTF8_HIGH_BITS) == 0;
+#endif
+}
+
+/**
+ * Count the continuation bytes in a block of UTF8_BLOCK bytes
+ *
+ * \param p  The block
+ * \return Number of bytes of the form 10xxxxxx
+ */
+static inline unsigned int utf8_block_continuations(const uint8_t *p)
+{
+#ifdef __SSE2__
+	/* As signed bytes, continuation bytes are those below -64 */
+	__m128i v = _mm_loadu_si128((const __m128i *) p);
+	unsigned int mask = _mm_movemask_epi8(
+			_mm_cmplt_epi8(v, _mm_set1_epi8(-64)));
+#ifdef __GNUC__
+	return __builtin_popcount(mask);
+#else
+	unsigned int count = 0;
+
+	for (; mask != 0; mask &= mask - 1)
+		count++;
+
+	return count;
+#endif
+#else
+	return utf8_word_continuations(utf8_load64(p)) +
+			utf8_word_continuations(utf8_load64(p + 8));
+#endif
+}
+
+/**
+ * Decode the UTF-8 sequence at the start of a buffer
+ *
+ * \param s  The sequence to process
+ * \param l  Length of buffer
+ * \return UCS4 character, or 0xfffd if the sequence is malformed,
+ *         overlong, truncated or encodes a surrogate, U+FFFE or U+FFFF
+ */
+static inline uint32_t utf8_decode(const uint8_t *s, size_t l)
+{
+	uint32_t c, min;
+	size_t n, i;
+
+	if (s[0] < 0x80) {
+		return s[0];
+	} else if ((s[0] & 0xE0) == 0xC0) {
+		c = s[0] & 0x1F;
+		n = 2;
+		min = 0x80;
+	} else if ((s[0] & 0xF0) == 0xE0) {
+		c = s[0] & 0x0F;
+		n = 3;
+		min = 0x800;
+	} else if ((s[0] & 0xF8) == 0xF0) {
+		c = s[0] & 0x07;
+		n = 4;
+		min = 0x10000;
+	} else if ((s[0] & 0xFC) == 0xF8) {
+		c = s[0] & 0x03;
+		n = 5;
+		min = 0x200000;
+	} else if ((s[0] & 0xFE) == 0xFC) {
+		c = s[0] & 0x01;
+		n = 6;
+		min = 0x4000000;
+	} else {
+		return 0xfffd;
+	}
+
+	if (l < n)
+		return 0xfffd;
+
+	for (i = 1; i < n; i++) {
+		if (UTF8_CONTINUATION(s[i]) == false)
+			return 0xfffd;
+
+		c = (c << 6) | (s[i] & 0x3F);
+	}
+
+	if (c < min || (c >= 0xD800 && c <= 0xDFFF) ||
+			c == 0xFFFE || c == 0xFFFF)
+		return 0xfffd;
+
+	return c;
+}
+
 /**
  * Convert a UTF-8 multibyte sequence into a single UCS4 character
  *
@@ -48,16 +187,115 @@ static utf8_convert_ret utf8_convert(const char *string, size_t len,
  */
 uint32_t utf8_to_ucs4(const char *s_in, size_t l)
 {
-	uint32_t ucs4;
-	size_t len;
-	parserutils_error perror;
+	if (l == 0)
+		return 0xfffd;
+
+	return utf8_decode((const uint8_t *) s_in, l);
+}
+
+/**
+ * Convert a bounded UTF-8 string into UCS4 characters
+ *
+ * \param s     The string
+ * \param l     Length of string, in bytes
+ * \param ucs4  Buffer to receive characters, with room for at least
+ *              utf8_bounded_length(s, l) entries
+ * \return Number of characters written
+ *
+ * Characters are delimited as by utf8_next(); each malformed sequence
+ * becomes a single U+FFFD.
+ */
+size_t utf8_to_ucs4_string(const char *s, size_t l, uint32_t *ucs4)
+{
+	const uint8_t *p = (const uint8_t *) s;
+	size_t i = 0, n = 0, j;
+
+	while (i < l) {
+		if (p[i] < 0x80) {
+			/* Runs of ASCII are widened a block at a time */
+			while (i + UTF8_BLOCK <= l &&
+					utf8_block_is_ascii(p + i)) {
+				for (j = 0; j < UTF8_BLOCK; j++)
+					ucs4[n + j] = p[i + j];
+				i += UTF8_BLOCK;
+				n += UTF8_BLOCK;
+			}
+
+			if (i == l)
+				break;
+
+			if (p[i] < 0x80) {
+				ucs4[n++] = p[i++];
+				continue;
+			}
+		}
+
+		ucs4[n++] = utf8_decode(p + i, l - i);
+		i = utf8_next(s, l, i);
+	}
+
+	return n;
+}
+
+/**
+ * Determine whether a bounded string is valid UTF-8
+ *
+ * \param s  The string
+ * \param l  Length of string, in bytes
+ * \return true if the string is well formed according to RFC3629
+ *
+ * Overlong forms, surrogates, values above U+10FFFF and truncated or
+ * unterminated sequences are all rejected.
+ */
+bool utf8_validate(const char *s, size_t l)
+{
+	const uint8_t *p = (const uint8_t *) s;
+	size_t i = 0, n, k;
+	uint32_t c;
+
+	while (i < l) {
+		if (i + UTF8_BLOCK <= l && utf8_block_is_ascii(p + i)) {
+			i += UTF8_BLOCK;
+			continue;
+		}
+
+		if (p[i] < 0x80) {
+			i++;
+			continue;
+		}
+
+		if (p[i] < 0xC2) {
+			/* Continuation byte, or overlong two byte form */
+			return false;
+		} else if (p[i] < 0xE0) {
+			n = 2;
+		} else if (p[i] < 0xF0) {
+			n = 3;
+		} else if (p[i] < 0xF5) {
+			n = 4;
+		} else {
+			return false;
+		}
+
+		if (l - i < n)
+			return false;
+
+		c = p[i] & (0x7F >> n);
+		for (k = 1; k < n; k++) {
+			if (UTF8_CONTINUATION(p[i + k]) == false)
+				return false;
+
+			c = (c << 6) | (p[i + k] & 0x3F);
+		}
+
+		if ((n == 3 && (c < 0x800 || (c >= 0xD800 && c <= 0xDFFF))) ||
+				(n == 4 && (c < 0x10000 || c > 0x10FFFF)))
+			return false;
 
-	perror = parserutils_charset_utf8_to_ucs4((const uint8_t *) s_in, l, 
-			&ucs4, &len);
-	if (perror != PARSERUTILS_OK)
-		ucs4 = 0xfffd;
+		i += n;
+	}
 
-	return ucs4;
+	return true;
 }
 
 /**
@@ -107,13 +345,25 @@ size_t utf8_length(const char *s)
  */
 size_t utf8_bounded_length(const char *s, size_t l)
 {
-	size_t len;
-	parserutils_error perror;
+	const uint8_t *p = (const uint8_t *) s;
+	size_t i, len;
 
-	perror = parserutils_charset_utf8_length((const uint8_t *) s, l, &len);
-	if (perror != PARSERUTILS_OK)
+	if (l == 0)
 		return 0;
 
+	/* Each character starts with a byte that is not a continuation
+	 * byte, except that the first always starts one, as in utf8_next */
+	len = 1;
+	i = 1;
+
+	for (; i + UTF8_BLOCK <= l; i += UTF8_BLOCK)
+		len += UTF8_BLOCK - utf8_block_continuations(p + i);
+
+	for (; i < l; i++) {
+		if (UTF8_CONTINUATION(p[i]) == false)
+			len++;
+	}
+
 	return len;
 }
 
@@ -162,13 +412,10 @@ size_t utf8_char_byte_length(const char *s)
  */
 size_t utf8_prev(const char *s, size_t o)
 {
-	uint32_t prev;
-	parserutils_error perror;
+	while (o != 0 && UTF8_CONTINUATION((uint8_t) s[--o]))
+		;
 
-	perror = parserutils_charset_utf8_prev((const uint8_t *) s, o, &prev);
-	assert(perror == PARSERUTILS_OK);
-
-	return prev;
+	return o;
 }
 
 /**
@@ -181,35 +428,238 @@ size_t utf8_prev(const char *s, size_t o)
  */
 size_t utf8_next(const char *s, size_t l, size_t o)
 {
-	uint32_t next;
-	parserutils_error perror;
+	/* Skip the current byte, then any continuation bytes */
+	if (o < l)
+		o++;
 
-	perror = parserutils_charset_utf8_next((const uint8_t *) s, l, o, 
-			&next);
-	assert(perror == PARSERUTILS_OK);
+	while (o < l && UTF8_CONTINUATION((uint8_t) s[o]))
+		o++;
 
-	return next;
+	return o;
 }
 
-/* Cache of previous iconv conversion descriptor used by utf8_convert */
-static struct {
+/** Number of iconv conversion descriptors kept for reuse */
+#define UTF8_CD_CACHE_SIZE 4
+
+/** Cache of idle iconv conversion descriptors, most recently used first */
+static struct utf8_cd_entry {
+	char from[32];	/**< Encoding name to convert from */
+	char to[32];	/**< Encoding name to convert to */
+	iconv_t cd;	/**< Iconv conversion descriptor, or 0 if unused */
+} utf8_cd_cache[UTF8_CD_CACHE_SIZE];
+
+/** A streaming conversion */
+struct utf8_stream {
 	char from[32];	/**< Encoding name to convert from */
 	char to[32];	/**< Encoding name to convert to */
 	iconv_t cd;	/**< Iconv conversion descriptor */
-} last_cd;
+};
+
+/**
+ * Obtain an iconv conversion descriptor for exclusive use
+ *
+ * \param from  The encoding name to convert from
+ * \param to    The encoding name to convert to
+ * \param cd    Pointer to location to receive descriptor
+ * \return Appropriate utf8_convert_ret value
+ *
+ * A descriptor is taken from the cache if one is available.  It should
+ * be handed back with utf8_cd_release() when the conversion is done.
+ */
+static utf8_convert_ret utf8_cd_acquire(const char *from, const char *to,
+		iconv_t *cd)
+{
+	int i;
+
+	for (i = 0; i < UTF8_CD_CACHE_SIZE && utf8_cd_cache[i].cd != 0; i++) {
+		if (strcasecmp(utf8_cd_cache[i].from, from) == 0 &&
+				strcasecmp(utf8_cd_cache[i].to, to) == 0) {
+			*cd = utf8_cd_cache[i].cd;
+
+			/* Close up the gap */
+			for (; i < UTF8_CD_CACHE_SIZE - 1; i++)
+				utf8_cd_cache[i] = utf8_cd_cache[i + 1];
+			utf8_cd_cache[i].cd = 0;
+
+			return UTF8_CONVERT_OK;
+		}
+	}
+
+	*cd = iconv_open(to, from);
+	if (*cd == (iconv_t) -1) {
+		if (errno == EINVAL)
+			return UTF8_CONVERT_BADENC;
+		/* default to no memory */
+		return UTF8_CONVERT_NOMEM;
+	}
+
+	return UTF8_CONVERT_OK;
+}
+
+/**
+ * Return an iconv conversion descriptor to the cache
+ *
+ * \param from  The encoding name the descriptor converts from
+ * \param to    The encoding name the descriptor converts to
+ * \param cd    Descriptor to release
+ *
+ * The least recently used descriptor is closed if the cache is full.
+ */
+static void utf8_cd_release(const char *from, const char *to, iconv_t cd)
+{
+	int i;
+
+	if (strlen(from) >= sizeof(utf8_cd_cache[0].from) ||
+			strlen(to) >= sizeof(utf8_cd_cache[0].to)) {
+		iconv_close(cd);
+		return;
+	}
+
+	/* Return to the initial shift state for the next user */
+	iconv(cd, NULL, NULL, NULL, NULL);
+
+	if (utf8_cd_cache[UTF8_CD_CACHE_SIZE - 1].cd != 0)
+		iconv_close(utf8_cd_cache[UTF8_CD_CACHE_SIZE - 1].cd);
+
+	for (i = UTF8_CD_CACHE_SIZE - 1; i > 0; i--)
+		utf8_cd_cache[i] = utf8_cd_cache[i - 1];
+
+	strcpy(utf8_cd_cache[0].from, from);
+	strcpy(utf8_cd_cache[0].to, to);
+	utf8_cd_cache[0].cd = cd;
+}
+
+/**
+ * Run iconv, translating its errors
+ *
+ * \param cd      Iconv conversion descriptor
+ * \param in      Pointer to input pointer, updated past consumed input
+ * \param inlen   Pointer to input length, updated to remaining input
+ * \param out     Pointer to output pointer, updated past written output
+ * \param outlen  Pointer to output space, updated to remaining space
+ * \return UTF8_CONVERT_OK if all input was consumed, or ends with an
+ *         incomplete sequence, UTF8_CONVERT_NOSPACE if the output is full,
+ *         UTF8_CONVERT_BADSEQ on an invalid input sequence
+ */
+static utf8_convert_ret utf8_iconv(iconv_t cd, const char **in,
+		size_t *inlen, char **out, size_t *outlen)
+{
+	if (iconv(cd, (void *) in, inlen, out, outlen) != (size_t) -1)
+		return UTF8_CONVERT_OK;
+
+	switch (errno) {
+	case E2BIG:
+		return UTF8_CONVERT_NOSPACE;
+	case EINVAL:
+		/* Incomplete sequence, left for the next chunk */
+		return UTF8_CONVERT_OK;
+	case EILSEQ:
+		return UTF8_CONVERT_BADSEQ;
+	}
+
+	return UTF8_CONVERT_NOMEM;
+}
 
 /**
  * Finalise the UTF-8 library
  */
 void utf8_finalise(void)
 {
-	if (last_cd.cd != 0)
-		iconv_close(last_cd.cd);
+	int i;
+
+	for (i = 0; i < UTF8_CD_CACHE_SIZE; i++) {
+		if (utf8_cd_cache[i].cd != 0)
+			iconv_close(utf8_cd_cache[i].cd);
 
-	/* paranoia follows */
-	last_cd.from[0] = '\0';
-	last_cd.to[0] = '\0';
-	last_cd.cd = 0;
+		/* paranoia follows */
+		utf8_cd_cache[i].from[0] = '\0';
+		utf8_cd_cache[i].to[0] = '\0';
+		utf8_cd_cache[i].cd = 0;
+	}
+}
+
+/**
+ * Begin a streaming conversion between two encodings
+ *
+ * \param from    The encoding name to convert from
+ * \param to      The encoding name to convert to
+ * \param stream  Pointer to location to receive stream
+ * \return Appropriate utf8_convert_ret value
+ */
+utf8_convert_ret utf8_stream_open(const char *from, const char *to,
+		struct utf8_stream **stream)
+{
+	struct utf8_stream *s;
+	utf8_convert_ret ret;
+
+	if (strlen(from) >= sizeof(s->from) || strlen(to) >= sizeof(s->to))
+		return UTF8_CONVERT_BADENC;
+
+	s = malloc(sizeof(struct utf8_stream));
+	if (s == NULL)
+		return UTF8_CONVERT_NOMEM;
+
+	ret = utf8_cd_acquire(from, to, &s->cd);
+	if (ret != UTF8_CONVERT_OK) {
+		free(s);
+		return ret;
+	}
+
+	strcpy(s->from, from);
+	strcpy(s->to, to);
+
+	*stream = s;
+
+	return UTF8_CONVERT_OK;
+}
+
+/**
+ * Convert a chunk of input into a caller-provided buffer
+ *
+ * \param stream  The stream
+ * \param in      Pointer to input pointer, or NULL to finish the output
+ *                with any sequence needed to return to the initial state
+ * \param inlen   Pointer to input length
+ * \param out     Pointer to output pointer
+ * \param outlen  Pointer to space available at output pointer
+ * \return UTF8_CONVERT_OK if all input was converted,
+ *         UTF8_CONVERT_NOSPACE if the output buffer filled up,
+ *         UTF8_CONVERT_BADSEQ if the input is invalid at *in
+ *
+ * The pointers and lengths are updated past the input consumed and
+ * output written.  An incomplete sequence at the end of the input is
+ * left unconsumed, to be passed again with the next chunk.
+ */
+utf8_convert_ret utf8_stream_convert(struct utf8_stream *stream,
+		const char **in, size_t *inlen, char **out, size_t *outlen)
+{
+	if (in == NULL) {
+		if (iconv(stream->cd, NULL, NULL, out, outlen) == (size_t) -1)
+			return UTF8_CONVERT_NOSPACE;
+
+		return UTF8_CONVERT_OK;
+	}
+
+	/* Some iconv implementations reject empty input */
+	if (*inlen == 0)
+		return UTF8_CONVERT_OK;
+
+	return utf8_iconv(stream->cd, in, inlen, out, outlen);
+}
+
+/**
+ * Finish a streaming conversion
+ *
+ * \param stream  The stream, which is destroyed
+ */
+void utf8_stream_close(struct utf8_stream *stream)
+{
+	if (stream == NULL)
+		return;
+
+	utf8_cd_release(stream->from, stream->to, stream->cd);
+
+	free(stream);
 }
 
 /**
@@ -256,8 +706,10 @@ utf8_convert_ret utf8_convert(const char *string, size_t len,
 		const char *from, const char *to, char **result)
 {
 	iconv_t cd;
-	char *temp, *out, *in;
-	size_t slen, rlen;
+	char *temp, *out;
+	const char *in;
+	size_t slen, rlen, alloc;
+	utf8_convert_ret ret;
 
 	assert(string && from && to && result);
 
@@ -286,59 +738,51 @@ utf8_convert_ret utf8_convert(const char *string, size_t len,
 		return UTF8_CONVERT_OK;
 	}
 
-	in = (char *)string;
+	in = string;
 
-	/* we cache the last used conversion descriptor,
-	 * so check if we're trying to use it here */
-	if (strncasecmp(last_cd.from, from, sizeof(last_cd.from)) == 0 &&
-			strncasecmp(last_cd.to, to, sizeof(last_cd.to)) == 0) {
-		cd = last_cd.cd;
-	}
-	else {
-		/* no match, so create a new cd */
-		cd = iconv_open(to, from);
-		if (cd == (iconv_t)-1) {
-			if (errno == EINVAL)
-				return UTF8_CONVERT_BADENC;
-			/* default to no memory */
-			return UTF8_CONVERT_NOMEM;
-		}
+	ret = utf8_cd_acquire(from, to, &cd);
+	if (ret != UTF8_CONVERT_OK)
+		return ret;
 
-		/* close the last cd - we don't care if this fails */
-		if (last_cd.cd)
-			iconv_close(last_cd.cd);
+	slen = len ? len : strlen(string);
 
-		/* and copy the to/from/cd data into last_cd */
-		strncpy(last_cd.from, from, sizeof(last_cd.from));
-		strncpy(last_cd.to, to, sizeof(last_cd.to));
-		last_cd.cd = cd;
-	}
+	/* Start with as much output space as input, which suffices for
+	 * most conversions, and grow it if that runs out.  4 bytes are
+	 * kept in hand for the NULL terminator. */
+	alloc = slen + 4;
+	rlen = slen;
 
-	slen = len ? len : strlen(string);
-	/* Worst case = ASCII -> UCS4, so allocate an output buffer
-	 * 4 times larger than the input buffer, and add 4 bytes at
-	 * the end for the NULL terminator
-	 */
-	rlen = slen * 4 + 4;
-
-	temp = out = malloc(rlen);
-	if (!out)
+	temp = out = malloc(alloc);
+	if (!out) {
+		utf8_cd_release(from, to, cd);
 		return UTF8_CONVERT_NOMEM;
+	}
 
 	/* perform conversion */
-	if (iconv(cd, (void *) &in, &slen, &out, &rlen) == (size_t)-1) {
+	while ((ret = utf8_iconv(cd, &in, &slen, &out, &rlen)) ==
+			UTF8_CONVERT_NOSPACE) {
+		size_t used = out - temp;
+		char *grown = realloc(temp, alloc * 2);
+
+		if (grown == NULL) {
+			ret = UTF8_CONVERT_NOMEM;
+			break;
+		}
+
+		rlen += alloc;
+		alloc *= 2;
+		temp = grown;
+		out = temp + used;
+	}
+
+	utf8_cd_release(from, to, cd);
+
+	if (ret != UTF8_CONVERT_OK || slen != 0) {
 		free(temp);
-		/* clear the cached conversion descriptor as it's invalid */
-		if (last_cd.cd)
-			iconv_close(last_cd.cd);
-		last_cd.from[0] = '\0';
-		last_cd.to[0] = '\0';
-		last_cd.cd = 0;
 		/** \todo handle the various cases properly
-		 * There are 3 possible error cases:
-		 * a) Insufficiently large output buffer
-		 * b) Invalid input byte sequence
-		 * c) Incomplete input sequence */
+		 * There are 2 possible error cases:
+		 * a) Invalid input byte sequence
+		 * b) Incomplete input sequence */
 		return UTF8_CONVERT_NOMEM;
 	}
 
@@ -411,13 +855,9 @@ utf8_convert_ret utf8_to_html(const char *string, const char *encname,
 	if (len == 0)
 		len = strlen(string);
 
-	cd = iconv_open(encname, "UTF-8");
-	if (cd == (iconv_t) -1) {
-		if (errno == EINVAL)
-			return UTF8_CONVERT_BADENC;
-		/* default to no memory */
-		return UTF8_CONVERT_NOMEM;
-	}
+	ret = utf8_cd_acquire("UTF-8", encname, &cd);
+	if (ret != UTF8_CONVERT_OK)
+		return ret;
 
 	/* Worst case is ASCII -> UCS4, with all characters escaped: 
 	 * "&#xYYYYYY;", thus each input character may become a string 
@@ -425,7 +865,7 @@ utf8_convert_ret utf8_to_html(const char *string, const char *encname,
 	origoutlen = outlen = len * 10 * 4;
 	origout = out = malloc(outlen);
 	if (out == NULL) {
-		iconv_close(cd);
+		utf8_cd_release("UTF-8", encname, cd);
 		return UTF8_CONVERT_NOMEM;
 	}
 
@@ -443,7 +883,7 @@ utf8_convert_ret utf8_to_html(const char *string, const char *encname,
 						&out, &outlen);
 				if (ret != UTF8_CONVERT_OK) {
 					free(origout);
-					iconv_close(cd);
+					utf8_cd_release("UTF-8", encname, cd);
 					return ret;
 				}
 			}
@@ -456,7 +896,7 @@ utf8_convert_ret utf8_to_html(const char *string, const char *encname,
 					&out, &outlen);
 			if (ret != UTF8_CONVERT_OK) {
 				free(origout);
-				iconv_close(cd);
+				utf8_cd_release("UTF-8", encname, cd);
 				return ret;
 			}
 
@@ -473,12 +913,12 @@ utf8_convert_ret utf8_to_html(const char *string, const char *encname,
 		ret = utf8_convert_html_chunk(cd, in, inlen, &out, &outlen);
 		if (ret != UTF8_CONVERT_OK) {
 			free(origout);
-			iconv_close(cd);
+			utf8_cd_release("UTF-8", encname, cd);
 			return ret;
 		}
 	}
 
-	iconv_close(cd);
+	utf8_cd_release("UTF-8", encname, cd);
 
 	/* Shrink-wrap */
 	*result = realloc(origout, origoutlen - outlen + 4);
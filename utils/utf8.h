@@ -29,12 +29,19 @@
 typedef enum {
 	UTF8_CONVERT_OK,
 	UTF8_CONVERT_NOMEM,
-	UTF8_CONVERT_BADENC
+	UTF8_CONVERT_BADENC,
+	UTF8_CONVERT_NOSPACE,	/**< Output buffer full (streams only) */
+	UTF8_CONVERT_BADSEQ	/**< Invalid input sequence (streams only) */
 } utf8_convert_ret;
 
+struct utf8_stream;
+
 uint32_t utf8_to_ucs4(const char *s, size_t l);
+size_t utf8_to_ucs4_string(const char *s, size_t l, uint32_t *ucs4);
 size_t utf8_from_ucs4(uint32_t c, char *s);
 
+bool utf8_validate(const char *s, size_t l);
+
 size_t utf8_length(const char *s);
 size_t utf8_bounded_length(const char *s, size_t l);
 size_t utf8_bounded_byte_length(const char *s, size_t l, size_t c);
@@ -52,6 +59,12 @@ utf8_convert_ret utf8_from_enc(const char *string, const char *encname,
 utf8_convert_ret utf8_to_html(const char *string, const char *encname,
 		size_t len, char **result);
 
+utf8_convert_ret utf8_stream_open(const char *from, const char *to,
+		struct utf8_stream **stream);
+utf8_convert_ret utf8_stream_convert(struct utf8_stream *stream,
+		const char **in, size_t *inlen, char **out, size_t *outlen);
+void utf8_stream_close(struct utf8_stream *stream);
+
 bool utf8_save_text(const char *utf8_text, const char *path);
 
 /* These two are platform specific */
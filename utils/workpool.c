@@ -0,0 +1,470 @@
+/*
+ * Copyright 2012 NetSurf Browser Project
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Background work pool (implementation).
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#ifdef WITH_THREADS
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include "utils/log.h"
+#include "utils/pool.h"
+#include "utils/schedule.h"
+#include "utils/workpool.h"
+
+/** Number of threads to use when the core count is unknown */
+#define WORKPOOL_DEFAULT_THREADS 2
+
+/** Greatest number of threads in a pool */
+#define WORKPOOL_MAX_THREADS 8
+
+/** Interval at which the scheduler checks for completions, in cs */
+#ifdef WITH_THREADS
+#define WORKPOOL_POLL_INTERVAL 1
+#else
+#define WORKPOOL_POLL_INTERVAL 0
+#endif
+
+/** A submitted job */
+struct workpool_item {
+	workpool_job_fn job;		/**< Job function */
+	workpool_done_fn done;		/**< Completion callback, or NULL */
+	void *pw;			/**< Client data */
+	struct workpool_item *next;	/**< Next item in queue */
+};
+
+/** A work pool */
+struct workpool {
+	struct pool *items;		/**< Item allocator, main thread only */
+
+	struct workpool_item *jobs;	/**< Jobs waiting to run */
+	struct workpool_item **jobs_tail; /**< Link to append jobs at */
+	struct workpool_item *done;	/**< Jobs waiting for completion */
+	struct workpool_item **done_tail; /**< Link to append completions at */
+	unsigned int outstanding;	/**< Jobs submitted but not completed */
+	bool destroying;		/**< Pool is being destroyed */
+
+#ifdef WITH_THREADS
+	pthread_mutex_t lock;		/**< Protects the queues and flags */
+	pthread_cond_t wait;		/**< Signalled when jobs are queued */
+	bool quit;			/**< Workers should exit when idle */
+	bool woken;			/**< Wake byte is in the pipe */
+	int wake[2];			/**< Wake pipe, read end first */
+
+	unsigned int thread_count;	/**< Number of workers */
+	pthread_t *threads;		/**< Workers */
+#endif
+};
+
+
+/**
+ * Take all queued completions from a pool
+ *
+ * \param pool  Pool to take from
+ * \return List of completed items
+ */
+static struct workpool_item *workpool_take_done(struct workpool *pool)
+{
+	struct workpool_item *list = pool->done;
+
+	pool->done = NULL;
+	pool->done_tail = &pool->done;
+
+	return list;
+}
+
+
+#ifdef WITH_THREADS
+
+/**
+ * Worker thread body
+ *
+ * \param p  Pool to work for
+ * \return NULL
+ */
+static void *workpool_worker(void *p)
+{
+	struct workpool *pool = p;
+	struct workpool_item *item;
+
+	pthread_mutex_lock(&pool->lock);
+
+	while (true) {
+		while (pool->jobs == NULL && pool->quit == false)
+			pthread_cond_wait(&pool->wait, &pool->lock);
+
+		/* Queued jobs are finished before quitting */
+		item = pool->jobs;
+		if (item == NULL)
+			break;
+
+		pool->jobs = item->next;
+		if (pool->jobs == NULL)
+			pool->jobs_tail = &pool->jobs;
+
+		pthread_mutex_unlock(&pool->lock);
+
+		item->job(item->pw);
+
+		pthread_mutex_lock(&pool->lock);
+
+		item->next = NULL;
+		*pool->done_tail = item;
+		pool->done_tail = &item->next;
+
+		if (pool->woken == false) {
+			ssize_t written;
+
+			do {
+				written = write(pool->wake[1], "", 1);
+			} while (written < 0 && errno == EINTR);
+
+			pool->woken = true;
+		}
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+
+/**
+ * Stop and join a pool's workers
+ *
+ * \param pool   Pool to stop
+ * \param count  Number of workers which were started
+ */
+static void workpool_stop(struct workpool *pool, unsigned int count)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = true;
+	pthread_cond_broadcast(&pool->wait);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < count; i++)
+		pthread_join(pool->threads[i], NULL);
+}
+
+
+/**
+ * Start a pool's workers and create its wake pipe
+ *
+ * \param pool     Pool to start
+ * \param threads  Number of workers, or 0 for one per processor
+ * \return NSERROR_OK on success, appropriate error otherwise
+ */
+static nserror workpool_start(struct workpool *pool, unsigned int threads)
+{
+	unsigned int i;
+
+	if (threads == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		threads = cpus > 0 ? cpus : WORKPOOL_DEFAULT_THREADS;
+	}
+	if (threads > WORKPOOL_MAX_THREADS)
+		threads = WORKPOOL_MAX_THREADS;
+
+	pool->threads = malloc(threads * sizeof(pthread_t));
+	if (pool->threads == NULL)
+		return NSERROR_NOMEM;
+
+	if (pipe(pool->wake) != 0) {
+		free(pool->threads);
+		return NSERROR_INIT_FAILED;
+	}
+
+	fcntl(pool->wake[0], F_SETFL, fcntl(pool->wake[0], F_GETFL) |
+			O_NONBLOCK);
+	fcntl(pool->wake[0], F_SETFD, FD_CLOEXEC);
+	fcntl(pool->wake[1], F_SETFD, FD_CLOEXEC);
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->wait, NULL);
+	pool->quit = false;
+	pool->woken = false;
+
+	for (i = 0; i < threads; i++) {
+		if (pthread_create(&pool->threads[i], NULL,
+				workpool_worker, pool) != 0) {
+			LOG(("Failed to start worker %u", i));
+			break;
+		}
+	}
+
+	if (i == 0) {
+		pthread_cond_destroy(&pool->wait);
+		pthread_mutex_destroy(&pool->lock);
+		close(pool->wake[0]);
+		close(pool->wake[1]);
+		free(pool->threads);
+		return NSERROR_INIT_FAILED;
+	}
+
+	pool->thread_count = i;
+
+	LOG(("Started %u workers", pool->thread_count));
+
+	return NSERROR_OK;
+}
+
+#endif
+
+
+/**
+ * Scheduler callback which runs completions for a pool
+ *
+ * \param p  Pool to process
+ *
+ * This makes progress when the frontend does not watch the wake
+ * descriptor, and runs the jobs themselves when there are no threads.
+ */
+static void workpool_scheduled(void *p)
+{
+	struct workpool *pool = p;
+
+	workpool_complete(pool);
+
+	if (pool->outstanding > 0)
+		schedule(WORKPOOL_POLL_INTERVAL, workpool_scheduled, pool);
+}
+
+
+/**
+ * Create a work pool
+ *
+ * \param threads  Number of worker threads, or 0 for one per processor
+ * \param result   Updated to the new pool on success
+ * \return NSERROR_OK on success, appropriate error otherwise
+ */
+nserror workpool_create(unsigned int threads, struct workpool **result)
+{
+	struct workpool *pool;
+
+	pool = malloc(sizeof(struct workpool));
+	if (pool == NULL)
+		return NSERROR_NOMEM;
+
+	pool->items = pool_create("work items", sizeof(struct workpool_item));
+	if (pool->items == NULL) {
+		free(pool);
+		return NSERROR_NOMEM;
+	}
+
+	pool->jobs = NULL;
+	pool->jobs_tail = &pool->jobs;
+	pool->done = NULL;
+	pool->done_tail = &pool->done;
+	pool->outstanding = 0;
+	pool->destroying = false;
+
+#ifdef WITH_THREADS
+	{
+		nserror error = workpool_start(pool, threads);
+		if (error != NSERROR_OK) {
+			pool_destroy(pool->items);
+			free(pool);
+			return error;
+		}
+	}
+#else
+	(void) threads;
+#endif
+
+	*result = pool;
+
+	return NSERROR_OK;
+}
+
+
+/**
+ * Destroy a work pool
+ *
+ * \param pool  Pool to destroy
+ *
+ * Waits for every submitted job to run, then runs the outstanding
+ * completion callbacks before returning.  Those callbacks can't submit
+ * further jobs.
+ */
+void workpool_destroy(struct workpool *pool)
+{
+	if (pool == NULL)
+		return;
+
+	pool->destroying = true;
+
+	schedule_remove(workpool_scheduled, pool);
+
+#ifdef WITH_THREADS
+	workpool_stop(pool, pool->thread_count);
+#endif
+
+	workpool_complete(pool);
+	assert(pool->jobs == NULL && pool->done == NULL);
+
+#ifdef WITH_THREADS
+	close(pool->wake[0]);
+	close(pool->wake[1]);
+	pthread_cond_destroy(&pool->wait);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->threads);
+#endif
+
+	pool_destroy(pool->items);
+	free(pool);
+}
+
+
+/**
+ * Submit a job to a work pool
+ *
+ * \param pool  Pool to run the job
+ * \param job   Job function, called on a worker thread
+ * \param done  Completion callback, called on the main thread, or NULL
+ * \param pw    Client data for job and done
+ * \return NSERROR_OK on success, NSERROR_INVALID if the pool is being
+ *         destroyed, appropriate error otherwise
+ *
+ * Jobs start in the order they are submitted, but may finish in any order.
+ */
+nserror workpool_submit(struct workpool *pool, workpool_job_fn job,
+		workpool_done_fn done, void *pw)
+{
+	struct workpool_item *item;
+
+	assert(job != NULL);
+
+	if (pool->destroying)
+		return NSERROR_INVALID;
+
+	item = pool_alloc(pool->items);
+	if (item == NULL)
+		return NSERROR_NOMEM;
+
+	item->job = job;
+	item->done = done;
+	item->pw = pw;
+	item->next = NULL;
+
+#ifdef WITH_THREADS
+	pthread_mutex_lock(&pool->lock);
+#endif
+
+	*pool->jobs_tail = item;
+	pool->jobs_tail = &item->next;
+
+#ifdef WITH_THREADS
+	pthread_cond_signal(&pool->wait);
+	pthread_mutex_unlock(&pool->lock);
+#endif
+
+	if (pool->outstanding++ == 0)
+		schedule(WORKPOOL_POLL_INTERVAL, workpool_scheduled, pool);
+
+	return NSERROR_OK;
+}
+
+
+/**
+ * Get the file descriptor which signals finished jobs
+ *
+ * \param pool  Pool to query
+ * \return Descriptor which is readable while completions are waiting,
+ *         or -1 if the pool has no worker threads
+ *
+ * Watching the descriptor is optional; without it, completions are
+ * picked up by the scheduler at short intervals.
+ */
+int workpool_wake_fd(const struct workpool *pool)
+{
+#ifdef WITH_THREADS
+	return pool->wake[0];
+#else
+	(void) pool;
+	return -1;
+#endif
+}
+
+
+/**
+ * Run the completion callbacks of finished jobs
+ *
+ * \param pool  Pool to process
+ * \return Number of completion callbacks run
+ *
+ * Completion callbacks may submit further jobs; these complete on a
+ * later call.
+ */
+unsigned int workpool_complete(struct workpool *pool)
+{
+	struct workpool_item *item, *next;
+	unsigned int count = 0;
+
+#ifdef WITH_THREADS
+	pthread_mutex_lock(&pool->lock);
+
+	if (pool->woken) {
+		char buf[16];
+
+		while (read(pool->wake[0], buf, sizeof(buf)) > 0)
+			;
+
+		pool->woken = false;
+	}
+
+	item = workpool_take_done(pool);
+
+	pthread_mutex_unlock(&pool->lock);
+#else
+	/* Without threads, queued jobs run here */
+	for (item = pool->jobs; item != NULL; item = item->next)
+		item->job(item->pw);
+
+	pool->done = pool->jobs;
+	pool->done_tail = pool->jobs_tail;
+	pool->jobs = NULL;
+	pool->jobs_tail = &pool->jobs;
+
+	item = workpool_take_done(pool);
+#endif
+
+	for (; item != NULL; item = next) {
+		next = item->next;
+
+		if (item->done != NULL)
+			item->done(item->pw);
+
+		pool_free(pool->items, item);
+		pool->outstanding--;
+		count++;
+	}
+
+	return count;
+}
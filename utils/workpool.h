@@ -0,0 +1,68 @@
+/*
+ * Copyright 2012 NetSurf Browser Project
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Background work pool (interface).
+ *
+ * Jobs submitted to a work pool run on worker threads.  When a job has
+ * finished, its completion callback is queued for the main thread, which
+ * runs it from workpool_complete().  The scheduler calls this while jobs
+ * are outstanding; frontends may also watch the file descriptor from
+ * workpool_wake_fd() in their poll loop and call workpool_complete() as
+ * soon as it becomes readable.
+ *
+ * Only the job function runs off the main thread.  It must not call into
+ * the rest of NetSurf; everything else, including submission, completion
+ * and destruction, happens on the main thread.
+ *
+ * Destroying a pool runs the completions of jobs still outstanding.  From
+ * then on, including within those completions, workpool_submit() fails
+ * with NSERROR_INVALID.
+ *
+ * Without WITH_THREADS, jobs run on the main thread from the scheduler.
+ */
+
+#ifndef _NETSURF_UTILS_WORKPOOL_H_
+#define _NETSURF_UTILS_WORKPOOL_H_
+
+#include "utils/errors.h"
+
+struct workpool;
+
+/**
+ * Job function, called on a worker thread
+ *
+ * \param pw  Client data passed to workpool_submit()
+ */
+typedef void (*workpool_job_fn)(void *pw);
+
+/**
+ * Completion callback, called on the main thread once the job has run
+ *
+ * \param pw  Client data passed to workpool_submit()
+ */
+typedef void (*workpool_done_fn)(void *pw);
+
+nserror workpool_create(unsigned int threads, struct workpool **result);
+void workpool_destroy(struct workpool *pool);
+nserror workpool_submit(struct workpool *pool, workpool_job_fn job,
+		workpool_done_fn done, void *pw);
+int workpool_wake_fd(const struct workpool *pool);
+unsigned int workpool_complete(struct workpool *pool);
+
+#endif